@@ -178,6 +178,173 @@ int WavpackGetNumErrors (WavpackContext *wpc)
     return wpc ? wpc->crc_errors : 0;
 }
 
+// Get the decoder profile accumulated so far for the specified context, which
+// is only available if the library was built with WAVPACK_PROFILE defined
+// (otherwise the profile is cleared and FALSE is returned). The timings are in
+// ticks, which can be converted to seconds with the ticks_per_second field.
+// Because decoding is complete whenever the unpacking functions return, this
+// includes everything done by worker threads.
+
+int WavpackGetProfile (WavpackContext *wpc, WavpackProfile *profile)
+{
+#ifdef WAVPACK_PROFILE
+#ifndef PROFILE_TICKS_ARE_NS
+    double elapsed;
+#endif
+    int si;
+
+    if (!wpc || !profile)
+        return FALSE;
+
+    *profile = wpc->profile;
+
+    // the profiles of the current streams have not been merged yet
+
+    for (si = 0; si < wpc->num_streams; ++si)
+        if (wpc->streams [si]) {
+            WavpackProfile stream_profile = wpc->streams [si]->profile;
+            profile_merge (profile, &stream_profile);
+        }
+
+#ifdef PROFILE_TICKS_ARE_NS
+    profile->ticks_per_second = 1.0e9;
+#else
+    elapsed = profile_seconds () - wpc->profile_base_seconds;
+    profile->ticks_per_second = elapsed > 0.0 ? (profile_ticks () - wpc->profile_base_ticks) / elapsed : 0.0;
+#endif
+
+    return TRUE;
+#else
+    (void) wpc;
+
+    if (profile)
+        memset (profile, 0, sizeof (WavpackProfile));
+
+    return FALSE;
+#endif
+}
+
+// Install a function that reads up to WP_PROFILE_MAX_COUNTERS event counters
+// (for example, hardware performance counters) for the calling thread, which
+// the decoder profiling of the specified context will then read at the start
+// and end of every timed stage and accumulate the differences of in the
+// counters[] arrays of its profile (the meaning of the counters is up to the
+// application). Because the function is called from whichever thread does the
+// decoding (including the worker threads) it must count for the calling thread
+// only. This should be done before any samples are unpacked (the threads that
+// call the function are only started then); passing zero counters (or a NULL
+// function) turns it off. Returns FALSE if the library was not built with
+// WAVPACK_PROFILE defined or the count is invalid.
+
+int WavpackSetProfileCounters (WavpackContext *wpc, int num_counters, void (*read_counters) (uint64_t *values))
+{
+#ifdef WAVPACK_PROFILE
+    if (!wpc || num_counters < 0 || num_counters > WP_PROFILE_MAX_COUNTERS)
+        return FALSE;
+
+    wpc->profile_num_counters = 0;
+    wpc->profile_counter_reader = read_counters;
+
+    if (read_counters)
+        wpc->profile_num_counters = num_counters;
+
+    return TRUE;
+#else
+    (void) wpc; (void) num_counters; (void) read_counters;
+    return FALSE;
+#endif
+}
+
+#ifdef WAVPACK_PROFILE
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+// Read the application's event counters into the mark (for PROFILE_START)
+
+void profile_read_counters (ProfileMark *mark)
+{
+    mark->wpc->profile_counter_reader (mark->counters);
+}
+
+// Read the application's event counters and add their changes since "start"
+// to "totals" (for PROFILE_STOP)
+
+void profile_add_counters (uint64_t *totals, const ProfileMark *start)
+{
+    uint64_t values [WP_PROFILE_MAX_COUNTERS];
+    int i;
+
+    start->wpc->profile_counter_reader (values);
+
+    for (i = 0; i < start->wpc->profile_num_counters; ++i)
+        totals [i] += values [i] - start->counters [i];
+}
+
+// Add the profile counts at "src" into "dst" and clear them at "src"
+
+void profile_merge (WavpackProfile *dst, WavpackProfile *src)
+{
+    int i, j;
+
+    for (i = 0; i < WP_PROFILE_STAGES; ++i) {
+        dst->ticks [i] += src->ticks [i];
+        dst->calls [i] += src->calls [i];
+
+        for (j = 0; j < WP_PROFILE_MAX_COUNTERS; ++j)
+            dst->counters [i] [j] += src->counters [i] [j];
+    }
+
+    dst->blocks += src->blocks;
+    dst->bytes += src->bytes;
+    dst->samples += src->samples;
+    dst->refills += src->refills;
+    dst->allocations += src->allocations;
+    memset (src, 0, sizeof (WavpackProfile));
+}
+
+// Return the time of a monotonic clock in seconds (this is used to calibrate
+// the ticks of the timestamp counter and as the fallback for the ticks)
+
+double profile_seconds (void)
+{
+#ifdef _WIN32
+    LARGE_INTEGER count, frequency;
+
+    QueryPerformanceCounter (&count);
+    QueryPerformanceFrequency (&frequency);
+    return (double) count.QuadPart / frequency.QuadPart;
+#else
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1.0e-9;
+#endif
+}
+
+#ifdef PROFILE_TICKS_ARE_NS
+uint64_t profile_ticks (void)
+{
+#ifdef _WIN32
+    LARGE_INTEGER count, frequency;
+
+    QueryPerformanceCounter (&count);
+    QueryPerformanceFrequency (&frequency);
+    return (uint64_t) (count.QuadPart * (1.0e9 / frequency.QuadPart));
+#else
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
+#endif
+
+#endif
+
 // return TRUE if any uncorrected lossy blocks were actually written or read
 
 int WavpackLossyBlocks (WavpackContext *wpc)
@@ -368,6 +535,9 @@ static void worker_threads_destroy (WavpackContext *wpc)
             wp_thread_join (wpc->workers [i].thread);
             wp_thread_delete (wpc->workers [i].thread);
             wp_condvar_delete (wpc->workers [i].worker_cond);
+#ifdef ENABLE_DSD
+            free_dsd_tables (&wpc->workers [i].dsd_tables);
+#endif
         }
 
         free (wpc->workers);
@@ -394,6 +564,13 @@ WavpackContext *WavpackCloseFile (WavpackContext *wpc)
     if (wpc->close_callback)
         wpc->close_callback (wpc);
 
+    // cursors don't own the parsed information of their shared file
+
+    if (wpc->shared) {
+        wpc->channel_identities = wpc->channel_reordering = NULL;
+        CLEAR (wpc->m_tag);
+    }
+
     if (wpc->streams) {
         free_streams (wpc);
 
@@ -406,6 +583,9 @@ WavpackContext *WavpackCloseFile (WavpackContext *wpc)
     if (wpc->reader && wpc->reader->close && wpc->wv_in)
         wpc->reader->close (wpc->wv_in);
 
+    if (wpc->wvc_in)
+        stop_wvc_reader (wpc);
+
     if (wpc->reader && wpc->reader->close && wpc->wvc_in)
         wpc->reader->close (wpc->wvc_in);
 
@@ -436,10 +616,18 @@ WavpackContext *WavpackCloseFile (WavpackContext *wpc)
         decimate_dsd_destroy (wpc->decimation_context);
 #endif
 
+#ifndef NO_SEEKING
+    free_checkpoints (wpc);
+    free_block_map (wpc);
+#endif
+
 #ifdef ENABLE_THREADS
     worker_threads_destroy (wpc);
 #endif
 
+    if (wpc->shared)
+        WavpackCloseFileShared (wpc->shared);
+
     free (wpc);
 
     return NULL;
@@ -561,6 +749,9 @@ void free_streams (WavpackContext *wpc)
     int si = wpc->num_streams;
 
     while (si--) {
+#ifdef WAVPACK_PROFILE
+        profile_merge (&wpc->profile, &wpc->streams [si]->profile);
+#endif
         free_single_stream (wpc->streams [si]);
 
         if (si) {
@@ -601,60 +792,42 @@ void free_single_stream (WavpackStream *wps)
     }
 
 #ifdef ENABLE_DSD
-    free_dsd_tables (wps);
+    free_dsd_tables (&wps->dsd.tables);
 #endif
 }
 
-// Free all DSD-related resources associated with the specified stream
+// Free the specified DSD decoding tables (leaving them empty)
 
-void free_dsd_tables (WavpackStream *wps)
+void free_dsd_tables (DSDtables *tables)
 {
-    if (wps->dsd.probabilities) {
-        free (wps->dsd.probabilities);
-        wps->dsd.probabilities = NULL;
-    }
+    if (tables->probabilities)
+        free (tables->probabilities);
 
-    if (wps->dsd.summed_probabilities) {
-        free (wps->dsd.summed_probabilities);
-        wps->dsd.summed_probabilities = NULL;
-    }
+    if (tables->summed_probabilities)
+        free (tables->summed_probabilities);
 
-    if (wps->dsd.lookup_buffer) {
-        free (wps->dsd.lookup_buffer);
-        wps->dsd.lookup_buffer = NULL;
-    }
+    if (tables->lookup_buffer)
+        free (tables->lookup_buffer);
 
-    if (wps->dsd.value_lookup) {
-        free (wps->dsd.value_lookup);
-        wps->dsd.value_lookup = NULL;
-    }
+    if (tables->value_lookup)
+        free (tables->value_lookup);
 
-    if (wps->dsd.ptable) {
-        free (wps->dsd.ptable);
-        wps->dsd.ptable = NULL;
-    }
+    if (tables->ptable)
+        free (tables->ptable);
+
+    CLEAR (*tables);
 }
 
 void WavpackFloatNormalize (int32_t *values, int32_t num_values, int delta_exp)
 {
-    f32 *fvalues = (f32 *) values;
-    int exp;
+    uint32_t *uvalues = (uint32_t *) values;
+    int32_t i;
 
     if (!delta_exp)
         return;
 
-    while (num_values--) {
-        if ((exp = get_exponent (*fvalues)) == 0 || exp + delta_exp <= 0)
-            *fvalues = 0;
-        else if (exp == 255 || (exp += delta_exp) >= 255) {
-            set_exponent (*fvalues, 255);
-            set_mantissa (*fvalues, 0);
-        }
-        else
-            set_exponent (*fvalues, exp);
-
-        fvalues++;
-    }
+    for (i = 0; i < num_values; ++i)
+        uvalues [i] = normalize_float (uvalues [i], delta_exp);
 }
 
 void WavpackLittleEndianToNative (void *data, char *format)
@@ -0,0 +1,187 @@
+////////////////////////////////////////////////////////////////////////////
+//                           **** WAVPACK ****                            //
+//                  Hybrid Lossless Wavefile Compressor                   //
+//                Copyright (c) 1998 - 2024 David Bryant.                 //
+//                          All Rights Reserved.                          //
+//      Distributed under the BSD Software License (see license.txt)      //
+////////////////////////////////////////////////////////////////////////////
+
+// open_memory.c
+
+// This module provides a reader for WavPack files that are already entirely
+// in memory (either loaded by the application or mapped with mmap() and the
+// like). Besides saving the application from writing its own set of reader
+// callbacks, knowing that the bytes are directly addressable allows other
+// parts of the library (e.g., binary tag items) to return pointers into the
+// source data instead of copying it.
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "wavpack_local.h"
+
+typedef struct {
+    const unsigned char *data;
+    int64_t size, pos;
+} WavpackMemoryStream;
+
+static int32_t mem_read_bytes (void *id, void *data, int32_t bcount)
+{
+    WavpackMemoryStream *ms = (WavpackMemoryStream *)id;
+
+    if (bcount < 0 || ms->pos >= ms->size)
+        return 0;
+
+    if (bcount > ms->size - ms->pos)
+        bcount = (int32_t)(ms->size - ms->pos);
+
+    memcpy (data, ms->data + ms->pos, bcount);
+    ms->pos += bcount;
+    return bcount;
+}
+
+static int32_t mem_write_bytes (void *id, void *data, int32_t bcount)
+{
+    (void) id; (void) data; (void) bcount;
+    return 0;   // the source data is read-only
+}
+
+static int64_t mem_get_pos (void *id)
+{
+    WavpackMemoryStream *ms = (WavpackMemoryStream *)id;
+    return ms->pos;
+}
+
+static int mem_set_pos_abs (void *id, int64_t pos)
+{
+    WavpackMemoryStream *ms = (WavpackMemoryStream *)id;
+
+    if (pos < 0 || pos > ms->size)
+        return -1;
+
+    ms->pos = pos;
+    return 0;
+}
+
+static int mem_set_pos_rel (void *id, int64_t delta, int mode)
+{
+    WavpackMemoryStream *ms = (WavpackMemoryStream *)id;
+
+    switch (mode) {
+        case SEEK_SET:
+            return mem_set_pos_abs (id, delta);
+
+        case SEEK_CUR:
+            return mem_set_pos_abs (id, ms->pos + delta);
+
+        case SEEK_END:
+            return mem_set_pos_abs (id, ms->size + delta);
+
+        default:
+            return -1;
+    }
+}
+
+static int mem_push_back_byte (void *id, int c)
+{
+    WavpackMemoryStream *ms = (WavpackMemoryStream *)id;
+
+    if (ms->pos <= 0)
+        return EOF;
+
+    ms->pos--;
+    return c;
+}
+
+static int64_t mem_get_length (void *id)
+{
+    WavpackMemoryStream *ms = (WavpackMemoryStream *)id;
+    return ms->size;
+}
+
+static int mem_can_seek (void *id)
+{
+    (void) id;
+    return 1;
+}
+
+static int mem_close_stream (void *id)
+{
+    free (id);
+    return 0;
+}
+
+static WavpackStreamReader64 memory_reader = {
+    mem_read_bytes, mem_write_bytes, mem_get_pos, mem_set_pos_abs, mem_set_pos_rel,
+    mem_push_back_byte, mem_get_length, mem_can_seek, NULL, mem_close_stream
+};
+
+// Open a WavPack file (and optionally its correction file) that is completely
+// contained in memory. The data is not copied, so it must remain valid (and
+// unchanged) until the context is closed with WavpackCloseFile(). Otherwise
+// this is identical to WavpackOpenFileInputEx64(), including the flags and
+// norm_offset parameters.
+
+WavpackContext *WavpackOpenMemoryInput (const void *wv_data, int64_t wv_size, const void *wvc_data, int64_t wvc_size, char *error, int flags, int norm_offset)
+{
+    WavpackMemoryStream *wv_stream, *wvc_stream = NULL;
+
+    if (!wv_data || wv_size <= 0) {
+        if (error) strcpy (error, "can't read all of WavPack file!");
+        return NULL;
+    }
+
+    wv_stream = (WavpackMemoryStream *)calloc (1, sizeof (WavpackMemoryStream));
+
+    if (wvc_data && wvc_size > 0)
+        wvc_stream = (WavpackMemoryStream *)calloc (1, sizeof (WavpackMemoryStream));
+
+    if (!wv_stream || (wvc_data && wvc_size > 0 && !wvc_stream)) {
+        if (error) strcpy (error, "can't allocate memory");
+        free (wvc_stream);
+        free (wv_stream);
+        return NULL;
+    }
+
+    wv_stream->data = (const unsigned char *)wv_data;
+    wv_stream->size = wv_size;
+
+    if (wvc_stream) {
+        wvc_stream->data = (const unsigned char *)wvc_data;
+        wvc_stream->size = wvc_size;
+    }
+
+    return WavpackOpenFileInputEx64 (&memory_reader, wv_stream, wvc_stream, error, flags, norm_offset);
+}
+
+// For local use only. If the specified reader stream is one of our memory streams
+// and the requested range is entirely contained in it, return a pointer directly
+// into the source data. Otherwise NULL is returned and the caller must fall back
+// to reading the data with the reader callbacks.
+
+const unsigned char *memory_reader_bytes (WavpackStreamReader64 *reader, void *id, int64_t pos, int64_t count)
+{
+    WavpackMemoryStream *ms = (WavpackMemoryStream *)id;
+
+    if (reader != &memory_reader || !ms || pos < 0 || count < 0 || pos > ms->size || count > ms->size - pos)
+        return NULL;
+
+    return ms->data + pos;
+}
+
+// For local use only. Create a new memory stream for the specified data (which is
+// not copied) and return its id for use with the returned reader, or NULL if out
+// of memory. The stream is freed when the reader's close() function is called.
+
+void *memory_reader_open (const void *data, int64_t size, WavpackStreamReader64 **reader)
+{
+    WavpackMemoryStream *ms = (WavpackMemoryStream *)calloc (1, sizeof (WavpackMemoryStream));
+
+    if (ms) {
+        ms->data = (const unsigned char *)data;
+        ms->size = size;
+    }
+
+    *reader = &memory_reader;
+    return ms;
+}
@@ -0,0 +1,324 @@
+////////////////////////////////////////////////////////////////////////////
+//                           **** WAVPACK ****                            //
+//                  Hybrid Lossless Wavefile Compressor                   //
+//                Copyright (c) 1998 - 2024 David Bryant.                 //
+//                          All Rights Reserved.                          //
+//      Distributed under the BSD Software License (see license.txt)      //
+////////////////////////////////////////////////////////////////////////////
+
+// open_shared.c
+
+// This module allows a WavPack file in memory to be opened (and completely
+// parsed) just once and then decoded by any number of independent "cursors",
+// which can be used concurrently from different threads. The shared file holds
+// everything that does not change during decoding (the configuration, tags,
+// channel information and an index of all the blocks) and is never modified
+// after it's opened. Each cursor is a regular WavpackContext (so the entire
+// unpacking API can be used with it) that starts out as a copy of the decoder
+// state right after the open, but shares the parsed file information and the
+// data with the shared file instead of reading it again.
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "wavpack_local.h"
+
+typedef struct {
+    int64_t block_index, file_pos;
+    uint32_t block_samples;
+} BlockIndexEntry;
+
+struct WavpackFile {
+    WavpackContext *wpc;                // parsed file, never decoded from
+    const void *wv_data, *wvc_data;
+    int64_t wv_size, wvc_size, wv_pos, wvc_pos;
+    BlockIndexEntry *wv_index, *wvc_index;
+    int wv_blocks, wvc_blocks, refs;
+#ifdef ENABLE_THREADS
+    wp_mutex_t mutex;
+#endif
+};
+
+static int build_block_index (WavpackContext *wpc, void *id, BlockIndexEntry **index, int *num_blocks);
+
+// Open a WavPack file (and optionally its correction file) that is completely
+// contained in memory for shared use. The data is not copied, so it must remain
+// valid (and unchanged) until the shared file and all of its cursors have been
+// closed. The "flags" and "norm_offset" parameters are the same as for the other
+// open functions, but OPEN_STREAMING, OPEN_EDIT_TAGS and OPEN_TAGS_ONLY are not
+// allowed. The returned file can't be decoded directly; use WavpackOpenCursor()
+// to create contexts to decode with, and WavpackCloseFileShared() when done.
+
+WavpackFile *WavpackOpenFileShared (const void *wv_data, int64_t wv_size, const void *wvc_data, int64_t wvc_size, char *error, int flags, int norm_offset)
+{
+    WavpackFile *wpf;
+    WavpackContext *wpc;
+
+    if (flags & (OPEN_STREAMING | OPEN_EDIT_TAGS | OPEN_TAGS_ONLY)) {
+        if (error) strcpy (error, "invalid flags for shared WavPack file!");
+        return NULL;
+    }
+
+    if (!(wpf = (WavpackFile *)calloc (1, sizeof (WavpackFile)))) {
+        if (error) strcpy (error, "can't allocate memory");
+        return NULL;
+    }
+
+    if (!(wpc = wpf->wpc = WavpackOpenMemoryInput (wv_data, wv_size, wvc_data, wvc_size, error, flags, norm_offset))) {
+        free (wpf);
+        return NULL;
+    }
+
+    wpf->wv_data = wv_data;
+    wpf->wv_size = wv_size;
+    wpf->wv_pos = wpc->reader->get_pos (wpc->wv_in);
+
+    if (wpc->wvc_in) {
+        stop_wvc_reader (wpc);              // the block index is built from the file directly
+        wpf->wvc_data = wvc_data;
+        wpf->wvc_size = wvc_size;
+        wpf->wvc_pos = wpc->reader->get_pos (wpc->wvc_in);
+    }
+
+    if (!build_block_index (wpc, wpc->wv_in, &wpf->wv_index, &wpf->wv_blocks) ||
+        (wpc->wvc_flag && !build_block_index (wpc, wpc->wvc_in, &wpf->wvc_index, &wpf->wvc_blocks))) {
+            if (error) strcpy (error, "can't allocate memory");
+            free (wpf->wv_index);
+            free (wpf->wvc_index);
+            WavpackCloseFile (wpc);
+            free (wpf);
+            return NULL;
+    }
+
+    wpc->reader->set_pos_abs (wpc->wv_in, wpf->wv_pos);
+
+    if (wpc->wvc_in)
+        wpc->reader->set_pos_abs (wpc->wvc_in, wpf->wvc_pos);
+
+#ifndef NO_TAGS
+    // resolve any "lazy" binary tag items now so that the tag is never modified again
+
+    if (wpc->m_tag.binary_items) {
+        int i;
+
+        for (i = 0; i < wpc->m_tag.num_binary_items; ++i) {
+            APE_Tag_Item_Ref *ref = wpc->m_tag.binary_items + i;
+
+            if (!ref->value)
+                ref->value = memory_reader_bytes (wpc->reader, wpc->wv_in, ref->value_pos, ref->value_size);
+        }
+    }
+#endif
+
+#ifdef ENABLE_THREADS
+    wp_mutex_init (wpf->mutex);
+#endif
+    wpf->refs = 1;
+    return wpf;
+}
+
+// Create a new decoding context ("cursor") for the specified shared file. This
+// is positioned at the first sample and behaves exactly like a context returned
+// by WavpackOpenMemoryInput() for the same data, except that seeking uses the
+// block index of the shared file. The cursor must be closed with
+// WavpackCloseFile(), and may outlive the WavpackCloseFileShared() call for its
+// file. Different cursors may be used concurrently (but each cursor by only one
+// thread at a time). NULL is returned on error.
+
+WavpackContext *WavpackOpenCursor (WavpackFile *wpf, char *error)
+{
+    WavpackContext *src = wpf->wpc, *wpc = (WavpackContext *)malloc (sizeof (WavpackContext));
+    WavpackStreamReader64 *reader;
+    int si;
+
+    if (!wpc) {
+        if (error) strcpy (error, "can't allocate memory");
+        return NULL;
+    }
+
+    // start with a copy of the parsed file context and then take ownership of
+    // the things each cursor needs its own copy of
+
+    memcpy (wpc, src, sizeof (WavpackContext));
+    wpc->shared = wpf;
+    wpc->wv_in = wpc->wvc_in = NULL;
+    wpc->streams = NULL;
+    wpc->num_streams = 0;
+    wpc->wrapper_data = NULL;
+    wpc->wrapper_bytes = 0;
+    wpc->metadata = NULL;
+    wpc->metacount = 0;
+    wpc->decimation_context = NULL;
+    wpc->checkpoints = NULL;
+    wpc->block_map = NULL;
+    wpc->close_callback = NULL;
+    wpc->error_message [0] = 0;
+#ifdef ENABLE_THREADS
+    wpc->workers = NULL;
+    wpc->wvc_reader = NULL;
+#endif
+#ifdef WAVPACK_PROFILE
+    CLEAR (wpc->profile);
+#endif
+
+#ifdef ENABLE_THREADS
+    wp_mutex_obtain (wpf->mutex);
+#endif
+    wpf->refs++;
+#ifdef ENABLE_THREADS
+    wp_mutex_release (wpf->mutex);
+#endif
+
+    wpc->wv_in = memory_reader_open (wpf->wv_data, wpf->wv_size, &reader);
+
+    if (src->wvc_in)
+        wpc->wvc_in = memory_reader_open (wpf->wvc_data, wpf->wvc_size, &reader);
+
+    wpc->reader = reader;
+
+    if (!wpc->wv_in || (src->wvc_in && !wpc->wvc_in) ||
+        !(wpc->streams = (WavpackStream **)calloc (src->num_streams, sizeof (wpc->streams [0])))) {
+            if (error) strcpy (error, "can't allocate memory");
+            return WavpackCloseFile (wpc);
+    }
+
+    for (si = 0; si < src->num_streams; ++si) {
+        if (!(wpc->streams [si] = (WavpackStream *)malloc (sizeof (WavpackStream))) ||
+            !copy_stream (wpc->streams [si], src->streams [si])) {
+                if (error) strcpy (error, "can't allocate memory");
+                free (wpc->streams [si]);
+                wpc->streams [si] = NULL;
+                return WavpackCloseFile (wpc);
+        }
+
+        wpc->streams [si]->wpc = wpc;
+        wpc->num_streams = si + 1;
+    }
+
+    if (src->wrapper_bytes) {
+        if (!(wpc->wrapper_data = (unsigned char *)malloc (src->wrapper_bytes))) {
+            if (error) strcpy (error, "can't allocate memory");
+            return WavpackCloseFile (wpc);
+        }
+
+        memcpy (wpc->wrapper_data, src->wrapper_data, wpc->wrapper_bytes = src->wrapper_bytes);
+    }
+
+#ifdef ENABLE_DSD
+    if (src->decimation_context && !(wpc->decimation_context = decimate_dsd_init (wpc->reduced_channels ?
+        wpc->reduced_channels : wpc->config.num_channels))) {
+            if (error) strcpy (error, "can't allocate memory");
+            return WavpackCloseFile (wpc);
+    }
+#endif
+
+    wpc->reader->set_pos_abs (wpc->wv_in, wpf->wv_pos);
+
+    if (wpc->wvc_in)
+        wpc->reader->set_pos_abs (wpc->wvc_in, wpf->wvc_pos);
+
+    return wpc;
+}
+
+// Release the caller's reference to the specified shared file. The file is
+// actually freed once all of its cursors have been closed too. Returns NULL.
+
+WavpackFile *WavpackCloseFileShared (WavpackFile *wpf)
+{
+    int refs;
+
+    if (!wpf)
+        return NULL;
+
+#ifdef ENABLE_THREADS
+    wp_mutex_obtain (wpf->mutex);
+#endif
+    refs = --wpf->refs;
+#ifdef ENABLE_THREADS
+    wp_mutex_release (wpf->mutex);
+#endif
+
+    if (!refs) {
+#ifdef ENABLE_THREADS
+        wp_mutex_delete (wpf->mutex);
+#endif
+        WavpackCloseFile (wpf->wpc);
+        free (wpf->wv_index);
+        free (wpf->wvc_index);
+        free (wpf);
+    }
+
+    return NULL;
+}
+
+// For local use only. Return the file position of the header of the block in
+// the WavPack file (or the correction file if "wvc" is TRUE) of the specified
+// cursor's shared file that contains the specified sample, or -1 if there is
+// no such block.
+
+int64_t find_shared_block (WavpackContext *wpc, int64_t sample, int wvc)
+{
+    BlockIndexEntry *index = wvc ? wpc->shared->wvc_index : wpc->shared->wv_index;
+    int low = 0, high = wvc ? wpc->shared->wvc_blocks : wpc->shared->wv_blocks;
+
+    // find the last block that starts at or before the sample
+
+    while (low < high) {
+        int mid = (low + high) >> 1;
+
+        if (index [mid].block_index <= sample)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+
+    if (low && sample < index [low - 1].block_index + index [low - 1].block_samples)
+        return index [low - 1].file_pos;
+
+    return -1;
+}
+
+// Scan all the block headers of the specified file and record the position of
+// every block that starts a set of streams with audio (the same ones that
+// seeking would find) in an allocated index. Returns FALSE if out of memory.
+
+static int build_block_index (WavpackContext *wpc, void *id, BlockIndexEntry **index, int *num_blocks)
+{
+    int64_t filepos = 0;
+    int max_blocks = 0;
+    WavpackHeader wphdr;
+    uint32_t bcount;
+
+    *index = NULL;
+    *num_blocks = 0;
+    wpc->reader->set_pos_abs (id, 0);
+
+    while ((bcount = read_next_header (wpc->reader, id, &wphdr)) != (uint32_t) -1) {
+        filepos += bcount;
+
+        if (wphdr.block_samples && (wphdr.flags & INITIAL_BLOCK)) {
+            if (*num_blocks == max_blocks) {
+                BlockIndexEntry *new_index = (BlockIndexEntry *)realloc (*index, (max_blocks = max_blocks ? max_blocks * 2 : 256) * sizeof (BlockIndexEntry));
+
+                if (!new_index) {
+                    free (*index);
+                    *index = NULL;
+                    return FALSE;
+                }
+
+                *index = new_index;
+            }
+
+            (*index) [*num_blocks].block_index = GET_BLOCK_INDEX (wphdr) - wpc->initial_index;
+            (*index) [*num_blocks].block_samples = wphdr.block_samples;
+            (*index) [(*num_blocks)++].file_pos = filepos;
+        }
+
+        filepos += wphdr.ckSize + 8;
+
+        if (wpc->reader->set_pos_abs (id, filepos))
+            break;
+    }
+
+    return TRUE;
+}
@@ -54,10 +54,15 @@ WavpackContext *WavpackOpenFileInputEx64 (WavpackStreamReader64 *reader, void *w
     wpc->max_streams = OLD_MAX_STREAMS;     // use this until overwritten with actual number
     wpc->open_flags = flags;
 
+#ifdef WAVPACK_PROFILE
+    wpc->profile_base_ticks = profile_ticks ();
+    wpc->profile_base_seconds = profile_seconds ();
+#endif
+
     wpc->filelen = wpc->reader->get_length (wpc->wv_in);
 
 #ifndef NO_TAGS
-    if ((flags & (OPEN_TAGS | OPEN_EDIT_TAGS)) && wpc->reader->can_seek (wpc->wv_in)) {
+    if ((flags & (OPEN_TAGS | OPEN_EDIT_TAGS | OPEN_TAGS_ONLY)) && wpc->reader->can_seek (wpc->wv_in)) {
         load_tag (wpc);
         wpc->reader->set_pos_abs (wpc->wv_in, 0);
 
@@ -68,6 +73,23 @@ WavpackContext *WavpackOpenFileInputEx64 (WavpackStreamReader64 *reader, void *w
     }
 #endif
 
+    // In tags-only mode we're done now. No audio block is read or verified and no
+    // streams are allocated, so the audio related functions simply return nothing.
+
+    if (flags & OPEN_TAGS_ONLY) {
+#ifdef NO_TAGS
+        if (error) strcpy (error, "not configured to read tags!");
+        return WavpackCloseFile (wpc);
+#else
+        if (!wpc->reader->can_seek (wpc->wv_in)) {
+            if (error) strcpy (error, "can't read tags from pipes or unseekable files!");
+            return WavpackCloseFile (wpc);
+        }
+
+        return wpc;
+#endif
+    }
+
     if (wpc->reader->read_bytes (wpc->wv_in, &first_byte, 1) != 1) {
         if (error) strcpy (error, "can't read all of WavPack file!");
         return WavpackCloseFile (wpc);
@@ -168,6 +190,11 @@ WavpackContext *WavpackOpenFileInputEx64 (WavpackStreamReader64 *reader, void *w
             return WavpackCloseFile (wpc);
         }
 
+#ifndef NO_SEEKING
+        if (wpc->wvc_flag)
+            map_block_position (wpc);
+#endif
+
         if (!wps->init_done && !unpack_init (wpc, 0)) {
             if (error) strcpy (error, wpc->error_message [0] ? wpc->error_message :
                 "not compatible with this version of WavPack file!");
@@ -306,7 +333,7 @@ int unpack_init (WavpackContext *wpc, int stream)
     unsigned char *blockptr, *block2ptr;
     WavpackMetadata wpmd;
 
-    wps->num_terms = 0;
+    wps->num_terms = wps->decorr_preset = 0;
     wps->mute_error = FALSE;
     wps->crc = wps->crc_x = 0xffffffff;
     wps->dsd.ready = 0;
@@ -363,8 +390,10 @@ int unpack_init (WavpackContext *wpc, int stream)
                 wpc->lossy_blocks = TRUE;
     }
 
-    if (wps->wphdr.block_samples)
+    if (wps->wphdr.block_samples) {
         wps->sample_index = GET_BLOCK_INDEX (wps->wphdr);
+        wps->decorr_preset = find_decorr_preset (wps);
+    }
 
     return TRUE;
 }
@@ -552,7 +581,7 @@ static int read_channel_identities (WavpackContext *wpc, WavpackMetadata *wpmd)
         if (!idents [i])
             return FALSE;
 
-    if (!wpc->channel_identities) {
+    if (!wpc->channel_identities && !wpc->shared) {
         wpc->channel_identities = (unsigned char *)malloc (wpmd->byte_length + 1);
         memcpy (wpc->channel_identities, wpmd->data, wpmd->byte_length);
         wpc->channel_identities [wpmd->byte_length] = 0;
@@ -599,6 +628,9 @@ static int read_new_config_info (WavpackContext *wpc, WavpackMetadata *wpmd)
     int bytecnt = wpmd->byte_length;
     unsigned char *byteptr = (unsigned char *)wpmd->data;
 
+    if (wpc->shared)            // already parsed (and shared) by cursors
+        return TRUE;
+
     wpc->version_five = 1;      // just having this block signals version 5.0
 
     wpc->file_format = wpc->config.qmode = wpc->channel_layout = 0;
@@ -910,7 +942,7 @@ uint32_t bs_close_read (Bitstream *bs)
 
 void WavpackSeekTrailingWrapper (WavpackContext *wpc)
 {
-    if ((wpc->open_flags & OPEN_WRAPPER) &&
+    if ((wpc->open_flags & OPEN_WRAPPER) && wpc->streams &&
         wpc->reader->can_seek (wpc->wv_in) && !wpc->stream3)
             seek_eof_information (wpc, NULL, TRUE);
 }
@@ -1013,13 +1045,19 @@ static int match_wvc_header (WavpackHeader *wv_hdr, WavpackHeader *wvc_hdr)
         return -1;
 }
 
+#ifdef ENABLE_THREADS
+static int start_wvc_reader (WavpackContext *wpc);
+static int read_queued_wvc_block (WavpackContext *wpc, int stream);
+#endif
+
 // Read the wvc block that matches the regular wv block that has been
 // read for the current stream. If an exact match is not found then
 // we either keep reading or back up and (possibly) use the block
 // later. The skip_wvc flag is set if not matching wvc block is found
 // so that we can still decode using only the lossy version (although
 // we flag this as an error). A return of FALSE indicates a serious
-// error (not just that we missed one wvc block).
+// error (not just that we missed one wvc block). With OPEN_WVC_THREAD
+// the blocks come from the queue of the reader thread instead.
 
 int read_wvc_block (WavpackContext *wpc, int stream)
 {
@@ -1028,10 +1066,18 @@ int read_wvc_block (WavpackContext *wpc, int stream)
     WavpackHeader orig_wphdr;
     WavpackHeader wphdr;
     int compare_result;
+    PROFILE_DECL (start_time);
+
+#ifdef ENABLE_THREADS
+    if ((wpc->open_flags & OPEN_WVC_THREAD) && (wpc->wvc_reader || start_wvc_reader (wpc)))
+        return read_queued_wvc_block (wpc, stream);
+#endif
 
     while (1) {
+        PROFILE_START (wpc, start_time);
         file2pos = wpc->reader->get_pos (wpc->wvc_in);
         bcount = read_next_header (wpc->reader, wpc->wvc_in, &wphdr);
+        PROFILE_STOP (wpc->profile, WP_PROFILE_IO, start_time);
 
         if (bcount == (uint32_t) -1) {
             wps->wvc_skip = TRUE;
@@ -1056,6 +1102,9 @@ int read_wvc_block (WavpackContext *wpc, int stream)
 	    if (!wps->block2buff)
 	        return FALSE;
 
+            PROFILE_COUNT (wpc->profile, allocations, 1);
+            PROFILE_START (wpc, start_time);
+
             if (wpc->reader->read_bytes (wpc->wvc_in, wps->block2buff + 32, wphdr.ckSize - 24) !=
                 wphdr.ckSize - 24) {
                     free (wps->block2buff);
@@ -1065,10 +1114,14 @@ int read_wvc_block (WavpackContext *wpc, int stream)
                     return FALSE;
             }
 
+            PROFILE_STOP (wpc->profile, WP_PROFILE_IO, start_time);
+            PROFILE_COUNT (wpc->profile, bytes, wphdr.ckSize + 8);
             memcpy (wps->block2buff, &orig_wphdr, 32);
+            PROFILE_START (wpc, start_time);
 
             // don't use corrupt blocks
             if (!WavpackVerifySingleBlock (wps->block2buff, !(wpc->open_flags & OPEN_NO_CHECKSUM))) {
+                PROFILE_STOP (wpc->profile, WP_PROFILE_VERIFY, start_time);
                 free (wps->block2buff);
                 wps->block2buff = NULL;
                 wps->wvc_skip = TRUE;
@@ -1076,6 +1129,7 @@ int read_wvc_block (WavpackContext *wpc, int stream)
                 return TRUE;
             }
 
+            PROFILE_STOP (wpc->profile, WP_PROFILE_VERIFY, start_time);
             wps->wvc_skip = FALSE;
             memcpy (wps->block2buff, &wphdr, 32);
             memcpy (&wps->wphdr, &wphdr, 32);
@@ -1090,6 +1144,284 @@ int read_wvc_block (WavpackContext *wpc, int stream)
     }
 }
 
+#ifdef ENABLE_THREADS
+
+// This is the correction file reader thread. It reads the wvc blocks ahead of
+// the decoder, verifies them, and queues them for read_queued_wvc_block(),
+// waiting whenever the queue is full. Once it has queued the end of the file
+// (or a block that couldn't be read) it waits until it's told to quit or to
+// re-sync, which means discarding whatever it's reading and starting again at
+// the position the decoder gives (see read_queued_wvc_block()).
+
+#ifdef _WIN32
+static unsigned WINAPI wvc_reader_thread (LPVOID param)
+#else
+static void *wvc_reader_thread (void *param)
+#endif
+{
+    WvcReader *wvcr = param;
+    WavpackContext *wpc = wvcr->wpc;
+    int status = WVC_GOOD, resyncs = 0;
+
+    while (1) {
+        int64_t resync_pos = -1;
+        WvcQueueEntry entry;
+        uint32_t bcount;
+        int quit;
+
+        wp_mutex_obtain (wvcr->mutex);
+
+        while ((wvcr->count == WVC_QUEUE_LENGTH || status == WVC_TRUNCATED || status == WVC_END) &&
+            !wvcr->quit && wvcr->resyncs == resyncs)
+                wp_condvar_wait (wvcr->reader_cond, wvcr->mutex);
+
+        if (wvcr->resyncs != resyncs) {
+            resyncs = wvcr->resyncs;
+            resync_pos = wvcr->next_pos;
+        }
+
+        quit = wvcr->quit;
+        wp_mutex_release (wvcr->mutex);
+
+        if (quit)
+            break;
+
+        if (resync_pos != -1)
+            wpc->reader->set_pos_abs (wpc->wvc_in, resync_pos);
+
+        CLEAR (entry);
+        entry.pos = wpc->reader->get_pos (wpc->wvc_in);
+        bcount = read_next_header (wpc->reader, wpc->wvc_in, &entry.wphdr);
+
+        if (bcount == (uint32_t) -1)
+            status = WVC_END;
+        else {
+            entry.bcount = bcount;
+
+            if (!(entry.block = (unsigned char *)malloc (entry.wphdr.ckSize + 8)) ||
+                wpc->reader->read_bytes (wpc->wvc_in, entry.block + 32, entry.wphdr.ckSize - 24) != (int32_t) entry.wphdr.ckSize - 24) {
+                    free (entry.block);
+                    entry.block = NULL;
+                    status = WVC_TRUNCATED;
+            }
+            else {
+                memcpy (entry.block, &entry.wphdr, 32);
+
+                // don't use corrupt blocks
+                if (WavpackVerifySingleBlock (entry.block, !(wpc->open_flags & OPEN_NO_CHECKSUM)))
+                    status = WVC_GOOD;
+                else {
+                    free (entry.block);
+                    entry.block = NULL;
+                    status = WVC_CORRUPT;
+                }
+            }
+        }
+
+        entry.status = status;
+        wp_mutex_obtain (wvcr->mutex);
+
+        if (wvcr->resyncs == resyncs) {
+            wvcr->queue [(wvcr->head + wvcr->count++) % WVC_QUEUE_LENGTH] = entry;
+            wvcr->next_pos = wpc->reader->get_pos (wpc->wvc_in);
+            wp_condvar_signal (wvcr->decoder_cond);
+        }
+        else
+            free (entry.block);     // read from where the decoder no longer wants
+
+        wp_mutex_release (wvcr->mutex);
+    }
+
+    wp_thread_exit (0);
+    return 0;
+}
+
+// Start the correction file reader thread at the current wvc position. If this
+// fails, OPEN_WVC_THREAD is cleared so that the file is read synchronously. The
+// correction file must be seekable because the reader might have to re-sync.
+
+static int start_wvc_reader (WavpackContext *wpc)
+{
+    WvcReader *wvcr = wpc->reader->can_seek (wpc->wvc_in) ? (WvcReader *)calloc (1, sizeof (WvcReader)) : NULL;
+
+    if (wvcr) {
+        wvcr->wpc = wpc;
+        wvcr->next_pos = wpc->reader->get_pos (wpc->wvc_in);
+        wp_mutex_init (wvcr->mutex);
+        wp_condvar_init (wvcr->reader_cond);
+        wp_condvar_init (wvcr->decoder_cond);
+        wp_thread_create (wvcr->thread, wvc_reader_thread, wvcr);
+
+        if (wvcr->thread) {
+            wpc->wvc_reader = wvcr;
+            return TRUE;
+        }
+
+        wp_condvar_delete (wvcr->decoder_cond);
+        wp_condvar_delete (wvcr->reader_cond);
+        wp_mutex_delete (wvcr->mutex);
+        free (wvcr);
+    }
+
+    wpc->open_flags &= ~OPEN_WVC_THREAD;
+    return FALSE;
+}
+
+// This is read_wvc_block() for when the reader thread is running. The blocks are
+// matched to the wv block in exactly the same way, except that a block that we
+// "back up" over simply stays at the head of the queue, and a block that could
+// not be read (or the end of the file) ends the queue. When the correction file
+// is behind, read_wvc_block() skips only the header of the block and searches
+// for the next one from there (because the block size can't be trusted), so in
+// that case the queue is discarded and the reader re-syncs at the same place.
+
+static int read_queued_wvc_block (WavpackContext *wpc, int stream)
+{
+    WavpackStream *wps = wpc->streams [stream];
+    WvcReader *wvcr = wpc->wvc_reader;
+    WvcQueueEntry *entry, taken;
+    WavpackHeader wphdr;
+    int compare_result;
+
+    wp_mutex_obtain (wvcr->mutex);
+
+    while (1) {
+        while (!wvcr->count)
+            wp_condvar_wait (wvcr->decoder_cond, wvcr->mutex);
+
+        entry = wvcr->queue + wvcr->head;
+
+        if (entry->status == WVC_END) {
+            wp_mutex_release (wvcr->mutex);
+            wps->wvc_skip = TRUE;
+            wpc->crc_errors++;
+            return FALSE;
+        }
+
+        memcpy (&wphdr, &entry->wphdr, 32);
+
+        if (wpc->open_flags & OPEN_STREAMING)
+            SET_BLOCK_INDEX (wphdr, wps->sample_index = 0);
+        else
+            SET_BLOCK_INDEX (wphdr, GET_BLOCK_INDEX (wphdr) - wpc->initial_index);
+
+        if (wphdr.flags & INITIAL_BLOCK)
+            wpc->file2pos = entry->pos + entry->bcount;
+
+        compare_result = match_wvc_header (&wps->wphdr, &wphdr);
+
+        if (compare_result == -1) {
+            wp_mutex_release (wvcr->mutex);
+            wps->wvc_skip = TRUE;
+            wpc->crc_errors++;
+            return TRUE;
+        }
+
+        if (compare_result) {
+            wvcr->next_pos = entry->pos + entry->bcount + 32;
+            wvcr->resyncs++;
+
+            while (wvcr->count--) {
+                free (wvcr->queue [wvcr->head].block);
+                wvcr->head = (wvcr->head + 1) % WVC_QUEUE_LENGTH;
+            }
+
+            wvcr->count = 0;
+            wp_condvar_signal (wvcr->reader_cond);
+            continue;
+        }
+
+        if (entry->status == WVC_TRUNCATED) {
+            entry->status = WVC_END;
+            wp_mutex_release (wvcr->mutex);
+            wps->wvc_skip = TRUE;
+            wpc->crc_errors++;
+            return FALSE;
+        }
+
+        taken = *entry;                     // the slot can be refilled once we release it
+        wvcr->head = (wvcr->head + 1) % WVC_QUEUE_LENGTH;
+        wvcr->count--;
+        wp_condvar_signal (wvcr->reader_cond);
+        break;
+    }
+
+    wp_mutex_release (wvcr->mutex);
+    PROFILE_COUNT (wpc->profile, allocations, 1);
+    PROFILE_COUNT (wpc->profile, bytes, wphdr.ckSize + 8);
+
+    if (taken.status == WVC_CORRUPT) {
+        wps->wvc_skip = TRUE;
+        wpc->crc_errors++;
+        return TRUE;
+    }
+
+    wps->block2buff = taken.block;
+    wps->wvc_skip = FALSE;
+    memcpy (wps->block2buff, &wphdr, 32);
+    memcpy (&wps->wphdr, &wphdr, 32);
+    return TRUE;
+}
+
+#endif
+
+// Return the position in the correction file of the next block that
+// read_wvc_block() will look at, which (if the reader thread is running)
+// is not where the file actually is.
+
+int64_t get_wvc_pos (WavpackContext *wpc)
+{
+#ifdef ENABLE_THREADS
+    if (wpc->wvc_reader) {
+        WvcReader *wvcr = wpc->wvc_reader;
+        int64_t pos;
+
+        wp_mutex_obtain (wvcr->mutex);
+        pos = wvcr->count ? wvcr->queue [wvcr->head].pos : wvcr->next_pos;
+        wp_mutex_release (wvcr->mutex);
+        return pos;
+    }
+#endif
+
+    return wpc->reader->get_pos (wpc->wvc_in);
+}
+
+// Stop the correction file reader thread (if it's running), discard the queued
+// blocks, and put the file back at the position returned by get_wvc_pos(). This
+// must be done before the correction file is accessed directly (e.g., to seek).
+// If OPEN_WVC_THREAD is set, the thread is restarted by the next read_wvc_block().
+
+void stop_wvc_reader (WavpackContext *wpc)
+{
+#ifdef ENABLE_THREADS
+    WvcReader *wvcr = wpc->wvc_reader;
+
+    if (wvcr) {
+        wp_mutex_obtain (wvcr->mutex);
+        wvcr->quit = TRUE;
+        wp_condvar_signal (wvcr->reader_cond);
+        wp_mutex_release (wvcr->mutex);
+        wp_thread_join (wvcr->thread);
+        wp_thread_delete (wvcr->thread);
+
+        wpc->reader->set_pos_abs (wpc->wvc_in, wvcr->count ? wvcr->queue [wvcr->head].pos : wvcr->next_pos);
+
+        while (wvcr->count--) {
+            free (wvcr->queue [wvcr->head].block);
+            wvcr->head = (wvcr->head + 1) % WVC_QUEUE_LENGTH;
+        }
+
+        wp_condvar_delete (wvcr->decoder_cond);
+        wp_condvar_delete (wvcr->reader_cond);
+        wp_mutex_delete (wvcr->mutex);
+        free (wvcr);
+        wpc->wvc_reader = NULL;
+    }
+#else
+    (void) wpc;
+#endif
+}
+
 // This function is used to seek to end of a file to obtain certain information
 // that is stored there at the file creation time because it is not known at
 // the start. This includes the MD5 sum and and trailing part of the file
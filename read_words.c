@@ -68,9 +68,10 @@ static const char ones_count_table [] = {
 static uint32_t __inline read_code (Bitstream *bs, uint32_t maxcode);
 
 // Read the next word from the bitstream "wvbits" and return the value. This
-// function can be used for hybrid or lossless streams, but since an
-// optimized version is available for lossless this function would normally
-// be used for hybrid only. If a hybrid lossless stream is being read then
+// function can be used for hybrid or lossless streams, but since optimized
+// versions are available for lossless and for lossy hybrid (without a
+// correction file) this function would normally be used for hybrid lossless
+// only. If a hybrid lossless stream is being read then
 // the "correction" offset is written at the specified pointer. A return value
 // of WORD_EOF indicates that the end of the bitstream was reached (all 1s) or
 // some other error occurred.
@@ -335,9 +336,21 @@ int32_t FASTCALL get_word (WavpackStream *wps, int chan, int32_t *correction)
 
 // This is an optimized version of get_word() that is used for lossless only
 // (error_limit == 0). Also, rather than obtaining a single sample, it can be
-// used to obtain an entire buffer of either mono or stereo samples.
+// used to obtain an entire buffer of either mono or stereo samples. The actual
+// decoding is done by a kernel template that is specialized for mono and for
+// stereo, so the channel handling costs nothing in the per-sample loop.
+
+static KERNEL_INLINE int32_t get_words_lossless_kernel (WavpackStream *wps, int32_t *buffer, int32_t nsamples, const int stereo);
 
 int32_t get_words_lossless (WavpackStream *wps, int32_t *buffer, int32_t nsamples)
+{
+    if (wps->wphdr.flags & MONO_DATA)
+        return get_words_lossless_kernel (wps, buffer, nsamples, FALSE);
+    else
+        return get_words_lossless_kernel (wps, buffer, nsamples, TRUE);
+}
+
+static KERNEL_INLINE int32_t get_words_lossless_kernel (WavpackStream *wps, int32_t *buffer, int32_t nsamples, const int stereo)
 {
     struct entropy_data *c = wps->w.c;
     uint32_t ones_count, low, high;
@@ -348,15 +361,15 @@ int32_t get_words_lossless (WavpackStream *wps, int32_t *buffer, int32_t nsample
 #endif
 
     if (nsamples && !bs->ptr) {
-        memset (buffer, 0, (wps->wphdr.flags & MONO_DATA) ? nsamples * 4 : nsamples * 8);
+        memset (buffer, 0, stereo ? nsamples * 8 : nsamples * 4);
         return nsamples;
     }
 
-    if (!(wps->wphdr.flags & MONO_DATA))
+    if (stereo)
         nsamples *= 2;
 
     for (csamples = 0; csamples < nsamples; ++csamples) {
-        if (!(wps->wphdr.flags & MONO_DATA))
+        if (stereo)
             c = wps->w.c + (csamples & 1);
 
         if (wps->w.holding_zero) {
@@ -368,11 +381,13 @@ int32_t get_words_lossless (WavpackStream *wps, int32_t *buffer, int32_t nsample
             if (++csamples == nsamples)
                 break;
 
-            if (!(wps->wphdr.flags & MONO_DATA))
+            if (stereo)
                 c = wps->w.c + (csamples & 1);
         }
 
-        if (wps->w.c [0].median [0] < 2 && !wps->w.holding_one && wps->w.c [1].median [0] < 2) {
+        // (the second channel's medians are never set for mono, so they're always zero)
+
+        if (wps->w.c [0].median [0] < 2 && !wps->w.holding_one && (!stereo || wps->w.c [1].median [0] < 2)) {
             uint32_t mask;
             int cbits;
 
@@ -572,7 +587,347 @@ int32_t get_words_lossless (WavpackStream *wps, int32_t *buffer, int32_t nsample
         buffer [csamples] = (getbit (bs)) ? ~low : low;
     }
 
-    return (wps->wphdr.flags & MONO_DATA) ? csamples : (csamples / 2);
+    return stereo ? (csamples / 2) : csamples;
+}
+
+// This is a batch version of get_word() for hybrid streams. Like
+// get_words_lossless() it decodes an entire buffer of mono or stereo samples
+// and is specialized by a kernel template, here for the number of channels,
+// for whether the HYBRID_BITRATE flag is set and for whether corrections are
+// read. If "correction" is NULL then the correction bitstream is never read,
+// otherwise the correction for every sample is stored there (interleaved like
+// the samples, and zero if there's no correction bitstream). The zero-run and
+// holding state is kept in locals for the whole buffer. The return value is
+// the number of samples completely decoded, which is less than requested if
+// the end of the bitstream was reached or a word could not be decoded (or was
+// WORD_EOF, which get_word() can't distinguish from an error either).
+
+static KERNEL_INLINE int32_t get_words_hybrid_kernel (WavpackStream *wps, int32_t *buffer, int32_t *correction, int32_t nsamples,
+    const int stereo, const int bitrate, const int wvc);
+
+int32_t get_words_hybrid (WavpackStream *wps, int32_t *buffer, int32_t *correction, int32_t nsamples)
+{
+    int stereo = !(wps->wphdr.flags & MONO_DATA), bitrate = (wps->wphdr.flags & HYBRID_BITRATE) != 0;
+
+    if (correction && !bs_is_open (&wps->wvcbits)) {
+        memset (correction, 0, stereo ? nsamples * 8 : nsamples * 4);
+        correction = NULL;
+    }
+
+    switch ((correction ? 4 : 0) + (bitrate ? 2 : 0) + stereo) {
+        case 0: return get_words_hybrid_kernel (wps, buffer, correction, nsamples, FALSE, FALSE, FALSE);
+        case 1: return get_words_hybrid_kernel (wps, buffer, correction, nsamples, TRUE, FALSE, FALSE);
+        case 2: return get_words_hybrid_kernel (wps, buffer, correction, nsamples, FALSE, TRUE, FALSE);
+        case 3: return get_words_hybrid_kernel (wps, buffer, correction, nsamples, TRUE, TRUE, FALSE);
+        case 4: return get_words_hybrid_kernel (wps, buffer, correction, nsamples, FALSE, FALSE, TRUE);
+        case 5: return get_words_hybrid_kernel (wps, buffer, correction, nsamples, TRUE, FALSE, TRUE);
+        case 6: return get_words_hybrid_kernel (wps, buffer, correction, nsamples, FALSE, TRUE, TRUE);
+        default: return get_words_hybrid_kernel (wps, buffer, correction, nsamples, TRUE, TRUE, TRUE);
+    }
+}
+
+static KERNEL_INLINE int32_t get_words_hybrid_kernel (WavpackStream *wps, int32_t *buffer, int32_t *correction, int32_t nsamples,
+    const int stereo, const int bitrate, const int wvc)
+{
+    uint32_t holding_one = wps->w.holding_one, zeros_acc = wps->w.zeros_acc;
+    uint32_t ones_count, low, mid, high;
+    int holding_zero = wps->w.holding_zero;
+    struct entropy_data *c = wps->w.c;
+    Bitstream *bs = &wps->wvbits;
+    int32_t csamples, value;
+#ifdef USE_NEXT8_OPTIMIZATION
+    int32_t next8;
+#endif
+
+    if (!bs->ptr)
+        return 0;
+
+    if (stereo)
+        nsamples *= 2;
+
+    for (csamples = 0; csamples < nsamples; ++csamples) {
+        if (stereo)
+            c = wps->w.c + (csamples & 1);
+
+        if (!(wps->w.c [0].median [0] & ~1) && !holding_zero && !holding_one && !(wps->w.c [1].median [0] & ~1)) {
+            uint32_t mask;
+            int cbits;
+
+            if (zeros_acc) {
+                if (--zeros_acc) {
+                    c->slow_level -= (c->slow_level + SLO) >> SLS;
+                    buffer [csamples] = 0;
+
+                    if (wvc)
+                        correction [csamples] = 0;
+
+                    continue;
+                }
+            }
+            else {
+                for (cbits = 0; cbits < 33 && getbit (bs); ++cbits);
+
+                if (cbits == 33)
+                    break;
+
+                if (cbits < 2)
+                    zeros_acc = cbits;
+                else {
+                    for (mask = 1, zeros_acc = 0; --cbits; mask <<= 1)
+                        if (getbit (bs))
+                            zeros_acc |= mask;
+
+                    zeros_acc |= mask;
+                }
+
+                if (zeros_acc) {
+                    c->slow_level -= (c->slow_level + SLO) >> SLS;
+                    CLEARA (wps->w.c [0].median);
+                    CLEARA (wps->w.c [1].median);
+                    buffer [csamples] = 0;
+
+                    if (wvc)
+                        correction [csamples] = 0;
+
+                    continue;
+                }
+            }
+        }
+
+        if (holding_zero)
+            ones_count = holding_zero = 0;
+        else {
+#ifdef USE_CTZ_OPTIMIZATION
+            while (bs->bc < LIMIT_ONES) {
+                if (++(bs->ptr) == bs->end)
+                    bs->wrap (bs);
+
+                bs->sr |= *(bs->ptr) << bs->bc;
+                bs->bc += sizeof (*(bs->ptr)) * 8;
+            }
+
+#ifdef _MSC_VER
+            { unsigned long res; _BitScanForward (&res, (unsigned long)~bs->sr); ones_count = (uint32_t) res; }
+#elif defined(__WATCOMC__) && defined(__386__)
+            ones_count = _bsf_watcom (~bs->sr);
+#else
+            ones_count = __builtin_ctz (~bs->sr);
+#endif
+
+            if (ones_count >= LIMIT_ONES) {
+                bs->bc -= ones_count;
+                bs->sr >>= ones_count;
+
+                for (; ones_count < (LIMIT_ONES + 1) && getbit (bs); ++ones_count);
+
+                if (ones_count == (LIMIT_ONES + 1))
+                    break;
+
+                if (ones_count == LIMIT_ONES) {
+                    uint32_t mask;
+                    int cbits;
+
+                    for (cbits = 0; cbits < 33 && getbit (bs); ++cbits);
+
+                    if (cbits == 33)
+                        break;
+
+                    if (cbits < 2)
+                        ones_count = cbits;
+                    else {
+                        for (mask = 1, ones_count = 0; --cbits; mask <<= 1)
+                            if (getbit (bs))
+                                ones_count |= mask;
+
+                        ones_count |= mask;
+                    }
+
+                    ones_count += LIMIT_ONES;
+                }
+            }
+            else {
+                bs->bc -= ones_count + 1;
+                bs->sr >>= ones_count + 1;
+            }
+#elif defined (USE_NEXT8_OPTIMIZATION)
+            if (bs->bc < 8) {
+                if (++(bs->ptr) == bs->end)
+                    bs->wrap (bs);
+
+                next8 = (bs->sr |= *(bs->ptr) << bs->bc) & 0xff;
+                bs->bc += sizeof (*(bs->ptr)) * 8;
+            }
+            else
+                next8 = bs->sr & 0xff;
+
+            if (next8 == 0xff) {
+                bs->bc -= 8;
+                bs->sr >>= 8;
+
+                for (ones_count = 8; ones_count < (LIMIT_ONES + 1) && getbit (bs); ++ones_count);
+
+                if (ones_count == (LIMIT_ONES + 1))
+                    break;
+
+                if (ones_count == LIMIT_ONES) {
+                    uint32_t mask;
+                    int cbits;
+
+                    for (cbits = 0; cbits < 33 && getbit (bs); ++cbits);
+
+                    if (cbits == 33)
+                        break;
+
+                    if (cbits < 2)
+                        ones_count = cbits;
+                    else {
+                        for (mask = 1, ones_count = 0; --cbits; mask <<= 1)
+                            if (getbit (bs))
+                                ones_count |= mask;
+
+                        ones_count |= mask;
+                    }
+
+                    ones_count += LIMIT_ONES;
+                }
+            }
+            else {
+                bs->bc -= (ones_count = ones_count_table [next8]) + 1;
+                bs->sr >>= ones_count + 1;
+            }
+#else
+            for (ones_count = 0; ones_count < (LIMIT_ONES + 1) && getbit (bs); ++ones_count);
+
+            if (ones_count >= LIMIT_ONES) {
+                uint32_t mask;
+                int cbits;
+
+                if (ones_count == (LIMIT_ONES + 1))
+                    break;
+
+                for (cbits = 0; cbits < 33 && getbit (bs); ++cbits);
+
+                if (cbits == 33)
+                    break;
+
+                if (cbits < 2)
+                    ones_count = cbits;
+                else {
+                    for (mask = 1, ones_count = 0; --cbits; mask <<= 1)
+                        if (getbit (bs))
+                            ones_count |= mask;
+
+                    ones_count |= mask;
+                }
+
+                ones_count += LIMIT_ONES;
+            }
+#endif
+
+            low = holding_one;
+            holding_one = ones_count & 1;
+            holding_zero = ~ones_count & 1;
+            ones_count = (ones_count >> 1) + low;
+        }
+
+        if (!stereo || !(csamples & 1))
+            update_error_limit (wps);
+
+        if (ones_count == 0) {
+            low = 0;
+            high = GET_MED (0) - 1;
+            DEC_MED0 ();
+        }
+        else {
+            low = GET_MED (0);
+            INC_MED0 ();
+
+            if (ones_count == 1) {
+                high = low + GET_MED (1) - 1;
+                DEC_MED1 ();
+            }
+            else {
+                low += GET_MED (1);
+                INC_MED1 ();
+
+                if (ones_count == 2) {
+                    high = low + GET_MED (2) - 1;
+                    DEC_MED2 ();
+                }
+                else {
+                    low += (ones_count - 2) * GET_MED (2);
+                    high = low + GET_MED (2) - 1;
+                    INC_MED2 ();
+                }
+            }
+        }
+
+        low &= 0x7fffffff;
+        high &= 0x7fffffff;
+
+        if (low > high)         // make sure high and low make sense
+            high = low;
+
+        mid = (high + low + 1) >> 1;
+
+        if (!c->error_limit)
+            mid = read_code (bs, high - low) + low;
+        else if (high - low > c->error_limit) {
+            uint32_t error_limit = c->error_limit, sr = bs->sr, mask;
+            int bc = bs->bc;
+
+            // This is the same binary search as get_word() does, but because the bits are essentially
+            // random it's done without branching on them, and with the bitstream state in locals.
+
+            do {
+                if (!bc) {
+                    if (++(bs->ptr) == bs->end)
+                        bs->wrap (bs);
+
+                    sr = *(bs->ptr);
+                    bc = sizeof (*(bs->ptr)) * 8;
+                }
+
+                mask = (uint32_t) 0 - (sr & 1);
+                sr >>= 1;
+                bc--;
+
+                low = (mid & mask) | (low & ~mask);
+                high = (high & mask) | ((mid - 1) & ~mask);
+                mid = (high + low + 1) >> 1;
+            } while (high - low > error_limit);
+
+            bs->sr = sr;
+            bs->bc = bc;
+        }
+
+        value = getbit (bs) ? ~mid : mid;
+
+        if (wvc) {
+            if (c->error_limit) {
+                low += read_code (&wps->wvcbits, high - low);
+                correction [csamples] = value < 0 ? (mid - low) : (low - mid);
+            }
+            else
+                correction [csamples] = 0;
+        }
+
+        if (bitrate) {
+            c->slow_level -= (c->slow_level + SLO) >> SLS;
+            c->slow_level += wp_log2 (mid);
+        }
+
+        if (value == WORD_EOF)
+            break;
+
+        buffer [csamples] = value;
+    }
+
+    wps->w.holding_one = holding_one;
+    wps->w.holding_zero = holding_zero;
+    wps->w.zeros_acc = zeros_acc;
+
+    return stereo ? (csamples / 2) : csamples;
 }
 
 // Read a single unsigned value from the specified bitstream with a value
@@ -28,6 +28,9 @@
 static int get_ape_tag_item (M_Tag *m_tag, const char *item, char *value, int size, int type);
 static int get_id3_tag_item (M_Tag *m_tag, const char *item, char *value, int size);
 static int get_ape_tag_item_indexed (M_Tag *m_tag, int index, char *item, int size, int type);
+static int get_ape_tag_item_view (M_Tag *m_tag, const char *item, const unsigned char **value);
+static APE_Tag_Item_Ref *find_binary_item_ref (M_Tag *m_tag, const char *item);
+static const unsigned char *load_binary_item_ref (WavpackContext *wpc, APE_Tag_Item_Ref *ref);
 static int get_id3_tag_item_indexed (M_Tag *m_tag, int index, char *item, int size);
 static int append_ape_tag_item (WavpackContext *wpc, const char *item, const char *value, int vsize, int type);
 static int write_tag_blockout (WavpackContext *wpc);
@@ -105,12 +108,58 @@ int WavpackGetBinaryTagItem (WavpackContext *wpc, const char *item, char *value,
     if (value && size)
         *value = 0;
 
-    if (m_tag->ape_tag_hdr.ID [0] == 'A')
+    if (m_tag->binary_items) {
+        APE_Tag_Item_Ref *ref = find_binary_item_ref (m_tag, item);
+        const unsigned char *data;
+
+        if (!ref)
+            return 0;
+
+        if (!value || !size)
+            return ref->value_size;
+
+        if (ref->value_size > size || !(data = load_binary_item_ref (wpc, ref)))
+            return 0;
+
+        memcpy (value, data, ref->value_size);
+        return ref->value_size;
+    }
+    else if (m_tag->ape_tag_hdr.ID [0] == 'A')
         return get_ape_tag_item (m_tag, item, value, size, APE_TAG_TYPE_BINARY);
     else
         return 0;
 }
 
+// Attempt to get a pointer to the specified binary item from the specified
+// file's APEv2 tag without copying it. The actual size is returned (or 0 if
+// no matching item is found or it can't be read) and "*value" is set to the
+// start of the data, which remains valid until the file is closed. Normally
+// this points into the tag that was loaded at open, but if the file was opened
+// with OPEN_TAGS_LAZY then the value is accessed here for the first time. In
+// that case, files opened with WavpackOpenMemoryInput() (including memory
+// mapped files) return a pointer directly into the source data and nothing is
+// copied; for other files the value is read once and retained.
+
+int WavpackGetBinaryTagItemView (WavpackContext *wpc, const char *item, const unsigned char **value)
+{
+    M_Tag *m_tag = &wpc->m_tag;
+
+    *value = NULL;
+
+    if (m_tag->binary_items) {
+        APE_Tag_Item_Ref *ref = find_binary_item_ref (m_tag, item);
+
+        if (ref && (*value = load_binary_item_ref (wpc, ref)) != NULL)
+            return ref->value_size;
+        else
+            return 0;
+    }
+    else if (m_tag->ape_tag_hdr.ID [0] == 'A')
+        return get_ape_tag_item_view (m_tag, item, value);
+    else
+        return 0;
+}
+
 // This function looks up the tag item name by index and is used when the
 // application wants to access all the items in the file's ID3v1 or APEv2 tag.
 // Note that this function accesses only the item's name; WavpackGetTagItem()
@@ -146,7 +195,31 @@ int WavpackGetBinaryTagItemIndexed (WavpackContext *wpc, int index, char *item,
     if (item && size)
         *item = 0;
 
-    if (m_tag->ape_tag_hdr.ID [0] == 'A')
+    if (m_tag->binary_items) {
+        int isize;
+
+        if (index < 0 || index >= m_tag->num_binary_items)
+            return 0;
+
+        isize = (int) strlen (m_tag->binary_items [index].item);
+
+        if (!item || !size)
+            return isize;
+
+        if (isize < size) {
+            memcpy (item, m_tag->binary_items [index].item, isize + 1);
+            return isize;
+        }
+        else if (size >= 4) {
+            memcpy (item, m_tag->binary_items [index].item, size - 1);
+            item [size - 4] = item [size - 3] = item [size - 2] = '.';
+            item [size - 1] = 0;
+            return size - 1;
+        }
+        else
+            return 0;
+    }
+    else if (m_tag->ape_tag_hdr.ID [0] == 'A')
         return get_ape_tag_item_indexed (m_tag, index, item, size, APE_TAG_TYPE_BINARY);
     else
         return 0;
@@ -283,6 +356,78 @@ static int get_ape_tag_item (M_Tag *m_tag, const char *item, char *value, int si
     return 0;
 }
 
+static int get_ape_tag_item_view (M_Tag *m_tag, const char *item, const unsigned char **value)
+{
+    unsigned char *p = m_tag->ape_tag_data;
+    unsigned char *q = p + m_tag->ape_tag_hdr.length - sizeof (APE_Tag_Hdr);
+    int i;
+
+    for (i = 0; i < m_tag->ape_tag_hdr.item_count && q - p > 8; ++i) {
+        int vsize, flags, isize;
+
+        vsize = p[0] + (p[1] << 8) + (p[2] << 16) + ((uint32_t) p[3] << 24); p += 4;
+        flags = p[0] + (p[1] << 8) + (p[2] << 16) + ((uint32_t) p[3] << 24); p += 4;
+        for (isize = 0; p + isize < q && p[isize]; ++isize);
+
+        if (vsize < 0 || vsize > m_tag->ape_tag_hdr.length || p + isize + vsize + 1 > q)
+            break;
+
+        if (isize && vsize && !stricmp (item, (char *) p) && ((flags & 6) >> 1) == APE_TAG_TYPE_BINARY) {
+            *value = p + isize + 1;
+            return vsize;
+        }
+        else
+            p += isize + vsize + 1;
+    }
+
+    return 0;
+}
+
+// Find the lazily loaded binary item with the specified name (or return NULL).
+
+static APE_Tag_Item_Ref *find_binary_item_ref (M_Tag *m_tag, const char *item)
+{
+    int i;
+
+    for (i = 0; i < m_tag->num_binary_items; ++i)
+        if (!stricmp (item, m_tag->binary_items [i].item))
+            return m_tag->binary_items + i;
+
+    return NULL;
+}
+
+// Return a pointer to the value of a lazily loaded binary item. If the source is in
+// memory we point right into it, otherwise the value is read into an allocated buffer
+// (just once). The reader position is restored afterward so that this can be called
+// at any time, even between calls to WavpackUnpackSamples().
+
+static const unsigned char *load_binary_item_ref (WavpackContext *wpc, APE_Tag_Item_Ref *ref)
+{
+    int64_t saved_pos;
+
+    if (ref->value)
+        return ref->value;
+
+    ref->value = memory_reader_bytes (wpc->reader, wpc->wv_in, ref->value_pos, ref->value_size);
+
+    if (ref->value)
+        return ref->value;
+
+    if (!(ref->value_buffer = (unsigned char *)malloc (ref->value_size)))
+        return NULL;
+
+    saved_pos = wpc->reader->get_pos (wpc->wv_in);
+
+    if (wpc->reader->set_pos_abs (wpc->wv_in, ref->value_pos) ||
+        wpc->reader->read_bytes (wpc->wv_in, ref->value_buffer, ref->value_size) != ref->value_size) {
+            free (ref->value_buffer);
+            ref->value_buffer = NULL;
+    }
+
+    wpc->reader->set_pos_abs (wpc->wv_in, saved_pos);
+    return ref->value = ref->value_buffer;
+}
+
 static int get_id3_tag_item (M_Tag *m_tag, const char *item, char *value, int size)
 {
     char lvalue [64];
@@ -18,6 +18,8 @@
 
 #include "wavpack_local.h"
 
+static int load_tag_layout (WavpackContext *wpc, int32_t body_length);
+
 // This function attempts to load an ID3v1 or APEv2 tag from the specified
 // file into the specified M_Tag structure. The ID3 tag fits in completely,
 // but an APEv2 tag is variable length and so space must be allocated here
@@ -27,6 +29,7 @@
 
 int load_tag (WavpackContext *wpc)
 {
+    int lazy = (wpc->open_flags & OPEN_TAGS_LAZY) && !(wpc->open_flags & OPEN_EDIT_TAGS);
     int ape_tag_length, ape_tag_items;
     M_Tag *m_tag = &wpc->m_tag;
 
@@ -59,7 +62,7 @@ int load_tag (WavpackContext *wpc)
                 if (m_tag->ape_tag_hdr.version == 2000 && m_tag->ape_tag_hdr.item_count &&
                     m_tag->ape_tag_hdr.length > (int) sizeof (m_tag->ape_tag_hdr) &&
                     m_tag->ape_tag_hdr.length <= APE_TAG_MAX_LENGTH &&
-                    (m_tag->ape_tag_data = (unsigned char *)malloc (m_tag->ape_tag_hdr.length)) != NULL) {
+                    (lazy || (m_tag->ape_tag_data = (unsigned char *)malloc (m_tag->ape_tag_hdr.length)) != NULL)) {
 
                         ape_tag_items = m_tag->ape_tag_hdr.item_count;
                         ape_tag_length = m_tag->ape_tag_hdr.length;
@@ -102,7 +105,18 @@ int load_tag (WavpackContext *wpc)
                             }
                         }
 
-                        if (wpc->reader->read_bytes (wpc->wv_in, m_tag->ape_tag_data,
+                        if (lazy) {
+                            if (!load_tag_layout (wpc, ape_tag_length - sizeof (APE_Tag_Hdr))) {
+                                free_tag (m_tag);
+                                CLEAR (*m_tag);
+                                return FALSE;       // something's wrong...
+                            }
+                            else {
+                                CLEAR (m_tag->id3_tag); // ignore ID3v1 tag if we found APEv2 tag
+                                return TRUE;
+                            }
+                        }
+                        else if (wpc->reader->read_bytes (wpc->wv_in, m_tag->ape_tag_data,
                             ape_tag_length - sizeof (APE_Tag_Hdr)) != ape_tag_length - sizeof (APE_Tag_Hdr)) {
                                 free (m_tag->ape_tag_data);
                                 CLEAR (*m_tag);
@@ -148,6 +162,97 @@ int load_tag (WavpackContext *wpc)
     }
 }
 
+// Load the body of an APEv2 tag in "lazy" mode (OPEN_TAGS_LAZY). The reader is
+// positioned at the first item and ape_tag_data has not been allocated yet; it
+// is grown here to hold just the text items, which are copied into it as usual
+// (so the regular parsing code works unchanged on them). Binary items are never
+// buffered, only their name, size and file position are recorded. The item
+// count and length in ape_tag_hdr are adjusted to describe the text items only.
+// Returns FALSE if the tag is malformed or an allocation fails.
+
+#define MAX_ITEM_PREFIX (8 + 256)   // item header plus longest legal key and terminator
+
+static int load_tag_layout (WavpackContext *wpc, int32_t body_length)
+{
+    M_Tag *m_tag = &wpc->m_tag;
+    int64_t item_pos = wpc->reader->get_pos (wpc->wv_in);
+    int64_t body_end = item_pos + body_length;
+    int item_count = m_tag->ape_tag_hdr.item_count, i;
+    int32_t data_bytes = 0, data_size = 0;
+    unsigned char prefix [MAX_ITEM_PREFIX];
+    int text_items = 0;
+
+    for (i = 0; i < item_count && body_end - item_pos > 8; ++i) {
+        int32_t prefix_bytes = (int32_t)(body_end - item_pos < MAX_ITEM_PREFIX ? body_end - item_pos : MAX_ITEM_PREFIX);
+        int vsize, flags, isize;
+
+        if (wpc->reader->set_pos_abs (wpc->wv_in, item_pos) ||
+            wpc->reader->read_bytes (wpc->wv_in, prefix, prefix_bytes) != prefix_bytes)
+                return FALSE;
+
+        vsize = prefix[0] + (prefix[1] << 8) + (prefix[2] << 16) + ((uint32_t) prefix[3] << 24);
+        flags = prefix[4] + (prefix[5] << 8) + (prefix[6] << 16) + ((uint32_t) prefix[7] << 24);
+        for (isize = 0; 8 + isize < prefix_bytes && prefix[8 + isize]; ++isize);
+
+        if (8 + isize == prefix_bytes || vsize < 0 || vsize > body_length ||
+            item_pos + 8 + isize + 1 + vsize > body_end)
+                break;
+
+        if (isize && vsize && ((flags & 6) >> 1) == APE_TAG_TYPE_BINARY) {
+            APE_Tag_Item_Ref *ref = (APE_Tag_Item_Ref *)realloc (m_tag->binary_items,
+                (m_tag->num_binary_items + 1) * sizeof (APE_Tag_Item_Ref));
+
+            if (!ref)
+                return FALSE;
+
+            m_tag->binary_items = ref;
+            ref += m_tag->num_binary_items;
+            CLEAR (*ref);
+
+            if (!(ref->item = strdup ((char *) prefix + 8)))
+                return FALSE;
+
+            ref->value_pos = item_pos + 8 + isize + 1;
+            ref->value_size = vsize;
+            m_tag->num_binary_items++;
+        }
+        else {
+            int32_t item_bytes = 8 + isize + 1 + vsize, copied = item_bytes < prefix_bytes ? item_bytes : prefix_bytes;
+            unsigned char *dst;
+
+            if (data_bytes + item_bytes > data_size) {
+                data_size = data_bytes + item_bytes > data_size * 2 ? data_bytes + item_bytes : data_size * 2;
+
+                if (!(dst = (unsigned char *)realloc (m_tag->ape_tag_data, data_size)))
+                    return FALSE;
+
+                m_tag->ape_tag_data = dst;
+            }
+
+            dst = m_tag->ape_tag_data + data_bytes;
+            memcpy (dst, prefix, copied);
+
+            if (copied < item_bytes &&
+                wpc->reader->read_bytes (wpc->wv_in, dst + copied, item_bytes - copied) != item_bytes - copied)
+                    return FALSE;
+
+            data_bytes += item_bytes;
+            text_items++;
+        }
+
+        item_pos += 8 + isize + 1 + vsize;
+    }
+
+    // the text item parsers expect ape_tag_data to be valid even when it's empty
+
+    if (!m_tag->ape_tag_data && !(m_tag->ape_tag_data = (unsigned char *)malloc (1)))
+        return FALSE;
+
+    m_tag->ape_tag_hdr.item_count = text_items;
+    m_tag->ape_tag_hdr.length = data_bytes + sizeof (APE_Tag_Hdr);
+    return TRUE;
+}
+
 // Return TRUE is a valid ID3v1 or APEv2 tag has been loaded.
 
 int valid_tag (M_Tag *m_tag)
@@ -176,4 +281,17 @@ void free_tag (M_Tag *m_tag)
         free (m_tag->ape_tag_data);
         m_tag->ape_tag_data = NULL;
     }
+
+    if (m_tag->binary_items) {
+        int i;
+
+        for (i = 0; i < m_tag->num_binary_items; ++i) {
+            free (m_tag->binary_items [i].item);
+            free (m_tag->binary_items [i].value_buffer);
+        }
+
+        free (m_tag->binary_items);
+        m_tag->binary_items = NULL;
+        m_tag->num_binary_items = 0;
+    }
 }
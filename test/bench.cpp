@@ -0,0 +1,667 @@
+// Decode benchmark: decodes each given WavPack file (plus its .wvc correction
+// file, if present next to it) repeatedly from memory and prints the results
+// as JSON on stdout, per file and aggregated per file mode. A "sample" here
+// is a single sample of a single channel, so stereo frames count as two. The
+// length of a file ("frames") and the call size ("samples_per_call", as in the
+// library's unpack functions) are counted in frames instead.
+//
+// usage: benchmark [-t threads] [-n samples_per_call] [-s min_seconds] [-p] [-w] [-S] [-c] [-16 | -f | -d] file.wv...
+//   -p  decode DSD files as PCM (decimated) instead of natively
+//   -w  read and verify the correction files on their own thread (OPEN_WVC_THREAD)
+//   -S  thread scaling sweep: decode each file with every worker thread count
+//       (0 to 15, or up to -t if given) and a range of call sizes (256 samples
+//       up to the whole file), reporting the speedup and efficiency relative
+//       to single-threaded decoding plus the CPU use and context switches
+//   -c  collect hardware performance counters (Linux perf events) for each
+//       file and, if the library was built with WAVPACK_PROFILE (see the
+//       "profbench" make target), for each decoding stage
+//   -16 decode to 16-bit samples with WavpackUnpackSamples16() (files with
+//       more than 16 bits per sample or float data are skipped)
+//   -f  decode to floats with WavpackUnpackSamplesFloat() (native DSD files
+//       are skipped, so use -p with it for DSD)
+//   -d  decode to packed (interleaved, MSB first) DSD bytes with
+//       WavpackUnpackSamplesDSD() (files that aren't native DSD are skipped)
+
+#include "../wavpack.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iterator>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <sys/resource.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+struct CStats
+{
+	double m_Seconds = 0;
+	int64_t m_Bytes = 0;
+	int64_t m_Samples = 0;
+	int m_Files = 0;
+	std::vector<double> m_CallSeconds;
+
+	void Add(const CStats &Other)
+	{
+		m_Seconds += Other.m_Seconds;
+		m_Bytes += Other.m_Bytes;
+		m_Samples += Other.m_Samples;
+		m_Files += Other.m_Files;
+		m_CallSeconds.insert(m_CallSeconds.end(), Other.m_CallSeconds.begin(), Other.m_CallSeconds.end());
+	}
+
+	double Percentile(double Fraction)
+	{
+		if(m_CallSeconds.empty())
+			return 0;
+		size_t Index = std::min(m_CallSeconds.size() - 1, (size_t)(Fraction * m_CallSeconds.size()));
+		std::nth_element(m_CallSeconds.begin(), m_CallSeconds.begin() + Index, m_CallSeconds.end());
+		return m_CallSeconds[Index];
+	}
+
+	void Print(const char *pIndent)
+	{
+		std::printf("%s\"mb_per_sec\": %.3f,\n", pIndent, m_Seconds > 0 ? m_Bytes / m_Seconds / 1e6 : 0);
+		std::printf("%s\"msamples_per_sec\": %.3f,\n", pIndent, m_Seconds > 0 ? m_Samples / m_Seconds / 1e6 : 0);
+		std::printf("%s\"ns_per_sample\": %.3f,\n", pIndent, m_Samples ? m_Seconds * 1e9 / m_Samples : 0);
+		std::printf("%s\"call_p50_us\": %.3f,\n", pIndent, Percentile(0.50) * 1e6);
+		std::printf("%s\"call_p99_us\": %.3f", pIndent, Percentile(0.99) * 1e6);
+	}
+};
+
+static bool ReadFile(const std::string &Path, std::vector<unsigned char> &Data)
+{
+	FILE *pFile = std::fopen(Path.c_str(), "rb");
+	if(!pFile)
+		return false;
+	std::fseek(pFile, 0, SEEK_END);
+	long Size = std::ftell(pFile);
+	std::fseek(pFile, 0, SEEK_SET);
+	Data.resize(Size > 0 ? Size : 0);
+	bool Ok = Size > 0 && std::fread(Data.data(), 1, Size, pFile) == (size_t)Size;
+	std::fclose(pFile);
+	return Ok;
+}
+
+static double Now()
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static double CpuSeconds()
+{
+	rusage Usage;
+	getrusage(RUSAGE_SELF, &Usage);
+	return Usage.ru_utime.tv_sec + Usage.ru_utime.tv_usec * 1e-6 + Usage.ru_stime.tv_sec + Usage.ru_stime.tv_usec * 1e-6;
+}
+
+static void ContextSwitches(long &Voluntary, long &Involuntary)
+{
+	rusage Usage;
+	getrusage(RUSAGE_SELF, &Usage);
+	Voluntary = Usage.ru_nvcsw;
+	Involuntary = Usage.ru_nivcsw;
+}
+
+// Hardware performance counters for the calling thread (and, if "Inherit" is
+// set, the threads it creates after this, which are added in when they exit).
+// Counters that can't be opened (not Linux, not supported by the processor or
+// not permitted by perf_event_paranoid) simply read as zero. The counters are
+// opened individually, so the kernel may multiplex them; the values are scaled
+// to make up for that.
+
+enum
+{
+	COUNTER_CYCLES = 0,
+	COUNTER_INSTRUCTIONS,
+	COUNTER_BRANCHES,
+	COUNTER_BRANCH_MISSES,
+	COUNTER_L1D_MISSES,
+	COUNTER_LLC_MISSES,
+	NUM_COUNTERS
+};
+
+static const char *s_apCounterNames[NUM_COUNTERS] = {"cycles", "instructions", "branches", "branch_misses", "l1d_misses", "llc_misses"};
+
+// sample format returned by the decoding calls
+
+enum
+{
+	OUTPUT_INT32 = 0,
+	OUTPUT_INT16,
+	OUTPUT_FLOAT,
+	OUTPUT_DSD,
+	NUM_OUTPUTS
+};
+
+static const char *s_apOutputNames[NUM_OUTPUTS] = {"int32", "int16", "float", "dsd"};
+
+class CCounters
+{
+	int m_aFds[NUM_COUNTERS];
+
+public:
+	explicit CCounters(bool Inherit)
+	{
+		for(int i = 0; i < NUM_COUNTERS; i++)
+		{
+			m_aFds[i] = -1;
+#ifdef __linux__
+			static const uint32_t s_aTypes[NUM_COUNTERS] = {PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HW_CACHE, PERF_TYPE_HW_CACHE};
+			static const uint64_t s_aConfigs[NUM_COUNTERS] = {PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_BRANCH_INSTRUCTIONS, PERF_COUNT_HW_BRANCH_MISSES,
+				PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16),
+				PERF_COUNT_HW_CACHE_LL | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)};
+			perf_event_attr Attr;
+			std::memset(&Attr, 0, sizeof(Attr));
+			Attr.size = sizeof(Attr);
+			Attr.type = s_aTypes[i];
+			Attr.config = s_aConfigs[i];
+			Attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+			Attr.inherit = Inherit;
+			Attr.exclude_kernel = 1;
+			Attr.exclude_hv = 1;
+			m_aFds[i] = (int)syscall(SYS_perf_event_open, &Attr, 0, -1, -1, 0);
+#endif
+		}
+	}
+
+	~CCounters()
+	{
+#ifdef __linux__
+		for(int Fd : m_aFds)
+			if(Fd >= 0)
+				close(Fd);
+#endif
+	}
+
+	CCounters(const CCounters &) = delete;
+	CCounters &operator=(const CCounters &) = delete;
+
+	bool Available(int Counter) const { return m_aFds[Counter] >= 0; }
+
+	bool AnyAvailable() const
+	{
+		for(int i = 0; i < NUM_COUNTERS; i++)
+			if(Available(i))
+				return true;
+		return false;
+	}
+
+	void Read(uint64_t *pValues) const
+	{
+		for(int i = 0; i < NUM_COUNTERS; i++)
+		{
+			pValues[i] = 0;
+#ifdef __linux__
+			uint64_t aData[3];
+			if(m_aFds[i] >= 0 && read(m_aFds[i], aData, sizeof(aData)) == (ssize_t)sizeof(aData) && aData[2])
+				pValues[i] = aData[2] < aData[1] ? (uint64_t)((double)aData[0] * aData[1] / aData[2]) : aData[0];
+#endif
+		}
+	}
+};
+
+// the per-stage counter reader for the library's profiling (WavpackSetProfileCounters()),
+// which is called from every decoding thread and so uses counters for each thread
+
+static void ReadThreadCounters(uint64_t *pValues)
+{
+	static thread_local CCounters s_Counters(false);
+	s_Counters.Read(pValues);
+}
+
+static const char *s_apStageNames[WP_PROFILE_STAGES] = {"io", "verify", "init", "entropy", "decorr", "fixup", "dsd", "decimate", "wait"};
+
+// print counter totals (only those that are available) and the metrics derived from them
+
+static void PrintCounters(const uint64_t *pValues, const bool *pAvailable, int64_t Samples)
+{
+	bool First = true;
+	std::printf("{");
+	for(int i = 0; i < NUM_COUNTERS; i++)
+		if(pAvailable[i])
+		{
+			std::printf("%s\"%s\": %llu", First ? "" : ", ", s_apCounterNames[i], (unsigned long long)pValues[i]);
+			First = false;
+		}
+	if(pAvailable[COUNTER_CYCLES] && Samples)
+		std::printf(", \"cycles_per_sample\": %.3f", (double)pValues[COUNTER_CYCLES] / Samples);
+	if(pAvailable[COUNTER_CYCLES] && pAvailable[COUNTER_INSTRUCTIONS] && pValues[COUNTER_CYCLES])
+		std::printf(", \"ipc\": %.3f", (double)pValues[COUNTER_INSTRUCTIONS] / pValues[COUNTER_CYCLES]);
+	if(pAvailable[COUNTER_BRANCHES] && pAvailable[COUNTER_BRANCH_MISSES] && pValues[COUNTER_BRANCHES])
+		std::printf(", \"branch_miss_rate\": %.5f", (double)pValues[COUNTER_BRANCH_MISSES] / pValues[COUNTER_BRANCHES]);
+	if(pAvailable[COUNTER_INSTRUCTIONS] && pValues[COUNTER_INSTRUCTIONS])
+	{
+		if(pAvailable[COUNTER_L1D_MISSES])
+			std::printf(", \"l1d_mpki\": %.3f", pValues[COUNTER_L1D_MISSES] * 1000.0 / pValues[COUNTER_INSTRUCTIONS]);
+		if(pAvailable[COUNTER_LLC_MISSES])
+			std::printf(", \"llc_mpki\": %.3f", pValues[COUNTER_LLC_MISSES] * 1000.0 / pValues[COUNTER_INSTRUCTIONS]);
+	}
+	std::printf("}");
+}
+
+struct CRun
+{
+	CStats m_Stats;
+	int m_Iterations = 0;
+	int m_Errors = 0;
+	double m_OpenSeconds = 0;
+	double m_WallSeconds = 0;
+	double m_CpuSeconds = 0;
+	long m_VoluntarySwitches = 0;
+	long m_InvoluntarySwitches = 0;
+	bool m_aCountersAvailable[NUM_COUNTERS] = {};
+	uint64_t m_aCounters[NUM_COUNTERS] = {};
+	bool m_HaveProfile = false;
+	double m_aStageSeconds[WP_PROFILE_STAGES] = {};
+	uint64_t m_aStageCalls[WP_PROFILE_STAGES] = {};
+	uint64_t m_aaStageCounters[WP_PROFILE_STAGES][NUM_COUNTERS] = {};
+};
+
+// always decode whole files, as many times as needed to reach the minimum time;
+// the CPU time and context switches are for the whole process (all threads)
+
+static bool DecodeFile(const std::vector<unsigned char> &Wv, const std::vector<unsigned char> &Wvc, int Flags, int CallSamples, double MinSeconds, bool Counters, int Output, CRun &Run)
+{
+	long Voluntary, Involuntary;
+	uint64_t aStartCounters[NUM_COUNTERS];
+	std::vector<int32_t> Buffer;
+	std::vector<int16_t> Buffer16;
+	std::vector<float> BufferFloat;
+	std::vector<unsigned char> BufferDsd;
+	CCounters FileCounters(true);
+	double Start = Now(), StartCpu = CpuSeconds();
+	ContextSwitches(Voluntary, Involuntary);
+	FileCounters.Read(aStartCounters);
+	Run.m_Stats.m_Files = 1;
+
+	do
+	{
+		char aError[80] = "";
+		double OpenStart = Now();
+		WavpackContext *pContext = WavpackOpenMemoryInput(Wv.data(), Wv.size(), Wvc.empty() ? nullptr : Wvc.data(), Wvc.size(), aError, Flags, 0);
+		Run.m_OpenSeconds += Now() - OpenStart;
+		if(!pContext)
+			return false;
+		if(Counters)
+			WavpackSetProfileCounters(pContext, NUM_COUNTERS, ReadThreadCounters);
+
+		const int Mode = WavpackGetMode(pContext);
+		const int NumChannels = WavpackGetNumChannels(pContext);
+		const int64_t NumSamples = WavpackGetNumSamples64(pContext);
+		if(Output == OUTPUT_INT16)
+			Buffer16.resize((size_t)CallSamples * NumChannels);
+		else if(Output == OUTPUT_FLOAT)
+			BufferFloat.resize((size_t)CallSamples * NumChannels);
+		else if(Output == OUTPUT_DSD)
+			BufferDsd.resize((size_t)CallSamples * NumChannels);
+		else
+			Buffer.resize((size_t)CallSamples * NumChannels);
+
+		int64_t Decoded = 0;
+		while(true)
+		{
+			double CallStart = Now();
+			uint32_t Count;
+			if(Output == OUTPUT_INT16)
+				Count = WavpackUnpackSamples16(pContext, Buffer16.data(), CallSamples);
+			else if(Output == OUTPUT_FLOAT)
+				Count = WavpackUnpackSamplesFloat(pContext, BufferFloat.data(), CallSamples);
+			else if(Output == OUTPUT_DSD)
+				Count = WavpackUnpackSamplesDSD(pContext, BufferDsd.data(), CallSamples, QMODE_DSD_MSB_FIRST);
+			else
+				Count = WavpackUnpackSamples(pContext, Buffer.data(), CallSamples);
+			double CallSeconds = Now() - CallStart;
+			if(!Count)
+				break;
+			Run.m_Stats.m_CallSeconds.push_back(CallSeconds);
+			Run.m_Stats.m_Seconds += CallSeconds;
+			Decoded += Count;
+		}
+
+		WavpackProfile Profile;
+		if(WavpackGetProfile(pContext, &Profile))
+		{
+			Run.m_HaveProfile = true;
+			for(int i = 0; i < WP_PROFILE_STAGES; i++)
+			{
+				Run.m_aStageSeconds[i] += Profile.ticks_per_second > 0 ? Profile.ticks[i] / Profile.ticks_per_second : 0;
+				Run.m_aStageCalls[i] += Profile.calls[i];
+				for(int c = 0; c < NUM_COUNTERS; c++)
+					Run.m_aaStageCounters[i][c] += Profile.counters[i][c];
+			}
+		}
+
+		Run.m_Errors += WavpackGetNumErrors(pContext) + (NumSamples != -1 && Decoded != NumSamples);
+		Run.m_Stats.m_Samples += Decoded * NumChannels;
+		Run.m_Stats.m_Bytes += Wv.size() + ((Mode & MODE_WVC) ? Wvc.size() : 0);
+		WavpackCloseFile(pContext);
+		Run.m_Iterations++;
+	} while(Now() - Start < MinSeconds);
+
+	// the worker threads have all exited by now, so their counts are included
+
+	if(Counters)
+	{
+		uint64_t aEndCounters[NUM_COUNTERS];
+		FileCounters.Read(aEndCounters);
+		for(int i = 0; i < NUM_COUNTERS; i++)
+		{
+			Run.m_aCountersAvailable[i] = FileCounters.Available(i);
+			Run.m_aCounters[i] = aEndCounters[i] - aStartCounters[i];
+		}
+	}
+
+	long EndVoluntary, EndInvoluntary;
+	ContextSwitches(EndVoluntary, EndInvoluntary);
+	Run.m_WallSeconds = Now() - Start;
+	Run.m_CpuSeconds = CpuSeconds() - StartCpu;
+	Run.m_VoluntarySwitches = EndVoluntary - Voluntary;
+	Run.m_InvoluntarySwitches = EndInvoluntary - Involuntary;
+	return true;
+}
+
+static std::string JsonString(const std::string &Str)
+{
+	std::string Result = "\"";
+	for(char c : Str)
+	{
+		if(c == '"' || c == '\\')
+			Result += '\\';
+		Result += c;
+	}
+	return Result + "\"";
+}
+
+// call sizes for the thread scaling sweep, followed by the whole file (if its
+// decoded audio fits in WHOLE_FILE_LIMIT samples)
+
+static const int s_aScalingCallSamples[] = {256, 1024, 4096, 16384, 65536};
+static const int64_t WHOLE_FILE_LIMIT = (int64_t)1 << 26;
+
+static int RunScaling(const std::vector<std::string> &Files, int Flags, int MaxThreads, double MinSeconds)
+{
+	int Failures = 0;
+
+	std::printf("{\n  \"library\": %s,\n", JsonString(WavpackGetLibraryVersionString()).c_str());
+	std::printf("  \"max_threads\": %d,\n  \"min_seconds\": %.3f,\n", MaxThreads, MinSeconds);
+	std::printf("  \"scaling\": [");
+
+	for(size_t f = 0; f < Files.size(); f++)
+	{
+		std::vector<unsigned char> Wv, Wvc;
+		char aError[80] = "";
+
+		if(!ReadFile(Files[f], Wv))
+		{
+			std::fprintf(stderr, "can't read %s\n", Files[f].c_str());
+			Failures++;
+			continue;
+		}
+
+		ReadFile(Files[f] + "c", Wvc);
+
+		WavpackContext *pContext = WavpackOpenMemoryInput(Wv.data(), Wv.size(), Wvc.empty() ? nullptr : Wvc.data(), Wvc.size(), aError, Flags, 0);
+		if(!pContext)
+		{
+			std::fprintf(stderr, "can't open %s: %s\n", Files[f].c_str(), aError);
+			Failures++;
+			continue;
+		}
+
+		const int NumChannels = WavpackGetNumChannels(pContext);
+		const int64_t NumSamples = WavpackGetNumSamples64(pContext);
+		WavpackCloseFile(pContext);
+
+		std::vector<int> CallSizes(std::begin(s_aScalingCallSamples), std::end(s_aScalingCallSamples));
+		if(NumSamples > 0 && NumSamples * NumChannels <= WHOLE_FILE_LIMIT)
+			CallSizes.push_back((int)NumSamples);
+
+		std::printf("%s\n    {\n", f ? "," : "");
+		std::printf("      \"file\": %s,\n", JsonString(Files[f]).c_str());
+		std::printf("      \"channels\": %d,\n      \"frames\": %lld,\n", NumChannels, (long long)NumSamples);
+		std::printf("      \"runs\": [");
+
+		bool First = true;
+		for(int CallSamples : CallSizes)
+		{
+			double BaseRate = 0;
+
+			for(int Threads = 0; Threads <= MaxThreads; Threads++)
+			{
+				CRun Run;
+
+				if(!DecodeFile(Wv, Wvc, (Flags & ~OPEN_THREADS_MASK) | (Threads << OPEN_THREADS_SHFT), CallSamples, MinSeconds, false, OUTPUT_INT32, Run))
+				{
+					std::fprintf(stderr, "can't open %s with %d threads\n", Files[f].c_str(), Threads);
+					Failures++;
+					continue;
+				}
+
+				// efficiency is the speedup per thread, counting the calling thread
+
+				double Rate = Run.m_Stats.m_Seconds > 0 ? Run.m_Stats.m_Samples / Run.m_Stats.m_Seconds : 0;
+				if(!Threads)
+					BaseRate = Rate;
+				double Speedup = BaseRate > 0 ? Rate / BaseRate : 0;
+
+				std::printf("%s\n        {", First ? "" : ",");
+				std::printf("\"threads\": %d, \"samples_per_call\": %d, ", Threads, CallSamples);
+				std::printf("\"msamples_per_sec\": %.3f, \"speedup\": %.3f, \"efficiency\": %.3f, ", Rate / 1e6, Speedup, Speedup / (Threads + 1));
+				std::printf("\"cpu_utilization\": %.3f, ", Run.m_WallSeconds > 0 ? Run.m_CpuSeconds / Run.m_WallSeconds : 0);
+				std::printf("\"voluntary_switches\": %.1f, \"involuntary_switches\": %.1f, ",
+					(double)Run.m_VoluntarySwitches / Run.m_Iterations, (double)Run.m_InvoluntarySwitches / Run.m_Iterations);
+				std::printf("\"iterations\": %d, \"errors\": %d}", Run.m_Iterations, Run.m_Errors);
+				First = false;
+
+				Failures += Run.m_Errors != 0;
+			}
+		}
+
+		std::printf("\n      ]\n    }");
+	}
+
+	std::printf("\n  ],\n  \"failures\": %d\n}\n", Failures);
+	return Failures ? 1 : 0;
+}
+
+int main(int argc, char **argv)
+{
+	int Threads = -1, CallSamples = 4096, Flags = OPEN_WVC | OPEN_DSD_NATIVE;
+	double MinSeconds = 1.0;
+	bool Scaling = false, Counters = false;
+	int Output = OUTPUT_INT32;
+	std::vector<std::string> Files;
+
+	for(int i = 1; i < argc; i++)
+	{
+		if(!std::strcmp(argv[i], "-t") && i + 1 < argc)
+			Threads = std::min(std::max(std::atoi(argv[++i]), 0), 15);
+		else if(!std::strcmp(argv[i], "-n") && i + 1 < argc)
+			CallSamples = std::max(1, std::atoi(argv[++i]));
+		else if(!std::strcmp(argv[i], "-s") && i + 1 < argc)
+			MinSeconds = std::atof(argv[++i]);
+		else if(!std::strcmp(argv[i], "-p"))
+			Flags = (Flags & ~OPEN_DSD_NATIVE) | OPEN_DSD_AS_PCM;
+		else if(!std::strcmp(argv[i], "-w"))
+			Flags |= OPEN_WVC_THREAD;
+		else if(!std::strcmp(argv[i], "-S"))
+			Scaling = true;
+		else if(!std::strcmp(argv[i], "-c"))
+			Counters = true;
+		else if(!std::strcmp(argv[i], "-16"))
+			Output = OUTPUT_INT16;
+		else if(!std::strcmp(argv[i], "-f"))
+			Output = OUTPUT_FLOAT;
+		else if(!std::strcmp(argv[i], "-d"))
+			Output = OUTPUT_DSD;
+		else
+			Files.push_back(argv[i]);
+	}
+
+	if(Files.empty())
+	{
+		std::fprintf(stderr, "usage: %s [-t threads] [-n samples_per_call] [-s min_seconds] [-p] [-w] [-S] [-c] [-16 | -f | -d] file.wv...\n", argv[0]);
+		return 1;
+	}
+
+	if(Scaling)
+		return RunScaling(Files, Flags, Threads < 0 ? 15 : Threads, MinSeconds);
+
+	Threads = std::max(Threads, 0);
+	Flags |= (Threads << OPEN_THREADS_SHFT) & OPEN_THREADS_MASK;
+
+	if(Counters)
+	{
+		CCounters Probe(false);
+		if(!Probe.AnyAvailable())
+		{
+			std::fprintf(stderr, "hardware performance counters are not available (see /proc/sys/kernel/perf_event_paranoid)\n");
+			Counters = false;
+		}
+	}
+
+	std::map<std::string, CStats> ModeStats;
+	int Failures = 0, FilesPrinted = 0;
+
+	std::printf("{\n  \"library\": %s,\n", JsonString(WavpackGetLibraryVersionString()).c_str());
+	std::printf("  \"threads\": %d,\n  \"samples_per_call\": %d,\n  \"min_seconds\": %.3f,\n", Threads, CallSamples, MinSeconds);
+	std::printf("  \"output\": \"%s\",\n", s_apOutputNames[Output]);
+	std::printf("  \"files\": [");
+
+	for(size_t f = 0; f < Files.size(); f++)
+	{
+		std::vector<unsigned char> Wv, Wvc;
+		char aError[80] = "";
+
+		if(!ReadFile(Files[f], Wv))
+		{
+			std::fprintf(stderr, "can't read %s\n", Files[f].c_str());
+			Failures++;
+			continue;
+		}
+
+		ReadFile(Files[f] + "c", Wvc);
+
+		WavpackContext *pContext = WavpackOpenMemoryInput(Wv.data(), Wv.size(), Wvc.empty() ? nullptr : Wvc.data(), Wvc.size(), aError, Flags, 0);
+		if(!pContext)
+		{
+			std::fprintf(stderr, "can't open %s: %s\n", Files[f].c_str(), aError);
+			Failures++;
+			continue;
+		}
+
+		const int Mode = WavpackGetMode(pContext);
+		const int NumChannels = WavpackGetNumChannels(pContext);
+		const int64_t NumSamples = WavpackGetNumSamples64(pContext);
+		const bool Dsd = (WavpackGetQualifyMode(pContext) & QMODE_DSD_AUDIO) != 0;
+		std::vector<std::string> Modes;
+
+		if(Dsd)
+			Modes.push_back("dsd");
+		else if(Mode & MODE_FLOAT)
+			Modes.push_back("float");
+		if(Mode & MODE_HYBRID)
+			Modes.push_back((Mode & MODE_WVC) ? "hybrid_wvc" : "hybrid");
+		else
+			Modes.push_back("lossless");
+		if(NumChannels > 2)
+			Modes.push_back("multichannel");
+
+		const int BytesPerSample = WavpackGetBytesPerSample(pContext);
+		WavpackCloseFile(pContext);
+
+		if(Output == OUTPUT_INT16 && (BytesPerSample > 2 || (Mode & MODE_FLOAT)))
+		{
+			std::fprintf(stderr, "%s has more than 16 bits per sample, skipping\n", Files[f].c_str());
+			continue;
+		}
+
+		if(Output == OUTPUT_FLOAT && Dsd && !(Flags & OPEN_DSD_AS_PCM))
+		{
+			std::fprintf(stderr, "%s is native DSD, skipping\n", Files[f].c_str());
+			continue;
+		}
+
+		if(Output == OUTPUT_DSD && (!Dsd || (Flags & OPEN_DSD_AS_PCM)))
+		{
+			std::fprintf(stderr, "%s is not native DSD, skipping\n", Files[f].c_str());
+			continue;
+		}
+
+		CRun Run;
+		if(!DecodeFile(Wv, Wvc, Flags, CallSamples, MinSeconds, Counters, Output, Run))
+		{
+			std::fprintf(stderr, "can't open %s\n", Files[f].c_str());
+			Failures++;
+			continue;
+		}
+
+		std::printf("%s\n    {\n", FilesPrinted++ ? "," : "");
+		std::printf("      \"file\": %s,\n", JsonString(Files[f]).c_str());
+		std::printf("      \"modes\": [");
+		for(size_t m = 0; m < Modes.size(); m++)
+			std::printf("%s%s", m ? ", " : "", JsonString(Modes[m]).c_str());
+		std::printf("],\n");
+		std::printf("      \"channels\": %d,\n      \"frames\": %lld,\n", NumChannels, (long long)NumSamples);
+		std::printf("      \"bytes\": %lld,\n", (long long)(Wv.size() + ((Mode & MODE_WVC) ? Wvc.size() : 0)));
+		std::printf("      \"iterations\": %d,\n      \"errors\": %d,\n", Run.m_Iterations, Run.m_Errors);
+		std::printf("      \"open_us\": %.3f,\n", Run.m_OpenSeconds * 1e6 / Run.m_Iterations);
+		if(Counters)
+		{
+			std::printf("      \"counters\": ");
+			PrintCounters(Run.m_aCounters, Run.m_aCountersAvailable, Run.m_Stats.m_Samples);
+			std::printf(",\n");
+		}
+		if(Run.m_HaveProfile)
+		{
+			// per-stage counts are relative to all the samples decoded, so they add up to the file's
+
+			std::printf("      \"stages\": {");
+			for(int i = 0; i < WP_PROFILE_STAGES; i++)
+			{
+				std::printf("%s\n        %s: {\"seconds\": %.6f, \"calls\": %llu", i ? "," : "", JsonString(s_apStageNames[i]).c_str(),
+					Run.m_aStageSeconds[i], (unsigned long long)Run.m_aStageCalls[i]);
+				if(Counters)
+				{
+					std::printf(", \"counters\": ");
+					PrintCounters(Run.m_aaStageCounters[i], Run.m_aCountersAvailable, Run.m_Stats.m_Samples);
+				}
+				std::printf("}");
+			}
+			std::printf("\n      },\n");
+		}
+		Run.m_Stats.Print("      ");
+		std::printf("\n    }");
+
+		Failures += Run.m_Errors != 0;
+
+		for(const auto &ModeName : Modes)
+			ModeStats[ModeName].Add(Run.m_Stats);
+	}
+
+	std::printf("\n  ],\n  \"modes\": {");
+
+	bool First = true;
+	for(auto &Entry : ModeStats)
+	{
+		std::printf("%s\n    %s: {\n", First ? "" : ",", JsonString(Entry.first).c_str());
+		std::printf("      \"files\": %d,\n", Entry.second.m_Files);
+		Entry.second.Print("      ");
+		std::printf("\n    }");
+		First = false;
+	}
+
+	std::printf("\n  },\n  \"failures\": %d\n}\n", Failures);
+	return Failures ? 1 : 0;
+}
@@ -0,0 +1,1494 @@
+////////////////////////////////////////////////////////////////////////////
+//                           **** WAVPACK ****                            //
+//                  Hybrid Lossless Wavefile Compressor                   //
+//                Copyright (c) 1998 - 2024 David Bryant.                 //
+//                          All Rights Reserved.                          //
+//      Distributed under the BSD Software License (see license.txt)      //
+////////////////////////////////////////////////////////////////////////////
+
+// encoder.c
+
+// This is a small WavPack encoder that exists only to generate test files
+// (see gencorpus.c); it is not part of the library. It writes valid WavPack
+// 4.0 and 5.0 blocks for all the kinds of audio the decoder handles: 1 to 32
+// bit integer and 32-bit float PCM (lossless, or hybrid with or without a
+// correction file), any number of channels, and DSD audio in all three of its
+// coding modes. It makes no attempt to compress well: the decorrelation terms
+// are fixed, there's no noise shaping or other hybrid refinements and the DSD
+// "fast" probability tables are simple per-block histograms. Every encoding
+// step is the exact reverse of the corresponding decoding step and the
+// encoder state is quantized at the start of each block exactly like it is
+// stored in the metadata, so the decoder reconstructs the original samples
+// (or, for lossy hybrid, the encoder's idea of the decoded samples) exactly.
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "../wavpack_local.h"
+#include "encoder.h"
+
+#define PCM_STREAM_VERSION  0x407
+#define DSD_STREAM_VERSION  0x410
+
+#define MAX_BLOCK_SAMPLES   196607      // the largest block read_next_header() accepts
+#define DSD_MULTIPLIER_LOG  3           // DSD rate is 8 x the header rate (e.g. 44100 x 8 bytes for DSD64)
+
+// DSD "high" mode parameters; the rest of these are the same as in unpack_dsd.c
+
+#define DSD_RATE_I  24
+#define DSD_RATE_S  20
+
+#define PTABLE_BITS 8
+#define PTABLE_BINS (1<<PTABLE_BITS)
+#define PTABLE_MASK (PTABLE_BINS-1)
+
+#define UP   0x010000fe
+#define DOWN 0x00010000
+#define DECAY 8
+
+#define PRECISION 20
+#define VALUE_ONE (1 << PRECISION)
+#define PRECISION_USE 12
+
+#define DSD_BYTE_READY(low,high) (!(((low) ^ (high)) & 0xff000000))
+
+// default decorrelation terms (in encoding order); hybrid and mono can't use negative terms
+
+static const signed char default_stereo_terms [] = { 18, 18, 2, 3, -2, 0 };
+static const signed char default_terms [] = { 18, 18, 2, 3, 0 };
+
+typedef struct {
+    unsigned char *data;
+    size_t size, allocated;
+    int failed;
+} ByteBuffer;
+
+typedef struct {
+    ByteBuffer bytes;
+    uint64_t sr;
+    int bc;
+} BitWriter;
+
+// The bits of one encoded sample, held until it's known how many "ones" are
+// sent ahead of it (which depends on the next sample).
+
+typedef struct {
+    uint64_t bits;
+    int count;
+} CodeBits;
+
+typedef struct {
+    WavpackStream *wps;                 // encoder state, in the same form as the decoder's
+    int channels;
+    BitWriter wvbits, wvcbits, wvxbits;
+    int32_t *values, *temp;             // this stream's samples for one block, and a working copy
+    int pending;                        // a sample's code is waiting to be written
+    uint32_t pend_ones;
+    CodeBits pend_code;
+    DSDfilters filters [2];             // "high" mode DSD filter state, carried between blocks
+} EncoderStream;
+
+struct WavpackEncoder {
+    EncoderConfig config;
+    FILE *wv, *wvc;
+    int64_t total_samples, sample_index;
+    int num_streams, version, shift, srate_index;
+    uint32_t base_flags;
+    EncoderStream *streams;
+    int32_t *input;
+    uint32_t input_samples;
+    ByteBuffer block, block2;
+    int error;
+};
+
+/////////////////////////////// output buffers ///////////////////////////////
+
+static void put_byte (ByteBuffer *bb, int byte)
+{
+    if (bb->size == bb->allocated) {
+        size_t allocated = bb->allocated ? bb->allocated * 2 : 65536;
+        unsigned char *data = (unsigned char *)realloc (bb->data, allocated);
+
+        if (!data) {
+            bb->failed = TRUE;
+            return;
+        }
+
+        bb->data = data;
+        bb->allocated = allocated;
+    }
+
+    bb->data [bb->size++] = (unsigned char) byte;
+}
+
+static void put_bytes (ByteBuffer *bb, const unsigned char *data, size_t count)
+{
+    while (count--)
+        put_byte (bb, *data++);
+}
+
+static void put_short (ByteBuffer *bb, int value)
+{
+    put_byte (bb, value);
+    put_byte (bb, value >> 8);
+}
+
+static void put_long (ByteBuffer *bb, uint32_t value)
+{
+    put_short (bb, value);
+    put_short (bb, value >> 16);
+}
+
+static void set_long (unsigned char *ptr, uint32_t value)
+{
+    ptr [0] = (unsigned char) value;
+    ptr [1] = (unsigned char) (value >> 8);
+    ptr [2] = (unsigned char) (value >> 16);
+    ptr [3] = (unsigned char) (value >> 24);
+}
+
+// Append a metadata sub-block with the specified id and data to a block
+
+static void put_metadata (ByteBuffer *block, int id, const unsigned char *data, size_t byte_length)
+{
+    size_t word_length = (byte_length + 1) >> 1;
+
+    if (byte_length & 1)
+        id |= ID_ODD_SIZE;
+
+    if (word_length > 255)
+        id |= ID_LARGE;
+
+    put_byte (block, id);
+    put_byte (block, (int) word_length);
+
+    if (id & ID_LARGE) {
+        put_byte (block, (int) (word_length >> 8));
+        put_byte (block, (int) (word_length >> 16));
+    }
+
+    put_bytes (block, data, byte_length);
+
+    if (byte_length & 1)
+        put_byte (block, 0);
+}
+
+// Write bits to a bitstream, LSB first like the decoder reads them (up to 32 at a time)
+
+static void put_bits (BitWriter *bw, uint32_t value, int nbits)
+{
+    if (nbits < 32)
+        value &= (1U << nbits) - 1;
+
+    bw->sr |= (uint64_t) value << bw->bc;
+
+    for (bw->bc += nbits; bw->bc >= 8; bw->bc -= 8) {
+        put_byte (&bw->bytes, (unsigned char) bw->sr);
+        bw->sr >>= 8;
+    }
+}
+
+// Write out any partial byte and pad the bitstream to the non-zero, even
+// length that the decoder requires
+
+static void flush_bits (BitWriter *bw)
+{
+    if (bw->bc)
+        put_byte (&bw->bytes, (unsigned char) bw->sr);
+
+    bw->sr = bw->bc = 0;
+
+    while (!bw->bytes.failed && (bw->bytes.size < 2 || (bw->bytes.size & 1)))
+        put_byte (&bw->bytes, 0);
+}
+
+static void add_bits (CodeBits *cb, uint32_t value, int nbits)
+{
+    if (nbits < 32)
+        value &= (1U << nbits) - 1;
+
+    cb->bits |= (uint64_t) value << cb->count;
+    cb->count += nbits;
+}
+
+static void put_code_bits (BitWriter *bw, CodeBits *cb)
+{
+    if (cb->count > 32) {
+        put_bits (bw, (uint32_t) cb->bits, 32);
+        put_bits (bw, (uint32_t) (cb->bits >> 32), cb->count - 32);
+    }
+    else
+        put_bits (bw, (uint32_t) cb->bits, cb->count);
+
+    cb->bits = cb->count = 0;
+}
+
+//////////////////////////////// entropy coding //////////////////////////////
+
+// Write a value with the Elias gamma-like code used for zero runs (and large
+// "ones" counts): the number of significant bits as 1s terminated with a 0,
+// followed by the significant bits below the top one
+
+static void put_elias (BitWriter *bw, uint32_t value)
+{
+    if (value < 2)
+        put_bits (bw, value, value + 1);
+    else {
+        int cbits = count_bits (value);
+
+        put_bits (bw, 0xffffffff >> (32 - cbits), cbits);
+        put_bits (bw, 0, 1);
+        put_bits (bw, value, cbits - 1);
+    }
+}
+
+// Write the count of 1s (terminated with a 0) that precedes each sample,
+// escaping long runs like the decoder expects
+
+static void put_unary (BitWriter *bw, uint32_t count)
+{
+    if (count < LIMIT_ONES)
+        put_bits (bw, (1U << count) - 1, count + 1);
+    else {
+        put_bits (bw, (1U << LIMIT_ONES) - 1, LIMIT_ONES + 1);
+        put_elias (bw, count - LIMIT_ONES);
+    }
+}
+
+// Add a value from 0 to "maxcode" with the truncated binary code that
+// read_code() reads
+
+static void add_code (CodeBits *cb, uint32_t value, uint32_t maxcode)
+{
+    uint32_t extras;
+    int bitcount;
+
+    if (maxcode < 2) {
+        if (maxcode)
+            add_bits (cb, value, 1);
+
+        return;
+    }
+
+    bitcount = count_bits (maxcode);
+    extras = (1U << bitcount) - maxcode - 1;
+
+    if (value < extras)
+        add_bits (cb, value, bitcount - 1);
+    else {
+        value += extras;
+        add_bits (cb, value >> 1, bitcount - 1);
+        add_bits (cb, value & 1, 1);
+    }
+}
+
+// Encode one (decorrelated) sample of the specified channel and return the
+// value the decoder will get for it, which in lossy hybrid mode is only an
+// approximation. This is the reverse of get_word() and get_words_lossless().
+// The decoder reads the number of "ones" of each sample as a unary code ahead
+// of it, but that code also says whether the next sample has at least one
+// "one" (so it's "holding" a one or a zero), so each sample's code is held
+// until the next sample is known.
+
+static int32_t encode_word (EncoderStream *es, int32_t value, int chan)
+{
+    WavpackStream *wps = es->wps;
+    struct entropy_data *c = wps->w.c + chan;
+    uint32_t avalue = value < 0 ? ~value : value, ones_count, low, high, mid;
+    CodeBits code = { 0, 0 };
+
+    if ((wps->wphdr.flags & HYBRID_FLAG) && !chan)
+        update_error_limit (wps);
+
+    if (avalue < GET_MED (0)) {
+        ones_count = low = 0;
+        high = GET_MED (0) - 1;
+        DEC_MED0 ();
+    }
+    else {
+        low = GET_MED (0);
+        INC_MED0 ();
+
+        if (avalue - low < GET_MED (1)) {
+            ones_count = 1;
+            high = low + GET_MED (1) - 1;
+            DEC_MED1 ();
+        }
+        else {
+            low += GET_MED (1);
+            INC_MED1 ();
+
+            if (avalue - low < GET_MED (2)) {
+                ones_count = 2;
+                high = low + GET_MED (2) - 1;
+                DEC_MED2 ();
+            }
+            else {
+                ones_count = 2 + (avalue - low) / GET_MED (2);
+                low += (ones_count - 2) * GET_MED (2);
+                high = low + GET_MED (2) - 1;
+                INC_MED2 ();
+            }
+        }
+    }
+
+    if (!c->error_limit) {
+        add_code (&code, avalue - low, high - low);
+        mid = avalue;
+    }
+    else {
+        mid = (high + low + 1) >> 1;
+
+        while (high - low > c->error_limit)
+            if (avalue >= mid) {
+                add_bits (&code, 1, 1);
+                mid = (high + (low = mid) + 1) >> 1;
+            }
+            else {
+                add_bits (&code, 0, 1);
+                mid = ((high = mid - 1) + low + 1) >> 1;
+            }
+
+        if (es->wvcbits.bytes.data) {
+            CodeBits correction = { 0, 0 };
+
+            add_code (&correction, avalue - low, high - low);
+            put_code_bits (&es->wvcbits, &correction);
+        }
+    }
+
+    add_bits (&code, value < 0, 1);
+
+    if (wps->wphdr.flags & HYBRID_BITRATE) {
+        c->slow_level -= (c->slow_level + SLO) >> SLS;
+        c->slow_level += wp_log2 (mid);
+    }
+
+    if (!es->pending) {
+        es->pending = TRUE;
+        es->pend_ones = ones_count;
+        es->pend_code = code;
+    }
+    else if (!ones_count) {
+        put_unary (&es->wvbits, es->pend_ones * 2);
+        put_code_bits (&es->wvbits, &es->pend_code);
+        put_code_bits (&es->wvbits, &code);
+        es->pending = FALSE;
+    }
+    else {
+        put_unary (&es->wvbits, es->pend_ones * 2 + 1);
+        put_code_bits (&es->wvbits, &es->pend_code);
+        es->pend_ones = ones_count - 1;
+        es->pend_code = code;
+    }
+
+    return value < 0 ? ~mid : mid;
+}
+
+// Write the last held sample at the end of a block
+
+static void flush_pending (EncoderStream *es)
+{
+    if (es->pending) {
+        put_unary (&es->wvbits, es->pend_ones * 2);
+        put_code_bits (&es->wvbits, &es->pend_code);
+        es->pending = FALSE;
+    }
+}
+
+// Is the next sample checked for being the start of a run of zeros? This is
+// only done when both channels' medians are tiny and no sample is held.
+
+static int zero_check (EncoderStream *es)
+{
+    return !es->pending && es->wps->w.c [0].median [0] < 2 && es->wps->w.c [1].median [0] < 2;
+}
+
+// Entropy code a block of lossless residuals (interleaved for stereo)
+
+static void encode_words_lossless (EncoderStream *es, const int32_t *buffer, uint32_t count)
+{
+    WavpackStream *wps = es->wps;
+    uint32_t i, j;
+
+    for (i = 0; i < count; ++i) {
+        if (zero_check (es)) {
+            if (wps->w.zeros_acc) {
+                if (--wps->w.zeros_acc)
+                    continue;
+            }
+            else {
+                for (j = i; j < count && !buffer [j]; ++j);
+
+                put_elias (&es->wvbits, wps->w.zeros_acc = j - i);
+
+                if (wps->w.zeros_acc) {
+                    CLEARA (wps->w.c [0].median);
+                    CLEARA (wps->w.c [1].median);
+                    continue;
+                }
+            }
+        }
+
+        encode_word (es, buffer [i], es->channels == 2 ? (i & 1) : 0);
+    }
+
+    flush_pending (es);
+}
+
+///////////////////////////////// decorrelation //////////////////////////////
+
+// Put the history of a pass with a term of 1 to 8 back in order (with the
+// oldest sample first) after "m" samples have been processed, which is the
+// form the next block's metadata stores it in
+
+static void normalize_history (struct decorr_pass *dpp, int m)
+{
+    if (m && dpp->term > 0 && dpp->term <= MAX_TERM) {
+        int32_t temp_A [MAX_TERM], temp_B [MAX_TERM];
+        int k;
+
+        memcpy (temp_A, dpp->samples_A, sizeof (dpp->samples_A));
+        memcpy (temp_B, dpp->samples_B, sizeof (dpp->samples_B));
+
+        for (k = 0; k < MAX_TERM; k++) {
+            dpp->samples_A [k] = temp_A [m];
+            dpp->samples_B [k] = temp_B [m];
+            m = (m + 1) & (MAX_TERM - 1);
+        }
+    }
+}
+
+// Run one decorrelation pass in the encoding direction over a whole block,
+// replacing the samples with the residuals. This is the reverse of
+// decorr_stereo_pass() and decorr_mono_pass() in unpack.c.
+
+static void encode_pass (struct decorr_pass *dpp, int32_t *buffer, uint32_t sample_count, int channels)
+{
+    int32_t *bptr, *eptr = buffer + sample_count * channels;
+    int m = 0, k = dpp->term & (MAX_TERM - 1), ch;
+
+    if (dpp->term > MAX_TERM) {
+        for (bptr = buffer; bptr < eptr; bptr += channels)
+            for (ch = 0; ch < channels; ++ch) {
+                int32_t *samples = ch ? dpp->samples_B : dpp->samples_A, *weight = ch ? &dpp->weight_B : &dpp->weight_A;
+                int32_t sam = (dpp->term & 1) ? 2 * samples [0] - samples [1] : (3 * samples [0] - samples [1]) >> 1;
+
+                samples [1] = samples [0];
+                samples [0] = bptr [ch];
+                bptr [ch] -= apply_weight (*weight, sam);
+                update_weight (*weight, dpp->delta, sam, bptr [ch]);
+            }
+    }
+    else if (dpp->term > 0) {
+        for (bptr = buffer; bptr < eptr; bptr += channels) {
+            for (ch = 0; ch < channels; ++ch) {
+                int32_t *samples = ch ? dpp->samples_B : dpp->samples_A, *weight = ch ? &dpp->weight_B : &dpp->weight_A;
+                int32_t sam = samples [m];
+
+                samples [k] = bptr [ch];
+                bptr [ch] -= apply_weight (*weight, sam);
+                update_weight (*weight, dpp->delta, sam, bptr [ch]);
+            }
+
+            m = (m + 1) & (MAX_TERM - 1);
+            k = (k + 1) & (MAX_TERM - 1);
+        }
+
+        normalize_history (dpp, m);
+    }
+    else
+        for (bptr = buffer; bptr < eptr; bptr += 2) {
+            int32_t left = bptr [0], right = bptr [1];
+
+            if (dpp->term == -1) {
+                bptr [0] = left - apply_weight (dpp->weight_A, dpp->samples_A [0]);
+                update_weight_clip (dpp->weight_A, dpp->delta, dpp->samples_A [0], bptr [0]);
+                bptr [1] = right - apply_weight (dpp->weight_B, left);
+                update_weight_clip (dpp->weight_B, dpp->delta, left, bptr [1]);
+                dpp->samples_A [0] = right;
+            }
+            else if (dpp->term == -2) {
+                bptr [1] = right - apply_weight (dpp->weight_B, dpp->samples_B [0]);
+                update_weight_clip (dpp->weight_B, dpp->delta, dpp->samples_B [0], bptr [1]);
+                bptr [0] = left - apply_weight (dpp->weight_A, right);
+                update_weight_clip (dpp->weight_A, dpp->delta, right, bptr [0]);
+                dpp->samples_B [0] = left;
+            }
+            else {
+                bptr [0] = left - apply_weight (dpp->weight_A, dpp->samples_A [0]);
+                update_weight_clip (dpp->weight_A, dpp->delta, dpp->samples_A [0], bptr [0]);
+                bptr [1] = right - apply_weight (dpp->weight_B, dpp->samples_B [0]);
+                update_weight_clip (dpp->weight_B, dpp->delta, dpp->samples_B [0], bptr [1]);
+                dpp->samples_B [0] = left;
+                dpp->samples_A [0] = right;
+            }
+        }
+}
+
+// For hybrid mode, the decorrelation has to track the values the decoder
+// will see, so it's done one sample at a time. This returns the residual of
+// the given sample of the specified channel with all the passes applied (in
+// encoding order), saving each pass's prediction for update_sample().
+
+static int32_t predict_sample (struct decorr_pass *passes, int num_terms, int m, int chan, int32_t value, int32_t *sams)
+{
+    while (num_terms--) {
+        struct decorr_pass *dpp = passes + num_terms;
+        int32_t *samples = chan ? dpp->samples_B : dpp->samples_A, weight = chan ? dpp->weight_B : dpp->weight_A;
+
+        if (dpp->term > MAX_TERM)
+            sams [num_terms] = (dpp->term & 1) ? 2 * samples [0] - samples [1] : (3 * samples [0] - samples [1]) >> 1;
+        else
+            sams [num_terms] = samples [m];
+
+        value -= apply_weight (weight, sams [num_terms]);
+    }
+
+    return value;
+}
+
+// Run the passes in decoding order on the residual the decoder will get,
+// updating them exactly like unpack_samples() does, and return the sample
+// the decoder will produce
+
+static int32_t update_sample (struct decorr_pass *passes, int num_terms, int m, int chan, int32_t residual, const int32_t *sams)
+{
+    int i;
+
+    for (i = 0; i < num_terms; ++i) {
+        struct decorr_pass *dpp = passes + i;
+        int32_t *samples = chan ? dpp->samples_B : dpp->samples_A, *weight = chan ? &dpp->weight_B : &dpp->weight_A;
+        int32_t value = apply_weight (*weight, sams [i]) + residual;
+
+        update_weight (*weight, dpp->delta, sams [i], residual);
+
+        if (dpp->term > MAX_TERM) {
+            samples [1] = samples [0];
+            samples [0] = value;
+        }
+        else
+            samples [(m + dpp->term) & (MAX_TERM - 1)] = value;
+
+        residual = value;
+    }
+
+    return residual;
+}
+
+// Count the zero residuals starting at the specified sample and channel,
+// simulating the decorrelation on a copy of the passes
+
+static uint32_t count_zeros (EncoderStream *es, const int32_t *values, uint32_t sample_count, uint32_t index, int chan, int m)
+{
+    struct decorr_pass passes [MAX_NTERMS];
+    int num_terms = es->wps->num_terms;
+    int32_t sams [MAX_NTERMS];
+    uint32_t zeros = 0;
+
+    memcpy (passes, es->wps->decorr_passes, sizeof (passes));
+
+    while (index < sample_count && !predict_sample (passes, num_terms, m, chan, values [index * es->channels + chan], sams)) {
+        update_sample (passes, num_terms, m, chan, 0, sams);
+        zeros++;
+
+        if (++chan == es->channels) {
+            chan = 0;
+            index++;
+            m = (m + 1) & (MAX_TERM - 1);
+        }
+    }
+
+    return zeros;
+}
+
+// Encode a hybrid block; "values" are the (joint stereo) input samples and
+// the lossy decoder's output for them is stored in "lossy"
+
+static void encode_hybrid (EncoderStream *es, const int32_t *values, int32_t *lossy, uint32_t sample_count)
+{
+    WavpackStream *wps = es->wps;
+    int32_t sams [MAX_NTERMS];
+    int m = 0, chan, i;
+    uint32_t index;
+
+    for (index = 0; index < sample_count; ++index) {
+        for (chan = 0; chan < es->channels; ++chan) {
+            int32_t residual = predict_sample (wps->decorr_passes, wps->num_terms, m, chan, values [index * es->channels + chan], sams);
+            struct entropy_data *c = wps->w.c + chan;
+
+            if (zero_check (es)) {
+                if (wps->w.zeros_acc) {
+                    if (--wps->w.zeros_acc) {
+                        c->slow_level -= (c->slow_level + SLO) >> SLS;
+                        lossy [index * es->channels + chan] = update_sample (wps->decorr_passes, wps->num_terms, m, chan, 0, sams);
+                        continue;
+                    }
+                }
+                else {
+                    wps->w.zeros_acc = residual ? 0 : count_zeros (es, values, sample_count, index, chan, m);
+                    put_elias (&es->wvbits, wps->w.zeros_acc);
+
+                    if (wps->w.zeros_acc) {
+                        c->slow_level -= (c->slow_level + SLO) >> SLS;
+                        CLEARA (wps->w.c [0].median);
+                        CLEARA (wps->w.c [1].median);
+                        lossy [index * es->channels + chan] = update_sample (wps->decorr_passes, wps->num_terms, m, chan, 0, sams);
+                        continue;
+                    }
+                }
+            }
+
+            residual = encode_word (es, residual, chan);
+            lossy [index * es->channels + chan] = update_sample (wps->decorr_passes, wps->num_terms, m, chan, residual, sams);
+        }
+
+        m = (m + 1) & (MAX_TERM - 1);
+    }
+
+    flush_pending (es);
+
+    for (i = 0; i < wps->num_terms; ++i)
+        normalize_history (wps->decorr_passes + i, m);
+}
+
+////////////////////////////////// metadata //////////////////////////////////
+
+static void put_log (unsigned char **byteptr, int32_t *value)
+{
+    int log = wp_log2s (*value);
+
+    *value = wp_exp2s (log);
+    *(*byteptr)++ = (unsigned char) log;
+    *(*byteptr)++ = (unsigned char) (log >> 8);
+}
+
+// Write the decorrelation terms, weights and history to the block, quantizing
+// the encoder's copies the same way the decoder will restore them
+
+static void put_decorr_metadata (ByteBuffer *block, WavpackStream *wps)
+{
+    unsigned char terms [MAX_NTERMS], weights [MAX_NTERMS * 2], samples [MAX_NTERMS * MAX_TERM * 4];
+    unsigned char *tp = terms, *wp = weights, *sp = samples;
+    int stereo = !(wps->wphdr.flags & MONO_DATA), i;
+    struct decorr_pass *dpp;
+
+    for (dpp = wps->decorr_passes + wps->num_terms; dpp-- > wps->decorr_passes;) {
+        int history = dpp->term > MAX_TERM ? 2 : (dpp->term < 0 ? 1 : dpp->term);
+
+        *tp++ = ((dpp->term + 5) & 0x1f) | ((dpp->delta << 5) & 0xe0);
+        dpp->weight_A = restore_weight (*wp++ = store_weight (dpp->weight_A));
+
+        if (stereo)
+            dpp->weight_B = restore_weight (*wp++ = store_weight (dpp->weight_B));
+
+        if (dpp->term > MAX_TERM) {
+            put_log (&sp, dpp->samples_A);
+            put_log (&sp, dpp->samples_A + 1);
+
+            if (stereo) {
+                put_log (&sp, dpp->samples_B);
+                put_log (&sp, dpp->samples_B + 1);
+            }
+        }
+        else if (dpp->term < 0) {
+            put_log (&sp, dpp->samples_A);
+            put_log (&sp, dpp->samples_B);
+        }
+        else
+            for (i = 0; i < dpp->term; ++i) {
+                put_log (&sp, dpp->samples_A + i);
+
+                if (stereo)
+                    put_log (&sp, dpp->samples_B + i);
+            }
+
+        for (i = history; i < MAX_TERM; ++i)
+            dpp->samples_A [i] = dpp->samples_B [i] = 0;
+    }
+
+    put_metadata (block, ID_DECORR_TERMS, terms, tp - terms);
+    put_metadata (block, ID_DECORR_WEIGHTS, weights, wp - weights);
+    put_metadata (block, ID_DECORR_SAMPLES, samples, sp - samples);
+}
+
+// Write the entropy coder's medians (and the hybrid parameters) to the block
+// and reset the rest of the entropy coder state like unpack_init() does
+
+static void put_entropy_metadata (ByteBuffer *block, WavpackStream *wps, int hybrid_bitrate)
+{
+    int channels = (wps->wphdr.flags & MONO_DATA) ? 1 : 2, chan, i;
+    unsigned char medians [12], *mp = medians, profile [8], *pp = profile;
+    struct words_data w = wps->w;
+
+    CLEAR (wps->w);
+
+    for (chan = 0; chan < channels; ++chan)
+        for (i = 0; i < 3; ++i) {
+            int log = wp_log2 (w.c [chan].median [i]);
+
+            wps->w.c [chan].median [i] = wp_exp2s (log);
+            *mp++ = (unsigned char) log;
+            *mp++ = (unsigned char) (log >> 8);
+        }
+
+    put_metadata (block, ID_ENTROPY_VARS, medians, mp - medians);
+
+    if (wps->wphdr.flags & HYBRID_FLAG) {
+        for (chan = 0; chan < channels; ++chan) {
+            int log = wp_log2 (w.c [chan].slow_level);
+
+            wps->w.c [chan].slow_level = wp_exp2s (log);
+            *pp++ = (unsigned char) log;
+            *pp++ = (unsigned char) (log >> 8);
+        }
+
+        for (chan = 0; chan < channels; ++chan) {
+            wps->w.bitrate_acc [chan] = (uint32_t) hybrid_bitrate << 16;
+            *pp++ = (unsigned char) hybrid_bitrate;
+            *pp++ = (unsigned char) (hybrid_bitrate >> 8);
+        }
+
+        put_metadata (block, ID_HYBRID_PROFILE, profile, pp - profile);
+    }
+}
+
+// Write the metadata that describes the whole file, in the first block of
+// each set of streams
+
+static void put_config_metadata (WavpackEncoder *enc, ByteBuffer *block)
+{
+    uint32_t mask = enc->config.channel_mask;
+    int nch = enc->config.num_channels;
+    unsigned char data [8], *dp = data;
+
+    if (enc->config.version_five && !enc->sample_index) {
+        *dp++ = enc->config.dsd ? WP_FORMAT_DFF : WP_FORMAT_WAV;
+        *dp++ = enc->config.dsd ? QMODE_DSD_MSB_FIRST : 0;
+        put_metadata (block, ID_NEW_CONFIG_BLOCK, data, dp - data);
+        dp = data;
+    }
+
+    if (nch > 2 || mask != 0x5U - nch) {
+        if (enc->num_streams > OLD_MAX_STREAMS) {
+            *dp++ = (unsigned char) (nch - 1);
+            *dp++ = (unsigned char) (enc->num_streams - 1);
+            *dp++ = (((nch - 1) >> 8) & 0xf) | (((enc->num_streams - 1) >> 4) & 0xf0);
+            set_long (dp, mask);
+            dp += 4;
+        }
+        else
+            for (*dp++ = nch; mask; mask >>= 8)
+                *dp++ = (unsigned char) mask;
+
+        put_metadata (block, ID_CHANNEL_INFO, data, dp - data);
+        dp = data;
+    }
+
+    if (enc->srate_index == 15) {
+        int32_t rate = enc->config.dsd ? enc->config.sample_rate >> DSD_MULTIPLIER_LOG : enc->config.sample_rate;
+
+        set_long (dp, rate & 0x7fffffff);
+        put_metadata (block, ID_SAMPLE_RATE, data, (rate & 0x7f000000) ? 4 : 3);
+    }
+}
+
+//////////////////////////////////// PCM //////////////////////////////////////
+
+static uint32_t pcm_crc (const int32_t *values, uint32_t count, int channels)
+{
+    uint32_t crc = 0xffffffff, i;
+
+    if (channels == 2)
+        for (i = 0; i < count; i += 2)
+            crc += (crc << 3) + ((uint32_t) values [i] << 1) + values [i] + values [i + 1];
+    else
+        for (i = 0; i < count; ++i)
+            crc += (crc << 1) + values [i];
+
+    return crc;
+}
+
+static uint32_t max_magnitude (const int32_t *values, uint32_t count, uint32_t magnitude)
+{
+    while (count--) {
+        uint32_t avalue = *values < 0 ? -(uint32_t) *values : (uint32_t) *values;
+
+        if (avalue > magnitude)
+            magnitude = avalue;
+
+        values++;
+    }
+
+    return magnitude;
+}
+
+// Convert a stereo block to the form that the decoder's joint stereo step
+// (left += (right -= left >> 1)) turns back into the given samples
+
+static void joint_stereo (int32_t *buffer, uint32_t sample_count)
+{
+    while (sample_count--) {
+        int32_t left = buffer [0], right = buffer [1];
+
+        buffer [0] = left - right;
+        buffer [1] = right + (buffer [0] >> 1);
+        buffer += 2;
+    }
+}
+
+static void unjoint_stereo (int32_t *buffer, uint32_t sample_count)
+{
+    while (sample_count--) {
+        buffer [0] += (buffer [1] -= (buffer [0] >> 1));
+        buffer += 2;
+    }
+}
+
+// Encode one block of PCM audio for the specified stream, filling in the
+// rest of its flags and its CRC (and, for hybrid mode, the lossless CRC for
+// the correction block)
+
+static void encode_pcm_block (WavpackEncoder *enc, EncoderStream *es, uint32_t sample_count, uint32_t *flags, uint32_t *crc, uint32_t *crc2)
+{
+    uint32_t count = sample_count * es->channels, magnitude = 0, crc_x = 0xffffffff, i;
+    int32_t *values = es->values, *temp = es->temp;
+    WavpackStream *wps = es->wps;
+
+    // reduce the samples to the values that are actually stored
+
+    for (i = 0; i < count; ++i)
+        if (*flags & INT32_DATA) {
+            put_bits (&es->wvxbits, values [i], 8);
+            crc_x = crc_x * 9 + (values [i] & 0xffff) * 3 + ((values [i] >> 16) & 0xffff);
+            values [i] >>= 8;
+        }
+        else
+            values [i] >>= enc->shift;
+
+    *crc = *crc2 = pcm_crc (values, count, es->channels);
+    magnitude = max_magnitude (values, count, magnitude);
+    memcpy (temp, values, count * sizeof (int32_t));
+
+    if (*flags & JOINT_STEREO) {
+        joint_stereo (temp, sample_count);
+        magnitude = max_magnitude (temp, count, magnitude);
+    }
+
+    wps->wphdr.flags = *flags;
+    put_decorr_metadata (&enc->block, wps);
+    put_entropy_metadata (&enc->block, wps, enc->config.hybrid_bits * 256);
+
+    if (*flags & FLOAT_DATA) {
+        static const unsigned char float_info [4] = { 0, 0, 127, 127 };
+
+        put_metadata (&enc->block, ID_FLOAT_INFO, float_info, sizeof (float_info));
+    }
+    else if (*flags & INT32_DATA) {
+        static const unsigned char int32_info [4] = { 8, 0, 0, 0 };
+
+        put_metadata (&enc->block, ID_INT32_INFO, int32_info, sizeof (int32_info));
+    }
+
+    if (*flags & HYBRID_FLAG) {
+        encode_hybrid (es, temp, values, sample_count);
+
+        if (*flags & JOINT_STEREO)
+            unjoint_stereo (values, sample_count);
+
+        *crc = pcm_crc (values, count, es->channels);
+        magnitude = max_magnitude (values, count, magnitude);
+    }
+    else {
+        for (i = wps->num_terms; i--;)
+            encode_pass (wps->decorr_passes + i, temp, sample_count, es->channels);
+
+        encode_words_lossless (es, temp, count);
+    }
+
+    *flags |= (uint32_t) count_bits (magnitude) << MAG_LSB;
+
+    flush_bits (&es->wvbits);
+    put_metadata (&enc->block, ID_WV_BITSTREAM, es->wvbits.bytes.data, es->wvbits.bytes.size);
+    es->wvbits.bytes.size = 0;
+
+    if (*flags & INT32_DATA) {
+        unsigned char *data;
+
+        flush_bits (&es->wvxbits);
+
+        // the extra bitstream is preceded by its own CRC
+
+        if ((data = (unsigned char *)malloc (es->wvxbits.bytes.size + 4))) {
+            set_long (data, crc_x);
+            memcpy (data + 4, es->wvxbits.bytes.data, es->wvxbits.bytes.size);
+            put_metadata (&enc->block, ID_WVX_BITSTREAM, data, es->wvxbits.bytes.size + 4);
+            free (data);
+        }
+        else
+            enc->block.failed = TRUE;
+
+        es->wvxbits.bytes.size = 0;
+    }
+
+    if (es->wvcbits.bytes.data) {
+        flush_bits (&es->wvcbits);
+        put_metadata (&enc->block2, ID_WVC_BITSTREAM, es->wvcbits.bytes.data, es->wvcbits.bytes.size);
+        es->wvcbits.bytes.size = 0;
+    }
+}
+
+//////////////////////////////////// DSD //////////////////////////////////////
+
+// "fast" mode: each byte is range coded with a probability table chosen by
+// the low bits of the previous byte of the same channel
+
+static void encode_dsd_fast (ByteBuffer *out, const int32_t *values, uint32_t count, int stereo)
+{
+    int bins = 1 << MAX_HISTORY_BITS, mask = bins - 1, max_probability = 0, p0 = 0, p1 = 0, bi, i;
+    uint32_t (*counts) [256] = (uint32_t (*)[256])calloc (bins, sizeof (*counts));
+    uint32_t (*summed) [256] = (uint32_t (*)[256])calloc (bins, sizeof (*summed));
+    unsigned char (*probabilities) [256] = (unsigned char (*)[256])calloc (bins, sizeof (*probabilities));
+    uint32_t low = 0, high = 0xffffffff, n;
+    unsigned char *pp, *pend;
+
+    if (!counts || !summed || !probabilities) {
+        out->failed = TRUE;
+        free (counts);
+        free (summed);
+        free (probabilities);
+        return;
+    }
+
+    for (n = 0; n < count; ++n) {
+        int code = values [n] & 0xff;
+
+        counts [p0] [code]++;
+
+        if (stereo) {
+            p0 = p1;
+            p1 = code & mask;
+        }
+        else
+            p0 = code & mask;
+    }
+
+    // scale each context's histogram to probabilities of at least 1 (for the
+    // bytes that occur) that fit in its share of the decoder's lookup table
+
+    for (bi = 0; bi < bins; ++bi) {
+        uint32_t max_count = 0;
+        int limit, sum;
+
+        for (i = 0; i < 256; ++i)
+            if (counts [bi] [i] > max_count)
+                max_count = counts [bi] [i];
+
+        if (!max_count)
+            continue;
+
+        for (limit = 127;; --limit) {
+            for (sum = i = 0; i < 256; ++i) {
+                uint32_t probability = counts [bi] [i] ? (uint32_t) ((uint64_t) counts [bi] [i] * limit / max_count) : 0;
+
+                sum += probabilities [bi] [i] = (unsigned char) (counts [bi] [i] && !probability ? 1 : probability);
+            }
+
+            if (sum <= MAX_BYTES_PER_BIN)
+                break;
+        }
+
+        for (sum = i = 0; i < 256; ++i) {
+            summed [bi] [i] = sum += probabilities [bi] [i];
+
+            if (probabilities [bi] [i] > max_probability)
+                max_probability = probabilities [bi] [i];
+        }
+    }
+
+    // the table is run-length encoded, with codes above max_probability being runs of zeros
+
+    put_byte (out, MAX_HISTORY_BITS);
+    put_byte (out, max_probability);
+
+    for (pp = probabilities [0], pend = pp + bins * 256; pp < pend;)
+        if (*pp)
+            put_byte (out, *pp++);
+        else {
+            int zcount = 0;
+
+            while (pp < pend && !*pp && zcount < 255 - max_probability) {
+                zcount++;
+                pp++;
+            }
+
+            put_byte (out, max_probability + zcount);
+        }
+
+    put_byte (out, 0);
+
+    for (p0 = p1 = 0, n = 0; n < count; ++n) {
+        int code = values [n] & 0xff;
+        uint32_t mult = (high - low) / summed [p0] [255];
+
+        if (!mult) {
+            for (i = 4; i--;)
+                put_byte (out, low >> (i * 8));
+
+            low = 0;
+            high = 0xffffffff;
+            mult = high / summed [p0] [255];
+        }
+
+        if (code)
+            low += summed [p0] [code - 1] * mult;
+
+        high = low + probabilities [p0] [code] * mult - 1;
+
+        if (stereo) {
+            p0 = p1;
+            p1 = code & mask;
+        }
+        else
+            p0 = code & mask;
+
+        while (DSD_BYTE_READY (high, low)) {
+            put_byte (out, high >> 24);
+            high = (high << 8) | 0xff;
+            low <<= 8;
+        }
+    }
+
+    for (i = 4; i--;)
+        put_byte (out, low >> (i * 8));
+
+    free (counts);
+    free (summed);
+    free (probabilities);
+}
+
+// same as the decoder's version in unpack_dsd.c
+
+static void init_ptable (int32_t *table, int rate_i, int rate_s)
+{
+    int value = 0x808000, rate = rate_i << 8, c, i;
+
+    for (c = (rate + 128) >> 8; c--;)
+        value += (DOWN - value) >> DECAY;
+
+    for (i = 0; i < PTABLE_BINS/2; ++i) {
+        table [i] = value;
+        table [PTABLE_BINS-1-i] = 0x100ffff - value;
+
+        if (value > 0x010000) {
+            rate += (rate * rate_s + 128) >> 8;
+
+            for (c = (rate + 64) >> 7; c--;)
+                value += (DOWN - value) >> DECAY;
+        }
+    }
+}
+
+static int32_t clip_filter (int32_t value)
+{
+    value >>= PRECISION - 8;
+    return value < 0 ? 0 : (value > 255 ? 255 : value);
+}
+
+// "high" mode: each bit is coded with an adaptive probability selected by
+// the output of a model of the noise-shaping filter that created the DSD
+
+static void encode_dsd_high (ByteBuffer *out, DSDfilters *filters, const int32_t *values, uint32_t count, int stereo)
+{
+    int channels = stereo ? 2 : 1, ch, i;
+    uint32_t low = 0, high = 0xffffffff, n;
+    int32_t ptable [PTABLE_BINS];
+
+    init_ptable (ptable, DSD_RATE_I, DSD_RATE_S);
+    put_byte (out, DSD_RATE_I);
+    put_byte (out, DSD_RATE_S);
+
+    // the filter state is carried over from the previous block, but it's only stored with 8-bit precision
+
+    for (ch = 0; ch < channels; ++ch) {
+        DSDfilters *sp = filters + ch;
+
+        put_byte (out, sp->filter1 = clip_filter (sp->filter1));
+        put_byte (out, sp->filter2 = clip_filter (sp->filter2));
+        put_byte (out, sp->filter3 = clip_filter (sp->filter3));
+        put_byte (out, sp->filter4 = clip_filter (sp->filter4));
+        put_byte (out, sp->filter5 = clip_filter (sp->filter5));
+        sp->filter1 <<= PRECISION - 8;
+        sp->filter2 <<= PRECISION - 8;
+        sp->filter3 <<= PRECISION - 8;
+        sp->filter4 <<= PRECISION - 8;
+        sp->filter5 <<= PRECISION - 8;
+        sp->filter6 = 0;
+        sp->factor = sp->factor < -32768 ? -32768 : (sp->factor > 32767 ? 32767 : sp->factor);
+        put_short (out, sp->factor);
+    }
+
+    for (n = 0; n < count; n += channels) {
+        for (ch = 0; ch < channels; ++ch)
+            filters [ch].value = filters [ch].filter1 - filters [ch].filter5 + ((filters [ch].filter6 * filters [ch].factor) >> 2);
+
+        for (i = 8; i--;)
+            for (ch = 0; ch < channels; ++ch) {
+                DSDfilters *sp = filters + ch;
+                int32_t *pp = ptable + ((sp->value >> (PRECISION - PRECISION_USE)) & PTABLE_MASK);
+                uint32_t split = low + ((high - low) >> 8) * (*pp >> 16);
+
+                if ((values [n + ch] >> i) & 1) {
+                    high = split;
+                    *pp += (UP - *pp) >> DECAY;
+                    sp->filter0 = -1;
+                }
+                else {
+                    low = split + 1;
+                    *pp += (DOWN - *pp) >> DECAY;
+                    sp->filter0 = 0;
+                }
+
+                while (DSD_BYTE_READY (high, low)) {
+                    put_byte (out, high >> 24);
+                    high = (high << 8) | 0xff;
+                    low <<= 8;
+                }
+
+                sp->value += sp->filter6 * 8;
+                sp->factor += (((sp->value ^ sp->filter0) >> 31) | 1) & ((sp->value ^ (sp->value - (sp->filter6 * 16))) >> 31);
+                sp->filter1 += ((sp->filter0 & VALUE_ONE) - sp->filter1) >> 6;
+                sp->filter2 += ((sp->filter0 & VALUE_ONE) - sp->filter2) >> 4;
+                sp->filter3 += (sp->filter2 - sp->filter3) >> 4;
+                sp->filter4 += (sp->filter3 - sp->filter4) >> 4;
+                sp->value = (sp->filter4 - sp->filter5) >> 4;
+                sp->filter5 += sp->value;
+                sp->filter6 += (sp->value - sp->filter6) >> 3;
+                sp->value = sp->filter1 - sp->filter5 + ((sp->filter6 * sp->factor) >> 2);
+            }
+
+        for (ch = 0; ch < channels; ++ch)
+            filters [ch].factor -= (filters [ch].factor + 512) >> 10;
+    }
+
+    for (i = 4; i--;)
+        put_byte (out, low >> (i * 8));
+}
+
+// Encode one block of DSD audio for the specified stream, returning its CRC
+
+static uint32_t encode_dsd_block (WavpackEncoder *enc, EncoderStream *es, uint32_t sample_count)
+{
+    uint32_t count = sample_count * es->channels, crc = 0xffffffff, i;
+    ByteBuffer *out = &es->wvbits.bytes;
+
+    for (i = 0; i < count; ++i)
+        crc += (crc << 1) + (es->values [i] & 0xff);
+
+    put_byte (out, DSD_MULTIPLIER_LOG);
+    put_byte (out, enc->config.dsd_mode);
+
+    if (enc->config.dsd_mode == ENCODER_DSD_FAST)
+        encode_dsd_fast (out, es->values, count, es->channels == 2);
+    else if (enc->config.dsd_mode == ENCODER_DSD_HIGH)
+        encode_dsd_high (out, es->filters, es->values, count, es->channels == 2);
+    else
+        for (i = 0; i < count; ++i)
+            put_byte (out, es->values [i]);
+
+    put_metadata (&enc->block, ID_DSD_BLOCK, out->data, out->size);
+    out->size = 0;
+    return crc;
+}
+
+///////////////////////////////// blocks //////////////////////////////////////
+
+static void begin_block (ByteBuffer *block)
+{
+    block->size = 0;
+
+    while (!block->failed && block->size < sizeof (WavpackHeader))
+        put_byte (block, 0);
+}
+
+// Fill in the header of a completed block (adding the checksum for version
+// 5.0 files) and write it to the file
+
+static int finish_block (WavpackEncoder *enc, ByteBuffer *block, FILE *file, uint32_t flags, uint32_t crc, uint32_t block_samples)
+{
+    unsigned char *hdr = block->data;
+    WavpackHeader wphdr;
+
+    if (enc->config.version_five)
+        flags |= HAS_CHECKSUM;
+
+    SET_BLOCK_INDEX (wphdr, enc->sample_index);
+    SET_TOTAL_SAMPLES (wphdr, enc->total_samples);
+
+    if (block->failed)
+        return FALSE;
+
+    memcpy (hdr, "wvpk", 4);
+    set_long (hdr + 4, (uint32_t) block->size + (enc->config.version_five ? 6 : 0) - 8);
+    hdr [8] = (unsigned char) enc->version;
+    hdr [9] = (unsigned char) (enc->version >> 8);
+    hdr [10] = wphdr.block_index_u8;
+    hdr [11] = wphdr.total_samples_u8;
+    set_long (hdr + 12, wphdr.total_samples);
+    set_long (hdr + 16, wphdr.block_index);
+    set_long (hdr + 20, block_samples);
+    set_long (hdr + 24, flags);
+    set_long (hdr + 28, crc);
+
+    if (enc->config.version_five) {
+        uint32_t csum = (uint32_t) -1;
+        size_t i;
+
+        for (i = 0; i < block->size; i += 2)
+            csum = (csum * 3) + hdr [i] + (hdr [i + 1] << 8);
+
+        put_byte (block, ID_BLOCK_CHECKSUM);
+        put_byte (block, 2);
+        put_long (block, csum);
+
+        if (block->failed)
+            return FALSE;
+    }
+
+    return fwrite (block->data, 1, block->size, file) == block->size;
+}
+
+// Encode and write one block of each stream for the buffered samples
+
+static int encode_blocks (WavpackEncoder *enc, uint32_t sample_count)
+{
+    int nch = enc->config.num_channels, si, ch;
+
+    for (si = 0; si < enc->num_streams; ++si) {
+        EncoderStream *es = enc->streams + si;
+        uint32_t flags = enc->base_flags, crc, crc2 = 0, i;
+
+        if (es->channels == 1)
+            flags = (flags & ~JOINT_STEREO) | MONO_FLAG;
+
+        if (!si)
+            flags |= INITIAL_BLOCK;
+
+        if (si == enc->num_streams - 1)
+            flags |= FINAL_BLOCK;
+
+        for (i = 0; i < sample_count; ++i)
+            for (ch = 0; ch < es->channels; ++ch)
+                es->values [i * es->channels + ch] = enc->input [i * nch + si * 2 + ch];
+
+        begin_block (&enc->block);
+
+        if (es->wvcbits.bytes.data)
+            begin_block (&enc->block2);
+
+        if (!si)
+            put_config_metadata (enc, &enc->block);
+
+        if (enc->config.dsd)
+            crc = encode_dsd_block (enc, es, sample_count);
+        else
+            encode_pcm_block (enc, es, sample_count, &flags, &crc, &crc2);
+
+        if (es->wvbits.bytes.failed || es->wvcbits.bytes.failed || es->wvxbits.bytes.failed ||
+            !finish_block (enc, &enc->block, enc->wv, flags, crc, sample_count) ||
+            (es->wvcbits.bytes.data && !finish_block (enc, &enc->block2, enc->wvc, flags, crc2, sample_count)))
+                return FALSE;
+    }
+
+    enc->sample_index += sample_count;
+    return TRUE;
+}
+
+////////////////////////////////// interface /////////////////////////////////
+
+WavpackEncoder *encoder_open (const EncoderConfig *config, int64_t total_samples, FILE *wv, FILE *wvc, char *error)
+{
+    const signed char *terms = config->terms [0] ? config->terms : (config->num_channels > 1 && !config->hybrid_bits ? default_stereo_terms : default_terms);
+    int bits = config->bits_per_sample, num_terms, si, i;
+    WavpackEncoder *enc;
+    const char *message = NULL;
+    int32_t header_rate;
+
+    for (num_terms = 0; num_terms < ENCODER_MAX_TERMS && terms [num_terms]; ++num_terms)
+        if (terms [num_terms] < -3 || (terms [num_terms] > MAX_TERM && terms [num_terms] < 17) || terms [num_terms] > 18)
+            message = "invalid decorrelation term!";
+        else if (terms [num_terms] < 0 && config->hybrid_bits)
+            message = "hybrid mode can't use negative terms!";
+
+    if (config->num_channels < 1 || config->num_channels > 4096)
+        message = "invalid number of channels!";
+    else if (config->sample_rate <= 0 || total_samples < 0 || config->block_samples > MAX_BLOCK_SAMPLES)
+        message = "invalid sample rate, length or block size!";
+    else if (config->dsd && (config->dsd_mode == 2 || config->dsd_mode > ENCODER_DSD_HIGH || config->dsd_mode < 0 ||
+        config->hybrid_bits || (config->sample_rate & ((1 << DSD_MULTIPLIER_LOG) - 1))))
+            message = "invalid DSD configuration!";
+    else if (!config->dsd && (bits < 1 || (bits > 24 && bits != 32) || (config->float_data && bits != 32)))
+        message = "invalid bits per sample!";
+    else if (config->hybrid_bits && (config->hybrid_bits < 0 || bits > 24))
+        message = "hybrid mode needs integers of 24 bits or fewer!";
+    else if (wvc && !config->hybrid_bits)
+        message = "correction files need hybrid mode!";
+
+    if (!message && !(enc = (WavpackEncoder *)calloc (1, sizeof (WavpackEncoder))))
+        message = "can't allocate memory";
+
+    if (message) {
+        if (error) strcpy (error, message);
+        return NULL;
+    }
+
+    enc->config = *config;
+    enc->wv = wv;
+    enc->wvc = wvc;
+    enc->total_samples = total_samples;
+    enc->num_streams = (config->num_channels + 1) / 2;
+
+    if (!enc->config.block_samples)
+        enc->config.block_samples = config->sample_rate / 2 > MAX_BLOCK_SAMPLES ? MAX_BLOCK_SAMPLES : (config->sample_rate + 1) / 2;
+
+    if (!enc->config.channel_mask)
+        enc->config.channel_mask = config->num_channels <= 2 ? 0x5U - config->num_channels :
+            (config->num_channels < 18 ? (1U << config->num_channels) - 1 : 0x3ffff);
+
+    if (config->dsd) {
+        enc->config.version_five = TRUE;
+        enc->version = DSD_STREAM_VERSION;
+        enc->base_flags = DSD_FLAG;
+        header_rate = config->sample_rate >> DSD_MULTIPLIER_LOG;
+    }
+    else {
+        int bytes = (bits + 7) / 8;
+
+        enc->version = PCM_STREAM_VERSION;
+        enc->shift = bits > 24 ? 0 : bytes * 8 - bits;
+        enc->base_flags = (bytes - 1) | ((uint32_t) enc->shift << SHIFT_LSB);
+
+        if (config->float_data)
+            enc->base_flags |= FLOAT_DATA;
+        else if (bits == 32)
+            enc->base_flags |= INT32_DATA;
+
+        if (config->hybrid_bits)
+            enc->base_flags |= HYBRID_FLAG | HYBRID_BITRATE;
+
+        if (config->joint_stereo)
+            enc->base_flags |= JOINT_STEREO;
+
+        for (i = 0; i < num_terms; ++i)
+            if (terms [i] < 0)
+                enc->base_flags |= CROSS_DECORR;
+
+        header_rate = config->sample_rate;
+    }
+
+    for (enc->srate_index = 0; enc->srate_index < 15; ++enc->srate_index)
+        if (sample_rates [enc->srate_index] == (uint32_t) header_rate)
+            break;
+
+    enc->base_flags |= (uint32_t) enc->srate_index << SRATE_LSB;
+    enc->input = (int32_t *)malloc (enc->config.block_samples * config->num_channels * sizeof (int32_t));
+    enc->streams = (EncoderStream *)calloc (enc->num_streams, sizeof (EncoderStream));
+
+    if (!enc->input || !enc->streams) {
+        if (error) strcpy (error, "can't allocate memory");
+        enc->num_streams = 0;
+        encoder_close (enc);
+        return NULL;
+    }
+
+    for (si = 0; si < enc->num_streams; ++si) {
+        EncoderStream *es = enc->streams + si;
+        WavpackStream *wps;
+
+        es->channels = (si * 2 + 1 < config->num_channels) ? 2 : 1;
+
+        if (es->channels == 1)
+            for (i = 0; i < num_terms; ++i)
+                if (terms [i] < 0) {
+                    if (error) strcpy (error, "mono audio can't use negative terms!");
+                    encoder_close (enc);
+                    return NULL;
+                }
+
+        es->values = (int32_t *)malloc (enc->config.block_samples * es->channels * sizeof (int32_t));
+        es->temp = (int32_t *)malloc (enc->config.block_samples * es->channels * sizeof (int32_t));
+        es->wps = wps = (WavpackStream *)calloc (1, sizeof (WavpackStream));
+
+        if (wvc)
+            put_byte (&es->wvcbits.bytes, 0);   // allocate the buffer to mark the correction bitstream as used
+
+        if (!es->values || !es->temp || !wps || (wvc && es->wvcbits.bytes.failed)) {
+            if (error) strcpy (error, "can't allocate memory");
+            encoder_close (enc);
+            return NULL;
+        }
+
+        es->wvcbits.bytes.size = 0;
+        wps->wphdr.flags = enc->base_flags | (es->channels == 1 ? MONO_FLAG : 0);
+        wps->num_terms = num_terms;
+
+        for (i = 0; i < num_terms; ++i) {
+            wps->decorr_passes [num_terms - 1 - i].term = terms [i];
+            wps->decorr_passes [num_terms - 1 - i].delta = config->delta ? config->delta : 2;
+        }
+    }
+
+    return enc;
+}
+
+int encoder_write (WavpackEncoder *enc, const int32_t *samples, uint32_t sample_count)
+{
+    int nch = enc->config.num_channels;
+
+    while (sample_count && !enc->error) {
+        uint32_t count = enc->config.block_samples - enc->input_samples;
+
+        if (count > sample_count)
+            count = sample_count;
+
+        memcpy (enc->input + enc->input_samples * nch, samples, count * nch * sizeof (int32_t));
+        enc->input_samples += count;
+        samples += count * nch;
+        sample_count -= count;
+
+        if (enc->input_samples == enc->config.block_samples) {
+            enc->error = !encode_blocks (enc, enc->input_samples);
+            enc->input_samples = 0;
+        }
+    }
+
+    return !enc->error;
+}
+
+int encoder_close (WavpackEncoder *enc)
+{
+    int result, si;
+
+    if (enc->input_samples && !enc->error)
+        enc->error = !encode_blocks (enc, enc->input_samples);
+
+    result = !enc->error && enc->sample_index == enc->total_samples;
+
+    for (si = 0; si < enc->num_streams; ++si) {
+        EncoderStream *es = enc->streams + si;
+
+        free (es->wvbits.bytes.data);
+        free (es->wvcbits.bytes.data);
+        free (es->wvxbits.bytes.data);
+        free (es->values);
+        free (es->temp);
+        free (es->wps);
+    }
+
+    free (enc->streams);
+    free (enc->input);
+    free (enc->block.data);
+    free (enc->block2.data);
+    free (enc);
+    return result;
+}
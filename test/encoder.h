@@ -0,0 +1,77 @@
+////////////////////////////////////////////////////////////////////////////
+//                           **** WAVPACK ****                            //
+//                  Hybrid Lossless Wavefile Compressor                   //
+//                Copyright (c) 1998 - 2024 David Bryant.                 //
+//                          All Rights Reserved.                          //
+//      Distributed under the BSD Software License (see license.txt)      //
+////////////////////////////////////////////////////////////////////////////
+
+// encoder.h
+
+// Interface to the test-only WavPack encoder in encoder.c, which is used to
+// generate the test corpus (see gencorpus.c). It is not part of the library.
+
+#ifndef ENCODER_H
+#define ENCODER_H
+
+#include <stdio.h>
+
+#include "../wavpack.h"
+
+#define ENCODER_MAX_TERMS   16      // same as MAX_NTERMS in the library
+
+// values for EncoderConfig.dsd_mode (the same as the mode byte of ID_DSD_BLOCK)
+
+#define ENCODER_DSD_RAW     0       // uncompressed bytes
+#define ENCODER_DSD_FAST    1       // range coded with a table per history context
+#define ENCODER_DSD_HIGH    3       // adaptive binary coder with the noise-shaping filter model
+
+// Samples are passed to encoder_write() interleaved, exactly as they will be
+// returned by WavpackUnpackSamples() for the file:
+//
+//  - integer PCM of 1 to 24 bits is right-justified in the smallest number of
+//    bytes that holds it, with the unused low bits (if any) zero (for example,
+//    20-bit audio is passed as 24-bit values that are multiples of 16)
+//  - 32-bit integer PCM is stored losslessly with the low 8 bits in the "extra"
+//    (wvx) bitstream, and can't be used with hybrid mode
+//  - for float data, the samples are passed as signed 24-bit integers "x" and
+//    are decoded as the 32-bit floats x / 2^23 (exactly)
+//  - DSD audio is passed as one byte (8 bits, MSB first) per sample and channel
+//
+// The decorrelation "terms" (zero terminated) are listed in the order the
+// encoder applies them (which is the order they are stored in the metadata).
+// If none are given, a default set is used. Hybrid mode only supports
+// positive terms, and mono audio doesn't support negative terms at all.
+
+typedef struct {
+    int num_channels, bits_per_sample, float_data;
+    int32_t sample_rate;                // for DSD this is the byte rate (e.g. 352800 for DSD64)
+    uint32_t channel_mask;              // 0 for the default (based on num_channels)
+    uint32_t block_samples;             // samples per block (per channel), up to 196607
+    int joint_stereo;                   // store stereo pairs as mid/side
+    int hybrid_bits;                    // hybrid lossy bitrate in bits per sample (0 = lossless)
+    int version_five;                   // write WavPack 5.0 files (new config and block checksums)
+    int dsd, dsd_mode;                  // DSD audio and its coding mode (ENCODER_DSD_*)
+    signed char delta, terms [ENCODER_MAX_TERMS + 1];
+} EncoderConfig;
+
+typedef struct WavpackEncoder WavpackEncoder;
+
+// Open an encoder writing to "wv" (and, for hybrid mode, the correction file
+// to "wvc" if it's not NULL). The total number of samples (per channel) must
+// be known ahead and exactly that many must be written. Returns NULL with a
+// message in "error" (if not NULL) on failure.
+
+WavpackEncoder *encoder_open (const EncoderConfig *config, int64_t total_samples, FILE *wv, FILE *wvc, char *error);
+
+// Encode the given number of (interleaved) samples. Returns FALSE on error.
+
+int encoder_write (WavpackEncoder *enc, const int32_t *samples, uint32_t sample_count);
+
+// Flush the final block and free the encoder (but don't close the files).
+// Returns FALSE if anything failed (including writing the wrong number of
+// samples).
+
+int encoder_close (WavpackEncoder *enc);
+
+#endif
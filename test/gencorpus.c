@@ -0,0 +1,973 @@
+////////////////////////////////////////////////////////////////////////////
+//                           **** WAVPACK ****                            //
+//                  Hybrid Lossless Wavefile Compressor                   //
+//                Copyright (c) 1998 - 2024 David Bryant.                 //
+//                          All Rights Reserved.                          //
+//      Distributed under the BSD Software License (see license.txt)      //
+////////////////////////////////////////////////////////////////////////////
+
+// gencorpus.c
+
+// Test corpus generator: writes a WavPack file (and a correction file, where
+// applicable) of any length for each of a set of workloads that together
+// cover all the decoder's paths (bit depths, float and 32-bit integers, mono,
+// stereo and multichannel, hybrid with and without correction files, all the
+// DSD modes, extreme block sizes and both stream versions), using the test
+// encoder in encoder.c and deterministic synthetic audio. Each file is then
+// decoded with the library and checked against the regenerated audio: exactly
+// for lossless files (and hybrid files with their correction files), and for
+// a clean decode of the right length (with all the CRCs matching) for lossy
+// files. Files of up to 16 bits are also checked with WavpackUnpackSamples16(),
+// all the PCM and float files with WavpackUnpackSamplesFloat(), and the DSD
+// files with WavpackUnpackSamplesDSD(). Damaged copies of the correction files
+// are decoded with and without the correction file reader thread, which must
+// agree. The lossless PCM files are also checked after seeking to blocks that
+// haven't been visited, with a limit on how much of the file (or the correction
+// file) each seek may read. The files can be used with the benchmarks, e.g.:
+//
+//   make corpus CORPUS_FLAGS="-d 10m" && make bench WV="corpus/*.wv"
+//
+// usage: gencorpus [-d duration] [-o directory] [-n] [-l] [workload ...]
+//   -d  length of each file, in seconds or with an s, m or h suffix (default 10s)
+//   -o  directory to write the files to (default current directory)
+//   -n  don't verify the files
+//   -l  list the workloads and exit
+//
+// The exit status is nonzero if anything fails to encode or verify.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "../wavpack_local.h"
+#include "encoder.h"
+
+#define CHUNK_SAMPLES 4096      // samples (per channel) generated, encoded and checked at a time
+
+typedef struct {
+    const char *name, *description;
+    int num_channels, bits_per_sample, float_data, sample_rate;
+    int joint_stereo, hybrid_bits, wvc, version_five;
+    int dsd, dsd_mode;
+    uint32_t block_samples;
+    signed char terms [ENCODER_MAX_TERMS + 1];
+} Workload;
+
+static const Workload workloads [] = {
+    { "lossless_16_stereo", "16-bit stereo, joint stereo, default terms", 2, 16, 0, 44100, 1, 0, 0, 1 },
+    { "lossless_16_mono", "16-bit mono, WavPack 4.0 stream", 1, 16, 0, 44100, 0, 0, 0, 0 },
+    { "lossless_8_stereo", "8-bit stereo at 22.05 kHz", 2, 8, 0, 22050, 1, 0, 0, 1 },
+    { "lossless_20_stereo", "20-bit stereo (shifted) at 48 kHz", 2, 20, 0, 48000, 1, 0, 0, 1 },
+    { "lossless_24_high", "24-bit stereo at 96 kHz, many terms", 2, 24, 0, 96000, 1, 0, 0, 1, 0, 0, 0,
+        { 18, 18, 17, 3, 2, 4, 5, 6, 7, 8, -1, -3 } },
+    { "lossless_32_int", "32-bit integer stereo (extra bitstream)", 2, 32, 0, 48000, 1, 0, 0, 1 },
+    { "float_stereo", "32-bit float stereo", 2, 32, 1, 44100, 1, 0, 0, 1 },
+    { "multichannel_6", "16-bit 5.1 at 48 kHz", 6, 16, 0, 48000, 1, 0, 0, 1 },
+    { "multichannel_18", "16-bit, 18 channels (9 streams)", 18, 16, 0, 48000, 0, 0, 0, 1 },
+    { "hybrid_stereo", "hybrid lossy 16-bit stereo, 3 bits/sample", 2, 16, 0, 44100, 0, 3, 0, 1 },
+    { "hybrid_wvc_stereo", "hybrid 16-bit stereo with correction file", 2, 16, 0, 44100, 1, 4, 1, 1 },
+    { "hybrid_wvc_mono_24", "hybrid 24-bit mono with correction file", 1, 24, 0, 96000, 0, 6, 1, 1 },
+    { "dsd_raw", "DSD64 stereo, uncompressed", 2, 8, 0, 352800, 0, 0, 0, 1, 1, ENCODER_DSD_RAW },
+    { "dsd_fast", "DSD64 stereo, fast mode", 2, 8, 0, 352800, 0, 0, 0, 1, 1, ENCODER_DSD_FAST },
+    { "dsd_high", "DSD64 stereo, high mode", 2, 8, 0, 352800, 0, 0, 0, 1, 1, ENCODER_DSD_HIGH },
+    { "dsd_high_mono", "DSD64 mono, high mode", 1, 8, 0, 352800, 0, 0, 0, 1, 1, ENCODER_DSD_HIGH },
+    { "huge_blocks", "16-bit stereo, 192000 sample blocks", 2, 16, 0, 44100, 1, 0, 0, 1, 0, 0, 192000 },
+    { "tiny_blocks", "16-bit stereo, 256 sample blocks", 2, 16, 0, 44100, 1, 0, 0, 1, 0, 0, 256 },
+    { "fast_terms", "16-bit stereo, single term 17", 2, 16, 0, 44100, 1, 0, 0, 1, 0, 0, 0, { 17 } },
+    { "fast_preset", "16-bit stereo, fast mode terms", 2, 16, 0, 44100, 1, 0, 0, 1, 0, 0, 0, { 17, 17 } },
+    { "high_preset", "24-bit stereo, high mode terms", 2, 24, 0, 48000, 1, 0, 0, 1, 0, 0, 0,
+        { 18, 18, 2, 3, -2, 18, 2, 4, 7, 5, 3, 6, 8, -1, 18, 2 } },
+    { "high_preset_3", "16-bit stereo, high mode terms with -3", 2, 16, 0, 44100, 1, 0, 0, 1, 0, 0, 0,
+        { 18, 18, 2, 3, -3, 18, 2, 4, 7, 5, 3, 6, 8, -3, 18, 2 } },
+};
+
+#define NUM_WORKLOADS ((int)(sizeof (workloads) / sizeof (workloads [0])))
+
+//////////////////////////////// audio sources ///////////////////////////////
+
+// Synthetic audio: per channel, two sines at different frequencies plus a
+// little noise from a simple LCG, with a quarter second of digital silence
+// every 4 seconds (for the zero-run paths). For DSD, the same kind of signal
+// drives a second-order sigma-delta modulator. Everything is generated in
+// sequence, so resetting the source regenerates exactly the same audio.
+
+typedef struct {
+    const Workload *wl;
+    int64_t index;
+    uint32_t noise;
+    double integrator [2] [2];
+    int32_t feedback [2];
+} Source;
+
+static void reset_source (Source *src, const Workload *wl)
+{
+    memset (src, 0, sizeof (Source));
+    src->wl = wl;
+    src->noise = 0x9e3779b9;
+}
+
+static double noise (Source *src)
+{
+    src->noise = src->noise * 1664525 + 1013904223;
+    return (int32_t) src->noise / 2147483648.0;
+}
+
+static double signal (Source *src, int64_t index, int rate, int chan)
+{
+    double t = (double) index / rate;
+
+    if (fmod (t, 4.0) >= 3.75)
+        return 0.0;
+
+    return 0.5 * sin (2 * M_PI * 220.0 * (chan + 1) * t) + 0.25 * sin (2 * M_PI * (1000.0 + 150.0 * chan) * t) + 0.02 * noise (src);
+}
+
+static void generate (Source *src, int32_t *buffer, uint32_t sample_count)
+{
+    const Workload *wl = src->wl;
+    uint32_t i;
+    int ch;
+
+    for (i = 0; i < sample_count; ++i, ++src->index)
+        for (ch = 0; ch < wl->num_channels; ++ch) {
+            if (wl->dsd) {
+                int byte = 0, bit;
+
+                // 8 bits (MSB first) per byte at 8x the byte rate; only the first two channels have separate modulators
+
+                for (bit = 0; bit < 8; ++bit) {
+                    double *integrator = src->integrator [ch & 1];
+                    double x = 0.5 * sin (2 * M_PI * (1000.0 + 250.0 * ch) * (src->index * 8.0 + bit) / (wl->sample_rate * 8.0));
+                    int32_t y = src->feedback [ch & 1];
+
+                    integrator [0] += x - y;
+                    integrator [1] += integrator [0] - y;
+                    src->feedback [ch & 1] = integrator [1] >= 0 ? 1 : -1;
+                    byte = (byte << 1) | (src->feedback [ch & 1] > 0);
+                }
+
+                *buffer++ = byte;
+            }
+            else {
+                int bits = wl->float_data ? 24 : wl->bits_per_sample, shift = bits > 24 ? 0 : ((bits + 7) & ~7) - bits;
+                double full_scale = (double) ((1U << (bits - 1)) - 1), value = signal (src, src->index, wl->sample_rate, ch) * full_scale;
+
+                *buffer++ = (int32_t) floor (value + 0.5) * (1 << shift);
+            }
+        }
+}
+
+////////////////////////////// stdio file reader /////////////////////////////
+
+static FILE *counted_file;      // the file whose reads are being counted (see verify_seeks())
+static int64_t counted_bytes;
+
+static int32_t read_bytes (void *id, void *data, int32_t bcount)
+{
+    int32_t result = (int32_t) fread (data, 1, bcount, (FILE *) id);
+
+    if (id == counted_file)
+        counted_bytes += result;
+
+    return result;
+}
+
+static int64_t get_pos (void *id)
+{
+    return ftello ((FILE *) id);
+}
+
+static int set_pos_abs (void *id, int64_t pos)
+{
+    return fseeko ((FILE *) id, pos, SEEK_SET);
+}
+
+static int set_pos_rel (void *id, int64_t delta, int mode)
+{
+    return fseeko ((FILE *) id, delta, mode);
+}
+
+static int push_back_byte (void *id, int c)
+{
+    return ungetc (c, (FILE *) id);
+}
+
+static int64_t get_length (void *id)
+{
+    FILE *file = (FILE *) id;
+    int64_t pos = ftello (file), length;
+
+    fseeko (file, 0, SEEK_END);
+    length = ftello (file);
+    fseeko (file, pos, SEEK_SET);
+    return length;
+}
+
+static int can_seek (void *id)
+{
+    return TRUE;
+}
+
+static WavpackStreamReader64 stdio_reader = {
+    read_bytes, NULL, get_pos, set_pos_abs, set_pos_rel, push_back_byte, get_length, can_seek, NULL, NULL
+};
+
+///////////////////////////////// workloads //////////////////////////////////
+
+static int64_t file_size (FILE *file)
+{
+    return file ? get_length (file) : 0;
+}
+
+static int encode_file (const Workload *wl, int64_t total_samples, FILE *wv, FILE *wvc)
+{
+    int32_t *buffer = (int32_t *)malloc (CHUNK_SAMPLES * wl->num_channels * sizeof (int32_t));
+    WavpackEncoder *enc;
+    EncoderConfig config;
+    char error [80];
+    int64_t done;
+    Source src;
+    int result;
+
+    memset (&config, 0, sizeof (config));
+    config.num_channels = wl->num_channels;
+    config.bits_per_sample = wl->bits_per_sample;
+    config.float_data = wl->float_data;
+    config.sample_rate = wl->sample_rate;
+    config.block_samples = wl->block_samples;
+    config.joint_stereo = wl->joint_stereo;
+    config.hybrid_bits = wl->hybrid_bits;
+    config.version_five = wl->version_five;
+    config.dsd = wl->dsd;
+    config.dsd_mode = wl->dsd_mode;
+    memcpy (config.terms, wl->terms, sizeof (config.terms));
+
+    if (!buffer || !(enc = encoder_open (&config, total_samples, wv, wvc, error))) {
+        fprintf (stderr, "%s: can't encode: %s\n", wl->name, buffer ? error : "out of memory");
+        free (buffer);
+        return FALSE;
+    }
+
+    reset_source (&src, wl);
+
+    for (done = 0, result = TRUE; result && done < total_samples; done += CHUNK_SAMPLES) {
+        uint32_t count = total_samples - done < CHUNK_SAMPLES ? (uint32_t) (total_samples - done) : CHUNK_SAMPLES;
+
+        generate (&src, buffer, count);
+        result = encoder_write (enc, buffer, count);
+    }
+
+    if (!encoder_close (enc) || !result) {
+        fprintf (stderr, "%s: encoding failed\n", wl->name);
+        result = FALSE;
+    }
+
+    free (buffer);
+    return result;
+}
+
+// Decode the file and compare it with the regenerated source (unless "lossy"),
+// opening it with the given extra flags
+
+static int verify_file (const Workload *wl, int64_t total_samples, FILE *wv, FILE *wvc, int lossy, int flags)
+{
+    int32_t *expected = (int32_t *)malloc (CHUNK_SAMPLES * wl->num_channels * sizeof (int32_t));
+    int32_t *decoded = (int32_t *)malloc (CHUNK_SAMPLES * wl->num_channels * sizeof (int32_t));
+    int64_t done = 0;
+    WavpackContext *wpc;
+    int result = TRUE;
+    char error [80];
+    uint32_t count;
+    Source src;
+
+    fseeko (wv, 0, SEEK_SET);
+
+    if (wvc)
+        fseeko (wvc, 0, SEEK_SET);
+
+    if (!expected || !decoded || !(wpc = WavpackOpenFileInputEx64 (&stdio_reader, wv, wvc, error, (wvc ? OPEN_WVC : 0) | OPEN_DSD_NATIVE | flags, 0))) {
+        fprintf (stderr, "%s: can't open: %s\n", wl->name, expected && decoded ? error : "out of memory");
+        free (expected);
+        free (decoded);
+        return FALSE;
+    }
+
+    if (WavpackGetNumSamples64 (wpc) != total_samples || WavpackGetNumChannels (wpc) != wl->num_channels) {
+        fprintf (stderr, "%s: wrong length or channel count\n", wl->name);
+        result = FALSE;
+    }
+
+    reset_source (&src, wl);
+
+    while (result && (count = WavpackUnpackSamples (wpc, decoded, CHUNK_SAMPLES)) > 0) {
+        if (!lossy) {
+            uint32_t i;
+
+            generate (&src, expected, count);
+
+            if (wl->float_data)
+                for (i = 0; i < count * wl->num_channels; ++i) {
+                    float value = (float) expected [i] / 8388608.0f;
+
+                    memcpy (expected + i, &value, sizeof (value));
+                }
+
+            for (i = 0; i < count * wl->num_channels; ++i)
+                if (expected [i] != decoded [i]) {
+                    fprintf (stderr, "%s: mismatch at sample %lld, channel %d: expected %d, got %d\n", wl->name,
+                        (long long) (done + i / wl->num_channels), (int) (i % wl->num_channels), expected [i], decoded [i]);
+                    result = FALSE;
+                    break;
+                }
+        }
+
+        done += count;
+    }
+
+    if (result && (done != total_samples || WavpackGetNumErrors (wpc))) {
+        fprintf (stderr, "%s: decoded %lld of %lld samples with %d errors%s\n", wl->name, (long long) done,
+            (long long) total_samples, WavpackGetNumErrors (wpc), wvc ? " (with correction file)" : "");
+        result = FALSE;
+    }
+
+    WavpackCloseFile (wpc);
+    free (expected);
+    free (decoded);
+    return result;
+}
+
+// Seek to a series of positions in a lossless PCM file (in both directions, and
+// always to blocks that haven't been visited before), checking the samples found
+// there against the regenerated audio and counting the bytes read from the file,
+// or from the correction file if there is one (which is searched with only the
+// blocks visited before to go by). The search for each block finishes by walking
+// the block headers, so a seek shouldn't read more than the block itself, a couple
+// of blocks' worth of searching and the few 4 KB buffers read by the search's
+// probes; reading more means that the search is scanning the file.
+
+#define NUM_SEEKS 16
+
+static int verify_seeks (const Workload *wl, int64_t total_samples, FILE *wv, FILE *wvc)
+{
+    int32_t *expected = (int32_t *)malloc (NUM_SEEKS * CHUNK_SAMPLES * wl->num_channels * sizeof (int32_t));
+    int32_t *decoded = (int32_t *)malloc (CHUNK_SAMPLES * wl->num_channels * sizeof (int32_t));
+    int64_t targets [NUM_SEEKS], max_bytes, most_bytes = 0, done;
+    uint32_t block_samples, lengths [NUM_SEEKS];
+    FILE *counted = wvc ? wvc : wv;
+    int order [NUM_SEEKS], result = TRUE, i, j;
+    WavpackContext *wpc;
+    char error [80];
+    Source src;
+
+    fseeko (wv, 0, SEEK_SET);
+
+    if (wvc)
+        fseeko (wvc, 0, SEEK_SET);
+
+    if (!expected || !decoded || !(wpc = WavpackOpenFileInputEx64 (&stdio_reader, wv, wvc, error, wvc ? OPEN_WVC : 0, 0))) {
+        fprintf (stderr, "%s: can't open for the seek check: %s\n", wl->name, expected && decoded ? error : "out of memory");
+        free (expected);
+        free (decoded);
+        return FALSE;
+    }
+
+    block_samples = wpc->streams [0]->wphdr.block_samples;
+    max_bytes = 3 * file_size (counted) / ((total_samples + block_samples - 1) / block_samples) + 6 * 4096;
+
+    // spread the targets over the file in a scrambled order (at various offsets into their blocks)
+    // and regenerate the audio at each of them in a single pass, visiting them in order of position
+
+    for (i = 0; i < NUM_SEEKS; ++i) {
+        targets [i] = total_samples * ((i * 5 + 3) % NUM_SEEKS) / NUM_SEEKS + i * 1237 % block_samples;
+
+        if (targets [i] >= total_samples)
+            targets [i] = total_samples - 1;
+
+        for (j = i; j && targets [order [j - 1]] > targets [i]; --j)
+            order [j] = order [j - 1];
+
+        order [j] = i;
+    }
+
+    reset_source (&src, wl);
+
+    for (done = i = 0; i < NUM_SEEKS; ++i) {
+        int64_t target = targets [order [i]], next = i + 1 < NUM_SEEKS ? targets [order [i + 1]] : total_samples;
+        int32_t *buffer = expected + (size_t) order [i] * CHUNK_SAMPLES * wl->num_channels;
+
+        for (; done < target; done += CHUNK_SAMPLES)
+            generate (&src, buffer, target - done < CHUNK_SAMPLES ? (uint32_t) (target - done) : CHUNK_SAMPLES);
+
+        lengths [order [i]] = next - target < CHUNK_SAMPLES ? (uint32_t) (next - target) : CHUNK_SAMPLES;
+        generate (&src, buffer, lengths [order [i]]);
+        done = target + lengths [order [i]];
+    }
+
+    counted_file = counted;
+
+    for (i = 0; result && i < NUM_SEEKS; ++i) {
+        int32_t *buffer = expected + (size_t) i * CHUNK_SAMPLES * wl->num_channels;
+        uint32_t count, k;
+
+        counted_bytes = 0;
+
+        if (!WavpackSeekSample64 (wpc, targets [i])) {
+            fprintf (stderr, "%s: seek to sample %lld failed\n", wl->name, (long long) targets [i]);
+            result = FALSE;
+            break;
+        }
+
+        if (counted_bytes > most_bytes)
+            most_bytes = counted_bytes;
+
+        if ((count = WavpackUnpackSamples (wpc, decoded, lengths [i])) != lengths [i]) {
+            fprintf (stderr, "%s: decoded %u of %u samples after seeking to %lld\n", wl->name, count, lengths [i],
+                (long long) targets [i]);
+            result = FALSE;
+            break;
+        }
+
+        for (k = 0; k < count * wl->num_channels; ++k)
+            if (buffer [k] != decoded [k]) {
+                fprintf (stderr, "%s: mismatch at sample %lld after seeking to %lld, channel %d: expected %d, got %d\n",
+                    wl->name, (long long) (targets [i] + k / wl->num_channels), (long long) targets [i],
+                    (int) (k % wl->num_channels), buffer [k], decoded [k]);
+                result = FALSE;
+                break;
+            }
+    }
+
+    counted_file = NULL;
+
+    if (result && most_bytes > max_bytes) {
+        fprintf (stderr, "%s: a seek read %lld bytes of the %s file (expected at most %lld)\n", wl->name,
+            (long long) most_bytes, wvc ? "correction" : "WavPack", (long long) max_bytes);
+        result = FALSE;
+    }
+
+    WavpackCloseFile (wpc);
+    free (expected);
+    free (decoded);
+    return result;
+}
+
+// Read the complete file into memory (returning NULL on any error)
+
+static void *read_whole_file (FILE *file, int64_t *size)
+{
+    void *data;
+
+    if (fseeko (file, 0, SEEK_END) || (*size = ftello (file)) <= 0 || fseeko (file, 0, SEEK_SET) ||
+        !(data = malloc ((size_t) *size)))
+            return NULL;
+
+    if (fread (data, 1, (size_t) *size, file) != (size_t) *size) {
+        free (data);
+        return NULL;
+    }
+
+    return data;
+}
+
+// Decode the file (of 16 bits or less) with both WavpackUnpackSamples() and
+// WavpackUnpackSamples16(), in chunks of varying sizes, and check that they
+// return exactly the same samples
+
+static int verify_file16 (const Workload *wl, FILE *wv, FILE *wvc)
+{
+    int32_t *decoded = (int32_t *)malloc (CHUNK_SAMPLES * wl->num_channels * sizeof (int32_t));
+    int16_t *decoded16 = (int16_t *)malloc (CHUNK_SAMPLES * wl->num_channels * sizeof (int16_t));
+    int64_t wv_size = 0, wvc_size = 0, done = 0;
+    void *wv_data = read_whole_file (wv, &wv_size), *wvc_data = wvc ? read_whole_file (wvc, &wvc_size) : NULL;
+    WavpackContext *wpc = NULL, *wpc16 = NULL;
+    int result = TRUE, flags = wvc ? OPEN_WVC : 0;
+    uint32_t count, count16, i;
+    char error [80];
+
+    if (!decoded || !decoded16 || !wv_data || (wvc && !wvc_data) ||
+        !(wpc = WavpackOpenMemoryInput (wv_data, wv_size, wvc_data, wvc_size, error, flags, 0)) ||
+        !(wpc16 = WavpackOpenMemoryInput (wv_data, wv_size, wvc_data, wvc_size, error, flags, 0))) {
+            fprintf (stderr, "%s: can't open for the 16-bit check\n", wl->name);
+            result = FALSE;
+    }
+
+    while (result) {
+        uint32_t chunk = 1 + (uint32_t) (done * 7919 % CHUNK_SAMPLES);     // vary the alignment with the blocks
+
+        count = WavpackUnpackSamples (wpc, decoded, chunk);
+        count16 = WavpackUnpackSamples16 (wpc16, decoded16, chunk);
+
+        if (count != count16) {
+            fprintf (stderr, "%s: WavpackUnpackSamples16() returned %u samples instead of %u\n", wl->name, count16, count);
+            result = FALSE;
+        }
+
+        for (i = 0; result && i < count * wl->num_channels; ++i)
+            if (decoded16 [i] != decoded [i]) {
+                fprintf (stderr, "%s: 16-bit mismatch at sample %lld, channel %d: expected %d, got %d\n", wl->name,
+                    (long long) (done + i / wl->num_channels), (int) (i % wl->num_channels), decoded [i], decoded16 [i]);
+                result = FALSE;
+            }
+
+        if (!count)
+            break;
+
+        done += count;
+    }
+
+    if (result && WavpackGetNumErrors (wpc16) != WavpackGetNumErrors (wpc)) {
+        fprintf (stderr, "%s: %d errors decoding 16-bit samples\n", wl->name, WavpackGetNumErrors (wpc16));
+        result = FALSE;
+    }
+
+    if (wpc)
+        WavpackCloseFile (wpc);
+
+    if (wpc16)
+        WavpackCloseFile (wpc16);
+
+    free (wv_data);
+    free (wvc_data);
+    free (decoded);
+    free (decoded16);
+    return result;
+}
+
+// Decode the file (PCM or float) with both WavpackUnpackSamples() and
+// WavpackUnpackSamplesFloat(), in chunks of varying sizes, and check that the
+// floats are exactly the integer samples scaled to +/-1.0 (or, for float files,
+// exactly what WavpackUnpackSamples() returns with OPEN_NORMALIZE)
+
+static int verify_file_float (const Workload *wl, FILE *wv, FILE *wvc)
+{
+    int32_t *decoded = (int32_t *)malloc (CHUNK_SAMPLES * wl->num_channels * sizeof (int32_t));
+    float *decoded_float = (float *)malloc (CHUNK_SAMPLES * wl->num_channels * sizeof (float));
+    int64_t wv_size = 0, wvc_size = 0, done = 0;
+    void *wv_data = read_whole_file (wv, &wv_size), *wvc_data = wvc ? read_whole_file (wvc, &wvc_size) : NULL;
+    WavpackContext *wpc = NULL, *wpc_float = NULL;
+    int result = TRUE, flags = wvc ? OPEN_WVC : 0;
+    uint32_t count, count_float, i;
+    float scale = 1.0f;
+    char error [80];
+
+    if (!decoded || !decoded_float || !wv_data || (wvc && !wvc_data) ||
+        !(wpc = WavpackOpenMemoryInput (wv_data, wv_size, wvc_data, wvc_size, error, flags | OPEN_NORMALIZE, 0)) ||
+        !(wpc_float = WavpackOpenMemoryInput (wv_data, wv_size, wvc_data, wvc_size, error, flags, 0))) {
+            fprintf (stderr, "%s: can't open for the float check\n", wl->name);
+            result = FALSE;
+    }
+    else if (!wl->float_data)
+        scale = (float) ldexp (1.0, 1 - WavpackGetBytesPerSample (wpc) * 8);
+
+    while (result) {
+        uint32_t chunk = 1 + (uint32_t) (done * 7919 % CHUNK_SAMPLES);     // vary the alignment with the blocks
+
+        count = WavpackUnpackSamples (wpc, decoded, chunk);
+        count_float = WavpackUnpackSamplesFloat (wpc_float, decoded_float, chunk);
+
+        if (count != count_float) {
+            fprintf (stderr, "%s: WavpackUnpackSamplesFloat() returned %u samples instead of %u\n", wl->name, count_float, count);
+            result = FALSE;
+        }
+
+        for (i = 0; result && i < count * wl->num_channels; ++i) {
+            float expected;
+
+            if (wl->float_data)
+                memcpy (&expected, decoded + i, sizeof (float));
+            else
+                expected = decoded [i] * scale;
+
+            if (memcmp (&expected, decoded_float + i, sizeof (float))) {
+                fprintf (stderr, "%s: float mismatch at sample %lld, channel %d: expected %g, got %g\n", wl->name,
+                    (long long) (done + i / wl->num_channels), (int) (i % wl->num_channels), expected, decoded_float [i]);
+                result = FALSE;
+            }
+        }
+
+        if (!count)
+            break;
+
+        done += count;
+    }
+
+    if (result && WavpackGetNumErrors (wpc_float) != WavpackGetNumErrors (wpc)) {
+        fprintf (stderr, "%s: %d errors decoding float samples\n", wl->name, WavpackGetNumErrors (wpc_float));
+        result = FALSE;
+    }
+
+    if (wpc)
+        WavpackCloseFile (wpc);
+
+    if (wpc_float)
+        WavpackCloseFile (wpc_float);
+
+    free (wv_data);
+    free (wvc_data);
+    free (decoded);
+    free (decoded_float);
+    return result;
+}
+
+// Decode the DSD file with WavpackUnpackSamples() and with WavpackUnpackSamplesDSD()
+// in all four formats (MSB or LSB first, interleaved or planar), in chunks of
+// varying sizes, and check that the packed bytes are exactly the same samples
+
+#define DSD_FORMATS 4
+
+static int reverse_bits (int byte)
+{
+    int result = 0, bit;
+
+    for (bit = 8; bit--; byte >>= 1)
+        result = (result << 1) | (byte & 1);
+
+    return result;
+}
+
+static int verify_file_dsd (const Workload *wl, FILE *wv)
+{
+    static const int formats [DSD_FORMATS] = {
+        QMODE_DSD_MSB_FIRST, QMODE_DSD_LSB_FIRST, QMODE_DSD_MSB_FIRST | QMODE_DSD_IN_BLOCKS, QMODE_DSD_LSB_FIRST | QMODE_DSD_IN_BLOCKS
+    };
+
+    int32_t *decoded = (int32_t *)malloc (CHUNK_SAMPLES * wl->num_channels * sizeof (int32_t));
+    unsigned char *packed = (unsigned char *)malloc (CHUNK_SAMPLES * wl->num_channels);
+    int64_t wv_size = 0, done = 0;
+    void *wv_data = read_whole_file (wv, &wv_size);
+    WavpackContext *wpc = NULL, *wpc_dsd [DSD_FORMATS];
+    uint32_t count, count_dsd, i;
+    int result = TRUE, f;
+    char error [80];
+
+    CLEARA (wpc_dsd);
+
+    if (!decoded || !packed || !wv_data || !(wpc = WavpackOpenMemoryInput (wv_data, wv_size, NULL, 0, error, OPEN_DSD_NATIVE, 0)))
+        result = FALSE;
+
+    for (f = 0; result && f < DSD_FORMATS; ++f)
+        if (!(wpc_dsd [f] = WavpackOpenMemoryInput (wv_data, wv_size, NULL, 0, error, OPEN_DSD_NATIVE, 0)))
+            result = FALSE;
+
+    if (!result)
+        fprintf (stderr, "%s: can't open for the DSD check\n", wl->name);
+
+    while (result) {
+        uint32_t chunk = 1 + (uint32_t) (done * 7919 % CHUNK_SAMPLES);     // vary the alignment with the blocks
+
+        count = WavpackUnpackSamples (wpc, decoded, chunk);
+
+        for (f = 0; result && f < DSD_FORMATS; ++f) {
+            int lsb_first = (formats [f] & QMODE_DSD_LSB_FIRST) != 0, planar = (formats [f] & QMODE_DSD_IN_BLOCKS) != 0;
+
+            count_dsd = WavpackUnpackSamplesDSD (wpc_dsd [f], packed, chunk, formats [f]);
+
+            if (count != count_dsd) {
+                fprintf (stderr, "%s: WavpackUnpackSamplesDSD() returned %u samples instead of %u\n", wl->name, count_dsd, count);
+                result = FALSE;
+            }
+
+            for (i = 0; result && i < count * wl->num_channels; ++i) {
+                uint32_t sample = i / wl->num_channels, channel = i % wl->num_channels;
+                int byte = packed [planar ? channel * chunk + sample : i], expected = decoded [i] & 0xff;
+
+                if (lsb_first)
+                    expected = reverse_bits (expected);
+
+                if (byte != expected) {
+                    fprintf (stderr, "%s: DSD mismatch (format 0x%02x) at sample %lld, channel %d: expected 0x%02x, got 0x%02x\n", wl->name,
+                        formats [f], (long long) (done + sample), (int) channel, expected, byte);
+                    result = FALSE;
+                }
+            }
+        }
+
+        if (!count)
+            break;
+
+        done += count;
+    }
+
+    for (f = 0; result && f < DSD_FORMATS; ++f)
+        if (WavpackGetNumErrors (wpc_dsd [f]) != WavpackGetNumErrors (wpc)) {
+            fprintf (stderr, "%s: %d errors decoding DSD bytes\n", wl->name, WavpackGetNumErrors (wpc_dsd [f]));
+            result = FALSE;
+        }
+
+    if (wpc)
+        WavpackCloseFile (wpc);
+
+    for (f = 0; f < DSD_FORMATS; ++f)
+        if (wpc_dsd [f])
+            WavpackCloseFile (wpc_dsd [f]);
+
+    free (wv_data);
+    free (decoded);
+    free (packed);
+    return result;
+}
+
+// Make a damaged copy of the correction file (returning NULL if it has too few
+// blocks or there's no memory): "truncated" ends in the middle of a block two
+// thirds of the way in, "corrupted" has a byte changed in every fifth block from
+// a quarter of the way in, and "stale block" has a copy of the header of the
+// block before the middle one inserted before that, with its size changed to
+// take in the next three blocks. The decoder should skip just that header (the
+// correction file is behind there) and then find the middle block, rather than
+// skip over the blocks that the header claims.
+
+enum { DAMAGE_TRUNCATED, DAMAGE_CORRUPTED, DAMAGE_STALE_BLOCK, NUM_DAMAGES };
+
+static const char *damage_names [NUM_DAMAGES] = { "truncated", "corrupted", "stale block" };
+
+#define NEXT_BLOCK(data,pos) ((pos) + 8 + ((data) [(pos) + 4] | (data) [(pos) + 5] << 8 | (int64_t) (data) [(pos) + 6] << 16))
+
+static unsigned char *damage_wvc (const unsigned char *wvc_data, int64_t wvc_size, int damage, int64_t *size)
+{
+    int num_blocks = 0, i, k;
+    unsigned char *damaged;
+    int64_t *blocks, pos;
+
+    for (pos = 0; pos + 32 <= wvc_size; pos = NEXT_BLOCK (wvc_data, pos))
+        num_blocks++;
+
+    if (num_blocks < 8 || !(blocks = (int64_t *)malloc ((num_blocks + 1) * sizeof (int64_t))))
+        return NULL;
+
+    for (pos = i = 0; i < num_blocks; pos = NEXT_BLOCK (wvc_data, pos))
+        blocks [i++] = pos;
+
+    blocks [num_blocks] = wvc_size;
+
+    if (!(damaged = (unsigned char *)malloc ((size_t) wvc_size + 32))) {
+        free (blocks);
+        return NULL;
+    }
+
+    k = num_blocks / 2;
+    *size = wvc_size;
+    memcpy (damaged, wvc_data, (size_t) wvc_size);
+
+    if (damage == DAMAGE_TRUNCATED)
+        *size = (blocks [num_blocks * 2 / 3] + blocks [num_blocks * 2 / 3 + 1]) / 2;
+    else if (damage == DAMAGE_CORRUPTED)
+        for (i = num_blocks / 4; i < num_blocks; i += 5)
+            damaged [(blocks [i] + 32 + blocks [i + 1]) / 2] ^= 0x55;
+    else {
+        uint32_t ckSize = (uint32_t) (blocks [k + 3] - blocks [k] + 24);
+
+        memcpy (damaged + blocks [k], wvc_data + blocks [k - 1], 32);
+        damaged [blocks [k] + 4] = (unsigned char) ckSize;
+        damaged [blocks [k] + 5] = (unsigned char) (ckSize >> 8);
+        damaged [blocks [k] + 6] = (unsigned char) (ckSize >> 16);
+        memcpy (damaged + blocks [k] + 32, wvc_data + blocks [k], (size_t) (wvc_size - blocks [k]));
+        *size += 32;
+    }
+
+    free (blocks);
+    return damaged;
+}
+
+// Decode the file with each kind of damaged correction file (see damage_wvc()),
+// both with the correction file read on its own thread (OPEN_WVC_THREAD) and
+// without, and check that they return exactly the same samples and errors
+
+static int verify_damaged_wvc (const Workload *wl, FILE *wv, FILE *wvc)
+{
+    int32_t *decoded = (int32_t *)malloc (CHUNK_SAMPLES * wl->num_channels * sizeof (int32_t));
+    int32_t *decoded_thread = (int32_t *)malloc (CHUNK_SAMPLES * wl->num_channels * sizeof (int32_t));
+    int64_t wv_size = 0, wvc_size = 0;
+    void *wv_data = read_whole_file (wv, &wv_size), *wvc_data = read_whole_file (wvc, &wvc_size);
+    int result = decoded && decoded_thread && wv_data && wvc_data, damage;
+
+    if (!result)
+        fprintf (stderr, "%s: can't read the files for the damaged correction file check\n", wl->name);
+
+    for (damage = 0; result && damage < NUM_DAMAGES; ++damage) {
+        WavpackContext *wpc = NULL, *wpc_thread = NULL;
+        int64_t damaged_size, done = 0;
+        unsigned char *damaged = damage_wvc (wvc_data, wvc_size, damage, &damaged_size);
+        uint32_t count, count_thread, i;
+        char error [80];
+
+        if (!damaged)
+            continue;           // too few blocks to damage
+
+        if (!(wpc = WavpackOpenMemoryInput (wv_data, wv_size, damaged, damaged_size, error, OPEN_WVC, 0)) ||
+            !(wpc_thread = WavpackOpenMemoryInput (wv_data, wv_size, damaged, damaged_size, error, OPEN_WVC | OPEN_WVC_THREAD, 0))) {
+                fprintf (stderr, "%s: can't open with the %s correction file\n", wl->name, damage_names [damage]);
+                result = FALSE;
+        }
+
+        while (result) {
+            count = WavpackUnpackSamples (wpc, decoded, CHUNK_SAMPLES);
+            count_thread = WavpackUnpackSamples (wpc_thread, decoded_thread, CHUNK_SAMPLES);
+
+            if (count != count_thread) {
+                fprintf (stderr, "%s: with the %s correction file, the reader thread returned %u samples instead of %u\n",
+                    wl->name, damage_names [damage], count_thread, count);
+                result = FALSE;
+            }
+
+            for (i = 0; result && i < count * wl->num_channels; ++i)
+                if (decoded_thread [i] != decoded [i]) {
+                    fprintf (stderr, "%s: with the %s correction file, the reader thread mismatched at sample %lld, channel %d\n",
+                        wl->name, damage_names [damage], (long long) (done + i / wl->num_channels), (int) (i % wl->num_channels));
+                    result = FALSE;
+                }
+
+            if (!count)
+                break;
+
+            done += count;
+        }
+
+        if (result && WavpackGetNumErrors (wpc_thread) != WavpackGetNumErrors (wpc)) {
+            fprintf (stderr, "%s: with the %s correction file, the reader thread had %d errors instead of %d\n", wl->name,
+                damage_names [damage], WavpackGetNumErrors (wpc_thread), WavpackGetNumErrors (wpc));
+            result = FALSE;
+        }
+
+        if (wpc)
+            WavpackCloseFile (wpc);
+
+        if (wpc_thread)
+            WavpackCloseFile (wpc_thread);
+
+        free (damaged);
+    }
+
+    free (wv_data);
+    free (wvc_data);
+    free (decoded);
+    free (decoded_thread);
+    return result;
+}
+
+static int run_workload (const Workload *wl, double seconds, const char *directory, int verify)
+{
+    int64_t total_samples = (int64_t) (seconds * wl->sample_rate + 0.5);
+    char wv_name [1024], wvc_name [1024];
+    FILE *wv, *wvc = NULL;
+    double raw_bytes;
+    int result;
+
+    snprintf (wv_name, sizeof (wv_name), "%s/%s.wv", directory, wl->name);
+    snprintf (wvc_name, sizeof (wvc_name), "%s/%s.wvc", directory, wl->name);
+
+    if (!(wv = fopen (wv_name, "w+b")) || (wl->wvc && !(wvc = fopen (wvc_name, "w+b")))) {
+        fprintf (stderr, "%s: can't create %s\n", wl->name, wv ? wvc_name : wv_name);
+
+        if (wv)
+            fclose (wv);
+
+        return FALSE;
+    }
+
+    result = encode_file (wl, total_samples, wv, wvc) && !fflush (wv) && (!wvc || !fflush (wvc));
+
+    if (result && verify) {
+        result = verify_file (wl, total_samples, wv, wvc, wl->hybrid_bits && !wvc, 0);
+
+        if (result && wvc)
+            result = verify_file (wl, total_samples, wv, wvc, FALSE, OPEN_WVC_THREAD) &&
+                verify_file (wl, total_samples, wv, NULL, TRUE, 0) && verify_damaged_wvc (wl, wv, wvc);
+
+        // WavpackSeekSample64() doesn't skip more than 131072 samples into a block
+
+        if (result && !wl->dsd && !wl->float_data && (!wl->hybrid_bits || wvc) && wl->block_samples <= 131072)
+            result = verify_seeks (wl, total_samples, wv, wvc);
+
+        if (result && !wl->dsd && !wl->float_data && wl->bits_per_sample <= 16)
+            result = verify_file16 (wl, wv, wvc);
+
+        if (result && !wl->dsd)
+            result = verify_file_float (wl, wv, wvc);
+
+        if (result && wl->dsd)
+            result = verify_file_dsd (wl, wv);
+    }
+
+    raw_bytes = (double) total_samples * wl->num_channels * (wl->dsd ? 1 : (wl->bits_per_sample + 7) / 8);
+
+    printf ("%-20s %12lld bytes%s  ratio %5.1f%%  %s\n", wl->name, (long long) (file_size (wv) + file_size (wvc)),
+        wvc ? " (wv+wvc)" : "        ", raw_bytes ? (file_size (wv) + file_size (wvc)) * 100.0 / raw_bytes : 0.0,
+        !result ? "FAILED" : (verify ? "verified" : "not verified"));
+
+    fclose (wv);
+
+    if (wvc)
+        fclose (wvc);
+
+    return result;
+}
+
+static double parse_duration (const char *string)
+{
+    char *end;
+    double value = strtod (string, &end);
+
+    if (end == string || value <= 0)
+        return 0;
+
+    if (*end == 'm')
+        value *= 60;
+    else if (*end == 'h')
+        value *= 3600;
+    else if (*end && *end != 's')
+        return 0;
+
+    return value;
+}
+
+int main (int argc, char **argv)
+{
+    const char *directory = ".";
+    int verify = TRUE, selected = 0, failures = 0, i, w;
+    double seconds = 10.0;
+
+    for (i = 1; i < argc && argv [i] [0] == '-'; ++i)
+        if (!strcmp (argv [i], "-d") && i + 1 < argc) {
+            if (!(seconds = parse_duration (argv [++i]))) {
+                fprintf (stderr, "invalid duration: %s\n", argv [i]);
+                return 1;
+            }
+        }
+        else if (!strcmp (argv [i], "-o") && i + 1 < argc)
+            directory = argv [++i];
+        else if (!strcmp (argv [i], "-n"))
+            verify = FALSE;
+        else if (!strcmp (argv [i], "-l")) {
+            for (w = 0; w < NUM_WORKLOADS; ++w)
+                printf ("%-20s %s\n", workloads [w].name, workloads [w].description);
+
+            return 0;
+        }
+        else {
+            fprintf (stderr, "usage: %s [-d duration] [-o directory] [-n] [-l] [workload ...]\n", argv [0]);
+            return 1;
+        }
+
+    for (w = 0; w < NUM_WORKLOADS; ++w) {
+        int j, run = (i == argc);
+
+        for (j = i; j < argc; ++j)
+            if (!strcmp (argv [j], workloads [w].name))
+                run = TRUE;
+
+        if (run) {
+            selected++;
+
+            if (!run_workload (workloads + w, seconds, directory, verify))
+                failures++;
+        }
+    }
+
+    if (!selected) {
+        fprintf (stderr, "no matching workloads (use -l to list them)\n");
+        return 1;
+    }
+
+    return failures ? 1 : 0;
+}
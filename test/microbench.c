@@ -0,0 +1,1139 @@
+////////////////////////////////////////////////////////////////////////////
+//                           **** WAVPACK ****                            //
+//                  Hybrid Lossless Wavefile Compressor                   //
+//                Copyright (c) 1998 - 2024 David Bryant.                 //
+//                          All Rights Reserved.                          //
+//      Distributed under the BSD Software License (see license.txt)      //
+////////////////////////////////////////////////////////////////////////////
+
+// microbench.c
+
+// Kernel microbenchmarks: the decoder's inner loops are timed in isolation
+// on synthetic decorrelation states and data and on bitstreams captured from
+// real WavPack files, and every alternate version of a kernel is checked for
+// identical results against the plain C version (or, where there is only one
+// version, against a straightforward reference implementation). The modules
+// containing the kernels are included directly so that their static functions
+// are visible; the rest of the library is linked normally. If the x86-64
+// assembly decorrelation passes are built in (OPT_ASM_X64), they are timed
+// and checked against the C passes.
+//
+// usage: microbenchmark [-s min_seconds] [file.wv ...]
+//   -s  minimum time to run each measurement (default 0.2 seconds)
+//
+// A "sample" here is a single sample of a single channel. The exit status is
+// nonzero if any cross-check fails.
+
+#include "../unpack.c"
+#include "../read_words.c"
+#include "../unpack_floats.c"
+#include "../unpack_dsd.c"
+
+#include <stdio.h>
+#include <math.h>
+#include <time.h>
+
+#define BENCH_SAMPLES 4096      // (stereo) samples per kernel call for synthetic data
+
+static double min_seconds = 0.2;
+static int failures;
+
+static double now (void)
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1.0e-9;
+}
+
+// simple xorshift generator so that the synthetic data is the same every run
+
+static uint32_t random_state = 0x12345678;
+
+static uint32_t random32 (void)
+{
+    random_state ^= random_state << 13;
+    random_state ^= random_state >> 17;
+    random_state ^= random_state << 5;
+    return random_state;
+}
+
+static int32_t random_range (int32_t range)
+{
+    return (int32_t)(random32 () % (2 * (uint32_t) range + 1)) - range;
+}
+
+// Print one result line; "check" is -1 for no cross-check, otherwise TRUE if it matched
+
+static void report (const char *kernel, const char *variant, double seconds, int64_t samples, int check)
+{
+    printf ("%-40s %-10s %10.3f ns/sample  %s\n", kernel, variant, samples ? seconds * 1.0e9 / samples : 0.0,
+        check < 0 ? "" : (check ? "ok" : "MISMATCH"));
+
+    if (!check)
+        failures++;
+}
+
+// report a cross-check that isn't timed
+
+static void report_check (const char *kernel, const char *variant, int check)
+{
+    printf ("%-40s %-10s %-23s%s\n", kernel, variant, "", check ? "ok" : "MISMATCH");
+
+    if (!check)
+        failures++;
+}
+
+////////////////////////////// decorrelation passes ///////////////////////////////
+
+static const int stereo_terms [] = { -3, -2, -1, 1, 2, 3, 4, 5, 6, 7, 8, 17, 18 };
+static const int mono_terms [] = { 1, 2, 3, 4, 5, 6, 7, 8, 17, 18 };
+
+static void init_decorr_pass (struct decorr_pass *dpp, int term, int32_t range)
+{
+    int i;
+
+    memset (dpp, 0, sizeof (*dpp));
+    dpp->term = term;
+    dpp->delta = 2;
+    dpp->weight_A = random_range (1024);
+    dpp->weight_B = random_range (1024);
+
+    for (i = 0; i < MAX_TERM; ++i) {
+        dpp->samples_A [i] = random_range (range);
+        dpp->samples_B [i] = random_range (range);
+    }
+}
+
+// Leave the history of a pass in the same order the assembly versions (and
+// the mono C version) return it, like unpack_samples() does
+
+static void normalize_pass (struct decorr_pass *dpp, int m)
+{
+    if (m && dpp->term > 0 && dpp->term <= MAX_TERM) {
+        int32_t temp_A [MAX_TERM], temp_B [MAX_TERM];
+        int k;
+
+        memcpy (temp_A, dpp->samples_A, sizeof (dpp->samples_A));
+        memcpy (temp_B, dpp->samples_B, sizeof (dpp->samples_B));
+
+        for (k = 0; k < MAX_TERM; k++) {
+            dpp->samples_A [k] = temp_A [m];
+            dpp->samples_B [k] = temp_B [m];
+            m = (m + 1) & (MAX_TERM - 1);
+        }
+    }
+}
+
+#ifdef DECORR_STEREO_PASS_CONT
+
+// Compare the results of two passes. The assembly versions only return the
+// history that's actually used by the term, so that's all that's compared.
+
+static int same_pass (const struct decorr_pass *a, const struct decorr_pass *b)
+{
+    int history = (a->term > 0 && a->term <= MAX_TERM) ? a->term : (a->term > MAX_TERM ? 2 : 1);
+
+    return a->weight_A == b->weight_A && a->weight_B == b->weight_B &&
+        !memcmp (a->samples_A, b->samples_A, history * sizeof (a->samples_A [0])) &&
+        !memcmp (a->samples_B, b->samples_B, history * sizeof (a->samples_B [0]));
+}
+
+#endif
+
+// Generate the residuals for the given pass (which is not modified) from a
+// bounded random signal by running the pass in the encoding direction, so
+// that decoding them returns that signal (and doesn't overflow like decoding
+// random residuals eventually would).
+
+static void encode_pass (const struct decorr_pass *pass, int32_t *buffer, int channels, int32_t range)
+{
+    struct decorr_pass dp = *pass, *dpp = &dp;
+    int32_t signal [2] = { 0, 0 }, *bptr = buffer;
+    int m = 0, k = dpp->term & (MAX_TERM - 1), i, ch;
+
+    for (i = 0; i < BENCH_SAMPLES; ++i) {
+        int32_t x [2];
+
+        for (ch = 0; ch < channels; ++ch) {
+            signal [ch] += random_range (range >> 3);
+
+            if (signal [ch] > range || signal [ch] < -range)
+                signal [ch] /= 2;
+
+            x [ch] = signal [ch];
+        }
+
+        if (dpp->term > MAX_TERM) {
+            for (ch = 0; ch < channels; ++ch) {
+                int32_t *samples = ch ? dpp->samples_B : dpp->samples_A, *weight = ch ? &dpp->weight_B : &dpp->weight_A;
+                int32_t sam = (dpp->term & 1) ? 2 * samples [0] - samples [1] : (3 * samples [0] - samples [1]) >> 1;
+
+                bptr [ch] = x [ch] - apply_weight (*weight, sam);
+                update_weight (*weight, dpp->delta, sam, bptr [ch]);
+                samples [1] = samples [0];
+                samples [0] = x [ch];
+            }
+        }
+        else if (dpp->term > 0) {
+            for (ch = 0; ch < channels; ++ch) {
+                int32_t *samples = ch ? dpp->samples_B : dpp->samples_A, *weight = ch ? &dpp->weight_B : &dpp->weight_A;
+                int32_t sam = samples [m];
+
+                bptr [ch] = x [ch] - apply_weight (*weight, sam);
+                update_weight (*weight, dpp->delta, sam, bptr [ch]);
+                samples [k] = x [ch];
+            }
+
+            m = (m + 1) & (MAX_TERM - 1);
+            k = (k + 1) & (MAX_TERM - 1);
+        }
+        else if (dpp->term == -1) {
+            bptr [0] = x [0] - apply_weight (dpp->weight_A, dpp->samples_A [0]);
+            update_weight_clip (dpp->weight_A, dpp->delta, dpp->samples_A [0], bptr [0]);
+            bptr [1] = x [1] - apply_weight (dpp->weight_B, x [0]);
+            update_weight_clip (dpp->weight_B, dpp->delta, x [0], bptr [1]);
+            dpp->samples_A [0] = x [1];
+        }
+        else if (dpp->term == -2) {
+            bptr [1] = x [1] - apply_weight (dpp->weight_B, dpp->samples_B [0]);
+            update_weight_clip (dpp->weight_B, dpp->delta, dpp->samples_B [0], bptr [1]);
+            bptr [0] = x [0] - apply_weight (dpp->weight_A, x [1]);
+            update_weight_clip (dpp->weight_A, dpp->delta, x [1], bptr [0]);
+            dpp->samples_B [0] = x [0];
+        }
+        else {
+            bptr [0] = x [0] - apply_weight (dpp->weight_A, dpp->samples_A [0]);
+            update_weight_clip (dpp->weight_A, dpp->delta, dpp->samples_A [0], bptr [0]);
+            bptr [1] = x [1] - apply_weight (dpp->weight_B, dpp->samples_B [0]);
+            update_weight_clip (dpp->weight_B, dpp->delta, dpp->samples_B [0], bptr [1]);
+            dpp->samples_B [0] = x [0];
+            dpp->samples_A [0] = x [1];
+        }
+
+        bptr += channels;
+    }
+}
+
+// Time the decorrelation of BENCH_SAMPLES samples with the given pass (and number
+// of channels) using the C version (use_asm = FALSE) or the assembly version, leaving
+// the result in "output" and the final pass state in "result"
+
+static double time_decorr (const struct decorr_pass *dpp, const int32_t *input, int32_t *output,
+    struct decorr_pass *result, int channels, int long_math, int use_asm)
+{
+    double seconds = 0.0;
+    int64_t reps = 0;
+
+    do {
+        double start;
+
+        *result = *dpp;
+        memcpy (output, input, BENCH_SAMPLES * channels * sizeof (int32_t));
+        start = now ();
+
+        if (channels == 2) {
+#ifdef DECORR_STEREO_PASS_CONT
+            if (use_asm) {
+                int pre_samples = (dpp->term < 0 || dpp->term > MAX_TERM) ? 2 : dpp->term;
+
+                decorr_stereo_pass (result, output, pre_samples);
+                DECORR_STEREO_PASS_CONT (result, output + pre_samples * 2, BENCH_SAMPLES - pre_samples, long_math);
+            }
+            else
+#endif
+                decorr_stereo_pass (result, output, BENCH_SAMPLES);
+        }
+        else {
+#ifdef DECORR_MONO_PASS_CONT
+            if (use_asm) {
+                int pre_samples = (dpp->term > MAX_TERM) ? 2 : dpp->term;
+
+                decorr_mono_pass (result, output, pre_samples);
+                DECORR_MONO_PASS_CONT (result, output + pre_samples, BENCH_SAMPLES - pre_samples, long_math);
+            }
+            else
+#endif
+                decorr_mono_pass (result, output, BENCH_SAMPLES);
+        }
+
+        seconds += now () - start;
+        reps++;
+    } while (seconds < min_seconds);
+
+    if (channels == 2 && !use_asm)
+        normalize_pass (result, BENCH_SAMPLES & (MAX_TERM - 1));
+
+    return seconds / reps;
+}
+
+static void bench_decorr (int channels, int long_math)
+{
+    int32_t *input = malloc (BENCH_SAMPLES * 2 * sizeof (int32_t));
+    int32_t *output_c = malloc (BENCH_SAMPLES * 2 * sizeof (int32_t));
+    int32_t *output_asm = malloc (BENCH_SAMPLES * 2 * sizeof (int32_t));
+    int32_t range = long_math ? 0x7fffff : 0x7fff;
+    const int *terms = channels == 2 ? stereo_terms : mono_terms;
+    int num_terms = channels == 2 ? sizeof (stereo_terms) / sizeof (stereo_terms [0]) : sizeof (mono_terms) / sizeof (mono_terms [0]);
+    int t;
+
+    for (t = 0; t < num_terms; ++t) {
+        struct decorr_pass dpp, result_c;
+        char kernel [64];
+        double seconds;
+
+        init_decorr_pass (&dpp, terms [t], range);
+        encode_pass (&dpp, input, channels, range);
+
+        sprintf (kernel, "decorr_%s_pass %s term %d", channels == 2 ? "stereo" : "mono", long_math ? "24" : "16", terms [t]);
+        seconds = time_decorr (&dpp, input, output_c, &result_c, channels, long_math, FALSE);
+        report (kernel, "c", seconds, BENCH_SAMPLES * channels, -1);
+
+#if defined(DECORR_STEREO_PASS_CONT) && defined(DECORR_MONO_PASS_CONT)
+#ifdef DECORR_STEREO_PASS_CONT_AVAILABLE
+        if (channels == 1 || DECORR_STEREO_PASS_CONT_AVAILABLE)
+#endif
+        {
+            struct decorr_pass result_asm;
+
+            seconds = time_decorr (&dpp, input, output_asm, &result_asm, channels, long_math, TRUE);
+            report (kernel, "asm", seconds, BENCH_SAMPLES * channels,
+                !memcmp (output_c, output_asm, BENCH_SAMPLES * channels * sizeof (int32_t)) && same_pass (&result_c, &result_asm));
+        }
+#endif
+    }
+
+    free (input);
+    free (output_c);
+    free (output_asm);
+}
+
+////////////////////////////// fixup_samples() ///////////////////////////////
+
+// reference version of the non-float part of fixup_samples() (without a wvx stream), with
+// 32-bit integers getting their low bits restored in a separate pass as they used to be
+
+static void reference_fixup (const WavpackStream *wps, int32_t *buffer, uint32_t count)
+{
+    uint32_t flags = wps->wphdr.flags, i;
+    int bits = ((flags & BYTES_STORED) + 1) * 8, shift = (flags & SHIFT_MASK) >> SHIFT_LSB;
+    int64_t min_value, max_value;
+
+    if (flags & INT32_DATA) {
+        int zeros = wps->int32_zeros, ones = wps->int32_ones, dups = wps->int32_dups;
+
+        if (!wps->int32_sent_bits && (zeros + ones + dups)) {
+            while ((flags & HYBRID_FLAG) && (flags & BYTES_STORED) == 3 && shift < 8) {
+                if (zeros)
+                    zeros--;
+                else if (ones)
+                    ones--;
+                else if (dups)
+                    dups--;
+                else
+                    break;
+
+                shift++;
+            }
+
+            int32_fill_bits (buffer, count, zeros, ones, dups);
+        }
+        else
+            shift += zeros + wps->int32_sent_bits + ones + dups;
+    }
+
+    min_value = -((int64_t) 1 << (bits - 1)) >> shift;
+    max_value = (((int64_t) 1 << (bits - 1)) - 1) >> shift;
+
+    for (i = 0; i < count; ++i) {
+        int64_t value = buffer [i];
+
+        if (flags & HYBRID_FLAG) {
+            if (value < min_value)
+                value = min_value;
+            else if (value > max_value)
+                value = max_value;
+        }
+
+        buffer [i] = (int32_t)(uint32_t)((uint64_t) value << shift);
+    }
+}
+
+static void bench_fixup (const char *name, uint32_t flags, int32_t range, int int32_zeros, int int32_ones, int int32_dups)
+{
+    int32_t *input = malloc (BENCH_SAMPLES * 2 * sizeof (int32_t));
+    int32_t *output = malloc (BENCH_SAMPLES * 2 * sizeof (int32_t));
+    double seconds = 0.0;
+    WavpackStream *wps = calloc (1, sizeof (WavpackStream));
+    int64_t reps = 0;
+    int i;
+
+    wps->wphdr.flags = flags;
+    wps->int32_zeros = int32_zeros;
+    wps->int32_ones = int32_ones;
+    wps->int32_dups = int32_dups;
+
+    for (i = 0; i < BENCH_SAMPLES * 2; ++i)
+        input [i] = random_range (range);
+
+    do {
+        double start;
+
+        memcpy (output, input, BENCH_SAMPLES * 2 * sizeof (int32_t));
+        start = now ();
+        fixup_samples (wps, output, BENCH_SAMPLES);
+        seconds += now () - start;
+        reps++;
+    } while (seconds < min_seconds);
+
+    reference_fixup (wps, input, BENCH_SAMPLES * 2);
+    report (name, "c", seconds / reps, BENCH_SAMPLES * 2, !memcmp (input, output, BENCH_SAMPLES * 2 * sizeof (int32_t)));
+    free (wps);
+    free (input);
+    free (output);
+}
+
+////////////////////////////// float_values() ///////////////////////////////
+
+static void float_values_nowvx_vector (WavpackStream *wps, int32_t *values, int32_t num_values)
+{
+    float_values_nowvx (wps, values, num_values, 0);
+}
+
+static double time_float_values (WavpackStream *wps, void (*func) (WavpackStream *, int32_t *, int32_t),
+    const int32_t *input, int32_t *output)
+{
+    double seconds = 0.0;
+    int64_t reps = 0;
+
+    do {
+        double start;
+
+        memcpy (output, input, BENCH_SAMPLES * 2 * sizeof (int32_t));
+        start = now ();
+        func (wps, output, BENCH_SAMPLES * 2);
+        seconds += now () - start;
+        reps++;
+    } while (seconds < min_seconds);
+
+    return seconds / reps;
+}
+
+static void bench_float_values (void)
+{
+    int32_t *input = malloc (BENCH_SAMPLES * 2 * sizeof (int32_t));
+    int32_t *output = malloc (BENCH_SAMPLES * 2 * sizeof (int32_t));
+    int32_t *scalar = malloc (BENCH_SAMPLES * 2 * sizeof (int32_t));
+    WavpackStream *wps = calloc (1, sizeof (WavpackStream));
+    int i, j, match = TRUE, random_match = TRUE;
+    double seconds;
+
+    wps->wphdr.flags = FLOAT_DATA;
+    wps->float_max_exp = 127;   // full scale is +/-1.0
+    wps->float_shift = 0;
+
+    // mostly 24-bit values, but with some small ones (which need normalizing) and zeros
+
+    for (i = 0; i < BENCH_SAMPLES * 2; ++i)
+        switch (random32 () & 7) {
+            case 0: input [i] = 0; break;
+            case 1: input [i] = random_range (0xff); break;
+            default: input [i] = random_range (0xffffff); break;
+        }
+
+    seconds = time_float_values (wps, float_values_nowvx_vector, input, output);
+    memcpy (scalar, input, BENCH_SAMPLES * 2 * sizeof (int32_t));
+    float_values_nowvx_scalar (wps, scalar, BENCH_SAMPLES * 2);
+
+    // these values are all exactly representable, so the reference is trivial
+
+    for (i = 0; i < BENCH_SAMPLES * 2; ++i) {
+        float expected = (float) ldexp (input [i], wps->float_max_exp - 150), actual;
+
+        memcpy (&actual, output + i, sizeof (float));
+        match &= (actual == expected);
+    }
+
+    report ("float_values (no wvx)", "vector", seconds, BENCH_SAMPLES * 2,
+        match && !memcmp (output, scalar, BENCH_SAMPLES * 2 * sizeof (int32_t)));
+
+    seconds = time_float_values (wps, float_values_nowvx_scalar, input, output);
+    report ("float_values (no wvx)", "scalar", seconds, BENCH_SAMPLES * 2, -1);
+
+    // the fast version must match the scalar one bit-for-bit for any input and settings (including the
+    // values it hands off to the scalar version), so try random 32-bit values with random parameters,
+    // and with the normalization fused in half the time
+
+    for (j = 0; j < 256; ++j) {
+        int bits = (j & 31) + 1, delta_exp = (j & 32) ? random_range (254) : 0;
+
+        wps->float_shift = random32 () & 0x1f;
+        wps->float_max_exp = random32 () & 0xff;
+        wps->float_flags = (random32 () & 1) ? FLOAT_SHIFT_ONES : 0;
+
+        for (i = 0; i < 1024; ++i)
+            input [i] = bits == 32 ? (int32_t) random32 () : random_range ((1 << (bits - 1)) - 1) | (i & 1);
+
+        memcpy (output, input, 1024 * sizeof (int32_t));
+        memcpy (scalar, input, 1024 * sizeof (int32_t));
+        float_values_nowvx (wps, output, 1024, delta_exp);
+        float_values_nowvx_scalar (wps, scalar, 1024);
+        WavpackFloatNormalize (scalar, 1024, delta_exp);
+        random_match &= !memcmp (output, scalar, 1024 * sizeof (int32_t));
+    }
+
+    report_check ("float_values (no wvx) random", "vector", random_match);
+    free (wps);
+    free (input);
+    free (output);
+    free (scalar);
+}
+
+// reference version of WavpackFloatNormalize()
+
+static void reference_float_normalize (int32_t *values, int32_t num_values, int delta_exp)
+{
+    f32 *fvalues = (f32 *) values;
+    int exp;
+
+    if (!delta_exp)
+        return;
+
+    while (num_values--) {
+        if ((exp = get_exponent (*fvalues)) == 0 || exp + delta_exp <= 0)
+            *fvalues = 0;
+        else if (exp == 255 || (exp += delta_exp) >= 255) {
+            set_exponent (*fvalues, 255);
+            set_mantissa (*fvalues, 0);
+        }
+        else
+            set_exponent (*fvalues, exp);
+
+        fvalues++;
+    }
+}
+
+static void time_float_normalize (const char *name, const int32_t *input, int32_t *output, int check)
+{
+    void (*funcs [2]) (int32_t *, int32_t, int) = { WavpackFloatNormalize, reference_float_normalize };
+    int f;
+
+    for (f = 0; f < 2; ++f) {
+        double seconds = 0.0;
+        int64_t reps = 0;
+
+        do {
+            double start;
+
+            memcpy (output, input, BENCH_SAMPLES * 2 * sizeof (int32_t));
+            start = now ();
+            funcs [f] (output, BENCH_SAMPLES * 2, -15);
+            seconds += now () - start;
+            reps++;
+        } while (seconds < min_seconds);
+
+        report (name, f ? "scalar" : "vector", seconds / reps, BENCH_SAMPLES * 2, f ? -1 : check);
+    }
+}
+
+static void bench_float_normalize (void)
+{
+    static const int deltas [] = { 1, -1, 8, -8, 30, -30, 127, -127, 200, -200, 254, -254 };
+    int32_t *input = malloc (BENCH_SAMPLES * 2 * sizeof (int32_t));
+    int32_t *output = malloc (BENCH_SAMPLES * 2 * sizeof (int32_t));
+    int i, j, match = TRUE;
+
+    // random bit patterns cover zeros, denormals, infinities and NaNs as well as normal floats
+
+    for (i = 0; i < BENCH_SAMPLES * 2; ++i)
+        input [i] = (int32_t) random32 ();
+
+    for (j = 0; j < (int)(sizeof (deltas) / sizeof (deltas [0])); ++j) {
+        memcpy (output, input, BENCH_SAMPLES * 2 * sizeof (int32_t));
+        WavpackFloatNormalize (output, BENCH_SAMPLES * 2, deltas [j]);
+        reference_float_normalize (input, BENCH_SAMPLES * 2, deltas [j]);
+        match &= !memcmp (input, output, BENCH_SAMPLES * 2 * sizeof (int32_t));
+        memcpy (input, output, BENCH_SAMPLES * 2 * sizeof (int32_t));
+    }
+
+    // time random bit patterns (where the branches of the scalar version can't be predicted) and
+    // audio-like floats up to +/-1.0 (where they nearly always can)
+
+    for (i = 0; i < BENCH_SAMPLES * 2; ++i)
+        input [i] = (int32_t) random32 ();
+
+    time_float_normalize ("WavpackFloatNormalize random", input, output, match);
+
+    for (i = 0; i < BENCH_SAMPLES * 2; ++i) {
+        float value = (float) ldexp (random_range (0x7fffff), -23);
+        memcpy (input + i, &value, sizeof (float));
+    }
+
+    time_float_normalize ("WavpackFloatNormalize audio", input, output, -1);
+    free (input);
+    free (output);
+}
+
+////////////////////////////// decimate_dsd_run() ///////////////////////////////
+
+// reference version of decimate_dsd_run() (without the extrapolation after a reset), going
+// through all the channels for every sample with the filter histories in the context
+
+static void reference_decimate (void *decimate_context, int32_t *samples, int num_samples)
+{
+    DecimationContext *context = (DecimationContext *) decimate_context;
+    int chan = 0, scount = num_samples, i;
+    int32_t *samptr = samples;
+
+    while (scount) {
+        DecimationChannel *sp = context->chans + chan;
+        int32_t sum = 0;
+
+        for (i = 0; i < HISTORY_BYTES-1; ++i)
+            sum += context->conv_tables [i] [sp->delay [i] = sp->delay [i+1]];
+
+        sum += context->conv_tables [i] [sp->delay [i] = (unsigned char)*samptr];
+        *samptr++ = (sum + 8) >> 4;
+
+        if (++chan == context->num_channels) {
+            scount--;
+            chan = 0;
+        }
+    }
+}
+
+static void bench_decimate (int num_channels)
+{
+    int32_t *input = malloc (BENCH_SAMPLES * num_channels * sizeof (int32_t));
+    int32_t *output = malloc (BENCH_SAMPLES * num_channels * sizeof (int32_t));
+    int32_t *chunked = malloc (BENCH_SAMPLES * num_channels * sizeof (int32_t));
+    void *context = decimate_dsd_init (num_channels), *chunked_context = decimate_dsd_init (num_channels);
+    void *reference_context = decimate_dsd_init (num_channels);
+    size_t bytes = BENCH_SAMPLES * num_channels * sizeof (int32_t);
+    double seconds = 0.0, reference_seconds = 0.0;
+    int64_t reps = 0;
+    char name [40];
+    int i, match;
+
+    for (i = 0; i < BENCH_SAMPLES * num_channels; ++i)
+        input [i] = random32 () & 0xff;
+
+    // the first call after a reset extrapolates the start, so get past that first
+
+    memcpy (output, input, bytes);
+    decimate_dsd_run (context, output, BENCH_SAMPLES);
+
+    do {
+        double start;
+
+        memcpy (output, input, bytes);
+        start = now ();
+        decimate_dsd_run (context, output, BENCH_SAMPLES);
+        seconds += now () - start;
+        reps++;
+    } while (seconds < min_seconds);
+
+    // decimating the same data in small pieces (continuing from the same history) must give the same result
+
+    memcpy (chunked, input, bytes);
+    decimate_dsd_run (chunked_context, chunked, BENCH_SAMPLES);
+    memcpy (chunked, input, bytes);
+
+    for (i = 0; i < BENCH_SAMPLES; i += 37)
+        decimate_dsd_run (chunked_context, chunked + i * num_channels, BENCH_SAMPLES - i < 37 ? BENCH_SAMPLES - i : 37);
+
+    match = !memcmp (output, chunked, bytes);
+
+    // and so must the reference version (once its history has also been primed with the input)
+
+    memcpy (chunked, input, bytes);
+    reference_decimate (reference_context, chunked, BENCH_SAMPLES);
+    memcpy (chunked, input, bytes);
+    reference_decimate (reference_context, chunked, BENCH_SAMPLES);
+    match &= !memcmp (output, chunked, bytes);
+
+    snprintf (name, sizeof (name), "decimate_dsd_run (%d channels)", num_channels);
+    report (name, "c", seconds / reps, BENCH_SAMPLES * num_channels, match);
+    reps = 0;
+
+    do {
+        double start;
+
+        memcpy (chunked, input, bytes);
+        start = now ();
+        reference_decimate (reference_context, chunked, BENCH_SAMPLES);
+        reference_seconds += now () - start;
+        reps++;
+    } while (reference_seconds < min_seconds);
+
+    report (name, "reference", reference_seconds / reps, BENCH_SAMPLES * num_channels, -1);
+
+    decimate_dsd_destroy (context);
+    decimate_dsd_destroy (chunked_context);
+    decimate_dsd_destroy (reference_context);
+    free (input);
+    free (output);
+    free (chunked);
+}
+
+////////////////////////////// DSD decoding ///////////////////////////////
+
+// reference version of decode_fast_kernel(), with all the state in the stream
+
+static int reference_decode_fast (WavpackStream *wps, int32_t *output, int sample_count)
+{
+    int total_samples = sample_count;
+
+    if (!(wps->wphdr.flags & MONO_DATA))
+        total_samples *= 2;
+
+    while (total_samples--) {
+        unsigned int mult, index, code, i;
+
+        if (!wps->dsd.tables.summed_probabilities [wps->dsd.p0] [255])
+            return 0;
+
+        mult = (wps->dsd.high - wps->dsd.low) / wps->dsd.tables.summed_probabilities [wps->dsd.p0] [255];
+
+        if (!mult) {
+            if (wps->dsd.endptr - wps->dsd.byteptr >= 4)
+                for (i = 4; i--;)
+                    wps->dsd.value = (wps->dsd.value << 8) | *wps->dsd.byteptr++;
+
+            wps->dsd.low = 0;
+            wps->dsd.high = 0xffffffff;
+            mult = wps->dsd.high / wps->dsd.tables.summed_probabilities [wps->dsd.p0] [255];
+
+            if (!mult)
+                return 0;
+        }
+
+        index = (wps->dsd.value - wps->dsd.low) / mult;
+
+        if (index >= wps->dsd.tables.summed_probabilities [wps->dsd.p0] [255])
+            return 0;
+
+        if ((*output++ = code = wps->dsd.tables.value_lookup [wps->dsd.p0] [index]) != 0)
+            wps->dsd.low += wps->dsd.tables.summed_probabilities [wps->dsd.p0] [code-1] * mult;
+
+        wps->dsd.high = wps->dsd.low + wps->dsd.tables.probabilities [wps->dsd.p0] [code] * mult - 1;
+        wps->crc += (wps->crc << 1) + code;
+
+        if (wps->wphdr.flags & MONO_DATA)
+            wps->dsd.p0 = code & (wps->dsd.history_bins-1);
+        else {
+            wps->dsd.p0 = wps->dsd.p1;
+            wps->dsd.p1 = code & (wps->dsd.history_bins-1);
+        }
+
+        while (DSD_BYTE_READY (wps->dsd.high, wps->dsd.low) && wps->dsd.byteptr < wps->dsd.endptr) {
+            wps->dsd.value = (wps->dsd.value << 8) | *wps->dsd.byteptr++;
+            wps->dsd.high = (wps->dsd.high << 8) | 0xff;
+            wps->dsd.low <<= 8;
+        }
+    }
+
+    return sample_count;
+}
+
+// Time decoding the first block of the given DSD file with decode_fast_kernel() or decode_high_kernel()
+// (depending on its mode), starting from the state the block was opened with each time.
+// Fast mode is checked against reference_decode_fast(), including the state that's left
+// and the checksum. Raw DSD (mode 0) is just a copy, so it's skipped.
+
+static void bench_dsd (const char *filename, WavpackStream *wps)
+{
+    uint32_t samples = wps->wphdr.block_samples;
+    int channels = (wps->wphdr.flags & MONO_DATA) ? 1 : 2, fast = wps->dsd.mode == 1, result = 0;
+    int32_t *output = malloc (samples * channels * sizeof (int32_t));
+    int32_t *reference = malloc (samples * channels * sizeof (int32_t));
+    WavpackStream *saved = malloc (sizeof (WavpackStream));
+    int32_t ptable [PTABLE_BINS];
+    double seconds = 0.0;
+    int64_t reps = 0;
+    char kernel [64];
+
+    if (!wps->dsd.mode) {
+        fprintf (stderr, "%s is raw DSD, skipping\n", filename);
+        free (output);
+        free (reference);
+        free (saved);
+        return;
+    }
+
+    sprintf (kernel, "%s %.22s", fast ? "decode_fast" : "decode_high", filename);
+
+    if (!fast)
+        memcpy (ptable, wps->dsd.tables.ptable, sizeof (ptable));
+
+    memcpy (saved, wps, sizeof (WavpackStream));
+
+    do {
+        double start;
+
+        memcpy (wps, saved, sizeof (WavpackStream));
+
+        if (!fast)
+            memcpy (wps->dsd.tables.ptable, ptable, sizeof (ptable));
+
+        start = now ();
+        result = fast ? decode_fast_kernel (wps, output, NULL, NULL, 0, samples, DSD_VALUES) :
+            decode_high_kernel (wps, output, NULL, NULL, 0, samples, DSD_VALUES);
+        seconds += now () - start;
+        reps++;
+    } while (seconds < min_seconds);
+
+    report (kernel, "c", seconds / reps, (int64_t) samples * channels,
+        fast ? -1 : result == (int) samples && wps->crc == wps->wphdr.crc);
+
+    if (fast) {
+        WavpackStream *fast_state = malloc (sizeof (WavpackStream));
+        int reference_result = 0;
+
+        memcpy (fast_state, wps, sizeof (WavpackStream));
+        seconds = 0.0;
+        reps = 0;
+
+        do {
+            double start;
+
+            memcpy (wps, saved, sizeof (WavpackStream));
+            start = now ();
+            reference_result = reference_decode_fast (wps, reference, samples);
+            seconds += now () - start;
+            reps++;
+        } while (seconds < min_seconds);
+
+        report (kernel, "reference", seconds / reps, (int64_t) samples * channels,
+            result == (int) samples && reference_result == result && !memcmp (output, reference, samples * channels * sizeof (int32_t)) &&
+            fast_state->crc == wps->crc && fast_state->crc == wps->wphdr.crc && !memcmp (&fast_state->dsd, &wps->dsd, sizeof (wps->dsd)));
+
+        free (fast_state);
+    }
+
+    memcpy (wps, saved, sizeof (WavpackStream));
+
+    if (!fast)
+        memcpy (wps->dsd.tables.ptable, ptable, sizeof (ptable));
+
+    free (saved);
+    free (output);
+    free (reference);
+}
+
+////////////////////////////// captured bitstreams ///////////////////////////////
+
+static void wrap_to_start (Bitstream *bs)
+{
+    bs->ptr = bs->buf;
+}
+
+// reference version of read_code() that reads one bit at a time
+
+static uint32_t reference_read_code (Bitstream *bs, uint32_t maxcode)
+{
+    uint32_t extras, code = 0;
+    int bitcount, i;
+
+    if (maxcode < 2)
+        return maxcode ? getbit (bs) : 0;
+
+    bitcount = count_bits (maxcode);
+    extras = (1 << bitcount) - maxcode - 1;
+
+    for (i = 0; i < bitcount - 1; ++i)
+        if (getbit (bs))
+            code |= 1U << i;
+
+    if (code >= extras)
+        code = (code << 1) - extras + getbit (bs);
+
+    return code;
+}
+
+#define NUM_CODES 4096
+
+static void bench_read_code (const char *filename, Bitstream *wvbits)
+{
+    uint32_t *maxcodes = malloc (NUM_CODES * sizeof (uint32_t));
+    uint32_t *codes = malloc (NUM_CODES * sizeof (uint32_t));
+    uint32_t *reference_codes = malloc (NUM_CODES * sizeof (uint32_t));
+    Bitstream bs, reference_bs;
+    double seconds = 0.0;
+    int64_t reps = 0;
+    char kernel [64];
+    int i, match;
+
+    // the maximum codes used by get_words_lossless() are mostly small
+
+    for (i = 0; i < NUM_CODES; ++i)
+        maxcodes [i] = (random32 () & 3) ? random32 () % 64 : random32 () % 65536;
+
+    memset (&bs, 0, sizeof (bs));
+    bs.buf = wvbits->buf;
+    bs.end = wvbits->end;
+    bs.wrap = wrap_to_start;
+
+    do {
+        double start;
+
+        bs.ptr = bs.buf - 1;
+        bs.sr = bs.bc = 0;
+        start = now ();
+
+        for (i = 0; i < NUM_CODES; ++i)
+            codes [i] = read_code (&bs, maxcodes [i]);
+
+        seconds += now () - start;
+        reps++;
+    } while (seconds < min_seconds);
+
+    reference_bs = bs;
+    reference_bs.ptr = reference_bs.buf - 1;
+    reference_bs.sr = reference_bs.bc = 0;
+
+    for (i = 0; i < NUM_CODES; ++i)
+        reference_codes [i] = reference_read_code (&reference_bs, maxcodes [i]);
+
+    match = !memcmp (codes, reference_codes, NUM_CODES * sizeof (uint32_t)) &&
+        reference_bs.ptr == bs.ptr && reference_bs.bc == bs.bc;
+
+    sprintf (kernel, "read_code %.22s", filename);
+    report (kernel, "c", seconds / reps, NUM_CODES, match);
+    free (maxcodes);
+    free (codes);
+    free (reference_codes);
+}
+
+// If the first block of the file uses one of the preset term lists that have a
+// fused kernel, time that kernel on the block's words against running the passes
+// one at a time (like unpack_samples() does for any other terms), and check that
+// both return the same samples and leave the passes in the same state.
+
+static void bench_preset (const char *filename, WavpackStream *wps, const int32_t *words, uint32_t samples)
+{
+    int32_t *output_passes = malloc (samples * 2 * sizeof (int32_t));
+    int32_t *output_fused = malloc (samples * 2 * sizeof (int32_t));
+    struct decorr_pass passes [MAX_NTERMS], result_passes [MAX_NTERMS];
+    int long_math = ((wps->wphdr.flags & MAG_MASK) >> MAG_LSB) >= 16;
+    double seconds = 0.0;
+    int64_t reps = 0;
+    char kernel [64];
+    int t;
+
+    memcpy (passes, wps->decorr_passes, sizeof (passes));
+    sprintf (kernel, "decorr preset %d %.22s", wps->decorr_preset, filename);
+
+    do {
+        double start;
+
+        memcpy (wps->decorr_passes, passes, sizeof (passes));
+        memcpy (output_passes, words, samples * 2 * sizeof (int32_t));
+        start = now ();
+
+        for (t = 0; t < wps->num_terms; ++t)
+            if (long_math)
+                decorr_stereo_pass (wps->decorr_passes + t, output_passes, samples);
+            else
+                decorr_stereo_pass_short (wps->decorr_passes + t, output_passes, samples);
+
+        seconds += now () - start;
+        reps++;
+    } while (seconds < min_seconds);
+
+    normalize_decorr_samples (wps, samples & (MAX_TERM - 1));
+    memcpy (result_passes, wps->decorr_passes, sizeof (result_passes));
+    report (kernel, "passes", seconds / reps, (int64_t) samples * 2, -1);
+    seconds = 0.0;
+    reps = 0;
+
+#ifdef DECORR_STEREO_PASS_CONT
+    // the assembly passes are what unpack_samples() uses for other terms (when available)
+
+    if (samples >= 16 && DECORR_STEREO_PASS_CONT_AVAILABLE) {
+        do {
+            double start;
+
+            memcpy (wps->decorr_passes, passes, sizeof (passes));
+            memcpy (output_fused, words, samples * 2 * sizeof (int32_t));
+            start = now ();
+
+            for (t = 0; t < wps->num_terms; ++t) {
+                struct decorr_pass *dpp = wps->decorr_passes + t;
+                int pre_samples = (dpp->term < 0 || dpp->term > MAX_TERM) ? 2 : dpp->term;
+
+                decorr_stereo_pass (dpp, output_fused, pre_samples);
+                DECORR_STEREO_PASS_CONT (dpp, output_fused + pre_samples * 2, samples - pre_samples, long_math);
+            }
+
+            seconds += now () - start;
+            reps++;
+        } while (seconds < min_seconds);
+
+        report (kernel, "asm passes", seconds / reps, (int64_t) samples * 2,
+            !memcmp (output_passes, output_fused, samples * 2 * sizeof (int32_t)));
+        seconds = 0.0;
+        reps = 0;
+    }
+#endif
+
+    do {
+        double start;
+
+        memcpy (wps->decorr_passes, passes, sizeof (passes));
+        memcpy (output_fused, words, samples * 2 * sizeof (int32_t));
+        start = now ();
+        decorr_stereo_preset (wps, output_fused, samples, long_math);
+        seconds += now () - start;
+        reps++;
+    } while (seconds < min_seconds);
+
+    normalize_decorr_samples (wps, samples & (MAX_TERM - 1));
+    report (kernel, "fused", seconds / reps, (int64_t) samples * 2,
+        !memcmp (output_passes, output_fused, samples * 2 * sizeof (int32_t)) &&
+        !memcmp (result_passes, wps->decorr_passes, sizeof (result_passes)));
+
+    memcpy (wps->decorr_passes, passes, sizeof (passes));
+    free (output_passes);
+    free (output_fused);
+}
+
+// Time get_words_lossless() or (for lossy hybrid files) get_words_hybrid() over
+// the first audio block of the given file, and check it against decoding the same
+// block one word at a time with get_word(), including the entropy decoder state
+// that's left. Then time read_code()
+// on the same bitstream and the fused decorrelation kernel (if there is one) on
+// the decoded words. DSD files go to bench_dsd() instead.
+
+static void bench_file (const char *filename)
+{
+    WavpackContext *wpc = NULL;
+    unsigned char *data = NULL;
+    char error [80], kernel [64];
+    FILE *file = fopen (filename, "rb");
+    long size = 0;
+
+    if (file && !fseek (file, 0, SEEK_END) && (size = ftell (file)) > 0 && !fseek (file, 0, SEEK_SET) &&
+        (data = malloc (size)) && fread (data, 1, size, file) == (size_t) size)
+            wpc = WavpackOpenMemoryInput (data, size, NULL, 0, error, OPEN_DSD_NATIVE, 0);
+
+    if (file)
+        fclose (file);
+
+    if (!wpc)
+        fprintf (stderr, "can't open %s, skipping\n", filename);
+    else if (!wpc->streams [0]->wphdr.block_samples)
+        fprintf (stderr, "%s has no audio, skipping\n", filename);
+    else if (wpc->streams [0]->wphdr.flags & DSD_FLAG)
+        bench_dsd (filename, wpc->streams [0]);
+    else {
+        WavpackStream *wps = wpc->streams [0];
+        Bitstream wvbits = wps->wvbits;
+        struct words_data w = wps->w;
+        uint32_t samples = wps->wphdr.block_samples, i;
+        int channels = (wps->wphdr.flags & MONO_DATA) ? 1 : 2;
+        int32_t *output = malloc (samples * channels * sizeof (int32_t));
+        int32_t *words = malloc (samples * channels * sizeof (int32_t));
+        int lossless = !(wps->wphdr.flags & HYBRID_FLAG);
+        struct words_data w_batch;
+        double seconds = 0.0;
+        int64_t reps = 0;
+
+        sprintf (kernel, "%s %.22s", lossless ? "get_words_lossless" : "get_words_hybrid", filename);
+
+        do {
+            double start;
+
+            wps->wvbits = wvbits;
+            wps->w = w;
+            start = now ();
+
+            if (lossless)
+                get_words_lossless (wps, output, samples);
+            else
+                get_words_hybrid (wps, output, NULL, samples);
+
+            seconds += now () - start;
+            reps++;
+        } while (seconds < min_seconds);
+
+        w_batch = wps->w;
+        report (kernel, "c", seconds / reps, (int64_t) samples * channels, -1);
+        seconds = 0.0;
+        reps = 0;
+
+        do {
+            double start;
+
+            wps->wvbits = wvbits;
+            wps->w = w;
+            start = now ();
+
+            for (i = 0; i < samples * channels; ++i)
+                words [i] = get_word (wps, channels == 2 ? (i & 1) : 0, NULL);
+
+            seconds += now () - start;
+            reps++;
+        } while (seconds < min_seconds);
+
+        report (kernel, "get_word", seconds / reps, (int64_t) samples * channels,
+            !memcmp (output, words, samples * channels * sizeof (int32_t)) && !memcmp (&w_batch, &wps->w, sizeof (w_batch)));
+        bench_read_code (filename, &wvbits);
+
+        if (wps->decorr_preset)
+            bench_preset (filename, wps, words, samples);
+
+        wps->wvbits = wvbits;
+        wps->w = w;
+        free (output);
+        free (words);
+    }
+
+    WavpackCloseFile (wpc);
+    free (data);
+}
+
+int main (int argc, char **argv)
+{
+    int i;
+
+    for (i = 1; i < argc; ++i)
+        if (!strcmp (argv [i], "-s") && i + 1 < argc)
+            min_seconds = atof (argv [++i]);
+        else if (argv [i][0] == '-') {
+            fprintf (stderr, "usage: %s [-s min_seconds] [file.wv ...]\n", argv [0]);
+            return 1;
+        }
+
+#ifdef DECORR_STEREO_PASS_CONT
+    printf ("assembly decorrelation passes: %s\n", "built in");
+#else
+    printf ("assembly decorrelation passes: %s\n", "not available");
+#endif
+
+    bench_decorr (2, FALSE);
+    bench_decorr (2, TRUE);
+    bench_decorr (1, FALSE);
+    bench_decorr (1, TRUE);
+
+    bench_fixup ("fixup_samples shift 8", (8 << SHIFT_LSB) | 2, 0x7fff, 0, 0, 0);
+    bench_fixup ("fixup_samples clip 16", HYBRID_FLAG | 1, 0x9000, 0, 0, 0);
+    bench_fixup ("fixup_samples clip 24 shift 4", HYBRID_FLAG | (4 << SHIFT_LSB) | 2, 0x90000, 0, 0, 0);
+    bench_fixup ("fixup_samples int32 zeros 8", INT32_DATA | 3, 0x7fffff, 8, 0, 0);
+    bench_fixup ("fixup_samples int32 ones 8", INT32_DATA | 3, 0x7fffff, 0, 8, 0);
+    bench_fixup ("fixup_samples int32 dups 8", INT32_DATA | 3, 0x7fffff, 0, 0, 8);
+    bench_fixup ("fixup_samples int32 ones 12 clip", INT32_DATA | HYBRID_FLAG | 3, 0x90000, 0, 12, 0);
+    bench_float_values ();
+    bench_float_normalize ();
+    bench_decimate (2);
+    bench_decimate (6);
+
+    for (i = 1; i < argc; ++i)
+        if (!strcmp (argv [i], "-s"))
+            ++i;
+        else
+            bench_file (argv [i]);
+
+    printf ("%d cross-check failure%s\n", failures, failures == 1 ? "" : "s");
+    return failures ? 1 : 0;
+}
@@ -49,6 +49,11 @@ extern void ASMCALL DECORR_MONO_PASS_CONT (struct decorr_pass *dpp, int32_t *buf
 
 #define LOSSY_MUTE
 
+// Hybrid lossless data is decoded in tiles of this many samples, which must be
+// a multiple of MAX_TERM so the decorrelation history stays aligned.
+
+#define HYBRID_TILE_SAMPLES 256
+
 ///////////////////////////// executable code ////////////////////////////////
 
 // This monster actually unpacks the WavPack bitstream(s) into the specified
@@ -68,16 +73,30 @@ extern void ASMCALL DECORR_MONO_PASS_CONT (struct decorr_pass *dpp, int32_t *buf
 // occurs or the end of the block is reached.
 
 static void decorr_stereo_pass (struct decorr_pass *dpp, int32_t *buffer, int32_t sample_count);
+static void decorr_stereo_pass_short (struct decorr_pass *dpp, int32_t *buffer, int32_t sample_count);
 static void decorr_mono_pass (struct decorr_pass *dpp, int32_t *buffer, int32_t sample_count);
+static void decorr_mono_pass_short (struct decorr_pass *dpp, int32_t *buffer, int32_t sample_count);
 static void fixup_samples (WavpackStream *wps, int32_t *buffer, uint32_t sample_count);
+static void decorr_stereo_preset (WavpackStream *wps, int32_t *buffer, int32_t sample_count, int long_math);
+static void normalize_decorr_samples (WavpackStream *wps, int m);
+static void int32_fill_bits (int32_t *buffer, uint32_t count, int zeros, int ones, int dups);
+
+#ifdef WAVPACK_PROFILE
+static uint64_t bs_words_read (const Bitstream *bs, const Bitstream *start);
+#endif
 
 int32_t unpack_samples (WavpackStream *wps, int32_t *buffer, uint32_t sample_count)
 {
     uint32_t flags = wps->wphdr.flags, crc = wps->crc, i;
     int32_t mute_limit = (1L << ((flags & MAG_MASK) >> MAG_LSB)) + 2;
     int32_t correction [2], read_word, *bptr;
+    int long_math = ((flags & MAG_MASK) >> MAG_LSB) >= 16;
     struct decorr_pass *dpp;
     int tcount, m = 0;
+#ifdef WAVPACK_PROFILE
+    Bitstream wvbits = wps->wvbits, wvcbits = wps->wvcbits, wvxbits = wps->wvxbits;
+#endif
+    PROFILE_DECL (start_time);
 
     // don't attempt to decode past the end of the block, but watch out for overflow!
 
@@ -101,42 +120,39 @@ int32_t unpack_samples (WavpackStream *wps, int32_t *buffer, uint32_t sample_cou
     if ((flags & HYBRID_FLAG) && !wps->block2buff)
         mute_limit = (mute_limit * 2) + 128;
 
+    PROFILE_START (wps->wpc, start_time);
+
     //////////////// handle lossless or hybrid lossy mono data /////////////////
 
     if (!wps->block2buff && (flags & MONO_DATA)) {
+        void (*decorr_pass) (struct decorr_pass *, int32_t *, int32_t) = long_math ? decorr_mono_pass : decorr_mono_pass_short;
         int32_t *eptr = buffer + sample_count;
 
-        if (flags & HYBRID_FLAG) {
-            i = sample_count;
-
-            for (bptr = buffer; bptr < eptr;)
-                if ((*bptr++ = get_word (wps, 0, NULL)) == WORD_EOF) {
-                    i = (uint32_t)(bptr - buffer);
-                    break;
-                }
-        }
+        if (flags & HYBRID_FLAG)
+            i = get_words_hybrid (wps, buffer, NULL, sample_count);
         else
             i = get_words_lossless (wps, buffer, sample_count);
 
+        PROFILE_STOP (wps->profile, WP_PROFILE_ENTROPY, start_time);
+        PROFILE_START (wps->wpc, start_time);
+
         if (i != sample_count)
             goto get_word_eof;
 
 #ifdef DECORR_MONO_PASS_CONT
         if (sample_count < 16)
             for (tcount = wps->num_terms, dpp = wps->decorr_passes; tcount--; dpp++)
-                decorr_mono_pass (dpp, buffer, sample_count);
+                decorr_pass (dpp, buffer, sample_count);
         else
             for (tcount = wps->num_terms, dpp = wps->decorr_passes; tcount--; dpp++) {
                 int pre_samples = (dpp->term > MAX_TERM) ? 2 : dpp->term;
 
-                decorr_mono_pass (dpp, buffer, pre_samples);
-
-                DECORR_MONO_PASS_CONT (dpp, buffer + pre_samples, sample_count - pre_samples,
-                    ((flags & MAG_MASK) >> MAG_LSB) > 15);
+                decorr_pass (dpp, buffer, pre_samples);
+                DECORR_MONO_PASS_CONT (dpp, buffer + pre_samples, sample_count - pre_samples, long_math);
             }
 #else
         for (tcount = wps->num_terms, dpp = wps->decorr_passes; tcount--; dpp++)
-            decorr_mono_pass (dpp, buffer, sample_count);
+            decorr_pass (dpp, buffer, sample_count);
 #endif
 
 #ifndef LOSSY_MUTE
@@ -160,46 +176,46 @@ int32_t unpack_samples (WavpackStream *wps, int32_t *buffer, uint32_t sample_cou
     /////////////// handle lossless or hybrid lossy stereo data ///////////////
 
     else if (!wps->block2buff && !(flags & MONO_DATA)) {
+        void (*decorr_pass) (struct decorr_pass *, int32_t *, int32_t) = long_math ? decorr_stereo_pass : decorr_stereo_pass_short;
         int32_t *eptr = buffer + (sample_count * 2);
 
-        if (flags & HYBRID_FLAG) {
-            i = sample_count;
-
-            for (bptr = buffer; bptr < eptr; bptr += 2)
-                if ((bptr [0] = get_word (wps, 0, NULL)) == WORD_EOF ||
-                    (bptr [1] = get_word (wps, 1, NULL)) == WORD_EOF) {
-                        i = (uint32_t)(bptr - buffer) / 2;
-                        break;
-                }
-        }
+        if (flags & HYBRID_FLAG)
+            i = get_words_hybrid (wps, buffer, NULL, sample_count);
         else
             i = get_words_lossless (wps, buffer, sample_count);
 
+        PROFILE_STOP (wps->profile, WP_PROFILE_ENTROPY, start_time);
+        PROFILE_START (wps->wpc, start_time);
+
         if (i != sample_count)
             goto get_word_eof;
 
-#ifdef DECORR_STEREO_PASS_CONT
-        if (sample_count < 16 || !DECORR_STEREO_PASS_CONT_AVAILABLE) {
-            for (tcount = wps->num_terms, dpp = wps->decorr_passes; tcount--; dpp++)
-                decorr_stereo_pass (dpp, buffer, sample_count);
-
+        if (wps->decorr_preset) {
+            decorr_stereo_preset (wps, buffer, sample_count, long_math);
             m = sample_count & (MAX_TERM - 1);
         }
-        else
-            for (tcount = wps->num_terms, dpp = wps->decorr_passes; tcount--; dpp++) {
-                int pre_samples = (dpp->term < 0 || dpp->term > MAX_TERM) ? 2 : dpp->term;
-
-                decorr_stereo_pass (dpp, buffer, pre_samples);
+        else {
+#ifdef DECORR_STEREO_PASS_CONT
+            if (sample_count < 16 || !DECORR_STEREO_PASS_CONT_AVAILABLE) {
+                for (tcount = wps->num_terms, dpp = wps->decorr_passes; tcount--; dpp++)
+                    decorr_pass (dpp, buffer, sample_count);
 
-                DECORR_STEREO_PASS_CONT (dpp, buffer + pre_samples * 2, sample_count - pre_samples,
-                    ((flags & MAG_MASK) >> MAG_LSB) >= 16);
+                m = sample_count & (MAX_TERM - 1);
             }
+            else
+                for (tcount = wps->num_terms, dpp = wps->decorr_passes; tcount--; dpp++) {
+                    int pre_samples = (dpp->term < 0 || dpp->term > MAX_TERM) ? 2 : dpp->term;
+
+                    decorr_pass (dpp, buffer, pre_samples);
+                    DECORR_STEREO_PASS_CONT (dpp, buffer + pre_samples * 2, sample_count - pre_samples, long_math);
+                }
 #else
-        for (tcount = wps->num_terms, dpp = wps->decorr_passes; tcount--; dpp++)
-            decorr_stereo_pass (dpp, buffer, sample_count);
+            for (tcount = wps->num_terms, dpp = wps->decorr_passes; tcount--; dpp++)
+                decorr_pass (dpp, buffer, sample_count);
 
-        m = sample_count & (MAX_TERM - 1);
+            m = sample_count & (MAX_TERM - 1);
 #endif
+        }
 
         if (flags & JOINT_STEREO)
             for (bptr = buffer; bptr < eptr; bptr += 2) {
@@ -220,120 +236,191 @@ int32_t unpack_samples (WavpackStream *wps, int32_t *buffer, uint32_t sample_cou
             }
     }
 
-    /////////////////// handle hybrid lossless mono data ////////////////////
+    ////////// handle hybrid lossless data (except cross-correlated stereo) //////////
 
-    else if ((flags & HYBRID_FLAG) && (flags & MONO_DATA))
-        for (bptr = buffer, i = 0; i < sample_count; ++i) {
+    // Here the lossy residuals and the corrections are decoded for a tile of samples first, then the
+    // decorrelation passes are applied to the lossy residuals over the whole tile, and finally the
+    // corrections (and noise shaping) are applied per sample. This works because only the lossy
+    // values feed back into the decorrelation, which isn't true for cross-correlated stereo (below).
 
-            if ((read_word = get_word (wps, 0, correction)) == WORD_EOF)
-                break;
+    else if (wps->block2buff && ((flags & MONO_DATA) || !(flags & CROSS_DECORR))) {
+        int32_t corrections [HYBRID_TILE_SAMPLES * 2], *cptr, j, count;
+        int stereo = !(flags & MONO_DATA);
 
-            for (tcount = wps->num_terms, dpp = wps->decorr_passes; tcount--; dpp++) {
-                int32_t sam, temp;
-                int k;
+        for (bptr = buffer, i = 0; i < sample_count; i += count) {
+            count = sample_count - i < HYBRID_TILE_SAMPLES ? sample_count - i : HYBRID_TILE_SAMPLES;
+            j = get_words_hybrid (wps, bptr, corrections, count);
 
-                if (dpp->term > MAX_TERM) {
-                    if (dpp->term & 1)
-                        sam = 2 * dpp->samples_A [0] - dpp->samples_A [1];
-                    else
-                        sam = (3 * dpp->samples_A [0] - dpp->samples_A [1]) >> 1;
+            PROFILE_STOP (wps->profile, WP_PROFILE_ENTROPY, start_time);
+            PROFILE_START (wps->wpc, start_time);
 
-                    dpp->samples_A [1] = dpp->samples_A [0];
-                    k = 0;
-                }
-                else {
-                    sam = dpp->samples_A [m];
-                    k = (m + dpp->term) & (MAX_TERM - 1);
-                }
+            if (j != count) {
+                i += j;
+                break;
+            }
+
+            if (stereo && wps->decorr_preset)
+                decorr_stereo_preset (wps, bptr, count, long_math);
+            else {
+                void (*decorr_pass) (struct decorr_pass *, int32_t *, int32_t) = stereo ?
+                    (long_math ? decorr_stereo_pass : decorr_stereo_pass_short) :
+                    (long_math ? decorr_mono_pass : decorr_mono_pass_short);
 
-                temp = apply_weight (dpp->weight_A, sam) + read_word;
-                update_weight (dpp->weight_A, dpp->delta, sam, read_word);
-                dpp->samples_A [k] = read_word = temp;
+                for (tcount = wps->num_terms, dpp = wps->decorr_passes; tcount--; dpp++)
+                    decorr_pass (dpp, bptr, count);
             }
 
-            m = (m + 1) & (MAX_TERM - 1);
+            // the mono passes normalize their own history, and every tile but the last is a multiple of MAX_TERM
 
-            if (flags & HYBRID_SHAPE) {
-                int shaping_weight = (wps->dc.shaping_acc [0] += wps->dc.shaping_delta [0]) >> 16;
-                int32_t temp = -apply_weight (shaping_weight, wps->dc.error [0]);
+            m = stereo ? count & (MAX_TERM - 1) : 0;
 
-                if ((flags & NEW_SHAPING) && shaping_weight < 0 && temp) {
-                    if (temp == wps->dc.error [0])
-                        temp = (temp < 0) ? temp + 1 : temp - 1;
+            if (stereo)
+                for (cptr = corrections, j = 0; j < count; ++j, cptr += 2) {
+                    int32_t left = bptr [0], right = bptr [1];
+                    int32_t left_c = left + cptr [0], right_c = right + cptr [1];
 
-                    wps->dc.error [0] = temp - correction [0];
-                }
-                else
-                    wps->dc.error [0] = -correction [0];
+                    if (flags & JOINT_STEREO) {
+                        left_c += (right_c -= (left_c >> 1));
+                        left += (right -= (left >> 1));
+                    }
 
-                read_word += correction [0] - temp;
-            }
+                    if (flags & HYBRID_SHAPE) {
+                        int shaping_weight;
+                        int32_t temp;
+
+                        correction [0] = left_c - left;
+                        shaping_weight = (wps->dc.shaping_acc [0] += wps->dc.shaping_delta [0]) >> 16;
+                        temp = -apply_weight (shaping_weight, wps->dc.error [0]);
+
+                        if ((flags & NEW_SHAPING) && shaping_weight < 0 && temp) {
+                            if (temp == wps->dc.error [0])
+                                temp = (temp < 0) ? temp + 1 : temp - 1;
+
+                            wps->dc.error [0] = temp - correction [0];
+                        }
+                        else
+                            wps->dc.error [0] = -correction [0];
+
+                        left = left_c - temp;
+                        correction [1] = right_c - right;
+                        shaping_weight = (wps->dc.shaping_acc [1] += wps->dc.shaping_delta [1]) >> 16;
+                        temp = -apply_weight (shaping_weight, wps->dc.error [1]);
+
+                        if ((flags & NEW_SHAPING) && shaping_weight < 0 && temp) {
+                            if (temp == wps->dc.error [1])
+                                temp = (temp < 0) ? temp + 1 : temp - 1;
+
+                            wps->dc.error [1] = temp - correction [1];
+                        }
+                        else
+                            wps->dc.error [1] = -correction [1];
+
+                        right = right_c - temp;
+                    }
+                    else {
+                        left = left_c;
+                        right = right_c;
+                    }
+
+                    if (labs (left) > mute_limit || labs (right) > mute_limit)
+                        break;
+
+                    crc += (crc << 3) + ((uint32_t) left << 1) + left + right;
+                    *bptr++ = left;
+                    *bptr++ = right;
+                }
             else
-                read_word += correction [0];
+                for (cptr = corrections, j = 0; j < count; ++j, ++cptr) {
+                    read_word = bptr [0];
 
-            crc += (crc << 1) + read_word;
+                    if (flags & HYBRID_SHAPE) {
+                        int shaping_weight = (wps->dc.shaping_acc [0] += wps->dc.shaping_delta [0]) >> 16;
+                        int32_t temp = -apply_weight (shaping_weight, wps->dc.error [0]);
 
-            if (labs (read_word) > mute_limit)
-                break;
+                        if ((flags & NEW_SHAPING) && shaping_weight < 0 && temp) {
+                            if (temp == wps->dc.error [0])
+                                temp = (temp < 0) ? temp + 1 : temp - 1;
+
+                            wps->dc.error [0] = temp - cptr [0];
+                        }
+                        else
+                            wps->dc.error [0] = -cptr [0];
+
+                        read_word += cptr [0] - temp;
+                    }
+                    else
+                        read_word += cptr [0];
 
-            *bptr++ = read_word;
+                    crc += (crc << 1) + read_word;
+
+                    if (labs (read_word) > mute_limit)
+                        break;
+
+                    *bptr++ = read_word;
+                }
+
+            if (j != count) {
+                i += j;
+                break;
+            }
         }
+    }
+
+    //////////////// handle hybrid lossless cross-correlated stereo data ///////////////
 
-    //////////////////// handle hybrid lossless stereo data ///////////////////
+    // Because the negative terms of cross-correlated stereo apply to the corrected samples, this
+    // is still done one sample at a time, with the entropy decoding and decorrelation together.
 
     else if (wps->block2buff && !(flags & MONO_DATA))
         for (bptr = buffer, i = 0; i < sample_count; ++i) {
-            int32_t left, right, left2, right2;
-            int32_t left_c = 0, right_c = 0;
+            int32_t left, right, left2, right2, left_c, right_c;
 
             if ((left = get_word (wps, 0, correction)) == WORD_EOF ||
                 (right = get_word (wps, 1, correction + 1)) == WORD_EOF)
                     break;
 
-            if (flags & CROSS_DECORR) {
-                left_c = left + correction [0];
-                right_c = right + correction [1];
+            left_c = left + correction [0];
+            right_c = right + correction [1];
 
-                for (tcount = wps->num_terms, dpp = wps->decorr_passes; tcount--; dpp++) {
-                    int32_t sam_A, sam_B;
-
-                    if (dpp->term > 0) {
-                        if (dpp->term > MAX_TERM) {
-                            if (dpp->term & 1) {
-                                sam_A = 2 * dpp->samples_A [0] - dpp->samples_A [1];
-                                sam_B = 2 * dpp->samples_B [0] - dpp->samples_B [1];
-                            }
-                            else {
-                                sam_A = (3 * dpp->samples_A [0] - dpp->samples_A [1]) >> 1;
-                                sam_B = (3 * dpp->samples_B [0] - dpp->samples_B [1]) >> 1;
-                            }
+            for (tcount = wps->num_terms, dpp = wps->decorr_passes; tcount--; dpp++) {
+                int32_t sam_A, sam_B;
+
+                if (dpp->term > 0) {
+                    if (dpp->term > MAX_TERM) {
+                        if (dpp->term & 1) {
+                            sam_A = 2 * dpp->samples_A [0] - dpp->samples_A [1];
+                            sam_B = 2 * dpp->samples_B [0] - dpp->samples_B [1];
                         }
                         else {
-                            sam_A = dpp->samples_A [m];
-                            sam_B = dpp->samples_B [m];
+                            sam_A = (3 * dpp->samples_A [0] - dpp->samples_A [1]) >> 1;
+                            sam_B = (3 * dpp->samples_B [0] - dpp->samples_B [1]) >> 1;
                         }
-
-                        left_c += apply_weight (dpp->weight_A, sam_A);
-                        right_c += apply_weight (dpp->weight_B, sam_B);
-                    }
-                    else if (dpp->term == -1) {
-                        left_c += apply_weight (dpp->weight_A, dpp->samples_A [0]);
-                        right_c += apply_weight (dpp->weight_B, left_c);
                     }
                     else {
-                        right_c += apply_weight (dpp->weight_B, dpp->samples_B [0]);
-
-                        if (dpp->term == -3)
-                            left_c += apply_weight (dpp->weight_A, dpp->samples_A [0]);
-                        else
-                            left_c += apply_weight (dpp->weight_A, right_c);
+                        sam_A = dpp->samples_A [m];
+                        sam_B = dpp->samples_B [m];
                     }
+
+                    left_c += apply_weight (dpp->weight_A, sam_A);
+                    right_c += apply_weight (dpp->weight_B, sam_B);
                 }
+                else if (dpp->term == -1) {
+                    left_c += apply_weight (dpp->weight_A, dpp->samples_A [0]);
+                    right_c += apply_weight (dpp->weight_B, left_c);
+                }
+                else {
+                    right_c += apply_weight (dpp->weight_B, dpp->samples_B [0]);
 
-                if (flags & JOINT_STEREO)
-                    left_c += (right_c -= (left_c >> 1));
+                    if (dpp->term == -3)
+                        left_c += apply_weight (dpp->weight_A, dpp->samples_A [0]);
+                    else
+                        left_c += apply_weight (dpp->weight_A, right_c);
+                }
             }
 
+            if (flags & JOINT_STEREO)
+                left_c += (right_c -= (left_c >> 1));
+
             for (tcount = wps->num_terms, dpp = wps->decorr_passes; tcount--; dpp++) {
                 int32_t sam_A, sam_B;
 
@@ -395,14 +482,6 @@ int32_t unpack_samples (WavpackStream *wps, int32_t *buffer, uint32_t sample_cou
 
             m = (m + 1) & (MAX_TERM - 1);
 
-            if (!(flags & CROSS_DECORR)) {
-                left_c = left + correction [0];
-                right_c = right + correction [1];
-
-                if (flags & JOINT_STEREO)
-                    left_c += (right_c -= (left_c >> 1));
-            }
-
             if (flags & JOINT_STEREO)
                 left += (right -= (left >> 1));
 
@@ -455,6 +534,11 @@ int32_t unpack_samples (WavpackStream *wps, int32_t *buffer, uint32_t sample_cou
         i = 0;  /* this line can't execute, but suppresses compiler warning */
 
 get_word_eof:
+    // cross-correlated hybrid lossless decoding does the entropy decoding and decorrelation together
+
+    PROFILE_STOP (wps->profile, (wps->block2buff && !(flags & MONO_DATA) && (flags & CROSS_DECORR)) ?
+        WP_PROFILE_ENTROPY : WP_PROFILE_DECORR, start_time);
+
     if (i != sample_count) {
         memset (buffer, 0, sample_count * (flags & MONO_FLAG ? 4 : 8));
         wps->mute_error = TRUE;
@@ -465,26 +549,15 @@ get_word_eof:
     }
 
     if (m)
-        for (tcount = wps->num_terms, dpp = wps->decorr_passes; tcount--; dpp++)
-            if (dpp->term > 0 && dpp->term <= MAX_TERM) {
-                int32_t temp_A [MAX_TERM], temp_B [MAX_TERM];
-                int k;
-
-                memcpy (temp_A, dpp->samples_A, sizeof (dpp->samples_A));
-                memcpy (temp_B, dpp->samples_B, sizeof (dpp->samples_B));
-
-                for (k = 0; k < MAX_TERM; k++) {
-                    dpp->samples_A [k] = temp_A [m];
-                    dpp->samples_B [k] = temp_B [m];
-                    m = (m + 1) & (MAX_TERM - 1);
-                }
-            }
+        normalize_decorr_samples (wps, m);
 
+    PROFILE_START (wps->wpc, start_time);
     fixup_samples (wps, buffer, i);
 
-    if ((flags & FLOAT_DATA) && (wps->wpc->open_flags & OPEN_NORMALIZE))
-        WavpackFloatNormalize (buffer, (flags & MONO_DATA) ? i : i * 2,
-            127 - wps->float_norm_exp + wps->wpc->norm_offset);
+    if (wps->wpc->float_output && !(flags & FLOAT_DATA))
+        int_to_float_samples (buffer, (flags & MONO_DATA) ? i : i * 2, (flags & BYTES_STORED) + 1);
+
+    PROFILE_STOP (wps->profile, WP_PROFILE_FIXUP, start_time);
 
     if (flags & FALSE_STEREO) {
         int32_t *dptr = buffer + i * 2;
@@ -511,16 +584,218 @@ get_word_eof:
         }
     }
 
+#ifdef WAVPACK_PROFILE
+    wps->profile.refills += bs_words_read (&wps->wvbits, &wvbits) +
+        bs_words_read (&wps->wvcbits, &wvcbits) + bs_words_read (&wps->wvxbits, &wvxbits);
+#endif
+
     return i;
 }
 
+// Return TRUE if the current block of the specified stream can be decoded with
+// unpack_samples16(), which is a dedicated path for the most common format of
+// all: stereo lossless audio of 16 bits or less, with no shift and with a
+// magnitude of 15 bits or less (so the 32-bit decorrelation math always works
+// and the samples always fit in 16 bits). The stream must be initialized.
+
+int unpack_samples16_ok (WavpackStream *wps)
+{
+    uint32_t flags = wps->wphdr.flags;
+
+    return !wps->mute_error && !wps->block2buff && (flags & BYTES_STORED) <= 1 &&
+        ((flags & MAG_MASK) >> MAG_LSB) <= 15 && !(flags & (MONO_DATA | HYBRID_FLAG |
+        FLOAT_DATA | INT32_DATA | SHIFT_MASK | DSD_FLAG));
+}
+
+// Unpack the specified number of samples of a block that unpack_samples16_ok()
+// accepted straight into 16-bit interleaved stereo samples. This is equivalent
+// to unpack_samples() followed by a conversion, but the samples are decoded in
+// small tiles that stay in the cache (and don't need any temp buffer) with all
+// of the steps specialized for the format: 32-bit math in the decorrelation
+// passes, a separate joint stereo loop that the compiler can vectorize, and no
+// fixup at all. Errors are handled exactly like unpack_samples() does.
+
+#define UNPACK16_TILE_SAMPLES 512   // stereo samples per tile (must be a multiple of MAX_TERM)
+
+int32_t unpack_samples16 (WavpackStream *wps, int16_t *buffer, uint32_t sample_count)
+{
+    uint32_t flags = wps->wphdr.flags, crc = wps->crc, samples_left, i;
+    int32_t mute_limit = (1L << ((flags & MAG_MASK) >> MAG_LSB)) + 2;
+    int32_t tile [UNPACK16_TILE_SAMPLES * 2];
+    int16_t *outptr = buffer;
+    struct decorr_pass *dpp;
+    int tcount, m = 0, errors = 0;
+#ifdef WAVPACK_PROFILE
+    Bitstream wvbits = wps->wvbits;
+#endif
+    PROFILE_DECL (start_time);
+
+    // don't attempt to decode past the end of the block, but watch out for overflow!
+
+    if (wps->sample_index + sample_count > GET_BLOCK_INDEX (wps->wphdr) + wps->wphdr.block_samples &&
+        (uint32_t) (GET_BLOCK_INDEX (wps->wphdr) + wps->wphdr.block_samples - wps->sample_index) < sample_count)
+            sample_count = (uint32_t) (GET_BLOCK_INDEX (wps->wphdr) + wps->wphdr.block_samples - wps->sample_index);
+
+    if (GET_BLOCK_INDEX (wps->wphdr) > wps->sample_index || wps->wphdr.block_samples < sample_count)
+        wps->mute_error = TRUE;
+
+    for (samples_left = wps->mute_error ? 0 : sample_count; samples_left;) {
+        uint32_t count = samples_left < UNPACK16_TILE_SAMPLES ? samples_left : UNPACK16_TILE_SAMPLES;
+        int32_t *bptr, *eptr = tile + count * 2;
+
+        PROFILE_START (wps->wpc, start_time);
+
+        if (get_words_lossless (wps, tile, count) != (int32_t) count) {
+            wps->mute_error = TRUE;
+            break;
+        }
+
+        PROFILE_STOP (wps->profile, WP_PROFILE_ENTROPY, start_time);
+        PROFILE_START (wps->wpc, start_time);
+
+        // only the last tile can be partial, so the history only needs normalizing after that
+
+        if (wps->decorr_preset)
+            decorr_stereo_preset (wps, tile, count, FALSE);
+        else
+            for (tcount = wps->num_terms, dpp = wps->decorr_passes; tcount--; dpp++)
+                decorr_stereo_pass_short (dpp, tile, count);
+
+        m = count & (MAX_TERM - 1);
+
+        if (flags & JOINT_STEREO)
+            for (bptr = tile; bptr < eptr; bptr += 2) {
+                bptr [1] -= bptr [0] >> 1;
+                bptr [0] += bptr [1];
+            }
+
+        for (bptr = tile; bptr < eptr; bptr += 2)
+            crc += (crc << 3) + ((uint32_t) bptr [0] << 1) + bptr [0] + bptr [1];
+
+        PROFILE_STOP (wps->profile, WP_PROFILE_DECORR, start_time);
+        PROFILE_START (wps->wpc, start_time);
+
+        // check every sample for a corrupt value (labs (sample) > mute_limit) while converting,
+        // but without any branches so that this can be vectorized too
+
+        for (i = 0; i < count * 2; ++i) {
+            errors |= (uint32_t) tile [i] + mute_limit > (uint32_t) mute_limit * 2;
+            outptr [i] = (int16_t) tile [i];
+        }
+
+        PROFILE_STOP (wps->profile, WP_PROFILE_FIXUP, start_time);
+
+        if (errors) {
+            wps->mute_error = TRUE;
+            break;
+        }
+
+        outptr += count * 2;
+        samples_left -= count;
+    }
+
+    if (m)
+        normalize_decorr_samples (wps, m);
+
+    wps->sample_index += sample_count;
+    wps->crc = crc;
+
+    // as in unpack_samples(), both decoding errors and checksum mismatches mute the output
+
+    if (!wps->mute_error && wps->sample_index == GET_BLOCK_INDEX (wps->wphdr) + wps->wphdr.block_samples &&
+        wps->crc != wps->wphdr.crc)
+            wps->mute_error = TRUE;
+
+    if (wps->mute_error)
+        memset (buffer, 0, sample_count * 2 * sizeof (*buffer));
+
+#ifdef WAVPACK_PROFILE
+    wps->profile.refills += bs_words_read (&wps->wvbits, &wvbits);
+#endif
+
+    return sample_count;
+}
+
+#ifdef WAVPACK_PROFILE
+
+// Return the number of words that were read from the specified bitstream since
+// it was in the "start" state (or zero if it has been closed or has run out of
+// data and wrapped in the meantime).
+
+static uint64_t bs_words_read (const Bitstream *bs, const Bitstream *start)
+{
+    if (bs->buf && bs->buf == start->buf && bs->ptr > start->ptr)
+        return (uint64_t)(bs->ptr - start->ptr);
+    else
+        return 0;
+}
+
+#endif
+
+// Rotate the history samples of the decorrelation passes with terms 1-8 so that
+// they're normalized again (the first one is at index 0), after decoding a total
+// number of samples that is not a multiple of MAX_TERM, which leaves the first
+// one at index "m".
+
+static void normalize_decorr_samples (WavpackStream *wps, int m)
+{
+    struct decorr_pass *dpp;
+    int tcount;
+
+    for (tcount = wps->num_terms, dpp = wps->decorr_passes; tcount--; dpp++)
+        if (dpp->term > 0 && dpp->term <= MAX_TERM) {
+            int32_t temp_A [MAX_TERM], temp_B [MAX_TERM];
+            int k;
+
+            memcpy (temp_A, dpp->samples_A, sizeof (dpp->samples_A));
+            memcpy (temp_B, dpp->samples_B, sizeof (dpp->samples_B));
+
+            for (k = 0; k < MAX_TERM; k++) {
+                dpp->samples_A [k] = temp_A [m];
+                dpp->samples_B [k] = temp_B [m];
+                m = (m + 1) & (MAX_TERM - 1);
+            }
+        }
+}
+
+// The decorrelation passes are kernel templates with a "long_math" parameter.
+// When it's FALSE (because the block's magnitude is 15 bits or less, which is
+// also what the assembly versions go by) the weights are always applied with
+// 32-bit math, otherwise the magnitude of every sample is checked to see if
+// the slower version is needed.
+
+#define apply_weight_k(weight, sample) (long_math ? apply_weight (weight, sample) : apply_weight_i (weight, sample))
+
+static KERNEL_INLINE void decorr_mono_pass_kernel (struct decorr_pass *dpp, int32_t *buffer, int32_t sample_count, const int long_math);
+static KERNEL_INLINE void decorr_stereo_pass_kernel (struct decorr_pass *dpp, int32_t *buffer, int32_t sample_count, const int long_math);
+
+static void decorr_mono_pass (struct decorr_pass *dpp, int32_t *buffer, int32_t sample_count)
+{
+    decorr_mono_pass_kernel (dpp, buffer, sample_count, TRUE);
+}
+
+static void decorr_mono_pass_short (struct decorr_pass *dpp, int32_t *buffer, int32_t sample_count)
+{
+    decorr_mono_pass_kernel (dpp, buffer, sample_count, FALSE);
+}
+
+static void decorr_stereo_pass (struct decorr_pass *dpp, int32_t *buffer, int32_t sample_count)
+{
+    decorr_stereo_pass_kernel (dpp, buffer, sample_count, TRUE);
+}
+
+static void decorr_stereo_pass_short (struct decorr_pass *dpp, int32_t *buffer, int32_t sample_count)
+{
+    decorr_stereo_pass_kernel (dpp, buffer, sample_count, FALSE);
+}
+
 // General function to perform mono decorrelation pass on specified buffer
 // (although since this is the reverse function it might technically be called
 // "correlation" instead). This version handles all sample resolutions and
 // weight deltas. The dpp->samples_X[] data is returned normalized for term
 // values 1-8.
 
-static void decorr_mono_pass (struct decorr_pass *dpp, int32_t *buffer, int32_t sample_count)
+static KERNEL_INLINE void decorr_mono_pass_kernel (struct decorr_pass *dpp, int32_t *buffer, int32_t sample_count, const int long_math)
 {
     int32_t delta = dpp->delta, weight_A = dpp->weight_A;
     int32_t *bptr, *eptr = buffer + sample_count, sam_A;
@@ -532,7 +807,7 @@ static void decorr_mono_pass (struct decorr_pass *dpp, int32_t *buffer, int32_t
             for (bptr = buffer; bptr < eptr; bptr++) {
                 sam_A = 2 * dpp->samples_A [0] - dpp->samples_A [1];
                 dpp->samples_A [1] = dpp->samples_A [0];
-                dpp->samples_A [0] = apply_weight (weight_A, sam_A) + bptr [0];
+                dpp->samples_A [0] = apply_weight_k (weight_A, sam_A) + bptr [0];
                 update_weight (weight_A, delta, sam_A, bptr [0]);
                 bptr [0] = dpp->samples_A [0];
             }
@@ -543,7 +818,7 @@ static void decorr_mono_pass (struct decorr_pass *dpp, int32_t *buffer, int32_t
             for (bptr = buffer; bptr < eptr; bptr++) {
                 sam_A = (3 * dpp->samples_A [0] - dpp->samples_A [1]) >> 1;
                 dpp->samples_A [1] = dpp->samples_A [0];
-                dpp->samples_A [0] = apply_weight (weight_A, sam_A) + bptr [0];
+                dpp->samples_A [0] = apply_weight_k (weight_A, sam_A) + bptr [0];
                 update_weight (weight_A, delta, sam_A, bptr [0]);
                 bptr [0] = dpp->samples_A [0];
             }
@@ -553,7 +828,7 @@ static void decorr_mono_pass (struct decorr_pass *dpp, int32_t *buffer, int32_t
         default:
             for (m = 0, k = dpp->term & (MAX_TERM - 1), bptr = buffer; bptr < eptr; bptr++) {
                 sam_A = dpp->samples_A [m];
-                dpp->samples_A [k] = apply_weight (weight_A, sam_A) + bptr [0];
+                dpp->samples_A [k] = apply_weight_k (weight_A, sam_A) + bptr [0];
                 update_weight (weight_A, delta, sam_A, bptr [0]);
                 bptr [0] = dpp->samples_A [k];
                 m = (m + 1) & (MAX_TERM - 1);
@@ -582,126 +857,382 @@ static void decorr_mono_pass (struct decorr_pass *dpp, int32_t *buffer, int32_t
 // term values 1-8, so it should be normalized if it is going to be used to
 // call this function again.
 
-static void decorr_stereo_pass (struct decorr_pass *dpp, int32_t *buffer, int32_t sample_count)
+static KERNEL_INLINE void decorr_stereo_pass_kernel (struct decorr_pass *dpp, int32_t *buffer, int32_t sample_count, const int long_math)
 {
+    int32_t delta = dpp->delta, weight_A = dpp->weight_A, weight_B = dpp->weight_B;
     int32_t *bptr, *eptr = buffer + (sample_count * 2);
     int m, k;
 
+    // The weights and (except for terms 1-8) the history samples are kept in locals
+    // during the loops because the compiler must otherwise assume that every store
+    // to the buffer might change them.
+
     switch (dpp->term) {
-        case 17:
+        case 17: {
+            int32_t sam_A0 = dpp->samples_A [0], sam_A1 = dpp->samples_A [1];
+            int32_t sam_B0 = dpp->samples_B [0], sam_B1 = dpp->samples_B [1];
+
             for (bptr = buffer; bptr < eptr; bptr += 2) {
                 int32_t sam, tmp;
 
-                sam = 2 * dpp->samples_A [0] - dpp->samples_A [1];
-                dpp->samples_A [1] = dpp->samples_A [0];
-                bptr [0] = dpp->samples_A [0] = apply_weight (dpp->weight_A, sam) + (tmp = bptr [0]);
-                update_weight (dpp->weight_A, dpp->delta, sam, tmp);
+                sam = 2 * sam_A0 - sam_A1;
+                sam_A1 = sam_A0;
+                bptr [0] = sam_A0 = apply_weight_k (weight_A, sam) + (tmp = bptr [0]);
+                update_weight (weight_A, delta, sam, tmp);
 
-                sam = 2 * dpp->samples_B [0] - dpp->samples_B [1];
-                dpp->samples_B [1] = dpp->samples_B [0];
-                bptr [1] = dpp->samples_B [0] = apply_weight (dpp->weight_B, sam) + (tmp = bptr [1]);
-                update_weight (dpp->weight_B, dpp->delta, sam, tmp);
+                sam = 2 * sam_B0 - sam_B1;
+                sam_B1 = sam_B0;
+                bptr [1] = sam_B0 = apply_weight_k (weight_B, sam) + (tmp = bptr [1]);
+                update_weight (weight_B, delta, sam, tmp);
             }
 
+            dpp->samples_A [0] = sam_A0;
+            dpp->samples_A [1] = sam_A1;
+            dpp->samples_B [0] = sam_B0;
+            dpp->samples_B [1] = sam_B1;
             break;
+        }
+
+        case 18: {
+            int32_t sam_A0 = dpp->samples_A [0], sam_A1 = dpp->samples_A [1];
+            int32_t sam_B0 = dpp->samples_B [0], sam_B1 = dpp->samples_B [1];
 
-        case 18:
             for (bptr = buffer; bptr < eptr; bptr += 2) {
                 int32_t sam, tmp;
 
-                sam = dpp->samples_A [0] + ((dpp->samples_A [0] - dpp->samples_A [1]) >> 1);
-                dpp->samples_A [1] = dpp->samples_A [0];
-                bptr [0] = dpp->samples_A [0] = apply_weight (dpp->weight_A, sam) + (tmp = bptr [0]);
-                update_weight (dpp->weight_A, dpp->delta, sam, tmp);
+                sam = sam_A0 + ((sam_A0 - sam_A1) >> 1);
+                sam_A1 = sam_A0;
+                bptr [0] = sam_A0 = apply_weight_k (weight_A, sam) + (tmp = bptr [0]);
+                update_weight (weight_A, delta, sam, tmp);
 
-                sam = dpp->samples_B [0] + ((dpp->samples_B [0] - dpp->samples_B [1]) >> 1);
-                dpp->samples_B [1] = dpp->samples_B [0];
-                bptr [1] = dpp->samples_B [0] = apply_weight (dpp->weight_B, sam) + (tmp = bptr [1]);
-                update_weight (dpp->weight_B, dpp->delta, sam, tmp);
+                sam = sam_B0 + ((sam_B0 - sam_B1) >> 1);
+                sam_B1 = sam_B0;
+                bptr [1] = sam_B0 = apply_weight_k (weight_B, sam) + (tmp = bptr [1]);
+                update_weight (weight_B, delta, sam, tmp);
             }
 
+            dpp->samples_A [0] = sam_A0;
+            dpp->samples_A [1] = sam_A1;
+            dpp->samples_B [0] = sam_B0;
+            dpp->samples_B [1] = sam_B1;
             break;
+        }
+
+        default: {
+            int32_t samples_A [MAX_TERM], samples_B [MAX_TERM];
+
+            memcpy (samples_A, dpp->samples_A, sizeof (samples_A));
+            memcpy (samples_B, dpp->samples_B, sizeof (samples_B));
 
-        default:
             for (m = 0, k = dpp->term & (MAX_TERM - 1), bptr = buffer; bptr < eptr; bptr += 2) {
                 int32_t sam;
 
-                sam = dpp->samples_A [m];
-                dpp->samples_A [k] = apply_weight (dpp->weight_A, sam) + bptr [0];
-                update_weight (dpp->weight_A, dpp->delta, sam, bptr [0]);
-                bptr [0] = dpp->samples_A [k];
+                sam = samples_A [m];
+                samples_A [k] = apply_weight_k (weight_A, sam) + bptr [0];
+                update_weight (weight_A, delta, sam, bptr [0]);
+                bptr [0] = samples_A [k];
 
-                sam = dpp->samples_B [m];
-                dpp->samples_B [k] = apply_weight (dpp->weight_B, sam) + bptr [1];
-                update_weight (dpp->weight_B, dpp->delta, sam, bptr [1]);
-                bptr [1] = dpp->samples_B [k];
+                sam = samples_B [m];
+                samples_B [k] = apply_weight_k (weight_B, sam) + bptr [1];
+                update_weight (weight_B, delta, sam, bptr [1]);
+                bptr [1] = samples_B [k];
 
                 m = (m + 1) & (MAX_TERM - 1);
                 k = (k + 1) & (MAX_TERM - 1);
             }
 
+            memcpy (dpp->samples_A, samples_A, sizeof (samples_A));
+            memcpy (dpp->samples_B, samples_B, sizeof (samples_B));
             break;
+        }
+
+        case -1: {
+            int32_t sam_A = dpp->samples_A [0];
 
-        case -1:
             for (bptr = buffer; bptr < eptr; bptr += 2) {
                 int32_t sam;
 
-                sam = bptr [0] + apply_weight (dpp->weight_A, dpp->samples_A [0]);
-                update_weight_clip (dpp->weight_A, dpp->delta, dpp->samples_A [0], bptr [0]);
+                sam = bptr [0] + apply_weight_k (weight_A, sam_A);
+                update_weight_clip (weight_A, delta, sam_A, bptr [0]);
                 bptr [0] = sam;
-                dpp->samples_A [0] = bptr [1] + apply_weight (dpp->weight_B, sam);
-                update_weight_clip (dpp->weight_B, dpp->delta, sam, bptr [1]);
-                bptr [1] = dpp->samples_A [0];
+                sam_A = bptr [1] + apply_weight_k (weight_B, sam);
+                update_weight_clip (weight_B, delta, sam, bptr [1]);
+                bptr [1] = sam_A;
             }
 
+            dpp->samples_A [0] = sam_A;
             break;
+        }
+
+        case -2: {
+            int32_t sam_B = dpp->samples_B [0];
 
-        case -2:
             for (bptr = buffer; bptr < eptr; bptr += 2) {
                 int32_t sam;
 
-                sam = bptr [1] + apply_weight (dpp->weight_B, dpp->samples_B [0]);
-                update_weight_clip (dpp->weight_B, dpp->delta, dpp->samples_B [0], bptr [1]);
+                sam = bptr [1] + apply_weight_k (weight_B, sam_B);
+                update_weight_clip (weight_B, delta, sam_B, bptr [1]);
                 bptr [1] = sam;
-                dpp->samples_B [0] = bptr [0] + apply_weight (dpp->weight_A, sam);
-                update_weight_clip (dpp->weight_A, dpp->delta, sam, bptr [0]);
-                bptr [0] = dpp->samples_B [0];
+                sam_B = bptr [0] + apply_weight_k (weight_A, sam);
+                update_weight_clip (weight_A, delta, sam, bptr [0]);
+                bptr [0] = sam_B;
             }
 
+            dpp->samples_B [0] = sam_B;
             break;
+        }
 
-        case -3:
-            for (bptr = buffer; bptr < eptr; bptr += 2) {
-                int32_t sam_A, sam_B;
+        case -3: {
+            int32_t sam_A = dpp->samples_A [0], sam_B = dpp->samples_B [0];
 
-                sam_A = bptr [0] + apply_weight (dpp->weight_A, dpp->samples_A [0]);
-                update_weight_clip (dpp->weight_A, dpp->delta, dpp->samples_A [0], bptr [0]);
-                sam_B = bptr [1] + apply_weight (dpp->weight_B, dpp->samples_B [0]);
-                update_weight_clip (dpp->weight_B, dpp->delta, dpp->samples_B [0], bptr [1]);
-                bptr [0] = dpp->samples_B [0] = sam_A;
-                bptr [1] = dpp->samples_A [0] = sam_B;
+            for (bptr = buffer; bptr < eptr; bptr += 2) {
+                int32_t new_A, new_B;
+
+                new_A = bptr [0] + apply_weight_k (weight_A, sam_A);
+                update_weight_clip (weight_A, delta, sam_A, bptr [0]);
+                new_B = bptr [1] + apply_weight_k (weight_B, sam_B);
+                update_weight_clip (weight_B, delta, sam_B, bptr [1]);
+                bptr [0] = sam_B = new_A;
+                bptr [1] = sam_A = new_B;
             }
 
+            dpp->samples_A [0] = sam_A;
+            dpp->samples_B [0] = sam_B;
+            break;
+        }
+    }
+
+    dpp->weight_A = weight_A;
+    dpp->weight_B = weight_B;
+}
+
+// The decorrelation terms are stored in every block, but the encoder's presets
+// produce the same few term lists over and over again. For the stereo list of
+// the high mode with term -3 in place of the other negative terms (as found in
+// hybrid files) there's a fused kernel that runs all of the passes on each
+// sample in turn, with every pass unrolled for its constant term and the state
+// of all of them held in locals. unpack_init() calls find_decorr_preset() to
+// recognize the list (the result is stored in wps->decorr_preset) and
+// everything else still goes pass by pass (the other preset lists were tried
+// too, but weren't reliably faster that way). The lists are in the order
+// they're stored in the metadata, which is the reverse of the decoding order.
+
+static const signed char high_terms_3 [] = { 18, 18, 2, 3, -3, 18, 2, 4, 7, 5, 3, 6, 8, -3, 18, 2, 0 };
+
+// Perform one stereo decorrelation pass with the constant "term" on a single
+// sample. This is exactly what decorr_stereo_pass_kernel() does per sample,
+// except that terms 1-8 use the history index "m" shared by all the passes.
+
+static KERNEL_INLINE void decorr_stereo_step (struct decorr_pass *dpp, const int term, int32_t *left, int32_t *right, int m, const int long_math)
+{
+    int32_t sam, tmp;
+
+    switch (term) {
+        case 17:
+            sam = 2 * dpp->samples_A [0] - dpp->samples_A [1];
+            dpp->samples_A [1] = dpp->samples_A [0];
+            *left = dpp->samples_A [0] = apply_weight_k (dpp->weight_A, sam) + (tmp = *left);
+            update_weight (dpp->weight_A, dpp->delta, sam, tmp);
+
+            sam = 2 * dpp->samples_B [0] - dpp->samples_B [1];
+            dpp->samples_B [1] = dpp->samples_B [0];
+            *right = dpp->samples_B [0] = apply_weight_k (dpp->weight_B, sam) + (tmp = *right);
+            update_weight (dpp->weight_B, dpp->delta, sam, tmp);
+            break;
+
+        case 18:
+            sam = dpp->samples_A [0] + ((dpp->samples_A [0] - dpp->samples_A [1]) >> 1);
+            dpp->samples_A [1] = dpp->samples_A [0];
+            *left = dpp->samples_A [0] = apply_weight_k (dpp->weight_A, sam) + (tmp = *left);
+            update_weight (dpp->weight_A, dpp->delta, sam, tmp);
+
+            sam = dpp->samples_B [0] + ((dpp->samples_B [0] - dpp->samples_B [1]) >> 1);
+            dpp->samples_B [1] = dpp->samples_B [0];
+            *right = dpp->samples_B [0] = apply_weight_k (dpp->weight_B, sam) + (tmp = *right);
+            update_weight (dpp->weight_B, dpp->delta, sam, tmp);
+            break;
+
+        default: {
+            int k = (m + term) & (MAX_TERM - 1);
+
+            sam = dpp->samples_A [m];
+            *left = dpp->samples_A [k] = apply_weight_k (dpp->weight_A, sam) + (tmp = *left);
+            update_weight (dpp->weight_A, dpp->delta, sam, tmp);
+
+            sam = dpp->samples_B [m];
+            *right = dpp->samples_B [k] = apply_weight_k (dpp->weight_B, sam) + (tmp = *right);
+            update_weight (dpp->weight_B, dpp->delta, sam, tmp);
+            break;
+        }
+
+        case -1:
+            sam = *left + apply_weight_k (dpp->weight_A, dpp->samples_A [0]);
+            update_weight_clip (dpp->weight_A, dpp->delta, dpp->samples_A [0], *left);
+            *left = sam;
+            dpp->samples_A [0] = *right + apply_weight_k (dpp->weight_B, sam);
+            update_weight_clip (dpp->weight_B, dpp->delta, sam, *right);
+            *right = dpp->samples_A [0];
+            break;
+
+        case -2:
+            sam = *right + apply_weight_k (dpp->weight_B, dpp->samples_B [0]);
+            update_weight_clip (dpp->weight_B, dpp->delta, dpp->samples_B [0], *right);
+            *right = sam;
+            dpp->samples_B [0] = *left + apply_weight_k (dpp->weight_A, sam);
+            update_weight_clip (dpp->weight_A, dpp->delta, sam, *left);
+            *left = dpp->samples_B [0];
+            break;
+
+        case -3:
+            sam = *left + apply_weight_k (dpp->weight_A, dpp->samples_A [0]);
+            update_weight_clip (dpp->weight_A, dpp->delta, dpp->samples_A [0], *left);
+            tmp = *right + apply_weight_k (dpp->weight_B, dpp->samples_B [0]);
+            update_weight_clip (dpp->weight_B, dpp->delta, dpp->samples_B [0], *right);
+            *left = dpp->samples_B [0] = sam;
+            *right = dpp->samples_A [0] = tmp;
             break;
     }
 }
 
+// The fused kernel template for the (constant) preset term list "terms" that
+// has "num_terms" entries. Each pass is copied to its own local structure (not
+// an array of them) so that the compiler can keep the weights and the history
+// of the terms that don't index it in registers, and the steps that aren't
+// needed drop out because "num_terms" is a constant. The history of terms 1-8
+// is left at index "m", like the pass by pass version does.
+
+#define DECORR_STEP(i) if (i < num_terms) decorr_stereo_step (&pass_##i, terms [num_terms - 1 - i], &left, &right, m, long_math)
+#define DECORR_LOAD(i) if (i < num_terms) pass_##i = dpp [i]
+#define DECORR_STORE(i) if (i < num_terms) dpp [i] = pass_##i
+
+static KERNEL_INLINE void decorr_stereo_preset_kernel (struct decorr_pass *dpp, int32_t *buffer, int32_t sample_count,
+    const signed char *terms, const int num_terms, const int long_math)
+{
+    struct decorr_pass pass_0, pass_1, pass_2, pass_3, pass_4, pass_5, pass_6, pass_7;
+    struct decorr_pass pass_8, pass_9, pass_10, pass_11, pass_12, pass_13, pass_14, pass_15;
+    int32_t *bptr, *eptr = buffer + (sample_count * 2);
+    int m = 0;
+
+    DECORR_LOAD (0);  DECORR_LOAD (1);  DECORR_LOAD (2);  DECORR_LOAD (3);
+    DECORR_LOAD (4);  DECORR_LOAD (5);  DECORR_LOAD (6);  DECORR_LOAD (7);
+    DECORR_LOAD (8);  DECORR_LOAD (9);  DECORR_LOAD (10); DECORR_LOAD (11);
+    DECORR_LOAD (12); DECORR_LOAD (13); DECORR_LOAD (14); DECORR_LOAD (15);
+
+    for (bptr = buffer; bptr < eptr; bptr += 2) {
+        int32_t left = bptr [0], right = bptr [1];
+
+        DECORR_STEP (0);  DECORR_STEP (1);  DECORR_STEP (2);  DECORR_STEP (3);
+        DECORR_STEP (4);  DECORR_STEP (5);  DECORR_STEP (6);  DECORR_STEP (7);
+        DECORR_STEP (8);  DECORR_STEP (9);  DECORR_STEP (10); DECORR_STEP (11);
+        DECORR_STEP (12); DECORR_STEP (13); DECORR_STEP (14); DECORR_STEP (15);
+
+        bptr [0] = left;
+        bptr [1] = right;
+        m = (m + 1) & (MAX_TERM - 1);
+    }
+
+    DECORR_STORE (0);  DECORR_STORE (1);  DECORR_STORE (2);  DECORR_STORE (3);
+    DECORR_STORE (4);  DECORR_STORE (5);  DECORR_STORE (6);  DECORR_STORE (7);
+    DECORR_STORE (8);  DECORR_STORE (9);  DECORR_STORE (10); DECORR_STORE (11);
+    DECORR_STORE (12); DECORR_STORE (13); DECORR_STORE (14); DECORR_STORE (15);
+}
+
+#undef DECORR_STEP
+#undef DECORR_LOAD
+#undef DECORR_STORE
+
+static void decorr_stereo_high_3 (struct decorr_pass *dpp, int32_t *buffer, int32_t sample_count)
+{
+    decorr_stereo_preset_kernel (dpp, buffer, sample_count, high_terms_3, sizeof (high_terms_3) - 1, TRUE);
+}
+
+static void decorr_stereo_high_3_short (struct decorr_pass *dpp, int32_t *buffer, int32_t sample_count)
+{
+    decorr_stereo_preset_kernel (dpp, buffer, sample_count, high_terms_3, sizeof (high_terms_3) - 1, FALSE);
+}
+
+static const struct {
+    const signed char *terms;
+    void (*pass) (struct decorr_pass *dpp, int32_t *buffer, int32_t sample_count);
+    void (*pass_short) (struct decorr_pass *dpp, int32_t *buffer, int32_t sample_count);
+} decorr_presets [] = {
+    { high_terms_3, decorr_stereo_high_3, decorr_stereo_high_3_short }
+};
+
+#define NUM_DECORR_PRESETS ((int)(sizeof (decorr_presets) / sizeof (decorr_presets [0])))
+
+// Return the index (plus one) of the preset whose term list matches the one
+// that was read for the current block, or zero if there isn't one (or if the
+// block is mono, or cross-correlated hybrid with a correction file, which is
+// decorrelated one sample at a time).
+
+int find_decorr_preset (WavpackStream *wps)
+{
+    int preset, i;
+
+    if ((wps->wphdr.flags & MONO_DATA) || (wps->block2buff && (wps->wphdr.flags & CROSS_DECORR)) || !wps->num_terms)
+        return 0;
+
+    for (preset = 0; preset < NUM_DECORR_PRESETS; ++preset) {
+        const signed char *terms = decorr_presets [preset].terms;
+
+        for (i = 0; i < wps->num_terms && terms [i]; ++i)
+            if (wps->decorr_passes [wps->num_terms - 1 - i].term != terms [i])
+                break;
+
+        if (i == wps->num_terms && !terms [i])
+            return preset + 1;
+    }
+
+    return 0;
+}
+
+// Run all the passes of the high mode -3 term list (the one preset there is)
+// with its fused kernel on the specified stereo buffer, which leaves the
+// history of terms 1-8 the same as the decorr_stereo_pass() functions do.
+
+static void decorr_stereo_preset (WavpackStream *wps, int32_t *buffer, int32_t sample_count, int long_math)
+{
+    if (long_math)
+        decorr_presets [wps->decorr_preset - 1].pass (wps->decorr_passes, buffer, sample_count);
+    else
+        decorr_presets [wps->decorr_preset - 1].pass_short (wps->decorr_passes, buffer, sample_count);
+}
+
 // This is a helper function for unpack_samples() that applies several final
 // operations. First, if the data is 32-bit float data, then that conversion
 // is done in the float.c module (whether lossy or lossless) and we return.
-// Otherwise, if the extended integer data applies, then that operation is
-// executed first. If the unpacked data is lossy (and not corrected) then
-// it is clipped and shifted in a single operation. Otherwise, if it's
-// lossless then the last step is to apply the final shift (if any).
+// Otherwise, if the extended integer data applies with a wvx stream, then that
+// operation is executed first. Everything else (the restoration of the low
+// bits of 32-bit integers without a wvx stream, the clipping of lossy data and
+// the final shift) is done in a single pass by fixup_int_samples().
+
+#define FILL_NONE   0
+#define FILL_ZEROS  1
+#define FILL_ONES   2
+#define FILL_DUPS   3
+
+static void fixup_int_samples (int32_t *buffer, uint32_t count, int fill, int fill_bits,
+    int clip, int32_t min_value, int32_t max_value, int shift);
 
 static void fixup_samples (WavpackStream *wps, int32_t *buffer, uint32_t sample_count)
 {
     uint32_t flags = wps->wphdr.flags;
     int lossy_flag = (flags & HYBRID_FLAG) && !wps->block2buff;
     int shift = (flags & SHIFT_MASK) >> SHIFT_LSB;
+    int fill = FILL_NONE, fill_bits = 0;
+    int32_t min_value = 0, max_value = 0;
+
+    // floats are normalized as they are reconstructed, either because the application asked
+    // for that when opening the file, or because they are going to WavpackUnpackSamplesFloat()
 
     if (flags & FLOAT_DATA) {
-        float_values (wps, buffer, (flags & MONO_DATA) ? sample_count : sample_count * 2);
+        int delta_exp = 0;
+
+        if ((wps->wpc->open_flags & OPEN_NORMALIZE) || wps->wpc->float_output)
+            delta_exp = 127 - wps->float_norm_exp + wps->wpc->norm_offset;
+
+        float_values (wps, buffer, (flags & MONO_DATA) ? sample_count : sample_count * 2, delta_exp);
         return;
     }
 
@@ -712,41 +1243,37 @@ static void fixup_samples (WavpackStream *wps, int32_t *buffer, uint32_t sample_
         uint32_t data, mask = (1U << sent_bits) - 1;
         int32_t *dptr = buffer;
 
+        // each of the steps here is done with a separate loop over the samples, so
+        // that the choices between the variants are made just once for the buffer
+
         if (bs_is_open (&wps->wvxbits)) {
             int max_width = wps->int32_max_width;
-            uint32_t crc = wps->crc_x;
-
-            while (count--) {
-                if (sent_bits) {
-                    if (max_width) {
-                        int32_t pvalue = *dptr < 0 ? ~*dptr : *dptr;
-                        int width = count_bits (pvalue) + sent_bits;
-                        int bits_to_read = sent_bits;
-
-                        if (width <= max_width || (bits_to_read -= width - max_width) > 0) {
-                            getbits (&data, bits_to_read, &wps->wvxbits);
-                            data &= (1U << bits_to_read) - 1;
-                            *dptr = (((uint32_t) *dptr << bits_to_read) | data) << (sent_bits - bits_to_read);
-                        }
-                        else
-                            *dptr = (uint32_t) *dptr << sent_bits;
-                    }
-                    else {
-                        getbits (&data, sent_bits, &wps->wvxbits);
-                        *dptr = ((uint32_t) *dptr << sent_bits) | (data & mask);
+            uint32_t crc = wps->crc_x, i;
+
+            if (sent_bits && max_width)
+                for (i = 0; i < count; ++i) {
+                    int32_t pvalue = dptr [i] < 0 ? ~dptr [i] : dptr [i];
+                    int width = count_bits (pvalue) + sent_bits;
+                    int bits_to_read = sent_bits;
+
+                    if (width <= max_width || (bits_to_read -= width - max_width) > 0) {
+                        getbits (&data, bits_to_read, &wps->wvxbits);
+                        data &= (1U << bits_to_read) - 1;
+                        dptr [i] = (((uint32_t) dptr [i] << bits_to_read) | data) << (sent_bits - bits_to_read);
                     }
+                    else
+                        dptr [i] = (uint32_t) dptr [i] << sent_bits;
+                }
+            else if (sent_bits)
+                for (i = 0; i < count; ++i) {
+                    getbits (&data, sent_bits, &wps->wvxbits);
+                    dptr [i] = ((uint32_t) dptr [i] << sent_bits) | (data & mask);
                 }
 
-                if (zeros)
-                    *(uint32_t*)dptr <<= zeros;
-                else if (ones)
-                    *dptr = ((uint32_t)(*dptr + 1) << ones) - 1;
-                else if (dups)
-                    *dptr = ((uint32_t)(*dptr + (*dptr & 1)) << dups) - (*dptr & 1);
+            int32_fill_bits (dptr, count, zeros, ones, dups);
 
-                crc = crc * 9 + (*dptr & 0xffff) * 3 + ((*dptr >> 16) & 0xffff);
-                dptr++;
-            }
+            for (i = 0; i < count; ++i)
+                crc = crc * 9 + (dptr [i] & 0xffff) * 3 + ((dptr [i] >> 16) & 0xffff);
 
             wps->crc_x = crc;
         }
@@ -764,16 +1291,14 @@ static void fixup_samples (WavpackStream *wps, int32_t *buffer, uint32_t sample_
                 shift++;
             }
 
-            while (count--) {
-                if (zeros)
-                    *(uint32_t*)dptr <<= zeros;
-                else if (ones)
-                    *dptr = ((uint32_t)(*dptr + 1) << ones) - 1;
-                else if (dups)
-                    *dptr = ((uint32_t)(*dptr + (*dptr & 1)) << dups) - (*dptr & 1);
+            // the bits are filled in by fixup_int_samples(), along with the clipping and shift
 
-                dptr++;
-            }
+            if (zeros)
+                fill = FILL_ZEROS, fill_bits = zeros;
+            else if (ones)
+                fill = FILL_ONES, fill_bits = ones;
+            else if (dups)
+                fill = FILL_DUPS, fill_bits = dups;
         }
         else
             shift += zeros + sent_bits + ones + dups;
@@ -781,48 +1306,113 @@ static void fixup_samples (WavpackStream *wps, int32_t *buffer, uint32_t sample_
 
     shift &= 0x1f;
 
-    if (lossy_flag) {
-        int32_t min_value, max_value, min_shifted, max_shifted;
-
+    if (lossy_flag)
         switch (flags & BYTES_STORED) {
             case 0:
-                min_shifted = (uint32_t)(min_value = -128 >> shift) << shift;
-                max_shifted = (max_value = 127 >> shift) << shift;
+                min_value = -128 >> shift;
+                max_value = 127 >> shift;
                 break;
 
             case 1:
-                min_shifted = (uint32_t)(min_value = -32768 >> shift) << shift;
-                max_shifted = (max_value = 32767 >> shift) << shift;
+                min_value = -32768 >> shift;
+                max_value = 32767 >> shift;
                 break;
 
             case 2:
-                min_shifted = (uint32_t)(min_value = -8388608 >> shift) << shift;
-                max_shifted = (max_value = 8388607 >> shift) << shift;
+                min_value = -8388608 >> shift;
+                max_value = 8388607 >> shift;
                 break;
 
             case 3: default:    /* "default" suppresses compiler warning */
-                min_shifted = (uint32_t)(min_value = (int32_t) 0x80000000 >> shift) << shift;
-                max_shifted = (max_value = (int32_t) 0x7fffffff >> shift) << shift;
+                min_value = (int32_t) 0x80000000 >> shift;
+                max_value = (int32_t) 0x7fffffff >> shift;
                 break;
         }
 
-        if (!(flags & MONO_DATA))
-            sample_count *= 2;
+    fixup_int_samples (buffer, (flags & MONO_DATA) ? sample_count : sample_count * 2, fill, fill_bits,
+        lossy_flag, min_value, max_value, shift);
+}
 
-        while (sample_count--) {
-            if (*buffer < min_value)
-                *buffer++ = min_shifted;
-            else if (*buffer > max_value)
-                *buffer++ = max_shifted;
-            else
-                *(uint32_t*)buffer++ <<= shift;
+// This is the kernel template for fixup_int_samples(), with the fill mode and whether
+// to clip as constant parameters. Each sample first has its missing low bits restored
+// (if FILL_ZEROS, FILL_ONES or FILL_DUPS), is then clipped to min_value and max_value
+// (if clip), and is finally shifted. Since there are no branches, the compiler is able
+// to vectorize all the variants, and none of them needs more than one pass.
+
+static KERNEL_INLINE void fixup_int_kernel (int32_t *buffer, uint32_t count, const int fill, int fill_bits,
+    const int clip, int32_t min_value, int32_t max_value, int shift)
+{
+    uint32_t i;
+
+    for (i = 0; i < count; ++i) {
+        int32_t value = buffer [i];
+
+        if (fill == FILL_ZEROS)
+            value = (uint32_t) value << fill_bits;
+        else if (fill == FILL_ONES)
+            value = ((uint32_t)(value + 1) << fill_bits) - 1;
+        else if (fill == FILL_DUPS)
+            value = ((uint32_t)(value + (value & 1)) << fill_bits) - (value & 1);
+
+        if (clip) {
+            value = (value < min_value) ? min_value : value;
+            value = (value > max_value) ? max_value : value;
         }
+
+        buffer [i] = (uint32_t) value << shift;
     }
-    else if (shift) {
-        if (!(flags & MONO_DATA))
-            sample_count *= 2;
+}
+
+static void fixup_int_samples (int32_t *buffer, uint32_t count, int fill, int fill_bits,
+    int clip, int32_t min_value, int32_t max_value, int shift)
+{
+    switch (fill * 2 + (clip ? 1 : 0)) {
+        case 0:
+            if (shift)
+                fixup_int_kernel (buffer, count, FILL_NONE, 0, FALSE, 0, 0, shift);
+
+            break;
 
-        while (sample_count--)
-            *(uint32_t*)buffer++ <<= shift;
+        case 1: fixup_int_kernel (buffer, count, FILL_NONE, 0, TRUE, min_value, max_value, shift); break;
+        case 2: fixup_int_kernel (buffer, count, FILL_ZEROS, fill_bits, FALSE, 0, 0, shift); break;
+        case 3: fixup_int_kernel (buffer, count, FILL_ZEROS, fill_bits, TRUE, min_value, max_value, shift); break;
+        case 4: fixup_int_kernel (buffer, count, FILL_ONES, fill_bits, FALSE, 0, 0, shift); break;
+        case 5: fixup_int_kernel (buffer, count, FILL_ONES, fill_bits, TRUE, min_value, max_value, shift); break;
+        case 6: fixup_int_kernel (buffer, count, FILL_DUPS, fill_bits, FALSE, 0, 0, shift); break;
+        default: fixup_int_kernel (buffer, count, FILL_DUPS, fill_bits, TRUE, min_value, max_value, shift); break;
     }
 }
+
+// Convert integer samples to floats (in place) for WavpackUnpackSamplesFloat(). This is
+// done right after fixup_samples() while the samples are still in the cache, and full
+// scale for the number of bytes per sample becomes +/-1.0 (which is exact up to 24 bits).
+
+void int_to_float_samples (int32_t *buffer, uint32_t count, int bytes_per_sample)
+{
+    float scale = 1.0f / (float)(1U << (bytes_per_sample * 8 - 1)), *fbuffer = (float *) buffer;
+    uint32_t i;
+
+    for (i = 0; i < count; ++i)
+        fbuffer [i] = buffer [i] * scale;
+}
+
+// Restore the low bits of 32-bit integer samples that were not sent because they
+// were identical in every sample: either all zeros, all ones, or duplicates of the
+// lowest sent bit (only one of these applies, in that order of precedence).
+
+static void int32_fill_bits (int32_t *buffer, uint32_t count, int zeros, int ones, int dups)
+{
+    if (zeros)
+        while (count--)
+            *(uint32_t*)buffer++ <<= zeros;
+    else if (ones)
+        while (count--) {
+            *buffer = ((uint32_t)(*buffer + 1) << ones) - 1;
+            buffer++;
+        }
+    else if (dups)
+        while (count--) {
+            *buffer = ((uint32_t)(*buffer + (*buffer & 1)) << dups) - (*buffer & 1);
+            buffer++;
+        }
+}
@@ -24,8 +24,6 @@
 
 static int init_dsd_block_fast (WavpackStream *wps, WavpackMetadata *wpmd);
 static int init_dsd_block_high (WavpackStream *wps, WavpackMetadata *wpmd);
-static int decode_fast (WavpackStream *wps, int32_t *output, int sample_count);
-static int decode_high (WavpackStream *wps, int32_t *output, int sample_count);
 
 int init_dsd_block (WavpackStream *wps, WavpackMetadata *wpmd)
 {
@@ -63,9 +61,82 @@ int init_dsd_block (WavpackStream *wps, WavpackMetadata *wpmd)
         return FALSE;
 }
 
+// The decoded DSD bytes are either returned as int32_t values (one per byte, which is what
+// WavpackUnpackSamples() provides) or stored as packed bytes for WavpackUnpackSamplesDSD().
+// Packed bytes are written through a pointer for each channel (which take turns for stereo)
+// that's advanced by "stride" bytes, so the channels can be either interleaved or planar, and
+// they can be stored LSB first by reversing the bits. The decoders are kernel templates with
+// a "packed" parameter that's one of these values, so the int32_t versions are not affected.
+
+#define DSD_VALUES      0
+#define DSD_BYTES_MSB   1
+#define DSD_BYTES_LSB   2
+
+#define R2(n) n, n + 2*64, n + 1*64, n + 3*64
+#define R4(n) R2(n), R2(n + 2*16), R2(n + 1*16), R2(n + 3*16)
+#define R6(n) R4(n), R4(n + 2*4), R4(n + 1*4), R4(n + 3*4)
+
+static const unsigned char bit_reverse [256] = { R6(0), R6(2), R6(1), R6(3) };
+
+#define PUT_DSD_BYTE(code,stereo) do {                                                  \
+    if (packed) {                                                                       \
+        *bptr = packed == DSD_BYTES_LSB ? bit_reverse [code] : (unsigned char) (code);  \
+        bptr += stride;                                                                 \
+        if (stereo) { unsigned char *swap = bptr; bptr = bptr_other; bptr_other = swap; } \
+    }                                                                                   \
+    else                                                                                \
+        *output++ = (code);                                                             \
+} while (0)
+
+static KERNEL_INLINE int32_t unpack_dsd_kernel (WavpackStream *wps, int32_t *buffer, unsigned char *left, unsigned char *right,
+    int stride, uint32_t sample_count, const int packed);
+static KERNEL_INLINE int decode_fast_kernel (WavpackStream *wps, int32_t *output, unsigned char *bptr, unsigned char *bptr_other,
+    int stride, int sample_count, const int packed);
+static KERNEL_INLINE int decode_high_kernel (WavpackStream *wps, int32_t *output, unsigned char *bptr, unsigned char *bptr_other,
+    int stride, int sample_count, const int packed);
+
 int32_t unpack_dsd_samples (WavpackStream *wps, int32_t *buffer, uint32_t sample_count)
+{
+    return unpack_dsd_kernel (wps, buffer, NULL, NULL, 0, sample_count, DSD_VALUES);
+}
+
+// Unpack DSD samples from the current block as packed bytes. The bytes for the left (or
+// mono) channel go to "left" and those for the right channel go to "right", and both are
+// advanced "stride" bytes per sample. Otherwise this is the same as unpack_dsd_samples().
+
+int32_t unpack_dsd_bytes (WavpackStream *wps, unsigned char *left, unsigned char *right, int stride, uint32_t sample_count, int lsb_first)
+{
+    if (lsb_first)
+        return unpack_dsd_kernel (wps, NULL, left, right, stride, sample_count, DSD_BYTES_LSB);
+    else
+        return unpack_dsd_kernel (wps, NULL, left, right, stride, sample_count, DSD_BYTES_MSB);
+}
+
+// Pack the interleaved int32_t values returned by WavpackUnpackSamples() for DSD audio into
+// bytes, with channel "c" of the first sample going to buffer [c * channel_step] and each
+// channel advancing "stride" bytes per sample (and optionally reversing the bits).
+
+void pack_dsd_values (const int32_t *values, uint32_t sample_count, int num_channels,
+    unsigned char *buffer, uint32_t channel_step, int stride, int lsb_first)
+{
+    uint32_t i;
+    int c;
+
+    for (i = 0; i < sample_count; ++i, buffer += stride)
+        for (c = 0; c < num_channels; ++c) {
+            unsigned char byte = (unsigned char) *values++;
+            buffer [c * channel_step] = lsb_first ? bit_reverse [byte] : byte;
+        }
+}
+
+static KERNEL_INLINE int32_t unpack_dsd_kernel (WavpackStream *wps, int32_t *buffer, unsigned char *left, unsigned char *right,
+    int stride, uint32_t sample_count, const int packed)
 {
     uint32_t flags = wps->wphdr.flags;
+#ifdef WAVPACK_PROFILE
+    unsigned char *byteptr = wps->dsd.byteptr;
+#endif
+    PROFILE_DECL (start_time);
 
     // don't attempt to decode past the end of the block, but watch out for overflow!
 
@@ -77,23 +148,36 @@ int32_t unpack_dsd_samples (WavpackStream *wps, int32_t *buffer, uint32_t sample
         wps->mute_error = TRUE;
 
     if (!wps->mute_error) {
+        PROFILE_START (wps->wpc, start_time);
+
         if (!wps->dsd.mode) {
-            int total_samples = sample_count * ((flags & MONO_DATA) ? 1 : 2);
-            int32_t *bptr = buffer;
+            int total_samples = sample_count * ((flags & MONO_DATA) ? 1 : 2), stereo = !(flags & MONO_DATA);
+            unsigned char *bptr = left, *bptr_other = right;
+            int32_t *output = buffer;
 
             if (wps->dsd.endptr - wps->dsd.byteptr < total_samples)
                 total_samples = (int)(wps->dsd.endptr - wps->dsd.byteptr);
 
-            while (total_samples--)
-                wps->crc += (wps->crc << 1) + (*bptr++ = *wps->dsd.byteptr++);
+            while (total_samples--) {
+                int code = *wps->dsd.byteptr++;
+
+                PUT_DSD_BYTE (code, stereo);
+                wps->crc += (wps->crc << 1) + code;
+            }
         }
         else if (wps->dsd.mode == 1) {
-            if (!decode_fast (wps, buffer, sample_count))
+            if (!decode_fast_kernel (wps, buffer, left, right, stride, sample_count, packed))
                 wps->mute_error = TRUE;
         }
-        else if (!decode_high (wps, buffer, sample_count))
+        else if (!decode_high_kernel (wps, buffer, left, right, stride, sample_count, packed))
             wps->mute_error = TRUE;
 
+        PROFILE_STOP (wps->profile, WP_PROFILE_DSD, start_time);
+#ifdef WAVPACK_PROFILE
+        if (wps->dsd.byteptr > byteptr)
+            wps->profile.refills += wps->dsd.byteptr - byteptr;
+#endif
+
         // If we just finished this block, then it's time to check if the applicable checksum matches. Like
         // other decoding errors, this is indicated by setting the mute_error flag.
 
@@ -103,20 +187,36 @@ int32_t unpack_dsd_samples (WavpackStream *wps, int32_t *buffer, uint32_t sample
     }
 
     if (wps->mute_error) {
-        int samples_to_null;
-        if (wps->wpc->reduced_channels == 1 || wps->wpc->config.num_channels == 1 || (flags & MONO_FLAG))
+        int samples_to_null, stereo = !(wps->wpc->reduced_channels == 1 || wps->wpc->config.num_channels == 1 || (flags & MONO_FLAG));
+        if (!stereo)
             samples_to_null = sample_count;
         else
             samples_to_null = sample_count * 2;
 
-        while (samples_to_null--)
-            *buffer++ = 0x55;
+        if (packed) {
+            unsigned char *bptr = left, *bptr_other = right;
+            int32_t *output = buffer;
+
+            while (samples_to_null--)
+                PUT_DSD_BYTE (0x55, stereo);
+        }
+        else
+            while (samples_to_null--)
+                *buffer++ = 0x55;
 
         wps->sample_index += sample_count;
         return sample_count;
     }
 
-    if (flags & FALSE_STEREO) {
+    if (packed) {
+        if (flags & FALSE_STEREO) {
+            uint32_t c;
+
+            for (c = 0; c < sample_count; ++c)
+                right [c * stride] = left [c * stride];
+        }
+    }
+    else if (flags & FALSE_STEREO) {
         int32_t *dptr = buffer + sample_count * 2;
         int32_t *sptr = buffer + sample_count;
         int32_t c = sample_count;
@@ -138,6 +238,33 @@ int32_t unpack_dsd_samples (WavpackStream *wps, int32_t *buffer, uint32_t sample
 // #define DSD_BYTE_READY(low,high) (!(((low) ^ (high)) >> 24))
 #define DSD_BYTE_READY(low,high) (!(((low) ^ (high)) & 0xff000000))
 
+// Make sure the stream's "fast" mode tables have room for the given number of history
+// bins. They're only ever grown (and kept from block to block), so this normally does
+// nothing after the first block.
+
+static int alloc_dsd_tables (WavpackStream *wps, int bins)
+{
+    DSDtables *tables = &wps->dsd.tables;
+
+    if (tables->bins >= bins)
+        return TRUE;
+
+    free_dsd_tables (tables);   // (the ptable goes too, but it's only used in "high" mode)
+    tables->lookup_buffer = (unsigned char *)malloc (bins * MAX_BYTES_PER_BIN);
+    tables->value_lookup = (unsigned char **)malloc (sizeof (*tables->value_lookup) * bins);
+    tables->summed_probabilities = (uint16_t (*)[256])malloc (sizeof (*tables->summed_probabilities) * bins);
+    tables->probabilities = (unsigned char (*)[256])malloc (sizeof (*tables->probabilities) * bins);
+    PROFILE_COUNT (wps->profile, allocations, 4);
+
+    if (!tables->lookup_buffer || !tables->value_lookup || !tables->summed_probabilities || !tables->probabilities) {
+        free_dsd_tables (tables);
+        return FALSE;
+    }
+
+    tables->bins = bins;
+    return TRUE;
+}
+
 static int init_dsd_block_fast (WavpackStream *wps, WavpackMetadata *wpmd)
 {
     unsigned char history_bits, max_probability, *lb_ptr;
@@ -155,18 +282,17 @@ static int init_dsd_block_fast (WavpackStream *wps, WavpackMetadata *wpmd)
 
     wps->dsd.history_bins = 1 << history_bits;
 
-    free_dsd_tables (wps);
-    lb_ptr = wps->dsd.lookup_buffer = (unsigned char *)malloc (wps->dsd.history_bins * MAX_BYTES_PER_BIN);
-    wps->dsd.value_lookup = (unsigned char **)malloc (sizeof (*wps->dsd.value_lookup) * wps->dsd.history_bins);
-    memset (wps->dsd.value_lookup, 0, sizeof (*wps->dsd.value_lookup) * wps->dsd.history_bins);
-    wps->dsd.summed_probabilities = (uint16_t (*)[256])malloc (sizeof (*wps->dsd.summed_probabilities) * wps->dsd.history_bins);
-    wps->dsd.probabilities = (unsigned char (*)[256])malloc (sizeof (*wps->dsd.probabilities) * wps->dsd.history_bins);
+    if (!alloc_dsd_tables (wps, wps->dsd.history_bins))
+        return FALSE;
+
+    lb_ptr = wps->dsd.tables.lookup_buffer;
+    memset (wps->dsd.tables.value_lookup, 0, sizeof (*wps->dsd.tables.value_lookup) * wps->dsd.history_bins);
 
     max_probability = *wps->dsd.byteptr++;
 
     if (max_probability < 0xff) {
-        unsigned char *outptr = (unsigned char *) wps->dsd.probabilities;
-        unsigned char *outend = outptr + sizeof (*wps->dsd.probabilities) * wps->dsd.history_bins;
+        unsigned char *outptr = (unsigned char *) wps->dsd.tables.probabilities;
+        unsigned char *outend = outptr + sizeof (*wps->dsd.tables.probabilities) * wps->dsd.history_bins;
 
         while (outptr < outend && wps->dsd.byteptr < wps->dsd.endptr) {
             int code = *wps->dsd.byteptr++;
@@ -186,9 +312,9 @@ static int init_dsd_block_fast (WavpackStream *wps, WavpackMetadata *wpmd)
         if (outptr < outend || (wps->dsd.byteptr < wps->dsd.endptr && *wps->dsd.byteptr++))
             return FALSE;
     }
-    else if (wps->dsd.endptr - wps->dsd.byteptr > (int) sizeof (*wps->dsd.probabilities) * wps->dsd.history_bins) {
-        memcpy (wps->dsd.probabilities, wps->dsd.byteptr, sizeof (*wps->dsd.probabilities) * wps->dsd.history_bins);
-        wps->dsd.byteptr += sizeof (*wps->dsd.probabilities) * wps->dsd.history_bins;
+    else if (wps->dsd.endptr - wps->dsd.byteptr > (int) sizeof (*wps->dsd.tables.probabilities) * wps->dsd.history_bins) {
+        memcpy (wps->dsd.tables.probabilities, wps->dsd.byteptr, sizeof (*wps->dsd.tables.probabilities) * wps->dsd.history_bins);
+        wps->dsd.byteptr += sizeof (*wps->dsd.tables.probabilities) * wps->dsd.history_bins;
     }
     else
         return FALSE;
@@ -197,16 +323,16 @@ static int init_dsd_block_fast (WavpackStream *wps, WavpackMetadata *wpmd)
         int32_t sum_values;
 
         for (sum_values = i = 0; i < 256; ++i)
-            wps->dsd.summed_probabilities [bi] [i] = (uint16_t)(sum_values += wps->dsd.probabilities [bi] [i]);
+            wps->dsd.tables.summed_probabilities [bi] [i] = (uint16_t)(sum_values += wps->dsd.tables.probabilities [bi] [i]);
 
         if (sum_values) {
             if ((total_summed_probabilities += sum_values) > wps->dsd.history_bins * MAX_BYTES_PER_BIN)
                 return FALSE;
 
-            wps->dsd.value_lookup [bi] = lb_ptr;
+            wps->dsd.tables.value_lookup [bi] = lb_ptr;
 
             for (i = 0; i < 256; i++) {
-                int c = wps->dsd.probabilities [bi] [i];
+                int c = wps->dsd.tables.probabilities [bi] [i];
 
                 while (c--)
                     *lb_ptr++ = (unsigned char)i;
@@ -227,60 +353,84 @@ static int init_dsd_block_fast (WavpackStream *wps, WavpackMetadata *wpmd)
     return TRUE;
 }
 
-static int decode_fast (WavpackStream *wps, int32_t *output, int sample_count)
+static KERNEL_INLINE int decode_fast_kernel (WavpackStream *wps, int32_t *output, unsigned char *bptr, unsigned char *bptr_other,
+    int stride, int sample_count, const int packed)
 {
-    int total_samples = sample_count;
+    unsigned char *byteptr = wps->dsd.byteptr, *endptr = wps->dsd.endptr;
+    uint32_t low = wps->dsd.low, high = wps->dsd.high, value = wps->dsd.value, crc = wps->crc;
+    int total_samples = sample_count, p0 = wps->dsd.p0, p1 = wps->dsd.p1, result = sample_count;
+    int mono = wps->wphdr.flags & MONO_DATA, bin_mask = wps->dsd.history_bins - 1;
+
+    // The state is kept in locals (and stored back at the end) because otherwise the stores
+    // to the output would force it all to be reloaded from the stream for every byte.
 
-    if (!(wps->wphdr.flags & MONO_DATA))
+    if (!mono)
         total_samples *= 2;
 
     while (total_samples--) {
-        unsigned int mult, index, code, i;
+        unsigned int total = wps->dsd.tables.summed_probabilities [p0] [255], mult, index, code, i;
 
-        if (!wps->dsd.summed_probabilities [wps->dsd.p0] [255])
-            return 0;
+        if (!total) {
+            result = 0;
+            break;
+        }
 
-        mult = (wps->dsd.high - wps->dsd.low) / wps->dsd.summed_probabilities [wps->dsd.p0] [255];
+        mult = (high - low) / total;
 
         if (!mult) {
-            if (wps->dsd.endptr - wps->dsd.byteptr >= 4)
+            if (endptr - byteptr >= 4)
                 for (i = 4; i--;)
-                    wps->dsd.value = (wps->dsd.value << 8) | *wps->dsd.byteptr++;
+                    value = (value << 8) | *byteptr++;
 
-            wps->dsd.low = 0;
-            wps->dsd.high = 0xffffffff;
-            mult = wps->dsd.high / wps->dsd.summed_probabilities [wps->dsd.p0] [255];
+            low = 0;
+            high = 0xffffffff;
+            mult = high / total;
 
-            if (!mult)
-                return 0;
+            if (!mult) {
+                result = 0;
+                break;
+            }
         }
 
-        index = (wps->dsd.value - wps->dsd.low) / mult;
+        index = (value - low) / mult;
 
-        if (index >= wps->dsd.summed_probabilities [wps->dsd.p0] [255])
-            return 0;
+        if (index >= total) {
+            result = 0;
+            break;
+        }
 
-        if ((*output++ = code = wps->dsd.value_lookup [wps->dsd.p0] [index]) != 0)
-            wps->dsd.low += wps->dsd.summed_probabilities [wps->dsd.p0] [code-1] * mult;
+        code = wps->dsd.tables.value_lookup [p0] [index];
+        PUT_DSD_BYTE (code, !mono);
 
-        wps->dsd.high = wps->dsd.low + wps->dsd.probabilities [wps->dsd.p0] [code] * mult - 1;
-        wps->crc += (wps->crc << 1) + code;
+        if (code)
+            low += wps->dsd.tables.summed_probabilities [p0] [code-1] * mult;
 
-        if (wps->wphdr.flags & MONO_DATA)
-            wps->dsd.p0 = code & (wps->dsd.history_bins-1);
+        high = low + wps->dsd.tables.probabilities [p0] [code] * mult - 1;
+        crc += (crc << 1) + code;
+
+        if (mono)
+            p0 = code & bin_mask;
         else {
-            wps->dsd.p0 = wps->dsd.p1;
-            wps->dsd.p1 = code & (wps->dsd.history_bins-1);
+            p0 = p1;
+            p1 = code & bin_mask;
         }
 
-        while (DSD_BYTE_READY (wps->dsd.high, wps->dsd.low) && wps->dsd.byteptr < wps->dsd.endptr) {
-            wps->dsd.value = (wps->dsd.value << 8) | *wps->dsd.byteptr++;
-            wps->dsd.high = (wps->dsd.high << 8) | 0xff;
-            wps->dsd.low <<= 8;
+        while (DSD_BYTE_READY (high, low) && byteptr < endptr) {
+            value = (value << 8) | *byteptr++;
+            high = (high << 8) | 0xff;
+            low <<= 8;
         }
     }
 
-    return sample_count;
+    wps->dsd.byteptr = byteptr;
+    wps->dsd.low = low;
+    wps->dsd.high = high;
+    wps->dsd.value = value;
+    wps->dsd.p0 = p0;
+    wps->dsd.p1 = p1;
+    wps->crc = crc;
+
+    return result;
 }
 
 /*------------------------------------------------------------------------------------------------------------------------*/
@@ -335,10 +485,24 @@ static int init_dsd_block_high (WavpackStream *wps, WavpackMetadata *wpmd)
     if (rate_s != RATE_S)
         return FALSE;
 
-    if (!wps->dsd.ptable)
-        wps->dsd.ptable = (int32_t *)malloc (PTABLE_BINS * sizeof (*wps->dsd.ptable));
+    // the ptable adapts while decoding, so it's reset for every block from a copy of its
+    // initial state (which only has to be rebuilt if the rate is different)
 
-    init_ptable (wps->dsd.ptable, rate_i, rate_s);
+    if (!wps->dsd.tables.ptable) {
+        if (!(wps->dsd.tables.ptable = (int32_t *)malloc (PTABLE_BINS * 2 * sizeof (*wps->dsd.tables.ptable))))
+            return FALSE;
+
+        wps->dsd.tables.ptable_init = wps->dsd.tables.ptable + PTABLE_BINS;
+        wps->dsd.tables.ptable_rate = -1;
+        PROFILE_COUNT (wps->profile, allocations, 1);
+    }
+
+    if (wps->dsd.tables.ptable_rate != rate_i) {
+        init_ptable (wps->dsd.tables.ptable_init, rate_i, rate_s);
+        wps->dsd.tables.ptable_rate = rate_i;
+    }
+
+    memcpy (wps->dsd.tables.ptable, wps->dsd.tables.ptable_init, PTABLE_BINS * sizeof (*wps->dsd.tables.ptable));
 
     for (channel = 0; channel < ((flags & MONO_DATA) ? 1 : 2); ++channel) {
         DSDfilters *sp = wps->dsd.filters + channel;
@@ -365,7 +529,8 @@ static int init_dsd_block_high (WavpackStream *wps, WavpackMetadata *wpmd)
     return TRUE;
 }
 
-static int decode_high (WavpackStream *wps, int32_t *output, int sample_count)
+static KERNEL_INLINE int decode_high_kernel (WavpackStream *wps, int32_t *output, unsigned char *bptr, unsigned char *bptr_other,
+    int stride, int sample_count, const int packed)
 {
     int total_samples = sample_count, stereo = (wps->wphdr.flags & MONO_DATA) ? 0 : 1;
     DSDfilters *sp = wps->dsd.filters;
@@ -379,7 +544,7 @@ static int decode_high (WavpackStream *wps, int32_t *output, int sample_count)
             sp [1].value = sp [1].filter1 - sp [1].filter5 + ((sp [1].filter6 * sp [1].factor) >> 2);
 
         while (bitcount--) {
-            int32_t *pp = wps->dsd.ptable + ((sp [0].value >> (PRECISION - PRECISION_USE)) & PTABLE_MASK);
+            int32_t *pp = wps->dsd.tables.ptable + ((sp [0].value >> (PRECISION - PRECISION_USE)) & PTABLE_MASK);
             uint32_t split = wps->dsd.low + ((wps->dsd.high - wps->dsd.low) >> 8) * (*pp >> 16);
 
             if (wps->dsd.value <= split) {
@@ -414,7 +579,7 @@ static int decode_high (WavpackStream *wps, int32_t *output, int sample_count)
             if (!stereo)
                 continue;
 
-            pp = wps->dsd.ptable + ((sp [1].value >> (PRECISION - PRECISION_USE)) & PTABLE_MASK);
+            pp = wps->dsd.tables.ptable + ((sp [1].value >> (PRECISION - PRECISION_USE)) & PTABLE_MASK);
             split = wps->dsd.low + ((wps->dsd.high - wps->dsd.low) >> 8) * (*pp >> 16);
 
             if (wps->dsd.value <= split) {
@@ -447,11 +612,13 @@ static int decode_high (WavpackStream *wps, int32_t *output, int sample_count)
             sp [1].value = sp [1].filter1 - sp [1].filter5 + ((sp [1].filter6 * sp [1].factor) >> 2);
         }
 
-        wps->crc += (wps->crc << 1) + (*output++ = sp [0].byte & 0xff);
+        PUT_DSD_BYTE (sp [0].byte & 0xff, stereo);
+        wps->crc += (wps->crc << 1) + (sp [0].byte & 0xff);
         sp [0].factor -= (sp [0].factor + 512) >> 10;
 
         if (stereo) {
-            wps->crc += (wps->crc << 1) + (*output++ = wps->dsd.filters [1].byte & 0xff);
+            PUT_DSD_BYTE (wps->dsd.filters [1].byte & 0xff, stereo);
+            wps->crc += (wps->crc << 1) + (wps->dsd.filters [1].byte & 0xff);
             wps->dsd.filters [1].factor -= (wps->dsd.filters [1].factor + 512) >> 10;
         }
     }
@@ -571,56 +738,88 @@ void decimate_dsd_reset (void *decimate_context)
     context->reset = 1;
 }
 
+// Decimate the DSD bytes (one per int32_t, interleaved for all the channels) to PCM in
+// place. This is simply decimate_dsd_run_channels() for all the channels followed by
+// decimate_dsd_finish(), and the caller can instead do those separately (for example,
+// with groups of channels run in parallel).
+
 void decimate_dsd_run (void *decimate_context, int32_t *samples, int num_samples)
 {
     DecimationContext *context = (DecimationContext *) decimate_context;
-    int chan = 0, scount = num_samples;
-    int32_t *samptr = samples;
 
     if (!context)
         return;
 
-    while (scount) {
+    decimate_dsd_run_channels (context, samples, num_samples, 0, context->num_channels);
+    decimate_dsd_finish (context, samples, num_samples);
+}
+
+// Decimate just the given range of channels. Each channel's filter history is its own
+// and the tables are only read, so different ranges can be run at the same time. Each
+// channel is done separately with its history in locals (rather than going through all
+// the channels for every sample) so that the history bytes stay in registers.
+
+void decimate_dsd_run_channels (void *decimate_context, int32_t *samples, int num_samples, int first_chan, int num_chans)
+{
+    DecimationContext *context = (DecimationContext *) decimate_context;
+    int chan;
+
+    if (!context)
+        return;
+
+    for (chan = first_chan; chan < first_chan + num_chans; ++chan) {
         DecimationChannel *sp = context->chans + chan;
-        int32_t sum = 0;
+        int32_t *samptr = samples + chan, *eptr = samptr + num_samples * context->num_channels;
+        unsigned char delay [HISTORY_BYTES];
+
+        memcpy (delay, sp->delay, HISTORY_BYTES);
+
+        for (; samptr < eptr; samptr += context->num_channels) {
+            int32_t sum = 0;
 
 #if (HISTORY_BYTES == 10)
-        sum += context->conv_tables [0] [sp->delay [0] = sp->delay [1]];
-        sum += context->conv_tables [1] [sp->delay [1] = sp->delay [2]];
-        sum += context->conv_tables [2] [sp->delay [2] = sp->delay [3]];
-        sum += context->conv_tables [3] [sp->delay [3] = sp->delay [4]];
-        sum += context->conv_tables [4] [sp->delay [4] = sp->delay [5]];
-        sum += context->conv_tables [5] [sp->delay [5] = sp->delay [6]];
-        sum += context->conv_tables [6] [sp->delay [6] = sp->delay [7]];
-        sum += context->conv_tables [7] [sp->delay [7] = sp->delay [8]];
-        sum += context->conv_tables [8] [sp->delay [8] = sp->delay [9]];
-        sum += context->conv_tables [9] [sp->delay [9] = (unsigned char)*samptr];
+            sum += context->conv_tables [0] [delay [0] = delay [1]];
+            sum += context->conv_tables [1] [delay [1] = delay [2]];
+            sum += context->conv_tables [2] [delay [2] = delay [3]];
+            sum += context->conv_tables [3] [delay [3] = delay [4]];
+            sum += context->conv_tables [4] [delay [4] = delay [5]];
+            sum += context->conv_tables [5] [delay [5] = delay [6]];
+            sum += context->conv_tables [6] [delay [6] = delay [7]];
+            sum += context->conv_tables [7] [delay [7] = delay [8]];
+            sum += context->conv_tables [8] [delay [8] = delay [9]];
+            sum += context->conv_tables [9] [delay [9] = (unsigned char)*samptr];
 #elif (HISTORY_BYTES == 7)
-        sum += context->conv_tables [0] [sp->delay [0] = sp->delay [1]];
-        sum += context->conv_tables [1] [sp->delay [1] = sp->delay [2]];
-        sum += context->conv_tables [2] [sp->delay [2] = sp->delay [3]];
-        sum += context->conv_tables [3] [sp->delay [3] = sp->delay [4]];
-        sum += context->conv_tables [4] [sp->delay [4] = sp->delay [5]];
-        sum += context->conv_tables [5] [sp->delay [5] = sp->delay [6]];
-        sum += context->conv_tables [6] [sp->delay [6] = (unsigned char)*samptr];
+            sum += context->conv_tables [0] [delay [0] = delay [1]];
+            sum += context->conv_tables [1] [delay [1] = delay [2]];
+            sum += context->conv_tables [2] [delay [2] = delay [3]];
+            sum += context->conv_tables [3] [delay [3] = delay [4]];
+            sum += context->conv_tables [4] [delay [4] = delay [5]];
+            sum += context->conv_tables [5] [delay [5] = delay [6]];
+            sum += context->conv_tables [6] [delay [6] = (unsigned char)*samptr];
 #else
-        int i;
+            int i;
 
-        for (i = 0; i < HISTORY_BYTES-1; ++i)
-            sum += context->conv_tables [i] [sp->delay [i] = sp->delay [i+1]];
+            for (i = 0; i < HISTORY_BYTES-1; ++i)
+                sum += context->conv_tables [i] [delay [i] = delay [i+1]];
 
-        sum += context->conv_tables [i] [sp->delay [i] = (unsigned char)*samptr];
+            sum += context->conv_tables [i] [delay [i] = (unsigned char)*samptr];
 #endif
 
-        *samptr++ = (sum + 8) >> 4;
-
-        if (++chan == context->num_channels) {
-            scount--;
-            chan = 0;
+            *samptr = (sum + 8) >> 4;
         }
+
+        memcpy (sp->delay, delay, HISTORY_BYTES);
     }
+}
 
-    if (context->reset) {
+// This must be called once all the channels of the samples have been decimated (it
+// takes care of the start of the first samples decimated after a reset).
+
+void decimate_dsd_finish (void *decimate_context, int32_t *samples, int num_samples)
+{
+    DecimationContext *context = (DecimationContext *) decimate_context;
+
+    if (context && context->reset) {
         extrapolate_pcm (samples, HISTORY_BYTES - 1, num_samples, context->num_channels);
         context->reset = 0;
     }
@@ -685,4 +884,87 @@ void decimate_dsd_destroy (void *decimate_context)
     free (context);
 }
 
+// Return an allocated copy of the specified decimation context (including the
+// filter history of each channel) so that it can be restored later with
+// decimate_dsd_restore(). The copy is freed with decimate_dsd_destroy().
+
+void *decimate_dsd_save (void *decimate_context)
+{
+    DecimationContext *context = (DecimationContext *) decimate_context, *copy;
+
+    if (!context || !(copy = (DecimationContext *)malloc (sizeof (DecimationContext))))
+        return NULL;
+
+    memcpy (copy, context, sizeof (DecimationContext));
+    copy->chans = (DecimationChannel *)malloc (context->num_channels * sizeof (DecimationChannel));
+
+    if (!copy->chans) {
+        free (copy);
+        return NULL;
+    }
+
+    memcpy (copy->chans, context->chans, context->num_channels * sizeof (DecimationChannel));
+    return copy;
+}
+
+// Restore the filter history of a decimation context from a copy previously
+// made with decimate_dsd_save(). The channel counts must match.
+
+void decimate_dsd_restore (void *decimate_context, void *saved_context)
+{
+    DecimationContext *context = (DecimationContext *) decimate_context;
+    DecimationContext *saved = (DecimationContext *) saved_context;
+
+    if (!context || !saved || context->num_channels != saved->num_channels)
+        return;
+
+    memcpy (context->chans, saved->chans, context->num_channels * sizeof (DecimationChannel));
+    context->reset = saved->reset;
+}
+
+// Make deep copies of the DSD decoding tables of the "src" stream into the "dst"
+// stream, which has already been copied from "src" and so still points at the
+// source tables. The copies have the same capacity, but only the contents in use
+// by the current block are copied, and the value_lookup pointers are rebased into
+// the new lookup buffer. Return FALSE (with no tables in "dst") if out of memory.
+
+int copy_dsd_tables (WavpackStream *dst, const WavpackStream *src)
+{
+    const DSDtables *tables = &src->dsd.tables;
+    int bins = src->dsd.history_bins, bi;
+
+    CLEAR (dst->dsd.tables);
+
+    if (tables->bins) {
+        if (!alloc_dsd_tables (dst, tables->bins))
+            return FALSE;
+
+        if (bins > tables->bins)
+            bins = tables->bins;
+
+        memcpy (dst->dsd.tables.probabilities, tables->probabilities, sizeof (*tables->probabilities) * bins);
+        memcpy (dst->dsd.tables.summed_probabilities, tables->summed_probabilities, sizeof (*tables->summed_probabilities) * bins);
+        memcpy (dst->dsd.tables.lookup_buffer, tables->lookup_buffer, bins * MAX_BYTES_PER_BIN);
+
+        for (bi = 0; bi < bins; ++bi)
+            if (tables->value_lookup [bi])
+                dst->dsd.tables.value_lookup [bi] = dst->dsd.tables.lookup_buffer + (tables->value_lookup [bi] - tables->lookup_buffer);
+            else
+                dst->dsd.tables.value_lookup [bi] = NULL;
+    }
+
+    if (tables->ptable) {
+        if (!(dst->dsd.tables.ptable = (int32_t *)malloc (PTABLE_BINS * 2 * sizeof (*tables->ptable)))) {
+            free_dsd_tables (&dst->dsd.tables);
+            return FALSE;
+        }
+
+        memcpy (dst->dsd.tables.ptable, tables->ptable, PTABLE_BINS * 2 * sizeof (*tables->ptable));
+        dst->dsd.tables.ptable_init = dst->dsd.tables.ptable + PTABLE_BINS;
+        dst->dsd.tables.ptable_rate = tables->ptable_rate;
+    }
+
+    return TRUE;
+}
+
 #endif      // ENABLE_DSD
@@ -17,16 +17,22 @@
 
 #include "wavpack_local.h"
 
-static void float_values_nowvx (WavpackStream *wps, int32_t *values, int32_t num_values);
+static void float_values_nowvx (WavpackStream *wps, int32_t *values, int32_t num_values, int delta_exp);
+static void float_values_nowvx_scalar (WavpackStream *wps, int32_t *values, int32_t num_values);
 
-void float_values (WavpackStream *wps, int32_t *values, int32_t num_values)
+// Convert the decoded integer values into floats (in place). If "delta_exp" is
+// not zero, it is added to the exponent of each value as it's stored (exactly
+// as WavpackFloatNormalize() would do afterward), which is how normalization is
+// done without another pass over the buffer. The crc is for the stored values.
+
+void float_values (WavpackStream *wps, int32_t *values, int32_t num_values, int delta_exp)
 {
     int min_shifted_zeros = wps->float_min_shifted_zeros;
     int max_shifted_ones = wps->float_max_shifted_ones;
     uint32_t crc = wps->crc_x;
 
     if (!bs_is_open (&wps->wvxbits)) {
-        float_values_nowvx (wps, values, num_values);
+        float_values_nowvx (wps, values, num_values, delta_exp);
         return;
     }
 
@@ -102,13 +108,80 @@ void float_values (WavpackStream *wps, int32_t *values, int32_t num_values)
         }
 
         crc = crc * 27 + get_mantissa (outval) * 9 + get_exponent (outval) * 3 + get_sign (outval);
-        * (f32 *) values++ = outval;
+        * (f32 *) values++ = delta_exp ? (f32) normalize_float (outval, delta_exp) : outval;
     }
 
     wps->crc_x = crc;
 }
 
-static void float_values_nowvx (WavpackStream *wps, int32_t *values, int32_t num_values)
+// Without a wvx stream the floats are rebuilt with pure integer arithmetic, and
+// for all the values that real files contain (magnitudes up to 28 bits, after
+// the shift, that don't need to be denormalized) this is done without any
+// branches so that the compiler can vectorize the loop. The leading zero count
+// is done with a branch-free binary search, and the value is normalized to bit
+// 31 so that the mantissa is always the same bits. If any value is outside of
+// that range (or max_exp is so large that exponents could wrap), the whole
+// buffer is done by float_values_nowvx_scalar() instead (which gives identical
+// results for the others). In range, the exponents are known to be from 1 to
+// 254, so "delta_exp" can be simply added in with the overflow and underflow
+// checks of normalize_float() reduced to a pair of selects.
+
+#define FLOAT_NORMALIZE_STEP(limit,bits) do {           \
+    uint32_t step = (mag <= limit) ? 0xffffffff : 0;    \
+    mag = (mag & ~step) | ((mag << bits) & step);       \
+    pow = (pow & ~step) | ((pow << bits) & step);       \
+    zeros += (int)(bits & step);                        \
+} while (0)
+
+static void float_values_nowvx (WavpackStream *wps, int32_t *values, int32_t num_values, int delta_exp)
+{
+    uint32_t *uvalues = (uint32_t *) values, min_mag, odd = 0;
+    int shift = wps->float_shift & 0x1f, max_exp = wps->float_max_exp;
+    uint32_t ones = (wps->float_flags & FLOAT_SHIFT_ONES) ? 0xffffffff : 0;
+    int32_t i;
+
+    // values that need fewer than max_exp shifts to normalize (and zeros) don't need denormalizing
+
+    min_mag = max_exp >= 24 ? 1 : 1U << (24 - max_exp);
+
+    for (i = 0; i < num_values; ++i) {
+        uint32_t value = uvalues [i] << shift, sign = value >> 31, mag = (value ^ (0 - sign)) + sign;
+
+        odd |= (uvalues [i] != 0) & (mag - min_mag > 0xfffffff - min_mag);
+    }
+
+    if (odd || max_exp > 250) {
+        float_values_nowvx_scalar (wps, values, num_values);
+        WavpackFloatNormalize (values, num_values, delta_exp);
+        return;
+    }
+
+    for (i = 0; i < num_values; ++i) {
+        uint32_t value = uvalues [i] << shift, sign = value >> 31, mag = (value ^ (0 - sign)) + sign;
+        uint32_t pow = 1, result;
+        int zeros = 0, exp;
+
+        // count the leading zeros with a binary search, normalizing the value to bit 31 as we go
+
+        FLOAT_NORMALIZE_STEP (0xffff, 16);
+        FLOAT_NORMALIZE_STEP (0xffffff, 8);
+        FLOAT_NORMALIZE_STEP (0xfffffff, 4);
+        FLOAT_NORMALIZE_STEP (0x3fffffff, 2);
+        FLOAT_NORMALIZE_STEP (0x7fffffff, 1);
+
+        // bit 31 is now bit 23 of the mantissa (values of 25 bits or more were shifted right, others
+        // left, and pow = 1 << zeros gives the bits shifted in, which might have to be ones)
+
+        mag >>= 8;
+        mag |= (zeros > 8) ? ((pow >> 8) - 1) & ones : 0;
+        exp = max_exp + 8 - zeros + delta_exp;
+        result = (sign << 31) | ((uint32_t) exp << 23) | (mag & 0x7fffff);
+        result = (exp >= 255) ? (sign << 31) | 0x7f800000 : result;
+        uvalues [i] = (!value || exp <= 0) ? 0 : result;
+    }
+}
+
+static void float_values_nowvx_scalar (WavpackStream *wps, int32_t *values, int32_t num_values)
 {
     while (num_values--) {
         int shift_count = 0, exp = wps->float_max_exp;
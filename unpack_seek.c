@@ -18,9 +18,25 @@
 
 #include "wavpack_local.h"
 
+// The block map remembers the positions (in both files) of the blocks of a hybrid
+// lossless file that have been decoded or seeked to, sorted by block index, so
+// that seeking back to one of them doesn't have to search either file again.
+
+typedef struct {
+    int64_t block_index, wv_pos, wvc_pos;
+    uint32_t block_samples;
+} BlockMapEntry;
+
+typedef struct {
+    BlockMapEntry *entries;
+    int num_entries, max_entries;
+} BlockMap;
+
 ///////////////////////////// executable code ////////////////////////////////
 
 static int64_t find_sample (WavpackContext *wpc, void *infile, int64_t header_pos, int64_t sample);
+static int64_t walk_to_sample (WavpackContext *wpc, void *infile, int64_t header_pos, int64_t sample);
+static BlockMapEntry *find_mapped_block (WavpackContext *wpc, int64_t sample);
 
 // Seek to the specified sample index, returning TRUE on success. Note that
 // files generated with version 4.0 or newer will seek almost immediately.
@@ -40,6 +56,7 @@ int WavpackSeekSample64 (WavpackContext *wpc, int64_t sample)
     WavpackStream *wps = wpc->streams ? wpc->streams [0] : NULL;
     uint32_t bcount, samples_to_skip, samples_to_decode = 0;
     int stream_index = 0;
+    BlockMapEntry *entry;
     int32_t *buffer;
 
     if (wpc->total_samples == -1 || sample >= wpc->total_samples ||
@@ -47,6 +64,11 @@ int WavpackSeekSample64 (WavpackContext *wpc, int64_t sample)
         (wpc->wvc_flag && !wpc->reader->can_seek (wpc->wvc_in)))
             return FALSE;
 
+    // the correction file is accessed directly below, so any blocks read ahead are discarded
+
+    if (wpc->wvc_flag)
+        stop_wvc_reader (wpc);
+
 #ifdef ENABLE_DSD
     if (wpc->decimation_context) {      // the decimation code needs some context to be sample accurate
         if (sample < 16) {
@@ -60,20 +82,37 @@ int WavpackSeekSample64 (WavpackContext *wpc, int64_t sample)
     }
 #endif
 
-    if (!wps->wphdr.block_samples || !(wps->wphdr.flags & INITIAL_BLOCK) || sample < GET_BLOCK_INDEX (wps->wphdr) ||
+    // if we have a cached checkpoint in the target block that's closer than where we are, start from there
+
+    if (wpc->checkpoints && restore_checkpoint (wpc, sample))
+        wps = wpc->streams [0];
+    else if (!wps->wphdr.block_samples || !(wps->wphdr.flags & INITIAL_BLOCK) || sample < GET_BLOCK_INDEX (wps->wphdr) ||
         sample >= GET_BLOCK_INDEX (wps->wphdr) + wps->wphdr.block_samples) {
 
             free_streams (wpc);
-            wpc->filepos = find_sample (wpc, wpc->wv_in, wpc->filepos, sample);
 
-            if (wpc->filepos == -1)
-                return FALSE;
+            // cursors of shared files have a block index, and we may have been to this block of a
+            // hybrid lossless file before (in which case it's in the block map); otherwise we have to search
 
-            if (wpc->wvc_flag) {
-                wpc->file2pos = find_sample (wpc, wpc->wvc_in, 0, sample);
+            if (wpc->wvc_flag && (entry = find_mapped_block (wpc, sample))) {
+                wpc->filepos = entry->wv_pos;
+                wpc->file2pos = entry->wvc_pos;
+            }
+            else {
+                if (wpc->shared)
+                    wpc->filepos = find_shared_block (wpc, sample, FALSE);
+                else
+                    wpc->filepos = find_sample (wpc, wpc->wv_in, wpc->filepos, sample);
 
-                if (wpc->file2pos == -1)
+                if (wpc->filepos == -1)
                     return FALSE;
+
+                if (wpc->wvc_flag) {
+                    wpc->file2pos = wpc->shared ? find_shared_block (wpc, sample, TRUE) : find_sample (wpc, wpc->wvc_in, -1, sample);
+
+                    if (wpc->file2pos == -1)
+                        return FALSE;
+                }
             }
     }
 
@@ -135,6 +174,7 @@ int WavpackSeekSample64 (WavpackContext *wpc, int64_t sample)
 
             SET_BLOCK_INDEX (wps->wphdr, GET_BLOCK_INDEX (wps->wphdr) - wpc->initial_index);
             memcpy (wps->block2buff, &wps->wphdr, sizeof (WavpackHeader));
+            map_block_position (wpc);
         }
 
         if (!wps->init_done && !unpack_init (wpc, stream_index)) {
@@ -309,25 +349,38 @@ static int64_t find_header (WavpackStreamReader64 *reader, void *id, int64_t fil
 }
 
 // Find the WavPack block that contains the specified sample. If "header_pos"
-// is zero, then no information is assumed except the total number of samples
-// in the file and its size in bytes. If "header_pos" is non-zero then we
-// assume that it is the file position of the valid header image contained in
-// the first stream and we can limit our search to either the portion above
-// or below that point. If a .wvc file is being used, then this must be called
-// for that file also.
+// is -1, then no information is assumed except the total number of samples
+// in the file and its size in bytes. Otherwise we assume that it is the file
+// position of the valid header image contained in the first stream and we can
+// limit our search to either the portion above or below that point. If a .wvc
+// file is being used, then this must be called for that file also. In that
+// case the search is also limited by the nearest blocks on either side of the
+// sample that are in the block map, in either file (so seeking to a block that
+// hasn't been visited yet only searches the part of the correction file between
+// the blocks that have). Once the block length is known the search aims a few
+// blocks short of the sample, and when it has a header within a few blocks
+// before the sample, it walks the headers from there instead of scanning the
+// data for them.
+
+#define MAX_WALK_BLOCKS 16   // initial blocks that may be walked over to reach the sample
 
 static int64_t find_sample (WavpackContext *wpc, void *infile, int64_t header_pos, int64_t sample)
 {
     WavpackStream *wps = wpc->streams [0];
     int64_t file_pos1 = 0, file_pos2 = wpc->reader->get_length (infile);
     int64_t sample_pos1 = 0, sample_pos2 = wpc->total_samples;
+    BlockMap *map = (BlockMap *) wpc->block_map;
+    uint32_t block_samples1 = 0;        // non-zero if there's a valid header at file_pos1
+    uint32_t block_samples = 0;         // length of the blocks seen so far (if any)
     double ratio = 0.96;
     int file_skip = 0;
 
     if (sample >= wpc->total_samples)
         return -1;
 
-    if (header_pos && wps->wphdr.block_samples) {
+    if (header_pos != -1 && wps->wphdr.block_samples) {
+        block_samples = wps->wphdr.block_samples;
+
         if (GET_BLOCK_INDEX (wps->wphdr) > sample) {
             sample_pos2 = GET_BLOCK_INDEX (wps->wphdr);
             file_pos2 = header_pos;
@@ -335,23 +388,77 @@ static int64_t find_sample (WavpackContext *wpc, void *infile, int64_t header_po
         else if (GET_BLOCK_INDEX (wps->wphdr) + wps->wphdr.block_samples <= sample) {
             sample_pos1 = GET_BLOCK_INDEX (wps->wphdr);
             file_pos1 = header_pos;
+            block_samples1 = wps->wphdr.block_samples;
         }
         else
             return header_pos;
     }
 
+    if (map && map->num_entries) {
+        int wvc = (infile == wpc->wvc_in), low = 0, high = map->num_entries;
+
+        block_samples = map->entries [0].block_samples;
+
+        // find the first mapped block that starts after the sample (the one before it starts at or before it)
+
+        while (low < high) {
+            int mid = (low + high) >> 1;
+
+            if (map->entries [mid].block_index <= sample)
+                low = mid + 1;
+            else
+                high = mid;
+        }
+
+        if (low && map->entries [low - 1].block_index >= sample_pos1) {
+            BlockMapEntry *entry = map->entries + low - 1;
+
+            if (entry->block_index + entry->block_samples > sample)
+                return wvc ? entry->wvc_pos : entry->wv_pos;
+
+            sample_pos1 = entry->block_index;
+            file_pos1 = wvc ? entry->wvc_pos : entry->wv_pos;
+            block_samples1 = entry->block_samples;
+        }
+
+        if (low < map->num_entries && map->entries [low].block_index < sample_pos2) {
+            sample_pos2 = map->entries [low].block_index;
+            file_pos2 = wvc ? map->entries [low].wvc_pos : map->entries [low].wv_pos;
+        }
+    }
+
     while (1) {
+        int64_t seek_pos, aim = sample;
         double bytes_per_sample;
-        int64_t seek_pos;
+
+        if (block_samples1 && sample - sample_pos1 < (int64_t) block_samples1 * MAX_WALK_BLOCKS) {
+            if ((seek_pos = walk_to_sample (wpc, infile, file_pos1, sample)) != -1)
+                return seek_pos;
+
+            block_samples1 = 0;     // something unexpected is in the way, so just search
+        }
 
         bytes_per_sample = (double) file_pos2 - file_pos1;
         bytes_per_sample /= sample_pos2 - sample_pos1;
         seek_pos = file_pos1 + (file_skip ? 32 : 0);
-        seek_pos += (int64_t)(bytes_per_sample * (sample - sample_pos1) * ratio);
+
+        // if we know how long the blocks are, aim a few blocks short of the sample (or at the start
+        // of the range if the sample is that close to it) so that walking the headers can finish
+
+        if (block_samples) {
+            if (sample - sample_pos1 > (int64_t) block_samples * MAX_WALK_BLOCKS)
+                aim -= (int64_t) block_samples * (MAX_WALK_BLOCKS / 2);
+            else
+                aim = sample_pos1;
+        }
+
+        seek_pos += (int64_t)(bytes_per_sample * (aim - sample_pos1) * ratio);
         seek_pos = find_header (wpc->reader, infile, seek_pos, &wps->wphdr);
 
-        if (seek_pos != (int64_t) -1)
+        if (seek_pos != (int64_t) -1) {
             SET_BLOCK_INDEX (wps->wphdr, GET_BLOCK_INDEX (wps->wphdr) - wpc->initial_index);
+            block_samples = wps->wphdr.block_samples;
+        }
 
         if (seek_pos == (int64_t) -1 || seek_pos >= file_pos2) {
             if (ratio > 0.0) {
@@ -369,15 +476,148 @@ static int64_t find_sample (WavpackContext *wpc, void *infile, int64_t header_po
 
             if (seek_pos == file_pos1)
                 file_skip = 1;
-            else {
-                sample_pos1 = GET_BLOCK_INDEX (wps->wphdr);
-                file_pos1 = seek_pos;
-            }
+
+            sample_pos1 = GET_BLOCK_INDEX (wps->wphdr);
+            file_pos1 = seek_pos;
+            block_samples1 = wps->wphdr.block_samples;
         }
         else
             return seek_pos;
     }
 }
 
+// Starting with the valid header at "header_pos", follow the chain of blocks by
+// their sizes (reading just the headers) to the initial block that contains the
+// specified sample and return its file position. If that takes more than
+// MAX_WALK_BLOCKS initial blocks, or the chain is broken, -1 is returned.
+
+static int64_t walk_to_sample (WavpackContext *wpc, void *infile, int64_t header_pos, int64_t sample)
+{
+    WavpackStream *wps = wpc->streams [0];
+    int initial_blocks = 0;
+
+    while (initial_blocks <= MAX_WALK_BLOCKS) {
+        uint32_t bcount;
+
+        if (wpc->reader->set_pos_abs (infile, header_pos) ||
+            (bcount = read_next_header (wpc->reader, infile, &wps->wphdr)) == (uint32_t) -1)
+                return -1;
+
+        header_pos += bcount;
+        SET_BLOCK_INDEX (wps->wphdr, GET_BLOCK_INDEX (wps->wphdr) - wpc->initial_index);
+
+        if (wps->wphdr.block_samples && (wps->wphdr.flags & INITIAL_BLOCK)) {
+            if (GET_BLOCK_INDEX (wps->wphdr) > sample)
+                return -1;
+
+            if (GET_BLOCK_INDEX (wps->wphdr) + wps->wphdr.block_samples > sample)
+                return header_pos;
+
+            initial_blocks++;
+        }
+
+        header_pos += wps->wphdr.ckSize + 8;
+    }
+
+    return -1;
+}
+
+// Record the positions of the initial block of the current streams in the block
+// map (which is allocated here), if they're at wpc->filepos and wpc->file2pos
+// and the block isn't already in the map. Cursors of shared files don't use the
+// map. Failing to allocate memory just means that the block isn't recorded.
+
+void map_block_position (WavpackContext *wpc)
+{
+    WavpackStream *wps = wpc->streams [0];
+    int64_t block_index = GET_BLOCK_INDEX (wps->wphdr);
+    BlockMap *map = (BlockMap *) wpc->block_map;
+    BlockMapEntry *entry;
+    int low = 0, high;
+
+    if (wpc->shared || !wpc->wvc_flag || (wpc->open_flags & OPEN_STREAMING) || wps->wvc_skip ||
+        !wps->wphdr.block_samples || !(wps->wphdr.flags & INITIAL_BLOCK))
+            return;
+
+    if (!map && !(wpc->block_map = map = (BlockMap *)calloc (1, sizeof (BlockMap))))
+        return;
+
+    high = map->num_entries;
+
+    // sequential decoding appends to the map, so check that first
+
+    if (high && map->entries [high - 1].block_index < block_index)
+        low = high;
+    else
+        while (low < high) {
+            int mid = (low + high) >> 1;
+
+            if (map->entries [mid].block_index < block_index)
+                low = mid + 1;
+            else
+                high = mid;
+        }
+
+    if (low < map->num_entries && map->entries [low].block_index == block_index)
+        return;
+
+    if (map->num_entries == map->max_entries) {
+        int max_entries = map->max_entries ? map->max_entries * 2 : 256;
+        BlockMapEntry *new_entries = (BlockMapEntry *)realloc (map->entries, max_entries * sizeof (BlockMapEntry));
+
+        if (!new_entries)
+            return;
+
+        map->entries = new_entries;
+        map->max_entries = max_entries;
+    }
+
+    entry = map->entries + low;
+    memmove (entry + 1, entry, (map->num_entries++ - low) * sizeof (BlockMapEntry));
+    entry->block_index = block_index;
+    entry->block_samples = wps->wphdr.block_samples;
+    entry->wv_pos = wpc->filepos;
+    entry->wvc_pos = wpc->file2pos;
+}
+
+// Return the block map entry of the block that contains the specified sample, or
+// NULL if there isn't one.
+
+static BlockMapEntry *find_mapped_block (WavpackContext *wpc, int64_t sample)
+{
+    BlockMap *map = (BlockMap *) wpc->block_map;
+    int low = 0, high;
+
+    if (!map)
+        return NULL;
+
+    // find the last block that starts at or before the sample
+
+    for (high = map->num_entries; low < high;) {
+        int mid = (low + high) >> 1;
+
+        if (map->entries [mid].block_index <= sample)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+
+    if (low && sample < map->entries [low - 1].block_index + map->entries [low - 1].block_samples)
+        return map->entries + low - 1;
+
+    return NULL;
+}
+
+void free_block_map (WavpackContext *wpc)
+{
+    BlockMap *map = (BlockMap *) wpc->block_map;
+
+    if (map) {
+        free (map->entries);
+        free (map);
+        wpc->block_map = NULL;
+    }
+}
+
 #endif
 
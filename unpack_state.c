@@ -0,0 +1,628 @@
+////////////////////////////////////////////////////////////////////////////
+//                           **** WAVPACK ****                            //
+//                  Hybrid Lossless Wavefile Compressor                   //
+//                Copyright (c) 1998 - 2024 David Bryant.                 //
+//                          All Rights Reserved.                          //
+//      Distributed under the BSD Software License (see license.txt)      //
+////////////////////////////////////////////////////////////////////////////
+
+// unpack_state.c
+
+// This module provides the API for taking a snapshot of the complete decoder
+// state at an arbitrary sample and later returning to that exact point. This
+// is intended for things like loop points that are revisited repeatedly; a
+// restore is just a copy of the saved streams (and a reader reposition),
+// whereas WavpackSeekSample64() must reload the block, call unpack_init() and
+// then decode (and discard) everything up to the target sample.
+
+#ifndef NO_SEEKING
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "wavpack_local.h"
+
+// The checkpoint cache (see WavpackSetCheckpoints()) is organized by block. The
+// raw block data for all the streams is stored once for each cached block, and
+// the streams of every checkpoint in that block point into those copies.
+
+typedef struct {
+    int64_t sample_index;
+    WavpackStream **streams;
+} Checkpoint;
+
+typedef struct {
+    int64_t block_index, wv_pos, wvc_pos, filepos, file2pos, bytes;
+    uint32_t block_samples, last_used;
+    int num_streams, num_checkpoints;
+    unsigned char **blocks;             // wv and wvc blocks for each stream
+    Checkpoint *checkpoints;
+} CheckpointBlock;
+
+typedef struct {
+    uint32_t interval, clock;
+    int64_t max_bytes, total_bytes;
+    int num_blocks;
+    CheckpointBlock *blocks;
+} CheckpointCache;
+
+struct WavpackState {
+    WavpackStream **streams;
+    int num_streams, num_channels;
+    int64_t wv_pos, wvc_pos, filepos, file2pos;
+    void *decimation_context;
+};
+
+///////////////////////////// executable code ////////////////////////////////
+
+// Relocate a pointer into a buffer of "size" bytes at "old_base" to the same
+// offset into a copy of that buffer at "new_base". Pointers that don't point
+// into the buffer (allowing for the bitstream pointer starting one byte before
+// it) are returned unchanged.
+
+static void *rebase_pointer (void *ptr, const unsigned char *old_base, uint32_t size, unsigned char *new_base)
+{
+    const unsigned char *cptr = (const unsigned char *) ptr;
+
+    if (!ptr || !old_base || !new_base || cptr < old_base - 1 || cptr > old_base + size)
+        return ptr;
+
+    return new_base + (cptr - old_base);
+}
+
+static void rebase_bitstream (Bitstream *bs, const unsigned char *old_base, uint32_t size, unsigned char *new_base)
+{
+    if (!bs_is_open (bs))
+        return;
+
+    bs->buf = rebase_pointer (bs->buf, old_base, size, new_base);
+    bs->end = rebase_pointer (bs->end, old_base, size, new_base);
+    bs->ptr = rebase_pointer (bs->ptr, old_base, size, new_base);
+}
+
+static uint32_t block_bytes (const unsigned char *block)
+{
+    return block ? ((const WavpackHeader *) block)->ckSize + 8 : 0;
+}
+
+static unsigned char *copy_block (const unsigned char *block)
+{
+    unsigned char *copy;
+
+    if (!block || !(copy = (unsigned char *)malloc (block_bytes (block))))
+        return NULL;
+
+    memcpy (copy, block, block_bytes (block));
+    return copy;
+}
+
+// Copy the "src" stream into "dst" using the specified copies of its raw block(s),
+// relocating all the bitstream pointers into them. If no copies are specified
+// then they are allocated here (and owned by "dst"). The DSD tables are always
+// duplicated and encoder-only buffers are not copied. On failure FALSE is
+// returned and "dst" holds no allocated resources.
+
+static int clone_stream (WavpackStream *dst, const WavpackStream *src, unsigned char *blockbuff, unsigned char *block2buff)
+{
+    uint32_t block_size = block_bytes (src->blockbuff), block2_size = block_bytes (src->block2buff);
+
+    memcpy (dst, src, sizeof (WavpackStream));
+    dst->sample_buffer = dst->pre_sample_buffer = NULL;
+    dst->dc.shaping_data = dst->dc.shaping_array = NULL;
+    dst->decorr_specs = NULL;
+    dst->blockbuff = dst->block2buff = NULL;
+#ifdef WAVPACK_PROFILE
+    CLEAR (dst->profile);
+#endif
+
+#ifdef ENABLE_DSD
+    if (!copy_dsd_tables (dst, src))
+        return FALSE;
+#endif
+
+    dst->blockbuff = blockbuff ? blockbuff : copy_block (src->blockbuff);
+    dst->block2buff = block2buff ? block2buff : copy_block (src->block2buff);
+
+    if ((src->blockbuff && !dst->blockbuff) || (src->block2buff && !dst->block2buff)) {
+        free_single_stream (dst);
+        return FALSE;
+    }
+
+    if (src->blockbuff) {
+        dst->blockend = rebase_pointer (src->blockend, src->blockbuff, block_size, dst->blockbuff);
+        rebase_bitstream (&dst->wvbits, src->blockbuff, block_size, dst->blockbuff);
+        rebase_bitstream (&dst->wvxbits, src->blockbuff, block_size, dst->blockbuff);
+        dst->dsd.byteptr = rebase_pointer (src->dsd.byteptr, src->blockbuff, block_size, dst->blockbuff);
+        dst->dsd.endptr = rebase_pointer (src->dsd.endptr, src->blockbuff, block_size, dst->blockbuff);
+    }
+
+    if (src->block2buff) {
+        dst->block2end = rebase_pointer (src->block2end, src->block2buff, block2_size, dst->block2buff);
+        rebase_bitstream (&dst->wvcbits, src->block2buff, block2_size, dst->block2buff);
+    }
+
+    return TRUE;
+}
+
+// For local use only. Make a deep copy of the "src" stream into "dst" that can
+// be decoded (or copied again) completely independently of the source. This
+// includes copies of the raw block(s), with all the bitstream pointers into them
+// relocated, and copies of the DSD tables. Encoder-only buffers are not copied.
+// The "wpc" pointer is copied too, so the caller may need to reassign it. On
+// failure FALSE is returned and "dst" holds no allocated resources.
+
+int copy_stream (WavpackStream *dst, const WavpackStream *src)
+{
+    return clone_stream (dst, src, NULL, NULL);
+}
+
+// Replace all the streams of the context with copies of the specified streams
+// (see WavpackRestoreState() for the behavior on failure).
+
+static int load_streams (WavpackContext *wpc, WavpackStream **streams, int num_streams)
+{
+    int si;
+
+    free_streams (wpc);
+
+    if (num_streams > wpc->num_streams) {
+        WavpackStream **new_streams = (WavpackStream **)realloc (wpc->streams, num_streams * sizeof (wpc->streams [0]));
+
+        if (!new_streams) {
+            strcpy (wpc->error_message, "can't allocate memory");
+            return FALSE;
+        }
+
+        wpc->streams = new_streams;
+
+        while (wpc->num_streams < num_streams)
+            if (!(wpc->streams [wpc->num_streams++] = (WavpackStream *)calloc (1, sizeof (WavpackStream)))) {
+                wpc->num_streams--;
+                free_streams (wpc);
+                strcpy (wpc->error_message, "can't allocate memory");
+                return FALSE;
+            }
+    }
+
+    for (si = 0; si < num_streams; ++si) {
+        if (!copy_stream (wpc->streams [si], streams [si])) {
+            wpc->streams [si]->wpc = wpc;
+            free_streams (wpc);
+            strcpy (wpc->error_message, "can't allocate memory");
+            return FALSE;
+        }
+
+        wpc->streams [si]->wpc = wpc;
+    }
+
+    return TRUE;
+}
+
+// Take a snapshot of the complete decoding state of the specified context at
+// its current sample index (see WavpackGetSampleIndex64()). This includes all
+// the streams (with their raw blocks), the file position(s) and the decimation
+// filter history (for DSD files decoded as PCM). The state can be restored any
+// number of times with WavpackRestoreState() and then freed with
+// WavpackFreeState(). This is only possible with seekable files and not with
+// pre-4.0 WavPack files. NULL is returned on error.
+
+WavpackState *WavpackSaveState (WavpackContext *wpc)
+{
+    WavpackState *state;
+    int si;
+
+    if (!wpc->streams || wpc->stream3 || !wpc->reader->can_seek (wpc->wv_in) ||
+        (wpc->open_flags & OPEN_STREAMING) || (wpc->wvc_flag && !wpc->reader->can_seek (wpc->wvc_in))) {
+            strcpy (wpc->error_message, "can't save decoder state of this file!");
+            return NULL;
+    }
+
+    state = (WavpackState *)calloc (1, sizeof (WavpackState));
+
+    if (!state || !(state->streams = (WavpackStream **)calloc (wpc->num_streams, sizeof (WavpackStream *)))) {
+        strcpy (wpc->error_message, "can't allocate memory");
+        free (state);
+        return NULL;
+    }
+
+    for (si = 0; si < wpc->num_streams; ++si) {
+        WavpackStream *wps = (WavpackStream *)malloc (sizeof (WavpackStream));
+
+        if (!wps || !copy_stream (wps, wpc->streams [si])) {
+            strcpy (wpc->error_message, "can't allocate memory");
+            free (wps);
+            WavpackFreeState (state);
+            return NULL;
+        }
+
+        state->streams [state->num_streams++] = wps;
+    }
+
+#ifdef ENABLE_DSD
+    if (wpc->decimation_context && !(state->decimation_context = decimate_dsd_save (wpc->decimation_context))) {
+        strcpy (wpc->error_message, "can't allocate memory");
+        WavpackFreeState (state);
+        return NULL;
+    }
+#endif
+
+    state->num_channels = wpc->config.num_channels;
+    state->wv_pos = wpc->reader->get_pos (wpc->wv_in);
+    state->wvc_pos = wpc->wvc_flag ? get_wvc_pos (wpc) : 0;
+    state->filepos = wpc->filepos;
+    state->file2pos = wpc->file2pos;
+
+    return state;
+}
+
+// Return the specified context to the exact decoding state it was in when the
+// state was saved with WavpackSaveState(), so that the next call to
+// WavpackUnpackSamples() continues from that sample. The state must have been
+// saved from the same context and is not consumed. Like WavpackSeekSample64(),
+// after a FALSE return the file should not be accessed again (other than to
+// close it).
+
+int WavpackRestoreState (WavpackContext *wpc, WavpackState *state)
+{
+    if (!state || !wpc->streams || state->num_channels != wpc->config.num_channels) {
+        strcpy (wpc->error_message, "invalid decoder state!");
+        return FALSE;
+    }
+
+    if (!load_streams (wpc, state->streams, state->num_streams))
+        return FALSE;
+
+#ifdef ENABLE_DSD
+    if (wpc->decimation_context && state->decimation_context)
+        decimate_dsd_restore (wpc->decimation_context, state->decimation_context);
+#endif
+
+    wpc->reader->set_pos_abs (wpc->wv_in, state->wv_pos);
+
+    if (wpc->wvc_flag) {
+        stop_wvc_reader (wpc);
+        wpc->reader->set_pos_abs (wpc->wvc_in, state->wvc_pos);
+    }
+
+    wpc->filepos = state->filepos;
+    wpc->file2pos = state->file2pos;
+
+    return TRUE;
+}
+
+// Free a decoder state returned by WavpackSaveState()
+
+void WavpackFreeState (WavpackState *state)
+{
+    int si;
+
+    if (!state)
+        return;
+
+    for (si = 0; si < state->num_streams; ++si) {
+        free_single_stream (state->streams [si]);
+        free (state->streams [si]);
+    }
+
+#ifdef ENABLE_DSD
+    decimate_dsd_destroy (state->decimation_context);
+#endif
+
+    free (state->streams);
+    free (state);
+}
+
+
+// Enable the checkpoint cache for the specified context. As samples are decoded
+// normally with WavpackUnpackSamples(), the complete decoder state is recorded
+// every "interval" samples into each block (the start of a block needs no
+// checkpoint because the decoder is initialized there anyway). Subsequent calls
+// to WavpackSeekSample64() that land in a cached block resume from the nearest
+// checkpoint at or before the target sample instead of from the beginning of
+// the block, so they have to decode (and discard) less than "interval" samples.
+// The memory used is limited to "max_bytes" by discarding the least recently
+// used blocks. An "interval" or "max_bytes" of zero disables (and frees) the
+// cache. Returns FALSE if the file does not allow seeking.
+
+int WavpackSetCheckpoints (WavpackContext *wpc, uint32_t interval, int64_t max_bytes)
+{
+    CheckpointCache *cache;
+
+    free_checkpoints (wpc);
+
+    if (!interval || max_bytes <= 0)
+        return TRUE;
+
+    if (!wpc->streams || wpc->stream3 || !wpc->reader->can_seek (wpc->wv_in) ||
+        (wpc->open_flags & OPEN_STREAMING) || (wpc->wvc_flag && !wpc->reader->can_seek (wpc->wvc_in))) {
+            strcpy (wpc->error_message, "can't use checkpoints with this file!");
+            return FALSE;
+    }
+
+    if (!(cache = (CheckpointCache *)calloc (1, sizeof (CheckpointCache)))) {
+        strcpy (wpc->error_message, "can't allocate memory");
+        return FALSE;
+    }
+
+    cache->interval = interval;
+    cache->max_bytes = max_bytes;
+    wpc->checkpoints = cache;
+    return TRUE;
+}
+
+static void free_checkpoint_streams (WavpackStream **streams, int num_streams)
+{
+    int si;
+
+    for (si = 0; si < num_streams; ++si)
+        if (streams [si]) {
+            streams [si]->blockbuff = streams [si]->block2buff = NULL;   // these belong to the block
+            free_single_stream (streams [si]);
+            free (streams [si]);
+        }
+
+    free (streams);
+}
+
+static void free_checkpoint_block (CheckpointCache *cache, int bi)
+{
+    CheckpointBlock *block = cache->blocks + bi;
+    int ci, si;
+
+    for (ci = 0; ci < block->num_checkpoints; ++ci)
+        free_checkpoint_streams (block->checkpoints [ci].streams, block->num_streams);
+
+    for (si = 0; si < block->num_streams * 2; ++si)
+        free (block->blocks [si]);
+
+    cache->total_bytes -= block->bytes;
+    free (block->checkpoints);
+    free (block->blocks);
+
+    if (bi < --cache->num_blocks)
+        memmove (block, block + 1, (cache->num_blocks - bi) * sizeof (CheckpointBlock));
+}
+
+// For local use only. Free the checkpoint cache (if any) of the specified context.
+
+void free_checkpoints (WavpackContext *wpc)
+{
+    CheckpointCache *cache = (CheckpointCache *) wpc->checkpoints;
+
+    if (!cache)
+        return;
+
+    while (cache->num_blocks)
+        free_checkpoint_block (cache, cache->num_blocks - 1);
+
+    free (cache->blocks);
+    free (cache);
+    wpc->checkpoints = NULL;
+}
+
+static int64_t stream_bytes (const WavpackStream *wps)
+{
+    int64_t bytes = sizeof (WavpackStream);
+
+    if (wps->dsd.tables.bins)
+        bytes += (int64_t) wps->dsd.tables.bins * (sizeof (*wps->dsd.tables.probabilities) +
+            sizeof (*wps->dsd.tables.summed_probabilities) + sizeof (*wps->dsd.tables.value_lookup) + MAX_BYTES_PER_BIN);
+
+    if (wps->dsd.tables.ptable)
+        bytes += 2 * 256 * sizeof (*wps->dsd.tables.ptable);
+
+    return bytes;
+}
+
+// Find the cached block containing the specified sample and return its index
+// (or -1 if there is none)
+
+static int find_checkpoint_block (CheckpointCache *cache, int64_t sample)
+{
+    int bi;
+
+    for (bi = 0; bi < cache->num_blocks; ++bi)
+        if (sample >= cache->blocks [bi].block_index && sample < cache->blocks [bi].block_index + cache->blocks [bi].block_samples)
+            return bi;
+
+    return -1;
+}
+
+// Return the index of a new cache entry for the block currently loaded into the
+// context's streams (including copies of the raw blocks), or -1 on error.
+
+static int add_checkpoint_block (WavpackContext *wpc, CheckpointCache *cache)
+{
+    CheckpointBlock *blocks = (CheckpointBlock *)realloc (cache->blocks, (cache->num_blocks + 1) * sizeof (CheckpointBlock));
+    CheckpointBlock *block;
+    int si;
+
+    if (!blocks)
+        return -1;
+
+    cache->blocks = blocks;
+    block = cache->blocks + cache->num_blocks++;
+    memset (block, 0, sizeof (CheckpointBlock));
+    block->block_index = GET_BLOCK_INDEX (wpc->streams [0]->wphdr);
+    block->block_samples = wpc->streams [0]->wphdr.block_samples;
+    block->wv_pos = wpc->reader->get_pos (wpc->wv_in);
+    block->wvc_pos = wpc->wvc_flag ? get_wvc_pos (wpc) : 0;
+    block->filepos = wpc->filepos;
+    block->file2pos = wpc->file2pos;
+
+    if (!(block->blocks = (unsigned char **)calloc (wpc->num_streams * 2, sizeof (unsigned char *)))) {
+        cache->num_blocks--;
+        return -1;
+    }
+
+    block->num_streams = wpc->num_streams;
+
+    for (si = 0; si < wpc->num_streams; ++si) {
+        WavpackStream *wps = wpc->streams [si];
+
+        if (!(block->blocks [si * 2] = copy_block (wps->blockbuff)) ||
+            (wps->block2buff && !(block->blocks [si * 2 + 1] = copy_block (wps->block2buff)))) {
+                free_checkpoint_block (cache, cache->num_blocks - 1);
+                return -1;
+        }
+
+        block->bytes += block_bytes (wps->blockbuff) + block_bytes (wps->block2buff);
+    }
+
+    block->bytes += sizeof (CheckpointBlock);
+    cache->total_bytes += block->bytes;
+    return cache->num_blocks - 1;
+}
+
+// Record a checkpoint of the current decoder state into the cache (if it's not
+// already there), discarding the least recently used blocks if required to stay
+// within the memory budget.
+
+static void add_checkpoint (WavpackContext *wpc, CheckpointCache *cache)
+{
+    WavpackStream *wps = wpc->streams [0];
+    CheckpointBlock *block;
+    Checkpoint *checkpoints;
+    int64_t bytes = 0;
+    int bi, ci, si;
+
+    // we only record complete sets of streams that are all at the same point
+
+    if (!wpc->reduced_channels && !(wpc->streams [wpc->num_streams - 1]->wphdr.flags & FINAL_BLOCK))
+        return;
+
+    for (si = 0; si < wpc->num_streams; ++si)
+        if (!wpc->streams [si]->blockbuff || !wpc->streams [si]->init_done ||
+            wpc->streams [si]->sample_index != wps->sample_index)
+                return;
+
+    if ((bi = find_checkpoint_block (cache, wps->sample_index)) >= 0) {
+        block = cache->blocks + bi;
+
+        for (ci = 0; ci < block->num_checkpoints; ++ci)
+            if (block->checkpoints [ci].sample_index == wps->sample_index) {
+                block->last_used = ++cache->clock;
+                return;
+            }
+
+        if (block->num_streams != wpc->num_streams || block->block_index != GET_BLOCK_INDEX (wps->wphdr))
+            return;
+    }
+    else if ((bi = add_checkpoint_block (wpc, cache)) < 0)
+        return;
+
+    block = cache->blocks + bi;
+    checkpoints = (Checkpoint *)realloc (block->checkpoints, (block->num_checkpoints + 1) * sizeof (Checkpoint));
+
+    if (!checkpoints)
+        return;
+
+    block->checkpoints = checkpoints;
+    checkpoints += block->num_checkpoints;
+    checkpoints->sample_index = wps->sample_index;
+
+    if (!(checkpoints->streams = (WavpackStream **)calloc (wpc->num_streams, sizeof (WavpackStream *))))
+        return;
+
+    for (si = 0; si < wpc->num_streams; ++si) {
+        checkpoints->streams [si] = (WavpackStream *)malloc (sizeof (WavpackStream));
+
+        if (!checkpoints->streams [si] ||
+            !clone_stream (checkpoints->streams [si], wpc->streams [si], block->blocks [si * 2], block->blocks [si * 2 + 1])) {
+                free (checkpoints->streams [si]);
+                checkpoints->streams [si] = NULL;
+                free_checkpoint_streams (checkpoints->streams, wpc->num_streams);
+                return;
+        }
+
+        bytes += stream_bytes (wpc->streams [si]);
+    }
+
+    block->num_checkpoints++;
+    block->bytes += bytes + sizeof (Checkpoint);
+    cache->total_bytes += bytes + sizeof (Checkpoint);
+    block->last_used = ++cache->clock;
+
+    // discard least recently used blocks (but never the one we just added to) until we fit
+
+    while (cache->total_bytes > cache->max_bytes && cache->num_blocks > 1) {
+        int lru = -1;
+
+        for (bi = 0; bi < cache->num_blocks; ++bi)
+            if (cache->blocks [bi].last_used != cache->clock && (lru < 0 || cache->blocks [bi].last_used < cache->blocks [lru].last_used))
+                lru = bi;
+
+        free_checkpoint_block (cache, lru);
+    }
+
+    if (cache->total_bytes > cache->max_bytes)
+        free_checkpoint_block (cache, 0);
+}
+
+// For local use only. This is called by WavpackUnpackSamples() just before it
+// decodes "samples_to_unpack" samples from the current block when checkpoints
+// are enabled. If the decoder is exactly at a checkpoint, the state is recorded,
+// and the returned sample count is limited so that decoding stops at the next
+// checkpoint.
+
+uint32_t record_checkpoint (WavpackContext *wpc, uint32_t samples_to_unpack)
+{
+    CheckpointCache *cache = (CheckpointCache *) wpc->checkpoints;
+    WavpackStream *wps = wpc->streams [0];
+    int64_t offset = wps->sample_index - GET_BLOCK_INDEX (wps->wphdr);
+    int64_t next = (offset / cache->interval + 1) * cache->interval;
+
+    if (offset > 0 && !(offset % cache->interval))
+        add_checkpoint (wpc, cache);
+
+    if (offset + samples_to_unpack > next)
+        samples_to_unpack = (uint32_t) (next - offset);
+
+    return samples_to_unpack;
+}
+
+// For local use only. This is called by WavpackSeekSample64() to position the
+// decoder at the latest cached checkpoint at or before the specified sample.
+// FALSE is returned (and nothing is done) if there is no such checkpoint or if
+// the currently loaded state would be at least as good a starting point.
+
+int restore_checkpoint (WavpackContext *wpc, int64_t sample)
+{
+    CheckpointCache *cache = (CheckpointCache *) wpc->checkpoints;
+    WavpackStream *wps = wpc->streams [0];
+    Checkpoint *best = NULL;
+    CheckpointBlock *block;
+    int bi, ci;
+
+    if ((bi = find_checkpoint_block (cache, sample)) < 0)
+        return FALSE;
+
+    block = cache->blocks + bi;
+
+    for (ci = 0; ci < block->num_checkpoints; ++ci)
+        if (block->checkpoints [ci].sample_index <= sample && (!best || block->checkpoints [ci].sample_index > best->sample_index))
+            best = block->checkpoints + ci;
+
+    if (!best || (wps->blockbuff && wps->init_done && GET_BLOCK_INDEX (wps->wphdr) == block->block_index &&
+        wps->sample_index <= sample && wps->sample_index >= best->sample_index))
+            return FALSE;
+
+    if (!load_streams (wpc, best->streams, block->num_streams)) {
+        wpc->streams [0]->wphdr.block_samples = 0;      // force the seek to locate the block again
+        return FALSE;
+    }
+
+    wpc->reader->set_pos_abs (wpc->wv_in, block->wv_pos);
+
+    if (wpc->wvc_flag) {
+        stop_wvc_reader (wpc);
+        wpc->reader->set_pos_abs (wpc->wvc_in, block->wvc_pos);
+    }
+
+    wpc->filepos = block->filepos;
+    wpc->file2pos = block->file2pos;
+    block->last_used = ++cache->clock;
+    return TRUE;
+}
+
+#endif
@@ -20,11 +20,19 @@
 
 #ifdef ENABLE_THREADS
 static void unpack_samples_enqueue (WavpackStream *wps, int32_t *outbuf, int offset, uint32_t samcnt, int free_wps);
+#ifdef ENABLE_DSD
+static void decimate_samples_enqueue (WavpackContext *wpc, int32_t *samples, uint32_t samcnt, int first_chan, int num_chans);
+static void take_spare_dsd_tables (WavpackContext *wpc, WavpackStream *wps);
+#endif
 static void worker_threads_finish (WavpackContext *wpc);
 static void worker_threads_create (WavpackContext *wpc);
 static int worker_available (WavpackContext *wpc);
 #endif
 
+#ifdef ENABLE_DSD
+static void decimate_samples (WavpackContext *wpc, int32_t *buffer, uint32_t sample_count);
+#endif
+
 ///////////////////////////// executable code ////////////////////////////////
 
 // This function unpacks the specified number of samples from the given stream (which must be
@@ -110,6 +118,10 @@ uint32_t WavpackUnpackSamples (WavpackContext *wpc, int32_t *buffer, uint32_t sa
     int num_channels = wpc->config.num_channels, file_done = FALSE;
     uint32_t bcount, samples_unpacked = 0, samples_to_unpack;
     int32_t *bptr = buffer;
+    PROFILE_DECL (start_time);
+
+    if (!wpc->streams)      // no audio in contexts opened with OPEN_TAGS_ONLY
+        return 0;
 
     memset (buffer, 0, (wpc->reduced_channels ? wpc->reduced_channels : num_channels) * samples * sizeof (int32_t));
 
@@ -136,6 +148,7 @@ uint32_t WavpackUnpackSamples (WavpackContext *wpc, int32_t *buffer, uint32_t sa
                     break;
 
                 free_streams (wpc);
+                PROFILE_START (wpc, start_time);
                 nexthdrpos = wpc->reader->get_pos (wpc->wv_in);
                 bcount = read_next_header (wpc->reader, wpc->wv_in, &wps->wphdr);
 
@@ -161,6 +174,12 @@ uint32_t WavpackUnpackSamples (WavpackContext *wpc, int32_t *buffer, uint32_t sa
                         break;
                 }
 
+                PROFILE_STOP (wpc->profile, WP_PROFILE_IO, start_time);
+                PROFILE_COUNT (wpc->profile, allocations, 1);
+                PROFILE_COUNT (wpc->profile, blocks, 1);
+                PROFILE_COUNT (wpc->profile, bytes, wps->wphdr.ckSize + 8);
+                PROFILE_START (wpc, start_time);
+
                 // render corrupt blocks harmless
                 if (!WavpackVerifySingleBlock (wps->blockbuff, !(wpc->open_flags & OPEN_NO_CHECKSUM))) {
                     wps->wphdr.ckSize = sizeof (WavpackHeader) - 8;
@@ -168,6 +187,8 @@ uint32_t WavpackUnpackSamples (WavpackContext *wpc, int32_t *buffer, uint32_t sa
                     memcpy (wps->blockbuff, &wps->wphdr, 32);
                 }
 
+                PROFILE_STOP (wpc->profile, WP_PROFILE_VERIFY, start_time);
+
                 // potentially adjusting block_index must be done AFTER verifying block
 
                 if (wpc->open_flags & OPEN_STREAMING)
@@ -185,15 +206,22 @@ uint32_t WavpackUnpackSamples (WavpackContext *wpc, int32_t *buffer, uint32_t sa
 
                 // if this block has audio, and we're in hybrid lossless mode, read the matching wvc block
 
-                if (wps->wphdr.block_samples && wpc->wvc_flag)
+                if (wps->wphdr.block_samples && wpc->wvc_flag) {
                     read_wvc_block (wpc, 0);
+#ifndef NO_SEEKING
+                    map_block_position (wpc);
+#endif
+                }
 
                 // if the block does NOT have any audio, call unpack_init() to process non-audio stuff
 
                 if (!wps->wphdr.block_samples) {
+                    PROFILE_START (wpc, start_time);
+
                     if (!wps->init_done && !unpack_init (wpc, 0))
                         wpc->crc_errors++;
 
+                    PROFILE_STOP (wpc->profile, WP_PROFILE_INIT, start_time);
                     wps->init_done = TRUE;
                 }
         }
@@ -244,11 +272,24 @@ uint32_t WavpackUnpackSamples (WavpackContext *wpc, int32_t *buffer, uint32_t sa
         if (samples_to_unpack > samples)
             samples_to_unpack = samples;
 
-        if (!wps->init_done && !unpack_init (wpc, 0))
-            wpc->crc_errors++;
+        if (!wps->init_done) {
+            PROFILE_START (wpc, start_time);
+
+            if (!unpack_init (wpc, 0))
+                wpc->crc_errors++;
+
+            PROFILE_STOP (wpc->profile, WP_PROFILE_INIT, start_time);
+        }
 
         wps->init_done = TRUE;
 
+#ifndef NO_SEEKING
+        // if checkpoints are enabled, record one here if we're at one and don't decode past the next
+
+        if (wpc->checkpoints)
+            samples_to_unpack = record_checkpoint (wpc, samples_to_unpack);
+#endif
+
         // if this block is not the final block of a multichannel sequence (and we're not truncating
         // to stereo), then enter this conditional block...otherwise we just unpack the samples directly
 
@@ -256,6 +297,8 @@ uint32_t WavpackUnpackSamples (WavpackContext *wpc, int32_t *buffer, uint32_t sa
             int32_t *temp_buffer = (int32_t *)calloc (1, samples_to_unpack * 8);
             uint32_t offset = 0;     // offset to next channel in sequence (0 to num_channels - 1)
 
+            PROFILE_COUNT (wpc->profile, allocations, 1);
+
             // loop through all the streams...
 
             while (1) {
@@ -275,6 +318,8 @@ uint32_t WavpackUnpackSamples (WavpackContext *wpc, int32_t *buffer, uint32_t sa
 
                     wps->wpc = wpc;
                     wps->stream_index = stream_index;
+                    PROFILE_COUNT (wpc->profile, allocations, 2);
+                    PROFILE_START (wpc, start_time);
                     bcount = read_next_header (wpc->reader, wpc->wv_in, &wps->wphdr);
 
                     if (bcount == (uint32_t) -1) {
@@ -299,6 +344,12 @@ uint32_t WavpackUnpackSamples (WavpackContext *wpc, int32_t *buffer, uint32_t sa
                             break;
                     }
 
+                    PROFILE_STOP (wpc->profile, WP_PROFILE_IO, start_time);
+                    PROFILE_COUNT (wpc->profile, allocations, 1);
+                    PROFILE_COUNT (wpc->profile, blocks, 1);
+                    PROFILE_COUNT (wpc->profile, bytes, wps->wphdr.ckSize + 8);
+                    PROFILE_START (wpc, start_time);
+
                     // render corrupt blocks harmless
                     if (!WavpackVerifySingleBlock (wps->blockbuff, !(wpc->open_flags & OPEN_NO_CHECKSUM))) {
                         wps->wphdr.ckSize = sizeof (WavpackHeader) - 8;
@@ -306,6 +357,8 @@ uint32_t WavpackUnpackSamples (WavpackContext *wpc, int32_t *buffer, uint32_t sa
                         memcpy (wps->blockbuff, &wps->wphdr, 32);
                     }
 
+                    PROFILE_STOP (wpc->profile, WP_PROFILE_VERIFY, start_time);
+
                     // potentially adjusting block_index must be done AFTER verifying block
 
                     if (wpc->open_flags & OPEN_STREAMING)
@@ -322,9 +375,12 @@ uint32_t WavpackUnpackSamples (WavpackContext *wpc, int32_t *buffer, uint32_t sa
 
                     // initialize the unpacker for this block
 
+                    PROFILE_START (wpc, start_time);
+
                     if (!unpack_init (wpc, stream_index))
                         wpc->crc_errors++;
 
+                    PROFILE_STOP (wpc->profile, WP_PROFILE_INIT, start_time);
                     wps->init_done = TRUE;
                 }
                 else
@@ -410,9 +466,14 @@ uint32_t WavpackUnpackSamples (WavpackContext *wpc, int32_t *buffer, uint32_t sa
                 WavpackStream *wps_copy = malloc (sizeof (WavpackStream));
 
                 memcpy (wps_copy, wps, sizeof (WavpackStream));
+#ifdef WAVPACK_PROFILE
+                CLEAR (wps_copy->profile);      // the copy's profile counts only its own decoding
+                PROFILE_COUNT (wpc->profile, allocations, 1);
+#endif
 
                 // Update the existing WavpackStream so we can use it for the next block before the current one
-                // is complete. Because the worker thread will free any allocated areas, we mark those NULL here.
+                // is complete. Because the worker thread will free the block buffers, we mark those NULL here.
+                // The DSD tables go with the copy too, so the stream gets a spare set instead (if there is one).
                 // Also advance the sample index (even though they're really not decoded yet).
 
                 wps->blockbuff = NULL;
@@ -420,11 +481,7 @@ uint32_t WavpackUnpackSamples (WavpackContext *wpc, int32_t *buffer, uint32_t sa
                 wps->sample_index += samples_to_unpack;
 
 #ifdef ENABLE_DSD
-                wps->dsd.probabilities = NULL;
-                wps->dsd.summed_probabilities = NULL;
-                wps->dsd.lookup_buffer = NULL;
-                wps->dsd.value_lookup = NULL;
-                wps->dsd.ptable = NULL;
+                take_spare_dsd_tables (wpc, wps);
 #endif
 
                 unpack_samples_enqueue (wps_copy, bptr, 0, samples_to_unpack, TRUE);
@@ -464,13 +521,270 @@ uint32_t WavpackUnpackSamples (WavpackContext *wpc, int32_t *buffer, uint32_t sa
 #endif
 
 #ifdef ENABLE_DSD
-    if (wpc->decimation_context)    // TODO: this could be parallelized too
-        decimate_dsd_run (wpc->decimation_context, buffer, samples_unpacked);
+    if (wpc->decimation_context) {
+        PROFILE_START (wpc, start_time);
+        decimate_samples (wpc, buffer, samples_unpacked);
+
+        if (wpc->float_output)
+            int_to_float_samples (buffer, samples_unpacked * (wpc->reduced_channels ? wpc->reduced_channels : num_channels), 3);
+
+        PROFILE_STOP (wpc->profile, WP_PROFILE_DECIMATE, start_time);
+    }
+#endif
+
+    PROFILE_COUNT (wpc->profile, samples, samples_unpacked);
+    return samples_unpacked;
+}
+
+#ifdef ENABLE_DSD
+
+// Decimate the DSD samples unpacked by WavpackUnpackSamples() to PCM. The channels are
+// independent, so if there are worker threads (and enough samples to be worth it) they
+// are split into groups, one for each worker plus one done here by the calling thread.
+
+#define DECIMATE_THREAD_SAMPLES 1024    // minimum complete samples to decimate with workers
+
+static void decimate_samples (WavpackContext *wpc, int32_t *buffer, uint32_t sample_count)
+{
+#ifdef ENABLE_THREADS
+    int num_channels = wpc->reduced_channels ? wpc->reduced_channels : wpc->config.num_channels;
+    int groups = wpc->workers ? wpc->num_workers + 1 : 1;
+
+    if (groups > num_channels)
+        groups = num_channels;
+
+    if (groups > 1 && sample_count >= DECIMATE_THREAD_SAMPLES) {
+        int first_chan = 0, num_chans;
+
+        while (--groups) {
+            num_chans = (num_channels - first_chan) / (groups + 1);
+            decimate_samples_enqueue (wpc, buffer, sample_count, first_chan, num_chans);
+            first_chan += num_chans;
+        }
+
+        decimate_dsd_run_channels (wpc->decimation_context, buffer, sample_count, first_chan, num_channels - first_chan);
+        worker_threads_finish (wpc);
+        decimate_dsd_finish (wpc->decimation_context, buffer, sample_count);
+        return;
+    }
+#endif
+
+    decimate_dsd_run (wpc->decimation_context, buffer, sample_count);
+}
+
+#endif
+
+// Unpack the specified number of samples from the current file position as
+// 16-bit integers (interleaved, native endian). This is otherwise exactly the
+// same as WavpackUnpackSamples(), but it can only be used with files that have
+// 16 bits per sample or less and are not floating point (for any other files
+// zero is returned). Blocks of stereo lossless audio that don't need a shift
+// (which is what most 16-bit files are) are decoded straight into the buffer
+// by a dedicated path (see unpack_samples16() in unpack.c), while everything
+// else is unpacked into a temp buffer with WavpackUnpackSamples() and then
+// converted. Since that is also where blocks are read, each block is started
+// with a single sample through the regular path. Worker threads are only used
+// for the regular path.
+
+#define UNPACK16_TEMP_SAMPLES 4096  // maximum complete samples converted at once
+
+uint32_t WavpackUnpackSamples16 (WavpackContext *wpc, int16_t *buffer, uint32_t samples)
+{
+    int num_channels = wpc->reduced_channels ? wpc->reduced_channels : wpc->config.num_channels;
+    uint32_t samples_unpacked = 0, samples_to_unpack, count, i;
+    int32_t *temp_buffer = NULL;
+
+    if (!wpc->streams || wpc->config.bytes_per_sample > 2 || (wpc->config.flags & CONFIG_FLOAT_DATA))
+        return 0;
+
+    while (samples) {
+        WavpackStream *wps = wpc->streams [0];
+        int in_block = wps->wphdr.block_samples && (wps->wphdr.flags & INITIAL_BLOCK) &&
+            wps->sample_index >= GET_BLOCK_INDEX (wps->wphdr) &&
+            wps->sample_index < GET_BLOCK_INDEX (wps->wphdr) + wps->wphdr.block_samples;
+
+        if (in_block) {
+            samples_to_unpack = (uint32_t) (GET_BLOCK_INDEX (wps->wphdr) + wps->wphdr.block_samples - wps->sample_index);
+
+            if (samples_to_unpack > samples)
+                samples_to_unpack = samples;
+        }
+        else
+            samples_to_unpack = 1;
+
+        // the dedicated path handles blocks that are already initialized and contain all the (two) channels
+
+        if (in_block && wps->init_done && num_channels == 2 && !wpc->reduced_channels &&
+#ifndef NO_SEEKING
+            !wpc->checkpoints &&
+#endif
+            (wps->wphdr.flags & FINAL_BLOCK) && unpack_samples16_ok (wps)) {
+                unpack_samples16 (wps, buffer, samples_to_unpack);
+
+                if (wps->sample_index == GET_BLOCK_INDEX (wps->wphdr) + wps->wphdr.block_samples && wps->mute_error)
+                    wpc->crc_errors++;
+
+                PROFILE_COUNT (wpc->profile, samples, samples_to_unpack);
+                buffer += samples_to_unpack * 2;
+                samples_unpacked += samples_to_unpack;
+                samples -= samples_to_unpack;
+
+                if (wpc->total_samples != -1 && wps->sample_index == wpc->total_samples)
+                    break;
+
+                continue;
+        }
+
+        if (samples_to_unpack > UNPACK16_TEMP_SAMPLES)
+            samples_to_unpack = UNPACK16_TEMP_SAMPLES;
+
+        if (!temp_buffer && !(temp_buffer = (int32_t *)malloc (UNPACK16_TEMP_SAMPLES * num_channels * sizeof (int32_t))))
+            break;
+
+        count = WavpackUnpackSamples (wpc, temp_buffer, samples_to_unpack);
+
+        for (i = 0; i < count * num_channels; ++i)
+            buffer [i] = (int16_t) temp_buffer [i];
+
+        buffer += count * num_channels;
+        samples_unpacked += count;
+        samples -= count;
+
+        if (count < samples_to_unpack)
+            break;
+    }
+
+    free (temp_buffer);
+    return samples_unpacked;
+}
+
+// Unpack the specified number of samples from the current file position as
+// 32-bit floats (interleaved, native endian) with full scale at +/-1.0. This
+// is otherwise exactly the same as WavpackUnpackSamples(), and the conversion
+// is done as each block is decoded instead of with another pass over the
+// buffer. Integer samples are scaled by their number of bytes per sample (so
+// 8-bit audio goes from +/-128 and 24-bit audio from +/-8388608), and float
+// samples are normalized by adjusting their exponents as they are rebuilt,
+// whether or not the file was opened with OPEN_NORMALIZE (if it was, the
+// "norm_offset" is still applied). DSD audio is only supported when it is
+// being decimated to PCM (OPEN_DSD_AS_PCM), and zero is returned otherwise.
+
+uint32_t WavpackUnpackSamplesFloat (WavpackContext *wpc, float *buffer, uint32_t samples)
+{
+    uint32_t samples_unpacked;
+
+    if (!wpc->streams || ((wpc->config.qmode & QMODE_DSD_AUDIO) && !wpc->decimation_context))
+        return 0;
+
+    wpc->float_output = TRUE;
+    samples_unpacked = WavpackUnpackSamples (wpc, (int32_t *) buffer, samples);
+    wpc->float_output = FALSE;
+    return samples_unpacked;
+}
+
+// Unpack the specified number of samples from the current file position as
+// packed DSD bytes, for files that were opened with OPEN_DSD_NATIVE (for any
+// other files zero is returned). This is otherwise the same as calling
+// WavpackUnpackSamples(), but instead of each byte taking an int32_t, there's
+// just the byte itself, which is MSB first unless "format" has the
+// QMODE_DSD_LSB_FIRST bit set. If "format" also has the QMODE_DSD_IN_BLOCKS
+// bit set, then the output is planar: all the requested samples of the first
+// channel, followed by all of the second channel and so on (so channel "c"
+// starts at buffer + c * samples, even if fewer samples are returned).
+// Otherwise the channels are interleaved. Blocks that contain all the (one or
+// two) channels are decoded straight into the buffer by unpack_dsd_bytes(),
+// while everything else is unpacked into a temp buffer with
+// WavpackUnpackSamples() and then converted, just like for
+// WavpackUnpackSamples16().
+
+#ifdef ENABLE_DSD
+
+#define UNPACKDSD_TEMP_SAMPLES 4096 // maximum complete samples converted at once
+
+uint32_t WavpackUnpackSamplesDSD (WavpackContext *wpc, unsigned char *buffer, uint32_t samples, int format)
+{
+    int num_channels = wpc->reduced_channels ? wpc->reduced_channels : wpc->config.num_channels;
+    int lsb_first = (format & QMODE_DSD_LSB_FIRST) ? TRUE : FALSE, stride = num_channels;
+    uint32_t samples_unpacked = 0, samples_to_unpack, count, channel_step = 1;
+    int32_t *temp_buffer = NULL;
+
+    if (!wpc->streams || !(wpc->config.qmode & QMODE_DSD_AUDIO) || wpc->decimation_context)
+        return 0;
+
+    if (format & QMODE_DSD_IN_BLOCKS) {
+        channel_step = samples;
+        stride = 1;
+    }
+
+    while (samples) {
+        WavpackStream *wps = wpc->streams [0];
+        int in_block = wps->wphdr.block_samples && (wps->wphdr.flags & INITIAL_BLOCK) &&
+            wps->sample_index >= GET_BLOCK_INDEX (wps->wphdr) &&
+            wps->sample_index < GET_BLOCK_INDEX (wps->wphdr) + wps->wphdr.block_samples;
+
+        if (in_block) {
+            samples_to_unpack = (uint32_t) (GET_BLOCK_INDEX (wps->wphdr) + wps->wphdr.block_samples - wps->sample_index);
+
+            if (samples_to_unpack > samples)
+                samples_to_unpack = samples;
+        }
+        else
+            samples_to_unpack = 1;
+
+        // the direct path handles DSD blocks that are already initialized and contain all the channels
+
+        if (in_block && wps->init_done && !wpc->reduced_channels &&
+#ifndef NO_SEEKING
+            !wpc->checkpoints &&
 #endif
+            (wps->wphdr.flags & (DSD_FLAG | FINAL_BLOCK)) == (DSD_FLAG | FINAL_BLOCK) &&
+            num_channels == ((wps->wphdr.flags & MONO_FLAG) ? 1 : 2)) {
+                unpack_dsd_bytes (wps, buffer, buffer + channel_step, stride, samples_to_unpack, lsb_first);
+
+                if (wps->sample_index == GET_BLOCK_INDEX (wps->wphdr) + wps->wphdr.block_samples && wps->mute_error)
+                    wpc->crc_errors++;
+
+                PROFILE_COUNT (wpc->profile, samples, samples_to_unpack);
+                buffer += samples_to_unpack * stride;
+                samples_unpacked += samples_to_unpack;
+                samples -= samples_to_unpack;
+
+                if (wpc->total_samples != -1 && wps->sample_index == wpc->total_samples)
+                    break;
+
+                continue;
+        }
 
+        if (samples_to_unpack > UNPACKDSD_TEMP_SAMPLES)
+            samples_to_unpack = UNPACKDSD_TEMP_SAMPLES;
+
+        if (!temp_buffer && !(temp_buffer = (int32_t *)malloc (UNPACKDSD_TEMP_SAMPLES * num_channels * sizeof (int32_t))))
+            break;
+
+        count = WavpackUnpackSamples (wpc, temp_buffer, samples_to_unpack);
+        pack_dsd_values (temp_buffer, count, num_channels, buffer, channel_step, stride, lsb_first);
+        buffer += count * stride;
+        samples_unpacked += count;
+        samples -= count;
+
+        if (count < samples_to_unpack)
+            break;
+    }
+
+    free (temp_buffer);
     return samples_unpacked;
 }
 
+#else
+
+uint32_t WavpackUnpackSamplesDSD (WavpackContext *wpc, unsigned char *buffer, uint32_t samples, int format)
+{
+    (void) wpc; (void) buffer; (void) samples; (void) format;
+    return 0;
+}
+
+#endif
+
 ///////////////////////////// multithreading code ////////////////////////////////
 
 #ifdef ENABLE_THREADS
@@ -502,6 +816,13 @@ static void *unpack_samples_worker_thread (void *param)
         if (cxt->state == Quit)                     // break out if we're done
             break;
 
+#ifdef ENABLE_DSD
+        if (cxt->decimation_context) {              // decimation jobs don't involve a stream
+            decimate_dsd_run_channels (cxt->decimation_context, cxt->outbuf, cxt->samcnt, cxt->offset, cxt->num_chans);
+            continue;
+        }
+#endif
+
         if (cxt->samcnt > temp_samples) {           // reallocate temp buffer if not big enough
             temp_buffer = (int32_t *) realloc (temp_buffer, (temp_samples = cxt->samcnt) * 8);
             memset (temp_buffer, 0, temp_samples * 8);
@@ -517,6 +838,20 @@ static void *unpack_samples_worker_thread (void *param)
         }
 
         if (cxt->free_wps) {                        // if instructed, free the WavpackStream context
+#ifdef WAVPACK_PROFILE
+            profile_merge (&cxt->profile, &cxt->wps->profile);
+#endif
+#ifdef ENABLE_DSD
+            // keep the copy's DSD tables as a spare set for take_spare_dsd_tables(), freeing
+            // the one we had instead if it wasn't taken
+
+            if (cxt->wps->dsd.tables.bins || cxt->wps->dsd.tables.ptable) {
+                DSDtables spare = cxt->dsd_tables;
+
+                cxt->dsd_tables = cxt->wps->dsd.tables;
+                cxt->wps->dsd.tables = spare;
+            }
+#endif
             free_single_stream (cxt->wps);
             free (cxt->wps);
         }
@@ -527,29 +862,32 @@ static void *unpack_samples_worker_thread (void *param)
     return 0;
 }
 
-// Send the given stream to an available worker thread. In the background, the stream will be
-// unpacked and written (interleaved) to the given buffer at the specified offset. The "free_wps"
-// flag indicates that the WavpackStream structure should be freed once the unpack operation is
-// complete because it is a copy of the original created for this operation only.
+// Give the job described by "job" to an available worker thread (waiting for one if
+// they're all busy).
 
-static void unpack_samples_enqueue (WavpackStream *wps, int32_t *outbuf, int offset, uint32_t samcnt, int free_wps)
+static void worker_start (WavpackContext *wpc, const WorkerInfo *job)
 {
-    WavpackContext *wpc = (WavpackContext *) wps->wpc;  // this is safe here because single-threaded
     int i;
+    PROFILE_DECL (start_time);
 
+    PROFILE_START (wpc, start_time);
     wp_mutex_obtain (wpc->mutex);
 
     while (!wpc->workers_ready)
         wp_condvar_wait (wpc->global_cond, wpc->mutex);
 
+    PROFILE_STOP (wpc->profile, WP_PROFILE_WAIT, start_time);
+
     for (i = 0; i < wpc->num_workers; ++i)
         if (wpc->workers [i].state == Ready) {
-            wpc->workers [i].wps = wps;
+            wpc->workers [i].wps = job->wps;
             wpc->workers [i].state = Running;
-            wpc->workers [i].outbuf = outbuf;
-            wpc->workers [i].offset = offset;
-            wpc->workers [i].samcnt = samcnt;
-            wpc->workers [i].free_wps = free_wps;
+            wpc->workers [i].outbuf = job->outbuf;
+            wpc->workers [i].offset = job->offset;
+            wpc->workers [i].samcnt = job->samcnt;
+            wpc->workers [i].free_wps = job->free_wps;
+            wpc->workers [i].decimation_context = job->decimation_context;
+            wpc->workers [i].num_chans = job->num_chans;
             wp_condvar_signal (wpc->workers [i].worker_cond);
             wpc->workers_ready--;
             break;
@@ -558,15 +896,93 @@ static void unpack_samples_enqueue (WavpackStream *wps, int32_t *outbuf, int off
     wp_mutex_release (wpc->mutex);
 }
 
+// Send the given stream to an available worker thread. In the background, the stream will be
+// unpacked and written (interleaved) to the given buffer at the specified offset. The "free_wps"
+// flag indicates that the WavpackStream structure should be freed once the unpack operation is
+// complete because it is a copy of the original created for this operation only.
+
+static void unpack_samples_enqueue (WavpackStream *wps, int32_t *outbuf, int offset, uint32_t samcnt, int free_wps)
+{
+    WorkerInfo job;
+
+    memset (&job, 0, sizeof (job));
+    job.wps = wps;
+    job.outbuf = outbuf;
+    job.offset = offset;
+    job.samcnt = samcnt;
+    job.free_wps = free_wps;
+    worker_start ((WavpackContext *) wps->wpc, &job);   // this is safe here because single-threaded
+}
+
+#ifdef ENABLE_DSD
+
+// Send a range of channels of the (interleaved) samples to an available worker thread to be
+// decimated from DSD to PCM with decimate_dsd_run_channels().
+
+static void decimate_samples_enqueue (WavpackContext *wpc, int32_t *samples, uint32_t samcnt, int first_chan, int num_chans)
+{
+    WorkerInfo job;
+
+    memset (&job, 0, sizeof (job));
+    job.outbuf = samples;
+    job.offset = first_chan;
+    job.samcnt = samcnt;
+    job.decimation_context = wpc->decimation_context;
+    job.num_chans = num_chans;
+    worker_start (wpc, &job);
+}
+
+#endif
+
+#ifdef ENABLE_DSD
+
+// A stream that's been copied for a worker thread has given its DSD tables to the copy, so
+// give it a set of spare tables instead, which idle workers keep from the copies they've
+// finished with. This way the tables get reused (as they are without threads) instead of
+// being freed and allocated for every block. If there aren't any spares, the stream gets
+// empty tables and allocates new ones for its next block.
+
+static void take_spare_dsd_tables (WavpackContext *wpc, WavpackStream *wps)
+{
+    int i;
+
+    CLEAR (wps->dsd.tables);
+    wp_mutex_obtain (wpc->mutex);
+
+    for (i = 0; i < wpc->num_workers; ++i)
+        if (wpc->workers [i].state == Ready && (wpc->workers [i].dsd_tables.bins || wpc->workers [i].dsd_tables.ptable)) {
+            wps->dsd.tables = wpc->workers [i].dsd_tables;
+            CLEAR (wpc->workers [i].dsd_tables);
+            break;
+        }
+
+    wp_mutex_release (wpc->mutex);
+}
+
+#endif
+
 static void worker_threads_finish (WavpackContext *wpc)
 {
     if (wpc->workers) {
+        PROFILE_DECL (start_time);
+
+        PROFILE_START (wpc, start_time);
         wp_mutex_obtain (wpc->mutex);
 
         while (wpc->workers_ready < wpc->num_workers)
             wp_condvar_wait (wpc->global_cond, wpc->mutex);
 
         wp_mutex_release (wpc->mutex);
+        PROFILE_STOP (wpc->profile, WP_PROFILE_WAIT, start_time);
+
+#ifdef WAVPACK_PROFILE
+        {
+            int i;
+
+            for (i = 0; i < wpc->num_workers; ++i)  // all workers are idle, so this is safe
+                profile_merge (&wpc->profile, &wpc->workers [i].profile);
+        }
+#endif
     }
 
     if (wpc->worker_errors) {
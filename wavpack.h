@@ -259,6 +259,36 @@ typedef struct {
 #define QMODE_RAW_PCM           0x1000  // user specified raw PCM format (no header present)
 #define QMODE_EVEN_BYTE_DEPTH   0x2000  // user specified to force even byte bit-depth
 
+//////////////////////////// decoder profiling ////////////////////////////////
+
+// These are the decoding stages that are timed separately when the library is
+// built with WAVPACK_PROFILE defined (they index the ticks[] and calls[] arrays
+// returned by WavpackGetProfile()).
+
+#define WP_PROFILE_IO       0   // reading raw blocks from the WavPack and correction files
+#define WP_PROFILE_VERIFY   1   // verifying raw blocks with WavpackVerifySingleBlock()
+#define WP_PROFILE_INIT     2   // processing block metadata in unpack_init()
+#define WP_PROFILE_ENTROPY  3   // entropy decoding of PCM audio (includes decorrelation for hybrid lossless)
+#define WP_PROFILE_DECORR   4   // decorrelation passes, joint stereo and CRCs
+#define WP_PROFILE_FIXUP    5   // fixup_samples() (including float_values()) and normalization
+#define WP_PROFILE_DSD      6   // decoding DSD audio
+#define WP_PROFILE_DECIMATE 7   // decimating DSD audio to PCM
+#define WP_PROFILE_WAIT     8   // waiting for worker threads
+#define WP_PROFILE_STAGES   9
+
+#define WP_PROFILE_MAX_COUNTERS 8   // event counters per stage (see WavpackSetProfileCounters())
+
+typedef struct {
+    uint64_t ticks [WP_PROFILE_STAGES], calls [WP_PROFILE_STAGES];
+    uint64_t counters [WP_PROFILE_STAGES] [WP_PROFILE_MAX_COUNTERS];    // deltas of the application's counters
+    uint64_t blocks;            // WavPack blocks read (not counting correction blocks)
+    uint64_t bytes;             // bytes of WavPack and correction blocks read
+    uint64_t samples;           // complete samples returned by WavpackUnpackSamples()
+    uint64_t refills;           // bitstream words (or DSD bytes) consumed by the decoders
+    uint64_t allocations;       // memory allocations made while decoding
+    double ticks_per_second;    // for converting ticks [] to seconds
+} WavpackProfile;
+
 ////////////// Callbacks used for reading & writing WavPack streams //////////
 
 typedef struct {
@@ -295,6 +325,8 @@ typedef int (*WavpackBlockOutput)(void *id, void *data, int32_t bcount);
 //////////////////////////// function prototypes /////////////////////////////
 
 typedef struct WavpackContext WavpackContext;
+typedef struct WavpackState WavpackState;
+typedef struct WavpackFile WavpackFile;
 
 #ifdef __cplusplus
 extern "C" {
@@ -304,6 +336,10 @@ extern "C" {
 
 WavpackContext *WavpackOpenFileInputEx64 (WavpackStreamReader64 *reader, void *wv_id, void *wvc_id, char *error, int flags, int norm_offset);
 WavpackContext *WavpackOpenFileInputEx (WavpackStreamReader *reader, void *wv_id, void *wvc_id, char *error, int flags, int norm_offset);
+WavpackContext *WavpackOpenMemoryInput (const void *wv_data, int64_t wv_size, const void *wvc_data, int64_t wvc_size, char *error, int flags, int norm_offset);
+WavpackFile *WavpackOpenFileShared (const void *wv_data, int64_t wv_size, const void *wvc_data, int64_t wvc_size, char *error, int flags, int norm_offset);
+WavpackContext *WavpackOpenCursor (WavpackFile *wpf, char *error);
+WavpackFile *WavpackCloseFileShared (WavpackFile *wpf);
 
 #define OPEN_WVC        0x1     // open/read "correction" file
 #define OPEN_TAGS       0x2     // read ID3v1 / APEv2 tags (seekable file)
@@ -329,6 +365,13 @@ WavpackContext *WavpackOpenFileInputEx (WavpackStreamReader *reader, void *wv_id
 #define OPEN_THREADS_SHFT 12     // specify number of additional worker threads here for
 #define OPEN_THREADS_MASK 0xF000 // decode; 0 to disable, otherwise 1-15 added threads
 
+#define OPEN_TAGS_LAZY  0x10000 // with OPEN_TAGS[_ONLY], skip reading binary APEv2 tag values
+                                // until requested (see WavpackGetBinaryTagItemView())
+#define OPEN_TAGS_ONLY  0x20000 // read only the tags (seekable file); audio blocks are
+                                // never read and no audio can be decoded
+#define OPEN_WVC_THREAD 0x40000 // read and verify the correction file ahead on its own
+                                // thread (requires thread-safe reader callbacks)
+
 int WavpackGetMode (WavpackContext *wpc);
 
 #define MODE_WVC        0x1
@@ -353,14 +396,23 @@ int WavpackGetVersion (WavpackContext *wpc);
 char *WavpackGetFileExtension (WavpackContext *wpc);
 unsigned char WavpackGetFileFormat (WavpackContext *wpc);
 uint32_t WavpackUnpackSamples (WavpackContext *wpc, int32_t *buffer, uint32_t samples);
+uint32_t WavpackUnpackSamples16 (WavpackContext *wpc, int16_t *buffer, uint32_t samples);
+uint32_t WavpackUnpackSamplesFloat (WavpackContext *wpc, float *buffer, uint32_t samples);
+uint32_t WavpackUnpackSamplesDSD (WavpackContext *wpc, unsigned char *buffer, uint32_t samples, int format);
 uint32_t WavpackGetNumSamples (WavpackContext *wpc);
 int64_t WavpackGetNumSamples64 (WavpackContext *wpc);
 uint32_t WavpackGetSampleIndex (WavpackContext *wpc);
 int64_t WavpackGetSampleIndex64 (WavpackContext *wpc);
 int WavpackGetNumErrors (WavpackContext *wpc);
+int WavpackGetProfile (WavpackContext *wpc, WavpackProfile *profile);
+int WavpackSetProfileCounters (WavpackContext *wpc, int num_counters, void (*read_counters) (uint64_t *values));
 int WavpackLossyBlocks (WavpackContext *wpc);
 int WavpackSeekSample (WavpackContext *wpc, uint32_t sample);
 int WavpackSeekSample64 (WavpackContext *wpc, int64_t sample);
+WavpackState *WavpackSaveState (WavpackContext *wpc);
+int WavpackRestoreState (WavpackContext *wpc, WavpackState *state);
+void WavpackFreeState (WavpackState *state);
+int WavpackSetCheckpoints (WavpackContext *wpc, uint32_t interval, int64_t max_bytes);
 WavpackContext *WavpackCloseFile (WavpackContext *wpc);
 uint32_t WavpackGetSampleRate (WavpackContext *wpc);
 uint32_t WavpackGetNativeSampleRate (WavpackContext *wpc);
@@ -389,6 +441,7 @@ int WavpackGetTagItemIndexed (WavpackContext *wpc, int index, char *item, int si
 int WavpackGetNumBinaryTagItems (WavpackContext *wpc);
 int WavpackGetBinaryTagItem (WavpackContext *wpc, const char *item, char *value, int size);
 int WavpackGetBinaryTagItemIndexed (WavpackContext *wpc, int index, char *item, int size);
+int WavpackGetBinaryTagItemView (WavpackContext *wpc, const char *item, const unsigned char **value);
 int WavpackAppendTagItem (WavpackContext *wpc, const char *item, const char *value, int vsize);
 int WavpackAppendBinaryTagItem (WavpackContext *wpc, const char *item, const char *value, int vsize);
 int WavpackDeleteTagItem (WavpackContext *wpc, const char *item);
@@ -26,6 +26,19 @@
 #define FASTCALL
 #endif
 
+// This is used for "kernel templates", which are static functions that take some
+// format parameters and are only ever called with constants for those. Because
+// they are always inlined, each call generates a copy of the kernel that has been
+// specialized for that format (with all the tests on the parameters removed).
+
+#if defined(_MSC_VER)
+#define KERNEL_INLINE __forceinline
+#elif defined(__GNUC__)
+#define KERNEL_INLINE __inline __attribute__((always_inline))
+#else
+#define KERNEL_INLINE __inline
+#endif
+
 #if defined(__WATCOMC__) && defined(OPT_ASM_X86)
 #define ASMCALL __cdecl
 #else
@@ -122,6 +135,52 @@ typedef pthread_t               wp_thread_t;
 
 #endif
 
+// These macros implement the optional profiling of the decoder (see
+// WavpackGetProfile()). Unless WAVPACK_PROFILE is defined they all expand to
+// nothing (and the profile fields of the contexts don't exist) so that there
+// is no overhead at all. Where available the processor's timestamp counter is
+// used for the timing, otherwise the ticks are nanoseconds of a monotonic clock.
+
+#ifdef WAVPACK_PROFILE
+
+#if defined(_MSC_VER) && (defined(_M_IX86) || defined(_M_X64))
+#include <intrin.h>
+#define profile_ticks() ((uint64_t) __rdtsc ())
+#elif defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+#include <x86intrin.h>
+#define profile_ticks() ((uint64_t) __rdtsc ())
+#else
+#define PROFILE_TICKS_ARE_NS
+uint64_t profile_ticks (void);
+#endif
+
+// the start of a timed stage, with the context it's for and the application's
+// event counters (if that context has any, see WavpackSetProfileCounters())
+
+typedef struct {
+    const WavpackContext *wpc;
+    uint64_t ticks, counters [WP_PROFILE_MAX_COUNTERS];
+} ProfileMark;
+
+void profile_read_counters (ProfileMark *mark);
+void profile_add_counters (uint64_t *totals, const ProfileMark *start);
+
+#define PROFILE_DECL(t)             ProfileMark t
+#define PROFILE_START(c,t)          ((t).wpc = (c), (t).wpc->profile_num_counters ? profile_read_counters (&(t)) : (void) 0, \
+                                     (t).ticks = profile_ticks ())
+#define PROFILE_STOP(p,stage,t)     ((p).ticks [stage] += profile_ticks () - (t).ticks, (p).calls [stage]++, \
+                                     (t).wpc->profile_num_counters ? profile_add_counters ((p).counters [stage], &(t)) : (void) 0)
+#define PROFILE_COUNT(p,field,n)    ((p).field += (n))
+
+#else
+
+#define PROFILE_DECL(t)
+#define PROFILE_START(c,t)
+#define PROFILE_STOP(p,stage,t)
+#define PROFILE_COUNT(p,field,n)
+
+#endif
+
 // Because the C99 specification states that "The order of allocation of
 // bit-fields within a unit (high-order to low-order or low-order to
 // high-order) is implementation-defined" (6.7.2.1), I decided to change
@@ -142,6 +201,21 @@ typedef int32_t f32;
 #define set_exponent(f,v)   (f) ^= (((f) ^ ((uint32_t)(v) << 23)) & 0x7f800000)
 #define set_sign(f,v)       (f) ^= (((f) ^ ((uint32_t)(v) << 31)) & 0x80000000)
 
+// Add "delta_exp" (which must not be zero) to the exponent of a float, flushing
+// zeros, denormals and values that underflow to zero and values that overflow
+// to infinity (as WavpackFloatNormalize() does). This only uses selects, so
+// loops that call it can still be vectorized.
+
+static __inline uint32_t normalize_float (uint32_t value, int delta_exp)
+{
+    uint32_t exp_bits = value & 0x7f800000, result;
+    int new_exp = (int)(exp_bits >> 23) + delta_exp;
+
+    result = (value & 0x807fffff) | ((uint32_t) new_exp << 23);
+    result = (exp_bits == 0x7f800000 || new_exp >= 255) ? (value & 0x80000000) | 0x7f800000 : result;
+    return (exp_bits == 0 || new_exp <= 0) ? 0 : result;
+}
+
 #include <stdio.h>
 
 #define FALSE 0
@@ -168,12 +242,26 @@ typedef struct {
 #define APE_TAG_CONTAINS_HEADER 0x80000000
 #define APE_TAG_MAX_LENGTH      (1024 * 1024 * 16)
 
+// When tags are loaded "lazily" (OPEN_TAGS_LAZY) the values of binary APEv2
+// items are not read into ape_tag_data; only their location is recorded here
+// and the value is accessed (or read) on demand.
+
+typedef struct {
+    char *item;                         // item name (NULL terminated)
+    int64_t value_pos;                  // position of value from start of file
+    int32_t value_size;
+    const unsigned char *value;         // value once accessed (NULL before)
+    unsigned char *value_buffer;        // allocated if value had to be read
+} APE_Tag_Item_Ref;
+
 typedef struct {
     int64_t tag_file_pos;
     int tag_begins_file;
     ID3_Tag id3_tag;
     APE_Tag_Hdr ape_tag_hdr;
     unsigned char *ape_tag_data;
+    APE_Tag_Item_Ref *binary_items;
+    int num_binary_items;
 } M_Tag;
 
 // or-values for "flags"
@@ -298,6 +386,18 @@ typedef struct {
     unsigned int byte;
 } DSDfilters;
 
+// The DSD decoding tables of a stream. These are kept from block to block and are only
+// reallocated when a block needs more history bins than there's room for. The adaptive
+// ptable is reset for each block from ptable_init (the second half of its allocation),
+// which is only rebuilt when the rate changes.
+
+typedef struct {
+    unsigned char (*probabilities) [256], *lookup_buffer, **value_lookup;
+    uint16_t (*summed_probabilities) [256];
+    int32_t *ptable, *ptable_init;
+    int bins, ptable_rate;      // history bins allocated, and the rate ptable_init is for
+} DSDtables;
+
 typedef struct {
     const WavpackContext *wpc;
     WavpackHeader wphdr;
@@ -330,17 +430,21 @@ typedef struct {
     } dc;
 
     struct decorr_pass decorr_passes [MAX_NTERMS], analysis_pass;
+    int decorr_preset;          // from find_decorr_preset(), or 0 to decode pass by pass
     const WavpackDecorrSpec *decorr_specs;
 
     struct {
-        unsigned char *byteptr, *endptr, (*probabilities) [256], *lookup_buffer, **value_lookup, mode, ready;
+        unsigned char *byteptr, *endptr, mode, ready;
         int history_bins, p0, p1;
-        uint16_t (*summed_probabilities) [256];
+        DSDtables tables;
         uint32_t low, high, value;
         DSDfilters filters [2];
-        int32_t *ptable;
     } dsd;
 
+#ifdef WAVPACK_PROFILE
+    WavpackProfile profile;     // decoding done with this stream (possibly in a worker thread)
+#endif
+
 } WavpackStream;
 
 // flags for float_flags:
@@ -371,11 +475,47 @@ typedef struct {
     uint32_t samcnt, offset;
     int result, free_wps;
 
+    void *decimation_context;   // if set, decimate "num_chans" channels starting at "offset" instead
+    int num_chans;
+
+    DSDtables dsd_tables;       // spare DSD tables kept from a stream copy the worker freed
+
     wp_condvar_t *global_cond, worker_cond;
     wp_mutex_t *mutex;
     wp_thread_t thread;
+
+#ifdef WAVPACK_PROFILE
+    WavpackProfile profile;     // from stream copies freed by the worker
+#endif
 } WorkerInfo;
 
+// With OPEN_WVC_THREAD a reader thread reads the correction file blocks ahead
+// of the decoder (and verifies them) into this queue, which read_wvc_block()
+// then takes them from in order. A WVC_END entry stays at the head forever.
+
+#define WVC_QUEUE_LENGTH 8
+
+enum { WVC_GOOD, WVC_CORRUPT, WVC_TRUNCATED, WVC_END };
+
+typedef struct {
+    WavpackHeader wphdr;        // original header (unless WVC_END)
+    unsigned char *block;       // entire block (only for WVC_GOOD)
+    int64_t pos, bcount;        // where the header search started and the bytes skipped
+    int status;
+} WvcQueueEntry;
+
+typedef struct {
+    WavpackContext *wpc;
+    WvcQueueEntry queue [WVC_QUEUE_LENGTH];
+    int head, count, quit;
+    int64_t next_pos;           // file position after the last queued block (or to re-sync at)
+    int resyncs;                // incremented to have the reader discard everything and re-sync
+
+    wp_condvar_t reader_cond, decoder_cond;
+    wp_mutex_t mutex;
+    wp_thread_t thread;
+} WvcReader;
+
 #endif
 
 struct WavpackContext {
@@ -397,6 +537,7 @@ struct WavpackContext {
     int64_t filelen, file2len, filepos, file2pos, total_samples, initial_index;
     uint32_t crc_errors, first_flags;
     int wvc_flag, open_flags, norm_offset, reduced_channels, lossy_blocks, version_five;
+    int float_output;           // set during WavpackUnpackSamplesFloat()
     uint32_t block_samples, ave_block_samples, block_boundary, max_samples, max_pre_samples, acc_samples, riff_trailer_bytes;
     int riff_header_added, riff_header_created;
     M_Tag m_tag;
@@ -411,12 +552,36 @@ struct WavpackContext {
     void *decimation_context;
     char file_extension [8];
 
+    // optional cache of decoder states for fast seeking within blocks (see unpack_state.c)
+    void *checkpoints;
+
+    // positions of the hybrid lossless blocks we've been to, for seeking back (see unpack_seek.c)
+    void *block_map;
+
+    // for cursors of a shared file (see open_shared.c), the parsed file information
+    // (tag, channel identities & reordering) belongs to this and must not be modified
+    WavpackFile *shared;
+
+#ifdef WAVPACK_PROFILE
+    // accumulated decoder profile (not including the streams' own profiles)
+    WavpackProfile profile;
+    uint64_t profile_base_ticks;
+    double profile_base_seconds;
+
+    // the application's event counter reader (see WavpackSetProfileCounters())
+    void (*profile_counter_reader) (uint64_t *values);
+    int profile_num_counters;
+#endif
+
 #ifdef ENABLE_THREADS
     // these items support multithreaded operations on multichannel streams
     WorkerInfo *workers;
     int num_workers, workers_ready, worker_errors;
     wp_condvar_t global_cond;
     wp_mutex_t mutex;
+
+    // the correction file reader thread, if running (see OPEN_WVC_THREAD)
+    WvcReader *wvc_reader;
 #endif
 
     void (*close_callback)(void *wpc);
@@ -492,9 +657,13 @@ int read_decorr_weights (WavpackStream *wps, WavpackMetadata *wpmd);
 int read_decorr_samples (WavpackStream *wps, WavpackMetadata *wpmd);
 int read_shaping_info (WavpackStream *wps, WavpackMetadata *wpmd);
 int32_t unpack_samples (WavpackStream *wps, int32_t *buffer, uint32_t sample_count);
+void int_to_float_samples (int32_t *buffer, uint32_t count, int bytes_per_sample);
+int unpack_samples16_ok (WavpackStream *wps);
+int32_t unpack_samples16 (WavpackStream *wps, int16_t *buffer, uint32_t sample_count);
+int find_decorr_preset (WavpackStream *wps);
 int scan_float_data (WavpackStream *wps, f32 *values, int32_t num_values);
 void send_float_data (WavpackStream *wps, f32 *values, int32_t num_values);
-void float_values (WavpackStream *wps, int32_t *values, int32_t num_values);
+void float_values (WavpackStream *wps, int32_t *values, int32_t num_values, int delta_exp);
 void dynamic_noise_shaping (WavpackStream *wps, const int32_t *buffer, int shortening_allowed);
 
 ////////////////////////// DSD related (including decimation) //////////////////////////
@@ -504,11 +673,19 @@ void pack_dsd_init (WavpackStream *wps);
 int pack_dsd_block (WavpackStream *wps, int32_t *buffer);
 int init_dsd_block (WavpackStream *wps, WavpackMetadata *wpmd);
 int32_t unpack_dsd_samples (WavpackStream *wps, int32_t *buffer, uint32_t sample_count);
+int32_t unpack_dsd_bytes (WavpackStream *wps, unsigned char *left, unsigned char *right, int stride, uint32_t sample_count, int lsb_first);
+void pack_dsd_values (const int32_t *values, uint32_t sample_count, int num_channels,
+    unsigned char *buffer, uint32_t channel_step, int stride, int lsb_first);
 
 void *decimate_dsd_init (int num_channels);
 void decimate_dsd_reset (void *decimate_context);
 void decimate_dsd_run (void *decimate_context, int32_t *samples, int num_samples);
+void decimate_dsd_run_channels (void *decimate_context, int32_t *samples, int num_samples, int first_chan, int num_chans);
+void decimate_dsd_finish (void *decimate_context, int32_t *samples, int num_samples);
 void decimate_dsd_destroy (void *decimate_context);
+void *decimate_dsd_save (void *decimate_context);
+void decimate_dsd_restore (void *decimate_context, void *saved_context);
+int copy_dsd_tables (WavpackStream *dst, const WavpackStream *src);
 
 ///////////////////////////////// CPU feature detection ////////////////////////////////
 
@@ -653,6 +830,7 @@ int32_t FASTCALL send_word (WavpackStream *wps, int32_t value, int chan);
 void send_words_lossless (WavpackStream *wps, int32_t *buffer, int32_t nsamples);
 int32_t FASTCALL get_word (WavpackStream *wps, int chan, int32_t *correction);
 int32_t get_words_lossless (WavpackStream *wps, int32_t *buffer, int32_t nsamples);
+int32_t get_words_hybrid (WavpackStream *wps, int32_t *buffer, int32_t *correction, int32_t nsamples);
 void flush_word (WavpackStream *wps);
 int32_t nosend_word (WavpackStream *wps, int32_t value, int chan);
 void scan_word (WavpackStream *wps, int32_t *samples, uint32_t num_samples, int dir);
@@ -716,6 +894,9 @@ int WavpackGetMode (WavpackContext *wpc);
 int WavpackGetQualifyMode (WavpackContext *wpc);
 int WavpackGetVersion (WavpackContext *wpc);
 uint32_t WavpackUnpackSamples (WavpackContext *wpc, int32_t *buffer, uint32_t samples);
+uint32_t WavpackUnpackSamples16 (WavpackContext *wpc, int16_t *buffer, uint32_t samples);
+uint32_t WavpackUnpackSamplesFloat (WavpackContext *wpc, float *buffer, uint32_t samples);
+uint32_t WavpackUnpackSamplesDSD (WavpackContext *wpc, unsigned char *buffer, uint32_t samples, int format);
 int WavpackSeekSample (WavpackContext *wpc, uint32_t sample);
 int WavpackSeekSample64 (WavpackContext *wpc, int64_t sample);
 int WavpackGetMD5Sum (WavpackContext *wpc, unsigned char data [16]);
@@ -723,6 +904,37 @@ int WavpackGetMD5Sum (WavpackContext *wpc, unsigned char data [16]);
 int WavpackVerifySingleBlock (unsigned char *buffer, int verify_checksum);
 uint32_t read_next_header (WavpackStreamReader64 *reader, void *id, WavpackHeader *wphdr);
 int read_wvc_block (WavpackContext *wpc, int stream);
+int64_t get_wvc_pos (WavpackContext *wpc);
+void stop_wvc_reader (WavpackContext *wpc);
+void map_block_position (WavpackContext *wpc);
+void free_block_map (WavpackContext *wpc);
+
+/////////////////////////// in-memory file support ////////////////////////////
+// module: open_memory.c
+
+WavpackContext *WavpackOpenMemoryInput (const void *wv_data, int64_t wv_size, const void *wvc_data, int64_t wvc_size, char *error, int flags, int norm_offset);
+const unsigned char *memory_reader_bytes (WavpackStreamReader64 *reader, void *id, int64_t pos, int64_t count);
+void *memory_reader_open (const void *data, int64_t size, WavpackStreamReader64 **reader);
+
+/////////////////////////// shared files & cursors ////////////////////////////
+// module: open_shared.c
+
+WavpackFile *WavpackOpenFileShared (const void *wv_data, int64_t wv_size, const void *wvc_data, int64_t wvc_size, char *error, int flags, int norm_offset);
+WavpackContext *WavpackOpenCursor (WavpackFile *wpf, char *error);
+WavpackFile *WavpackCloseFileShared (WavpackFile *wpf);
+int64_t find_shared_block (WavpackContext *wpc, int64_t sample, int wvc);
+
+/////////////////////////// decoder state snapshots ////////////////////////////
+// module: unpack_state.c
+
+WavpackState *WavpackSaveState (WavpackContext *wpc);
+int WavpackRestoreState (WavpackContext *wpc, WavpackState *state);
+void WavpackFreeState (WavpackState *state);
+int WavpackSetCheckpoints (WavpackContext *wpc, uint32_t interval, int64_t max_bytes);
+int copy_stream (WavpackStream *dst, const WavpackStream *src);
+uint32_t record_checkpoint (WavpackContext *wpc, uint32_t samples_to_unpack);
+int restore_checkpoint (WavpackContext *wpc, int64_t sample);
+void free_checkpoints (WavpackContext *wpc);
 
 /////////////////////////// high-level packing API and support ////////////////////////////
 // modules: pack_utils.c, pack_floats.c
@@ -758,6 +970,8 @@ uint32_t WavpackGetSampleIndex (WavpackContext *wpc);
 int64_t WavpackGetSampleIndex64 (WavpackContext *wpc);
 char *WavpackGetErrorMessage (WavpackContext *wpc);
 int WavpackGetNumErrors (WavpackContext *wpc);
+int WavpackGetProfile (WavpackContext *wpc, WavpackProfile *profile);
+int WavpackSetProfileCounters (WavpackContext *wpc, int num_counters, void (*read_counters) (uint64_t *values));
 int WavpackLossyBlocks (WavpackContext *wpc);
 uint32_t WavpackGetWrapperBytes (WavpackContext *wpc);
 unsigned char *WavpackGetWrapperData (WavpackContext *wpc);
@@ -776,7 +990,11 @@ void WavpackNativeToBigEndian (void *data, char *format);
 
 void install_close_callback (WavpackContext *wpc, void cb_func (void *wpc));
 void free_single_stream (WavpackStream *wps);
-void free_dsd_tables (WavpackStream *wps);
+void free_dsd_tables (DSDtables *tables);
+#ifdef WAVPACK_PROFILE
+void profile_merge (WavpackProfile *dst, WavpackProfile *src);
+double profile_seconds (void);
+#endif
 void free_streams (WavpackContext *wpc);
 
 /////////////////////////////////// tag utilities ////////////////////////////////////
@@ -788,6 +1006,7 @@ int WavpackGetTagItemIndexed (WavpackContext *wpc, int index, char *item, int si
 int WavpackGetNumBinaryTagItems (WavpackContext *wpc);
 int WavpackGetBinaryTagItem (WavpackContext *wpc, const char *item, char *value, int size);
 int WavpackGetBinaryTagItemIndexed (WavpackContext *wpc, int index, char *item, int size);
+int WavpackGetBinaryTagItemView (WavpackContext *wpc, const char *item, const unsigned char **value);
 int WavpackAppendTagItem (WavpackContext *wpc, const char *item, const char *value, int vsize);
 int WavpackAppendBinaryTagItem (WavpackContext *wpc, const char *item, const char *value, int vsize);
 int WavpackDeleteTagItem (WavpackContext *wpc, const char *item);